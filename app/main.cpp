@@ -6,34 +6,98 @@
 #include "xop/HttpFlvServer.h"
 #include "net/TcpServer.h"
 #include "net/EventLoop.h"
+#include "xop/ServerConfig.h"
+#include "xop/SharedStream.h"
+#include "net/ConfigFile.h"
 #include "net/Logger.h"
+#include "net/WorkerPool.h"
 
-#define TEST_MULTI_THREAD 1
+static void runServers(const std::string& configPath, const xop::ServerConfig& config, xop::SharedStreamRegistry::Ptr registry);
 
 int main(int argc, char **argv)
 {
+	std::string configPath = (argc > 1) ? argv[1] : "config.txt";
 
     LOG_INFO("\n\n");
     LOG_INFO("[+] ------------------------------------------");
     LOG_INFO("[+] RTMP Server started successfully !");
     LOG_INFO("[+] ------------------------------------------");
 
-	int count = 1;
-#if TEST_MULTI_THREAD
-	count = std::thread::hardware_concurrency();
-#endif
-	xop::EventLoop eventLoop(count);
+	xop::ServerConfig config;
+	std::string error;
+	if (xop::ConfigFile::getModifyTime(configPath) == 0)
+	{
+		LOG_INFO("[Config] %s not found, using the defaults.\n", configPath.c_str());
+	}
+	else if (!xop::ServerConfig::load(configPath, config, error))
+	{
+		LOG_INFO("[Config] %s: %s\n", configPath.c_str(), error.c_str());
+		return 1;
+	}
+
+	if (config.workers > 0)
+	{
+		/* worker processes on the same ports, streams are shared through memory
+		   mapped before the fork, a crashed worker is restarted */
+		auto registry = xop::SharedStreamRegistry::create();
+		if (registry == nullptr)
+		{
+			return 1;
+		}
+
+		xop::WorkerPool workerPool(config.workers);
+		workerPool.setExitCallback([registry](pid_t pid, uint32_t) {
+			registry->releaseProcess(pid);
+		});
+		return workerPool.run([&configPath, &config, registry](uint32_t) {
+			runServers(configPath, config, registry);
+		});
+	}
+
+	runServers(configPath, config, nullptr);
+	return 0;
+}
+
+static void runServers(const std::string& configPath, const xop::ServerConfig& config, xop::SharedStreamRegistry::Ptr registry)
+{
+	uint32_t count = config.threads;
+	if (count == 0)
+	{
+		count = std::thread::hardware_concurrency();
+	}
+	xop::EventLoop eventLoop(count, config.ioBackend);
+	eventLoop.setThreadOptions(config.threadOptions);
+	eventLoop.setEdgeTriggered(config.edgeTriggered); // before the servers listen
 
 	/* rtmp server example */
 	// rtmp://127.0.0.1:1935/live/zinzin
-	xop::RtmpServer rtmpServer(&eventLoop, "0.0.0.0", 1935);
-	rtmpServer.setChunkSize(60000);
-	//rtmpServer.setGopCache(); /* enable gop cache */
+	xop::RtmpServer rtmpServer(&eventLoop, config.ip, config.rtmpPort);
+	if (registry != nullptr)
+	{
+		rtmpServer.setSharedStreams(registry);
+	}
 
 	/* http-flv server example */
-    // http://127.0.0.1:8080/live/zinzin.flv
-	xop::HttpFlvServer httpFlvServer(&eventLoop, "0.0.0.0", 5391);
+    // http://127.0.0.1:5391/live/zinzin.flv
+	xop::HttpFlvServer httpFlvServer(&eventLoop, config.ip, config.httpPort);
 	httpFlvServer.attach(&rtmpServer);
+	if (!config.metricsPath.empty())
+	{
+		// http://127.0.0.1:5391/metrics
+		httpFlvServer.addMetricsRoute(config.metricsPath);
+	}
+
+	/* chunk size, gop cache and socket tuning, reloaded when the file changes */
+	auto applyConfig = [&eventLoop, &rtmpServer, &httpFlvServer](const xop::ServerConfig& config) {
+		eventLoop.setWriteCork(config.writeCork);
+		eventLoop.setEdgeTriggered(config.edgeTriggered);
+		eventLoop.setSlowHandlerTime(config.slowHandlerTime);
+		eventLoop.setBusyPoll(config.busyPollTime);
+		rtmpServer.setConfig(config);
+		httpFlvServer.setTcpOptions(config.tcp);
+	};
+	applyConfig(config);
+	xop::ServerConfig::watch(&eventLoop, configPath, config, applyConfig);
 
 
 	/* socket server */
@@ -45,6 +109,4 @@ int main(int argc, char **argv)
 	{
 		std::this_thread::sleep_for(std::chrono::milliseconds(100));
 	}
-
-	return 0;
 }
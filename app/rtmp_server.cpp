@@ -148,51 +148,32 @@ int H264File::readFrame(char *inBuf, int inBufSize, bool *bEndOfFrame)
 
 	bool bFindStart = false, bFindEnd = false;
 
-	int i = 0, startCode = 3;
+	const uint8_t *begin = (const uint8_t *)m_buf, *end = begin + bytesRead;
+	const uint8_t *p = xop::H264Parser::findStartCode(begin, end);
+	int i = 0;
 	*bEndOfFrame = false;
-	for (i = 0; i < bytesRead - 5; i++)
+	for (; end - p > 4; p = xop::H264Parser::findStartCode(p + 3, end))
 	{
-		if (m_buf[i] == 0 && m_buf[i + 1] == 0 && m_buf[i + 2] == 1)
-		{
-			startCode = 3;
-		}
-		else if (m_buf[i] == 0 && m_buf[i + 1] == 0 && m_buf[i + 2] == 0 && m_buf[i + 3] == 1)
-		{
-			startCode = 4;
-		}
-		else
-		{
-			continue;
-		}
-
-		if (((m_buf[i + startCode] & 0x1F) == 0x5 || (m_buf[i + startCode] & 0x1F) == 0x1) &&
-			((m_buf[i + startCode + 1] & 0x80) == 0x80))
+		uint8_t nalType = p[3] & 0x1F;
+		if ((nalType == 0x5 || nalType == 0x1) && ((p[4] & 0x80) == 0x80)) // first slice of a picture
 		{
 			bFindStart = true;
-			i += 4;
+			p = xop::H264Parser::findStartCode(p + 3, end);
 			break;
 		}
 	}
 
-	for (; i < bytesRead - 5; i++)
+	for (; bFindStart && end - p > 4; p = xop::H264Parser::findStartCode(p + 3, end))
 	{
-		if (m_buf[i] == 0 && m_buf[i + 1] == 0 && m_buf[i + 2] == 1)
-		{
-			startCode = 3;
-		}
-		else if (m_buf[i] == 0 && m_buf[i + 1] == 0 && m_buf[i + 2] == 0 && m_buf[i + 3] == 1)
-		{
-			startCode = 4;
-		}
-		else
-		{
-			continue;
-		}
-
-		if (((m_buf[i + startCode] & 0x1F) == 0x7) || ((m_buf[i + startCode] & 0x1F) == 0x8)
-			|| ((m_buf[i + startCode] & 0x1F) == 0x6) || (((m_buf[i + startCode] & 0x1F) == 0x5
-				|| (m_buf[i + startCode] & 0x1F) == 0x1) && ((m_buf[i + startCode + 1] & 0x80) == 0x80)))
+		uint8_t nalType = p[3] & 0x1F;
+		if (nalType == 0x7 || nalType == 0x8 || nalType == 0x6
+			|| ((nalType == 0x5 || nalType == 0x1) && ((p[4] & 0x80) == 0x80)))
 		{
+			i = (int)(p - begin);
+			if (i > 0 && begin[i - 1] == 0) // 00 00 00 01
+			{
+				i -= 1;
+			}
 			bFindEnd = true;
 			break;
 		}
@@ -0,0 +1,98 @@
+// Requests per second of HttpParser on typical player requests,
+// one at a time and pipelined in a single buffer.
+// usage: http_parser_bench [requests=5000000]
+
+#include "net/HttpParser.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+using namespace std::chrono;
+
+static const char *kRequest =
+	"GET /live/stream0.flv?start=30&token=8a1f0c93d2 HTTP/1.1\r\n"
+	"Host: 127.0.0.1:5391\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: */*\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9\r\n"
+	"Origin: http://127.0.0.1\r\n"
+	"Referer: http://127.0.0.1/player.html\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n";
+
+static double run(const std::string& buffer, int requests, int pipelined, uint64_t& checksum)
+{
+	xop::HttpParser parser;
+	auto start = steady_clock::now();
+
+	for (int n = 0; n < requests; n += pipelined)
+	{
+		const char *data = buffer.data();
+		uint32_t size = (uint32_t)buffer.size();
+		while (size > 0)
+		{
+			if (parser.parse(data, size) != xop::HttpParser::kComplete)
+			{
+				fprintf(stderr, "parse error %d\n", parser.getErrorCode());
+				exit(1);
+			}
+
+			const xop::HttpRequest& request = parser.getRequest();
+			checksum += request.path.size + request.headerCount;
+			data += parser.getRequestSize();
+			size -= parser.getRequestSize();
+			parser.reset();
+		}
+	}
+
+	double seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+	return requests / seconds;
+}
+
+static double runSplit(const std::string& request, int requests, uint64_t& checksum)
+{
+	// the request arrives in two reads, the second parse resumes the scan
+	xop::HttpParser parser;
+	uint32_t half = (uint32_t)request.size() / 2;
+	auto start = steady_clock::now();
+
+	for (int n = 0; n < requests; n++)
+	{
+		if (parser.parse(request.data(), half) != xop::HttpParser::kIncomplete
+			|| parser.parse(request.data(), (uint32_t)request.size()) != xop::HttpParser::kComplete)
+		{
+			fprintf(stderr, "parse error %d\n", parser.getErrorCode());
+			exit(1);
+		}
+		checksum += parser.getRequest().headerCount;
+		parser.reset();
+	}
+
+	double seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+	return requests / seconds;
+}
+
+int main(int argc, char **argv)
+{
+	int requests = argc > 1 ? atoi(argv[1]) : 5000000;
+	const int pipelined = 16;
+
+	std::string single = kRequest;
+	std::string batch;
+	for (int n = 0; n < pipelined; n++)
+	{
+		batch += kRequest;
+	}
+
+	uint64_t checksum = 0;
+	double singleRate = run(single, requests, 1, checksum);
+	double pipelinedRate = run(batch, requests, pipelined, checksum);
+	double splitRate = runSplit(single, requests, checksum);
+
+	printf("{\"request_bytes\": %u, \"requests\": %d, \"req_per_sec\": {\"single\": %.0f, \"pipelined_%d\": %.0f, \"split\": %.0f}, \"checksum\": %llu}\n",
+		(uint32_t)single.size(), requests, singleRate, pipelined, pipelinedRate, splitRate, (unsigned long long)checksum);
+
+	return 0;
+}
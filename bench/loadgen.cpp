@@ -0,0 +1,931 @@
+// End-to-end load: M publishers x N players, in process or against a running server.
+// usage: loadgen [--publishers=1] [--players=100] [--http=0.5] [--slow=0] [--slow-kbps=256]
+//                [--bitrate=2000] [--fps=30] [--gop=60] [--warmup=2] [--duration=10]
+//                [--threads=2] [--server-threads=2] [--server=127.0.0.1] [--rtmp-port=19935]
+//                [--http-port=18935] [--gop-cache=0] [--fast-start=0] [--app=live] [--server-pid=0]
+//                [--log=/dev/null] [--server-cpus=2-5|auto] [--housekeeping-cpus=0] [--sched-fifo=0]
+//                [--nice=0] [--stream-affinity=0] [--edge-triggered=0] [--io-backend=epoll]
+//                [--busy-poll=0] [--zerocopy=0]
+//
+// Without --server the rtmp and http-flv servers run in this process. Publishers
+// push synthetic H.264 (bitrate / fps, key frames 4x the size) with RtmpPublisher,
+// players are RtmpClient connections or raw non-blocking HTTP-FLV sockets, spread
+// over the streams /app/load0.../load(M-1). --http is the share of HTTP-FLV players,
+// --slow of them read at most --slow-kbps and let the server drop frames.
+// Without --gop-cache players wait for the next key frame, join times are up to a gop.
+// --fast-start pipelines connect, createStream and publish/play of rtmp connections.
+// --server-cpus, --housekeeping-cpus, --sched-fifo and --nice place the in-process
+// server threads like EventLoop::setThreadOptions(), "scheduler" reports their
+// epoll batch time and timer lateness during the measurement. --stream-affinity
+// moves the players of streams with fewer viewers to the publisher's thread,
+// "handoffs" counts the moves. --edge-triggered registers the server sockets
+// edge triggered, "epoll_ctl_per_sec" is the rate of the server threads.
+// --io-backend=io_uring runs them on IoUringTaskScheduler, "syscalls_per_sec"
+// counts their waits, channel updates and wakeups with either backend.
+// --busy-poll=usec lets the server's connection threads spin before blocking,
+// "threads" has the share of the run each spent spinning and blocked, and
+// the share of spins that found work. --zerocopy=bytes sets the server's
+// MSG_ZEROCOPY threshold; loopback falls back to copies after the first
+// completion, bench/zerocopy_bench compares the cost.
+//
+// Every frame carries its send time, players record the difference (publisher ->
+// server -> player, loopback included). Join time is connect to first video frame,
+// per group in first_frame_ms, open_ms is connect to NetStream.Play.Start for rtmp
+// players, which are all opened at once with RtmpClient::openUrlAsync().
+// Throughput counts http-flv bytes on the wire and rtmp message payloads.
+// CPU and RSS are of --server-pid if set, else of this process, clients included.
+// Prints one JSON object on stdout, server logs go to --log.
+
+#include "net/EventLoop.h"
+#include "net/Logger.h"
+#include "net/TaskScheduler.h"
+#include "net/TcpSocket.h"
+#include "net/SocketUtil.h"
+#include "net/ThreadUtil.h"
+#include "net/Metrics.h"
+#include "xop/RtmpServer.h"
+#include "xop/HttpFlvServer.h"
+#include "xop/RtmpPublisher.h"
+#include "xop/RtmpClient.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+static const char kMagic[4] = { 'L', 'G', 'T', 'S' }; // followed by the send time
+static const uint32_t kMagicOffset = 5;               // after the start code and nal header
+static const uint32_t kSearchSize = 64;
+
+enum Group { kRtmp, kHttp, kSlow, kGroups };
+static const char *s_groupNames[kGroups] = { "rtmp", "http", "slow" };
+
+struct Options
+{
+	int publishers = 1;
+	int players = 100;
+	double http = 0.5;
+	int slow = 0;
+	int slowKbps = 256;
+	int bitrate = 2000; // kbps
+	int fps = 30;
+	int gop = 60;
+	int warmup = 2;
+	int duration = 10;
+	int threads = 2;
+	int serverThreads = 2;
+	std::string server;
+	int rtmpPort = 19935;
+	int httpPort = 18935;
+	bool gopCache = false;
+	bool fastStart = false;
+	std::string app = "live";
+	int serverPid = 0;
+	std::string log = "/dev/null";
+	std::string serverCpus;
+	std::string housekeepingCpus;
+	int schedFifo = 0;
+	int nice = 0;
+	int streamAffinity = 0;
+	bool edgeTriggered = false;
+	std::string ioBackend = "epoll";
+	int busyPoll = 0;
+	int zeroCopy = 0;
+};
+
+static std::atomic_bool s_measuring(false);
+static std::atomic_bool s_stopping(false);
+
+// 10us bins up to 1s, one set per thread and group, summed when the run is over
+class LatencyBins
+{
+public:
+	static const uint32_t kBinWidth = 10;
+	static const uint32_t kBins = 100000;
+
+	LatencyBins()
+		: _bins(new std::atomic<uint64_t>[kBins + 1])
+	{
+		for (uint32_t n = 0; n <= kBins; n++)
+		{
+			_bins[n].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	void record(int64_t usec)
+	{
+		uint64_t value = (usec > 0) ? usec : 0;
+		uint64_t index = std::min<uint64_t>(value / kBinWidth, kBins);
+		_bins[index].store(_bins[index].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		if (value > _max.load(std::memory_order_relaxed))
+		{
+			_max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	static LatencyBins* get(int group)
+	{
+		static thread_local LatencyBins *s_bins[kGroups] = { nullptr };
+		if (s_bins[group] == nullptr)
+		{
+			s_bins[group] = new LatencyBins();
+			std::lock_guard<std::mutex> lock(s_mutex);
+			s_all[group].push_back(s_bins[group]);
+		}
+		return s_bins[group];
+	}
+
+	struct Summary
+	{
+		uint64_t count = 0, p50 = 0, p99 = 0, p999 = 0, max = 0;
+	};
+
+	static Summary summarize(int group)
+	{
+		std::vector<uint64_t> bins(kBins + 1, 0);
+		Summary summary;
+
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (auto bin : s_all[group])
+		{
+			for (uint32_t n = 0; n <= kBins; n++)
+			{
+				bins[n] += bin->_bins[n].load(std::memory_order_relaxed);
+			}
+			summary.max = std::max<uint64_t>(summary.max, bin->_max.load(std::memory_order_relaxed));
+		}
+
+		for (auto count : bins)
+		{
+			summary.count += count;
+		}
+
+		uint64_t *quantiles[] = { &summary.p50, &summary.p99, &summary.p999 };
+		double ranks[] = { 0.5, 0.99, 0.999 };
+		for (int q = 0; q < 3; q++)
+		{
+			uint64_t rank = std::max<uint64_t>((uint64_t)(ranks[q] * summary.count + 0.5), 1), seen = 0;
+			for (uint32_t n = 0; n <= kBins && summary.count > 0; n++)
+			{
+				seen += bins[n];
+				if (seen >= rank)
+				{
+					// upper bound of the bin, the max past the last one
+					*quantiles[q] = (n < kBins) ? std::min<uint64_t>((uint64_t)(n + 1) * kBinWidth, summary.max) : summary.max;
+					break;
+				}
+			}
+		}
+		return summary;
+	}
+
+private:
+	static std::mutex s_mutex;
+	static std::vector<LatencyBins*> s_all[kGroups];
+
+	std::unique_ptr<std::atomic<uint64_t>[]> _bins;
+	std::atomic<uint64_t> _max { 0 };
+};
+
+std::mutex LatencyBins::s_mutex;
+std::vector<LatencyBins*> LatencyBins::s_all[kGroups];
+
+// counters of one player, written by the thread feeding it
+struct PlayerStats
+{
+	int group = kRtmp;
+	int64_t joinStart = 0;
+	std::atomic<int64_t> joinTime { 0 }; // us, 0 until the first video frame
+	std::atomic<int64_t> openTime { 0 }; // us, rtmp: until the play started
+	std::atomic<uint64_t> bytes { 0 };
+	std::atomic<uint64_t> frames { 0 };
+	std::atomic_bool failed { false };
+
+	void add(std::atomic<uint64_t>& counter, uint64_t value)
+	{ counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }
+
+	// payload of a video tag or message, starts with the frame type / codec id byte
+	void onVideo(const uint8_t *data, uint32_t size)
+	{
+		int64_t now = xop::TaskScheduler::getMicroseconds();
+		if (size < 2 || data[1] == 0) // sequence header
+		{
+			return;
+		}
+
+		if (joinTime.load(std::memory_order_relaxed) == 0)
+		{
+			joinTime.store(std::max<int64_t>(now - joinStart, 1), std::memory_order_relaxed);
+		}
+
+		add(frames, 1);
+		if (!s_measuring)
+		{
+			return;
+		}
+
+		uint32_t searchSize = std::min<uint32_t>(size, kSearchSize);
+		for (uint32_t n = 0; n + sizeof(kMagic) + sizeof(int64_t) <= searchSize; n++)
+		{
+			if (memcmp(data + n, kMagic, sizeof(kMagic)) == 0)
+			{
+				int64_t sendTime = 0;
+				memcpy(&sendTime, data + n + sizeof(kMagic), sizeof(sendTime));
+				LatencyBins::get(group)->record(now - sendTime);
+				break;
+			}
+		}
+	}
+};
+
+// A non-blocking HTTP-FLV viewer parsing the tag chain in place.
+class HttpPlayer
+{
+public:
+	HttpPlayer(PlayerStats *stats, const std::string& ip, int port, const std::string& path)
+		: _stats(stats), _ip(ip), _port(port), _path(path)
+	{ }
+
+	~HttpPlayer()
+	{
+		if (_fd >= 0)
+		{
+			::close(_fd);
+		}
+	}
+
+	int fd() const
+	{ return _fd; }
+
+	bool open()
+	{
+		_stats->joinStart = xop::TaskScheduler::getMicroseconds();
+
+		xop::TcpSocket socket;
+		socket.create();
+		if (!socket.connect(_ip, (uint16_t)_port, 3000))
+		{
+			socket.close();
+			return false;
+		}
+
+		_fd = socket.fd();
+		std::string request = "GET " + _path + " HTTP/1.1\r\nHost: " + _ip + "\r\nConnection: close\r\n\r\n";
+		if (::send(_fd, request.c_str(), request.size(), 0) != (ssize_t)request.size())
+		{
+			return false;
+		}
+
+		xop::SocketUtil::setNonBlock(_fd);
+		return true;
+	}
+
+	// false once the connection is done
+	bool read(uint32_t maxBytes = UINT32_MAX)
+	{
+		while (maxBytes > 0)
+		{
+			if (_buffer.size() - _size < 65536)
+			{
+				_buffer.resize(_size + 65536);
+			}
+
+			uint32_t len = (uint32_t)std::min<size_t>(maxBytes, _buffer.size() - _size);
+			ssize_t ret = ::recv(_fd, &_buffer[_size], len, 0);
+			if (ret == 0)
+			{
+				return false;
+			}
+			else if (ret < 0)
+			{
+				return (errno == EAGAIN || errno == EINTR);
+			}
+
+			_size += (uint32_t)ret;
+			maxBytes -= (uint32_t)ret;
+			_stats->add(_stats->bytes, ret);
+			if (!parse())
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+private:
+	bool parse()
+	{
+		if (!_hasHeader)
+		{
+			std::string data(_buffer.data(), _size);
+			size_t pos = data.find("\r\n\r\n");
+			if (pos == std::string::npos)
+			{
+				return true;
+			}
+
+			if (data.compare(0, 12, "HTTP/1.1 200") != 0)
+			{
+				_stats->failed = true;
+				return false;
+			}
+
+			_hasHeader = true;
+			_offset = (uint32_t)pos + 4 + 13; // flv header and the first previous tag size
+		}
+
+		while (_offset + 11 <= _size)
+		{
+			const uint8_t *tag = (const uint8_t *)&_buffer[_offset];
+			uint32_t dataSize = (tag[1] << 16) | (tag[2] << 8) | tag[3];
+			if (_offset + 11 + dataSize + 4 > _size)
+			{
+				break;
+			}
+
+			if ((tag[0] & 0x1f) == 9)
+			{
+				_stats->onVideo(tag + 11, dataSize);
+			}
+			_offset += 11 + dataSize + 4;
+		}
+
+		if (_offset > _size)
+		{
+			return true; // the flv header has not arrived yet
+		}
+
+		memmove(&_buffer[0], &_buffer[_offset], _size - _offset);
+		_size -= _offset;
+		_offset = 0;
+		return true;
+	}
+
+	PlayerStats *_stats;
+	std::string _ip;
+	int _port;
+	std::string _path;
+	int _fd = -1;
+	std::vector<char> _buffer;
+	uint32_t _size = 0;
+	uint32_t _offset = 0;
+	bool _hasHeader = false;
+};
+
+// Opens its players and reads them, the slow ones on a 10ms budget.
+static void runHttpPlayers(std::vector<std::pair<PlayerStats*, std::string>> players, Options options)
+{
+	std::vector<std::unique_ptr<HttpPlayer>> fast, slow;
+	int epfd = epoll_create1(0);
+	const std::string& ip = options.server.empty() ? std::string("127.0.0.1") : options.server;
+
+	for (auto& player : players)
+	{
+		std::unique_ptr<HttpPlayer> httpPlayer(new HttpPlayer(player.first, ip, options.httpPort, player.second));
+		if (!httpPlayer->open())
+		{
+			player.first->failed = true;
+			continue;
+		}
+
+		if (player.first->group == kSlow)
+		{
+			slow.push_back(std::move(httpPlayer));
+		}
+		else
+		{
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.ptr = httpPlayer.get();
+			epoll_ctl(epfd, EPOLL_CTL_ADD, httpPlayer->fd(), &event);
+			fast.push_back(std::move(httpPlayer));
+		}
+	}
+
+	uint32_t slowBudget = (uint32_t)options.slowKbps * 1000 / 8 / 100;
+	std::vector<struct epoll_event> events(256);
+	int64_t nextTick = xop::TaskScheduler::getMicroseconds();
+	while (!s_stopping)
+	{
+		int64_t now = xop::TaskScheduler::getMicroseconds();
+		if (now >= nextTick)
+		{
+			for (auto& player : slow)
+			{
+				if (player != nullptr && !player->read(slowBudget))
+				{
+					player.reset();
+				}
+			}
+			nextTick += 10000;
+		}
+
+		int timeout = (int)std::max<int64_t>((nextTick - now) / 1000, 0);
+		int numEvents = epoll_wait(epfd, events.data(), (int)events.size(), slow.empty() ? 100 : timeout);
+		for (int n = 0; n < numEvents; n++)
+		{
+			HttpPlayer *player = (HttpPlayer *)events[n].data.ptr;
+			if (!player->read())
+			{
+				epoll_ctl(epfd, EPOLL_CTL_DEL, player->fd(), nullptr);
+			}
+		}
+	}
+
+	::close(epfd);
+}
+
+static std::shared_ptr<uint8_t> createParameterSet(const std::vector<uint8_t>& data)
+{
+	std::shared_ptr<uint8_t> parameterSet(new uint8_t[data.size()], std::default_delete<uint8_t[]>());
+	memcpy(parameterSet.get(), data.data(), data.size());
+	return parameterSet;
+}
+
+// Annex-B frames carrying the send time after the nal header.
+static void runPublishers(std::vector<std::shared_ptr<xop::RtmpPublisher>> publishers, Options options)
+{
+	uint32_t frameSize = (uint32_t)((int64_t)options.bitrate * 1000 / 8 / options.fps);
+	uint32_t interSize = std::max<uint32_t>(frameSize * options.gop / (options.gop + 3), 64);
+	std::vector<uint8_t> keyFrame(interSize * 4, 0xab), interFrame(interSize, 0xcd);
+	const uint8_t startCode[4] = { 0, 0, 0, 1 };
+	memcpy(keyFrame.data(), startCode, 4);
+	memcpy(interFrame.data(), startCode, 4);
+	keyFrame[4] = 0x65;
+	interFrame[4] = 0x41;
+	memcpy(keyFrame.data() + kMagicOffset, kMagic, sizeof(kMagic));
+	memcpy(interFrame.data() + kMagicOffset, kMagic, sizeof(kMagic));
+
+	auto next = steady_clock::now();
+	for (uint64_t frame = 0; !s_stopping; frame++)
+	{
+		std::vector<uint8_t>& data = (frame % options.gop == 0) ? keyFrame : interFrame;
+		for (auto& publisher : publishers)
+		{
+			int64_t sendTime = xop::TaskScheduler::getMicroseconds();
+			memcpy(data.data() + kMagicOffset + sizeof(kMagic), &sendTime, sizeof(sendTime));
+			publisher->pushVideoFrame(data.data(), (uint32_t)data.size());
+		}
+
+		next += microseconds(1000000 / options.fps);
+		std::this_thread::sleep_until(next);
+	}
+}
+
+struct CpuSample
+{
+	double cpuSec = 0;
+	uint64_t rssKb = 0;
+};
+
+static CpuSample sampleCpu(int pid)
+{
+	CpuSample sample;
+	if (pid <= 0)
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		sample.cpuSec = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+		              + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+	}
+	else
+	{
+		// utime and stime are fields 14 and 15, after the parenthesized comm
+		char path[64] = { 0 };
+		snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+		FILE *fp = fopen(path, "r");
+		if (fp != nullptr)
+		{
+			char buf[1024] = { 0 };
+			size_t len = fread(buf, 1, sizeof(buf) - 1, fp);
+			buf[len] = '\0';
+			fclose(fp);
+
+			const char *p = strrchr(buf, ')');
+			unsigned long long utime = 0, stime = 0;
+			if (p != nullptr && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) == 2)
+			{
+				sample.cpuSec = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+			}
+		}
+	}
+
+	char path[64] = { 0 };
+	snprintf(path, sizeof(path), "/proc/%s/status", (pid > 0) ? std::to_string(pid).c_str() : "self");
+	FILE *fp = fopen(path, "r");
+	if (fp != nullptr)
+	{
+		char line[256] = { 0 };
+		while (fgets(line, sizeof(line), fp) != nullptr)
+		{
+			unsigned long long rss = 0;
+			if (sscanf(line, "VmRSS: %llu kB", &rss) == 1)
+			{
+				sample.rssKb = rss;
+			}
+		}
+		fclose(fp);
+	}
+
+	return sample;
+}
+
+static bool parseOption(const char *arg, const char *name, std::string& value)
+{
+	size_t len = strlen(name);
+	if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0 || arg[2 + len] != '=')
+	{
+		return false;
+	}
+
+	value = arg + 3 + len;
+	return true;
+}
+
+static bool parseOptions(int argc, char **argv, Options& options)
+{
+	for (int n = 1; n < argc; n++)
+	{
+		std::string value;
+		if (parseOption(argv[n], "publishers", value)) options.publishers = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "players", value)) options.players = atoi(value.c_str());
+		else if (parseOption(argv[n], "http", value)) options.http = atof(value.c_str());
+		else if (parseOption(argv[n], "slow", value)) options.slow = atoi(value.c_str());
+		else if (parseOption(argv[n], "slow-kbps", value)) options.slowKbps = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "bitrate", value)) options.bitrate = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "fps", value)) options.fps = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "gop", value)) options.gop = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "warmup", value)) options.warmup = atoi(value.c_str());
+		else if (parseOption(argv[n], "duration", value)) options.duration = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "threads", value)) options.threads = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "server-threads", value)) options.serverThreads = std::max(atoi(value.c_str()), 1);
+		else if (parseOption(argv[n], "server", value)) options.server = value;
+		else if (parseOption(argv[n], "rtmp-port", value)) options.rtmpPort = atoi(value.c_str());
+		else if (parseOption(argv[n], "http-port", value)) options.httpPort = atoi(value.c_str());
+		else if (parseOption(argv[n], "gop-cache", value)) options.gopCache = (atoi(value.c_str()) != 0);
+		else if (parseOption(argv[n], "fast-start", value)) options.fastStart = (atoi(value.c_str()) != 0);
+		else if (parseOption(argv[n], "app", value)) options.app = value;
+		else if (parseOption(argv[n], "server-pid", value)) options.serverPid = atoi(value.c_str());
+		else if (parseOption(argv[n], "log", value)) options.log = value;
+		else if (parseOption(argv[n], "server-cpus", value)) options.serverCpus = value;
+		else if (parseOption(argv[n], "housekeeping-cpus", value)) options.housekeepingCpus = value;
+		else if (parseOption(argv[n], "sched-fifo", value)) options.schedFifo = atoi(value.c_str());
+		else if (parseOption(argv[n], "nice", value)) options.nice = atoi(value.c_str());
+		else if (parseOption(argv[n], "stream-affinity", value)) options.streamAffinity = std::max(atoi(value.c_str()), 0);
+		else if (parseOption(argv[n], "edge-triggered", value)) options.edgeTriggered = (atoi(value.c_str()) != 0);
+		else if (parseOption(argv[n], "zerocopy", value)) options.zeroCopy = std::max(atoi(value.c_str()), 0);
+		else if (parseOption(argv[n], "busy-poll", value)) options.busyPoll = std::max(atoi(value.c_str()), 0);
+		else if (parseOption(argv[n], "io-backend", value) && (value == "epoll" || value == "io_uring")) options.ioBackend = value;
+		else
+		{
+			fprintf(stderr, "unknown option %s\n", argv[n]);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static uint64_t getPercentile(std::vector<int64_t>& values, double p)
+{
+	if (values.empty())
+	{
+		return 0;
+	}
+
+	std::sort(values.begin(), values.end());
+	size_t index = std::min<size_t>((size_t)(p * values.size()), values.size() - 1);
+	return (uint64_t)values[index];
+}
+
+// one histogram of all threads, counted between the two snapshots
+static xop::Histogram::Snapshot getDifference(const std::vector<xop::TaskScheduler::Stats>& begin,
+                                              const std::vector<xop::TaskScheduler::Stats>& end,
+                                              xop::Histogram::Snapshot xop::TaskScheduler::Stats::*field)
+{
+	xop::Histogram::Snapshot total;
+	for (size_t n = 0; n < end.size(); n++)
+	{
+		const xop::Histogram::Snapshot& last = end[n].*field;
+		const xop::Histogram::Snapshot* first = (n < begin.size()) ? &(begin[n].*field) : nullptr;
+		for (uint32_t bucket = 0; bucket < xop::Histogram::kBuckets; bucket++)
+		{
+			total.buckets[bucket] += last.buckets[bucket] - (first ? first->buckets[bucket] : 0);
+		}
+		total.count += last.count - (first ? first->count : 0);
+		total.max = std::max(total.max, last.max);
+	}
+	return total;
+}
+
+static bool parseCpus(const std::string& text, std::vector<int>& cpus)
+{
+	if (text == "auto")
+	{
+		cpus = xop::ThreadUtil::getPhysicalCores();
+		return true;
+	}
+	return text.empty() || xop::ThreadUtil::parseCpuList(text, cpus);
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	if (!parseOptions(argc, argv, options))
+	{
+		return 1;
+	}
+
+	std::vector<char> logFile(options.log.begin(), options.log.end());
+	logFile.push_back('\0');
+	xop::Logger::instance().setLogFile(logFile.data());
+
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	std::unique_ptr<xop::EventLoop> serverLoop;
+	std::unique_ptr<xop::RtmpServer> rtmpServer;
+	std::unique_ptr<xop::HttpFlvServer> httpFlvServer;
+	std::string ip = options.server;
+	if (ip.empty())
+	{
+		ip = "127.0.0.1";
+		xop::IoBackend backend = (options.ioBackend == "io_uring") ? xop::IO_BACKEND_IO_URING : xop::IO_BACKEND_EPOLL;
+		serverLoop.reset(new xop::EventLoop(options.serverThreads, backend));
+
+		xop::ThreadOptions threadOptions;
+		threadOptions.priority = options.schedFifo;
+		threadOptions.nice = options.nice;
+		if (!parseCpus(options.serverCpus, threadOptions.cpus) || !parseCpus(options.housekeepingCpus, threadOptions.housekeepingCpus))
+		{
+			fprintf(stderr, "bad cpu list\n");
+			return 1;
+		}
+		if (!serverLoop->setThreadOptions(threadOptions))
+		{
+			fprintf(stderr, "server threads not placed as asked, see --log\n");
+		}
+		serverLoop->setEdgeTriggered(options.edgeTriggered);
+		serverLoop->setBusyPoll((uint32_t)options.busyPoll);
+
+		rtmpServer.reset(new xop::RtmpServer(serverLoop.get(), ip, (uint16_t)options.rtmpPort));
+		rtmpServer->setChunkSize(60000);
+		rtmpServer->setStreamAffinity((uint32_t)options.streamAffinity);
+		if (options.gopCache)
+		{
+			rtmpServer->setGopCache();
+		}
+		httpFlvServer.reset(new xop::HttpFlvServer(serverLoop.get(), ip, (uint16_t)options.httpPort));
+		httpFlvServer->attach(rtmpServer.get());
+
+		xop::TcpOptions tcpOptions;
+		tcpOptions.zeroCopyThreshold = (uint32_t)options.zeroCopy;
+		rtmpServer->setTcpOptions(tcpOptions);
+		httpFlvServer->setTcpOptions(tcpOptions);
+	}
+
+	auto getStreamPath = [&options](int index) {
+		return "/" + options.app + "/load" + std::to_string(index % options.publishers);
+	};
+
+	xop::EventLoop clientLoop(options.threads);
+	xop::MediaInfo mediaInfo;
+	mediaInfo.sps = createParameterSet({ 0x67, 0x42, 0xc0, 0x1f, 0xda, 0x01, 0x40, 0x16, 0xe8 });
+	mediaInfo.spsSize = 9;
+	mediaInfo.pps = createParameterSet({ 0x68, 0xce, 0x3c, 0x80 });
+	mediaInfo.ppsSize = 4;
+
+	std::vector<std::shared_ptr<xop::RtmpPublisher>> publishers;
+	for (int n = 0; n < options.publishers; n++)
+	{
+		auto publisher = std::make_shared<xop::RtmpPublisher>(&clientLoop);
+		publisher->setMediaInfo(mediaInfo);
+		publisher->setFastStart(options.fastStart);
+
+		std::string status;
+		std::string url = "rtmp://" + ip + ":" + std::to_string(options.rtmpPort) + getStreamPath(n);
+		if (publisher->openUrl(url, 3000, status) != 0)
+		{
+			fprintf(stderr, "publish %s failed: %s\n", url.c_str(), status.c_str());
+			return 1;
+		}
+		publishers.push_back(publisher);
+	}
+	std::thread publisherThread(runPublishers, publishers, options);
+
+	// players: the last --slow are slow http, then --http share of the rest is http
+	int slowPlayers = std::min(options.slow, options.players);
+	int httpPlayers = (int)((options.players - slowPlayers) * options.http + 0.5);
+	std::vector<std::unique_ptr<PlayerStats>> stats;
+	std::vector<std::vector<std::pair<PlayerStats*, std::string>>> httpGroups(options.threads);
+	std::vector<std::pair<PlayerStats*, std::string>> rtmpPlayers;
+	for (int n = 0; n < options.players; n++)
+	{
+		std::unique_ptr<PlayerStats> playerStats(new PlayerStats);
+		playerStats->group = (n >= options.players - slowPlayers) ? kSlow : (n < httpPlayers ? kHttp : kRtmp);
+		if (playerStats->group == kRtmp)
+		{
+			rtmpPlayers.emplace_back(playerStats.get(), getStreamPath(n));
+		}
+		else
+		{
+			httpGroups[n % options.threads].emplace_back(playerStats.get(), getStreamPath(n) + ".flv");
+		}
+		stats.push_back(std::move(playerStats));
+	}
+
+	std::vector<std::thread> httpThreads;
+	for (auto& group : httpGroups)
+	{
+		httpThreads.emplace_back(runHttpPlayers, group, options);
+	}
+
+	// all rtmp players connect at once, results come back on the client loop
+	std::vector<std::shared_ptr<xop::RtmpClient>> clients;
+	std::atomic<int> pendingOpens(0);
+	for (auto& player : rtmpPlayers)
+	{
+		PlayerStats *playerStats = player.first;
+		auto client = std::make_shared<xop::RtmpClient>(&clientLoop);
+		client->setFastStart(options.fastStart);
+		client->setFrameCB([playerStats](uint8_t *payload, uint32_t length, uint8_t codecId, uint32_t) {
+			playerStats->add(playerStats->bytes, length);
+			if (codecId == RTMP_CODEC_ID_H264)
+			{
+				playerStats->onVideo(payload, length);
+			}
+		});
+
+		std::string url = "rtmp://" + ip + ":" + std::to_string(options.rtmpPort) + player.second;
+		playerStats->joinStart = xop::TaskScheduler::getMicroseconds();
+		pendingOpens += 1;
+		int ret = client->openUrlAsync(url, 3000, [playerStats, &pendingOpens](int result, std::string) {
+			if (result == 0)
+			{
+				playerStats->openTime = std::max<int64_t>(xop::TaskScheduler::getMicroseconds() - playerStats->joinStart, 1);
+			}
+			else
+			{
+				playerStats->failed = true;
+			}
+			pendingOpens -= 1;
+		});
+
+		if (ret != 0)
+		{
+			playerStats->failed = true;
+			pendingOpens -= 1;
+		}
+		clients.push_back(client);
+	}
+
+	while (pendingOpens > 0)
+	{
+		std::this_thread::sleep_for(milliseconds(10));
+	}
+
+	std::this_thread::sleep_for(seconds(options.warmup));
+
+	uint64_t bytesBegin = 0, framesBegin[kGroups] = { 0 };
+	for (auto& playerStats : stats)
+	{
+		bytesBegin += playerStats->bytes;
+		framesBegin[playerStats->group] += playerStats->frames;
+	}
+	CpuSample cpuBegin = sampleCpu(options.serverPid);
+	std::vector<xop::TaskScheduler::Stats> schedulerBegin, schedulerEnd;
+	if (serverLoop)
+	{
+		serverLoop->getStats(schedulerBegin);
+	}
+	auto begin = steady_clock::now();
+	s_measuring = true;
+
+	std::this_thread::sleep_for(seconds(options.duration));
+
+	s_measuring = false;
+	s_stopping = true;
+	double elapsed = duration_cast<microseconds>(steady_clock::now() - begin).count() / 1e6;
+	CpuSample cpuEnd = sampleCpu(options.serverPid);
+	if (serverLoop)
+	{
+		serverLoop->getStats(schedulerEnd);
+	}
+	uint64_t bytesEnd = 0, framesEnd[kGroups] = { 0 };
+	int groupPlayers[kGroups] = { 0 }, joined = 0, failed = 0;
+	std::vector<int64_t> joinTimes, groupJoinTimes[kGroups], openTimes;
+	for (auto& playerStats : stats)
+	{
+		bytesEnd += playerStats->bytes;
+		framesEnd[playerStats->group] += playerStats->frames;
+		groupPlayers[playerStats->group] += 1;
+		if (playerStats->joinTime > 0)
+		{
+			joined += 1;
+			joinTimes.push_back(playerStats->joinTime);
+			groupJoinTimes[playerStats->group].push_back(playerStats->joinTime);
+		}
+		if (playerStats->openTime > 0)
+		{
+			openTimes.push_back(playerStats->openTime);
+		}
+		failed += playerStats->failed ? 1 : 0;
+	}
+
+	double gbits = (bytesEnd - bytesBegin) * 8 / 1e9;
+	printf("{\n");
+	printf("  \"config\": {\"publishers\": %d, \"players\": %d, \"http\": %.2f, \"slow\": %d, \"slow_kbps\": %d, "
+	       "\"bitrate_kbps\": %d, \"fps\": %d, \"gop\": %d, \"gop_cache\": %s, \"fast_start\": %s, \"duration_sec\": %d, \"server\": \"%s\", \"io_backend\": \"%s\"},\n",
+	       options.publishers, options.players, options.http, slowPlayers, options.slowKbps,
+	       options.bitrate, options.fps, options.gop, options.gopCache ? "true" : "false",
+	       options.fastStart ? "true" : "false", options.duration,
+	       options.server.empty() ? "in-process" : options.server.c_str(), options.ioBackend.c_str());
+	printf("  \"players\": {\"rtmp\": %d, \"http\": %d, \"slow\": %d, \"joined\": %d, \"failed\": %d},\n",
+	       groupPlayers[kRtmp], groupPlayers[kHttp], groupPlayers[kSlow], joined, failed);
+	printf("  \"throughput_mbps\": %.2f,\n", gbits * 1000 / elapsed);
+	printf("  \"cpu_sec\": %.3f,\n", cpuEnd.cpuSec - cpuBegin.cpuSec);
+	printf("  \"cpu_sec_per_gbit\": %.3f,\n", (gbits > 0) ? (cpuEnd.cpuSec - cpuBegin.cpuSec) / gbits : 0);
+	printf("  \"cpu_includes_clients\": %s,\n", (options.serverPid > 0) ? "false" : "true");
+	printf("  \"rss_kb\": %llu,\n", (unsigned long long)cpuEnd.rssKb);
+	printf("  \"join_ms\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f},\n",
+	       getPercentile(joinTimes, 0.5) / 1e3, getPercentile(joinTimes, 0.99) / 1e3, getPercentile(joinTimes, 1.0) / 1e3);
+	printf("  \"open_ms\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f},\n",
+	       getPercentile(openTimes, 0.5) / 1e3, getPercentile(openTimes, 0.99) / 1e3, getPercentile(openTimes, 1.0) / 1e3);
+	printf("  \"first_frame_ms\": {");
+	for (int group = 0; group < kGroups; group++)
+	{
+		std::vector<int64_t>& times = groupJoinTimes[group];
+		printf("%s\"%s\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f}", group > 0 ? ", " : "", s_groupNames[group],
+		       getPercentile(times, 0.5) / 1e3, getPercentile(times, 0.99) / 1e3, getPercentile(times, 1.0) / 1e3);
+	}
+	printf("},\n");
+	printf("  \"frames_per_sec_per_player\": {");
+	for (int group = 0; group < kGroups; group++)
+	{
+		double perPlayer = groupPlayers[group] > 0 ? (framesEnd[group] - framesBegin[group]) / elapsed / groupPlayers[group] : 0;
+		printf("%s\"%s\": %.2f", group > 0 ? ", " : "", s_groupNames[group], perPlayer);
+	}
+	printf("},\n");
+	printf("  \"latency_us\": {\n");
+	for (int group = 0; group < kGroups; group++)
+	{
+		LatencyBins::Summary summary = LatencyBins::summarize(group);
+		printf("    \"%s\": {\"count\": %llu, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s\n",
+		       s_groupNames[group], (unsigned long long)summary.count, (unsigned long long)summary.p50,
+		       (unsigned long long)summary.p99, (unsigned long long)summary.p999, (unsigned long long)summary.max,
+		       (group + 1 < kGroups) ? "," : "");
+	}
+	printf("  },\n");
+	xop::Histogram::Snapshot handleEventTime = getDifference(schedulerBegin, schedulerEnd, &xop::TaskScheduler::Stats::handleEventTime);
+	xop::Histogram::Snapshot timerLateness = getDifference(schedulerBegin, schedulerEnd, &xop::TaskScheduler::Stats::timerLateness);
+	uint32_t handoffsId = xop::Metrics::instance().counter("xop_tcp_handoffs_total", "");
+	uint64_t epollCtlCalls = 0, syscalls = 0;
+	for (size_t n = 0; n < schedulerEnd.size(); n++)
+	{
+		epollCtlCalls += schedulerEnd[n].epollCtlCalls - (n < schedulerBegin.size() ? schedulerBegin[n].epollCtlCalls : 0);
+		syscalls += schedulerEnd[n].syscalls - (n < schedulerBegin.size() ? schedulerBegin[n].syscalls : 0);
+	}
+	printf("  \"scheduler\": {\"handle_event_us\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}, "
+	       "\"timer_lateness_us\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu}, \"handoffs\": %llu, "
+	       "\"epoll_ctl_per_sec\": %.0f, \"syscalls_per_sec\": %.0f, \"threads\": [",
+	       (unsigned long long)handleEventTime.getPercentile(0.5), (unsigned long long)handleEventTime.getPercentile(0.99),
+	       (unsigned long long)handleEventTime.getPercentile(0.999), (unsigned long long)timerLateness.getPercentile(0.5),
+	       (unsigned long long)timerLateness.getPercentile(0.99), (unsigned long long)timerLateness.getPercentile(0.999),
+	       (unsigned long long)xop::Metrics::instance().get(handoffsId), epollCtlCalls / elapsed,
+	       syscalls / elapsed);
+	for (size_t n = 0; n < schedulerEnd.size(); n++)
+	{
+		xop::TaskScheduler::Stats first;
+		if (n < schedulerBegin.size())
+		{
+			first = schedulerBegin[n];
+		}
+		const xop::TaskScheduler::Stats& last = schedulerEnd[n];
+		uint64_t spins = (last.spinHits - first.spinHits) + (last.spinMisses - first.spinMisses);
+		printf("%s{\"spin\": %.3f, \"idle\": %.3f, \"spin_hits\": %.3f}", n > 0 ? ", " : "",
+		       (last.spinTime - first.spinTime) / 1e6 / elapsed, (last.idleTime - first.idleTime) / 1e6 / elapsed,
+		       spins > 0 ? (double)(last.spinHits - first.spinHits) / spins : 0);
+	}
+	printf("]}\n}\n");
+	fflush(stdout);
+
+	// thousands of connections torn down across loops are not part of the measurement
+	_exit(0);
+}
@@ -0,0 +1,89 @@
+// Cost of the metrics on the hot path.
+// usage: metrics_bench [threads=4] [frames=2000000]
+//
+// Compares thread-local counters with one shared atomic counter, and the
+// ingest path (RtmpSession::sendMediaData) with and without stream metrics
+// and frame latency tracking.
+// Without players the ingest path is only the session lock, the difference
+// is the absolute cost per frame; every player adds microseconds of its own.
+
+#include "net/Metrics.h"
+#include "net/TaskScheduler.h"
+#include "xop/RtmpSession.h"
+#include "xop/rtmp.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+template <typename Func>
+static double runThreads(int threads, uint64_t loops, Func func)
+{
+	std::vector<std::thread> workers;
+	auto start = steady_clock::now();
+	for (int n = 0; n < threads; n++)
+	{
+		workers.emplace_back([&func, loops] {
+			for (uint64_t i = 0; i < loops; i++)
+			{
+				func(i);
+			}
+		});
+	}
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / loops;
+}
+
+static double ingest(xop::RtmpSession::Ptr session, uint64_t frames, bool timed = false)
+{
+	std::shared_ptr<char> frame(new char[3000](), std::default_delete<char[]>());
+	frame.get()[0] = 0x27;
+	frame.get()[1] = 1;
+
+	auto start = steady_clock::now();
+	for (uint64_t i = 0; i < frames; i++)
+	{
+		session->sendMediaData(RTMP_VIDEO, i, frame, 3000, timed ? xop::TaskScheduler::getMicroseconds() : 0);
+	}
+
+	return (double)duration_cast<nanoseconds>(steady_clock::now() - start).count() / frames;
+}
+
+int main(int argc, char **argv)
+{
+	int threads = (argc > 1) ? atoi(argv[1]) : 4;
+	uint64_t frames = (argc > 2) ? strtoull(argv[2], nullptr, 10) : 2000000;
+	uint64_t loops = frames * 10;
+
+	uint32_t id = xop::Metrics::instance().counter("bench_total", "Benchmark counter.");
+	std::atomic<uint64_t> shared(0);
+
+	double local = runThreads(threads, loops, [id](uint64_t) { xop::Metrics::add(id); });
+	double atomic = runThreads(threads, loops, [&shared](uint64_t) { shared.fetch_add(1); });
+	printf("counter add, %d threads: thread-local %.2f ns, shared atomic %.2f ns\n", threads, local, atomic);
+	printf("sum check: %llu of %llu\n", (unsigned long long)xop::Metrics::instance().get(id),
+	       (unsigned long long)(loops * threads));
+
+	auto plain = std::make_shared<xop::RtmpSession>();
+	auto counted = std::make_shared<xop::RtmpSession>("/bench/stream");
+	ingest(plain, frames / 10); // warm up
+	ingest(counted, frames / 10);
+
+	double withoutMetrics = ingest(plain, frames);
+	double withMetrics = ingest(counted, frames);
+	double withLatency = ingest(counted, frames, true);
+	printf("ingest without players: %.2f ns/frame, with stream metrics %.2f ns/frame (%+.2f ns)\n",
+	       withoutMetrics, withMetrics, withMetrics - withoutMetrics);
+	printf("ingest with latency tracking: %.2f ns/frame (%+.2f ns)\n", withLatency, withLatency - withMetrics);
+
+	return 0;
+}
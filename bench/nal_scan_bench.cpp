@@ -0,0 +1,185 @@
+// Annex-B start code scanning: scalar, SSE2 and AVX2 against the byte loop
+// findNal used to be, on 4K sized frames.
+// usage: nal_scan_bench [frames=2000] [frameSize=600000]
+//
+// Before timing, every scanner the cpu supports is checked against a plain
+// definition of a start code on random buffers full of 0 and 1 bytes, at
+// every alignment. Exits with 1 if any of them disagrees.
+
+#include "xop/H264Parser.h"
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std::chrono;
+using xop::H264Parser;
+
+static const H264Parser::Scanner s_scanners[] = { H264Parser::SCANNER_SCALAR, H264Parser::SCANNER_SSE2, H264Parser::SCANNER_AVX2 };
+
+static std::vector<size_t> findAll(const uint8_t *data, size_t size, H264Parser::Scanner scanner)
+{
+	std::vector<size_t> positions;
+	const uint8_t *end = data + size;
+	for (const uint8_t *p = H264Parser::findStartCode(data, end, scanner); p != end; p = H264Parser::findStartCode(p + 1, end, scanner))
+	{
+		positions.push_back(p - data);
+	}
+	return positions;
+}
+
+static std::vector<size_t> findAllReference(const uint8_t *data, size_t size)
+{
+	std::vector<size_t> positions;
+	for (size_t n = 0; n + 3 <= size; n++)
+	{
+		if (data[n] == 0 && data[n + 1] == 0 && data[n + 2] == 1)
+		{
+			positions.push_back(n);
+		}
+	}
+	return positions;
+}
+
+static bool checkEquivalence(std::mt19937& random, int rounds)
+{
+	std::vector<uint8_t> buffer(4096 + 64);
+	for (int round = 0; round < rounds; round++)
+	{
+		size_t size = random() % 4096;
+		size_t offset = random() % 64;
+		uint32_t zeros = random() % 100;
+		for (size_t n = 0; n < size; n++)
+		{
+			uint32_t r = random() % 100;
+			buffer[offset + n] = (r < zeros) ? 0 : (r < zeros + (100 - zeros) / 3 ? 1 : (uint8_t)random());
+		}
+
+		const uint8_t *data = buffer.data() + offset;
+		std::vector<size_t> expected = findAllReference(data, size);
+		for (auto scanner : s_scanners)
+		{
+			if (H264Parser::isSupported(scanner) && findAll(data, size, scanner) != expected)
+			{
+				printf("%s scanner differs: size %zu, offset %zu, round %d\n", H264Parser::getScannerName(scanner), size, offset, round);
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// The byte loop H264Parser::findNal had, for comparison.
+static const uint8_t* findNalEnd(const uint8_t *data, uint32_t size)
+{
+	uint32_t pos = 0;
+	uint8_t prefix[3] = { 0 };
+	memcpy(prefix, data, 3);
+	size -= 3;
+	data += 2;
+	while (size--)
+	{
+		if ((prefix[pos % 3] == 0) && (prefix[(pos + 1) % 3] == 0) && (prefix[(pos + 2) % 3] == 1))
+		{
+			return data - 2;
+		}
+		prefix[(pos++) % 3] = *(++data);
+	}
+	return nullptr;
+}
+
+// aud, sps, pps, sei and slices with emulation prevention, like an encoder writes them
+static std::vector<uint8_t> createFrame(std::mt19937& random, uint32_t frameSize)
+{
+	std::vector<uint8_t> frame;
+	const uint8_t headers[][6] = { { 0x09, 0xf0 }, { 0x67, 0x64, 0x00, 0x33 }, { 0x68, 0xee, 0x3c, 0x80 }, { 0x06, 0x05, 0x10 } };
+	const uint32_t headerSizes[] = { 2, 4, 4, 3 };
+	for (int n = 0; n < 4; n++)
+	{
+		frame.insert(frame.end(), { 0, 0, 0, 1 });
+		frame.insert(frame.end(), headers[n], headers[n] + headerSizes[n]);
+	}
+
+	const int slices = 8;
+	for (int slice = 0; slice < slices; slice++)
+	{
+		frame.insert(frame.end(), { 0, 0, 1, 0x65 });
+		uint32_t zeros = 0;
+		for (uint32_t n = 0; n < frameSize / slices; n++)
+		{
+			uint8_t byte = (random() % 8 == 0) ? 0 : (uint8_t)random();
+			if (zeros == 2 && byte <= 3)
+			{
+				frame.push_back(3);
+				zeros = 0;
+			}
+			frame.push_back(byte);
+			zeros = (byte == 0) ? zeros + 1 : 0;
+		}
+		frame.push_back(0x80); // rbsp trailing bits
+	}
+
+	return frame;
+}
+
+int main(int argc, char **argv)
+{
+	int frames = (argc > 1) ? atoi(argv[1]) : 2000;
+	uint32_t frameSize = (argc > 2) ? (uint32_t)atoi(argv[2]) : 600000;
+
+	std::mt19937 random(12345);
+	if (!checkEquivalence(random, 20000))
+	{
+		return 1;
+	}
+	printf("equivalence: ok, default scanner %s\n", H264Parser::getScannerName(H264Parser::getScanner()));
+
+	std::vector<uint8_t> frame = createFrame(random, frameSize);
+	const uint8_t *data = frame.data();
+	const uint8_t *end = data + frame.size();
+	size_t expectedNals = findAllReference(data, frame.size()).size();
+
+	size_t found = 0;
+	auto start = steady_clock::now();
+	for (int n = 0; n < frames; n++)
+	{
+		for (const uint8_t *p = data; p != nullptr && p < end - 3; found++)
+		{
+			p = findNalEnd(p + 1, (uint32_t)(end - p - 1));
+		}
+	}
+	double elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e3 / frames;
+	printf("byte loop: %8.2f us/frame %8.1f MB/s (%zu boundaries)\n", elapsed, frame.size() / elapsed, found / frames - 1);
+
+	for (auto scanner : s_scanners)
+	{
+		if (!H264Parser::isSupported(scanner))
+		{
+			continue;
+		}
+
+		found = 0;
+		start = steady_clock::now();
+		for (int n = 0; n < frames; n++)
+		{
+			found += findAll(data, frame.size(), scanner).size();
+		}
+		elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e3 / frames;
+		printf("%-9s: %8.2f us/frame %8.1f MB/s (%zu boundaries)\n", H264Parser::getScannerName(scanner),
+		       elapsed, frame.size() / elapsed, found / frames);
+	}
+
+	std::vector<xop::NalUnit> nals;
+	start = steady_clock::now();
+	for (int n = 0; n < frames; n++)
+	{
+		H264Parser::findNals(data, (uint32_t)frame.size(), nals);
+	}
+	elapsed = duration_cast<nanoseconds>(steady_clock::now() - start).count() / 1e3 / frames;
+	printf("findNals : %8.2f us/frame (%zu nal units, %zu expected)\n", elapsed, nals.size(), expectedNals);
+
+	return (nals.size() == expectedNals) ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+// Ingest jitter with N concurrent flv recordings.
+// usage: record_bench [recordings=100] [seconds=10] [dir=/tmp]
+
+#include "xop/FlvRecorder.h"
+#include "xop/rtmp.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace std::chrono;
+
+int main(int argc, char **argv)
+{
+	int recordings = (argc > 1) ? atoi(argv[1]) : 100;
+	int seconds = (argc > 2) ? atoi(argv[2]) : 10;
+	std::string dir = (argc > 3) ? argv[3] : "/tmp";
+
+	const int fps = 30;
+	const int gop = 60;
+	const uint32_t frameSize = 10 * 1024; // ~2.5Mbps
+
+	xop::RecordOption option;
+	option.path = dir;
+	option.maxDuration = 4;
+
+	std::vector<xop::FlvRecorder::Ptr> recorders;
+	for (int n = 0; n < recordings; n++)
+	{
+		auto recorder = std::make_shared<xop::FlvRecorder>("/bench/stream" + std::to_string(n), option);
+		std::shared_ptr<char> avcSequenceHeader(new char[16]());
+		avcSequenceHeader.get()[0] = 0x17;
+		recorder->pushFrame(RTMP_AVC_SEQUENCE_HEADER, 0, avcSequenceHeader, 16);
+		xop::FlvRecordWriter::instance().addRecorder(recorder);
+		recorders.push_back(recorder);
+	}
+
+	std::shared_ptr<char> keyFrame(new char[frameSize]());
+	std::shared_ptr<char> interFrame(new char[frameSize]());
+	keyFrame.get()[0] = 0x17;
+	interFrame.get()[0] = 0x27;
+	keyFrame.get()[1] = 1;   // AVC NALU
+	interFrame.get()[1] = 1;
+
+	std::vector<int64_t> pushTimes, lateness;
+	pushTimes.reserve((size_t)recordings * fps * seconds);
+	lateness.reserve((size_t)fps * seconds);
+
+	auto start = steady_clock::now();
+	for (int frame = 0; frame < fps * seconds; frame++)
+	{
+		auto deadline = start + microseconds((int64_t)frame * 1000000 / fps);
+		std::this_thread::sleep_until(deadline);
+		lateness.push_back(duration_cast<microseconds>(steady_clock::now() - deadline).count());
+
+		uint64_t timestamp = (uint64_t)frame * 1000 / fps;
+		auto data = (frame % gop == 0) ? keyFrame : interFrame;
+		for (auto& recorder : recorders)
+		{
+			auto t = steady_clock::now();
+			recorder->pushFrame(RTMP_VIDEO, timestamp, data, frameSize);
+			pushTimes.push_back(duration_cast<nanoseconds>(steady_clock::now() - t).count());
+		}
+	}
+
+	uint64_t dropped = 0;
+	for (auto& recorder : recorders)
+	{
+		dropped += recorder->getDroppedFrames();
+		recorder->stop();
+	}
+
+	std::sort(pushTimes.begin(), pushTimes.end());
+	std::sort(lateness.begin(), lateness.end());
+	auto pct = [](std::vector<int64_t>& v, double p) { return v.empty() ? 0 : v[(size_t)(p * (v.size() - 1))]; };
+
+	printf("{\"recordings\": %d, \"frames\": %zu, \"dropped\": %llu, "
+		"\"push_ns\": {\"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}, "
+		"\"tick_lateness_us\": {\"p50\": %lld, \"p99\": %lld, \"max\": %lld}}\n",
+		recordings, pushTimes.size(), (unsigned long long)dropped,
+		(long long)pct(pushTimes, 0.5), (long long)pct(pushTimes, 0.99), (long long)pct(pushTimes, 0.999), (long long)pushTimes.back(),
+		(long long)pct(lateness, 0.5), (long long)pct(lateness, 0.99), (long long)lateness.back());
+	return 0;
+}
@@ -0,0 +1,167 @@
+// CPU per Gbit of BufferWriter sends over loopback TCP, copied vs MSG_ZEROCOPY.
+// usage: zerocopy_bench [mbytes=2000] [packet=65536] [threshold=32768]
+//
+// The sender keeps the write queue full with a few shared payloads, like one
+// frame fanned out to many players, a receiver thread drains the socket.
+// "copy" sends as usual, "zerocopy" with the threshold and the automatic
+// fallback, "zerocopy_forced" turns it back on after each fallback to show
+// what the pinning costs where the kernel copies anyway. Loopback always
+// copies (the completions say so), the gain needs a NIC with scatter-gather.
+// sender_cpu is the sending thread, process_cpu includes the receiver.
+
+#include "net/BufferWriter.h"
+#include "net/SocketUtil.h"
+#include "net/Metrics.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/resource.h>
+
+using namespace std::chrono;
+
+static double getThreadCpu()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double getProcessCpu()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6
+	     + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static bool connectLoopback(SOCKET& sender, SOCKET& receiver)
+{
+	SOCKET listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+	    || getsockname(listener, (struct sockaddr *)&addr, &len) != 0)
+	{
+		::close(listener);
+		return false;
+	}
+
+	sender = socket(AF_INET, SOCK_STREAM, 0);
+	if (::connect(sender, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		::close(listener);
+		return false;
+	}
+	receiver = accept(listener, nullptr, nullptr);
+	::close(listener);
+	return receiver >= 0;
+}
+
+static void run(const char *mode, uint64_t bytes, uint32_t packetSize, uint32_t threshold, bool isForced)
+{
+	SOCKET sender = -1, receiver = -1;
+	if (!connectLoopback(sender, receiver))
+	{
+		fprintf(stderr, "loopback connection failed\n");
+		return;
+	}
+	xop::SocketUtil::setNonBlock(sender);
+
+	std::atomic<uint64_t> received(0);
+	std::thread reader([receiver, bytes, &received] {
+		std::vector<char> buffer(1024 * 1024);
+		while (received < bytes)
+		{
+			ssize_t ret = ::recv(receiver, buffer.data(), buffer.size(), 0);
+			if (ret <= 0)
+			{
+				break;
+			}
+			received += (uint64_t)ret;
+		}
+	});
+
+	std::vector<std::shared_ptr<char>> payloads;
+	for (int n = 0; n < 8; n++)
+	{
+		std::shared_ptr<char> payload(new char[packetSize], std::default_delete<char[]>());
+		memset(payload.get(), n, packetSize);
+		payloads.push_back(payload);
+	}
+
+	xop::BufferWriter writer(64);
+	bool isZeroCopy = writer.setZeroCopy(sender, threshold);
+	uint32_t fallbacksId = xop::Metrics::instance().counter("xop_tcp_zerocopy_fallbacks_total", "");
+	uint32_t zeroCopyBytesId = xop::Metrics::instance().counter("xop_tcp_zerocopy_bytes_total", "");
+	uint64_t fallbacksBegin = xop::Metrics::instance().get(fallbacksId);
+	uint64_t zeroCopyBegin = xop::Metrics::instance().get(zeroCopyBytesId);
+
+	double threadBegin = getThreadCpu();
+	double processBegin = getProcessCpu();
+	auto begin = steady_clock::now();
+	uint64_t queued = 0;
+	size_t maxPinned = 0;
+	uint32_t next = 0;
+	while (received < bytes)
+	{
+		while (queued < bytes && !writer.isFull())
+		{
+			writer.append(payloads[next++ % payloads.size()], packetSize);
+			queued += packetSize;
+		}
+
+		if (writer.send(sender) < 0)
+		{
+			fprintf(stderr, "send failed: %s\n", strerror(errno));
+			break;
+		}
+
+		struct pollfd pfd = { sender, (short)(writer.isEmpty() ? 0 : POLLOUT), 0 };
+		if (poll(&pfd, 1, writer.isEmpty() && writer.getPinnedSends() == 0 ? 1 : 100) > 0 && (pfd.revents & POLLERR))
+		{
+			writer.handleErrorQueue(sender);
+			if (isForced && isZeroCopy)
+			{
+				writer.setZeroCopy(sender, threshold);
+			}
+		}
+		maxPinned = std::max(maxPinned, writer.getPinnedSends());
+	}
+
+	double elapsed = duration_cast<microseconds>(steady_clock::now() - begin).count() / 1e6;
+	double threadCpu = getThreadCpu() - threadBegin;
+	reader.join();
+	double processCpu = getProcessCpu() - processBegin;
+	double gbits = received * 8 / 1e9;
+	printf("  {\"mode\": \"%s\", \"zerocopy_available\": %s, \"gbit_per_sec\": %.2f, \"sender_cpu_sec_per_gbit\": %.3f, "
+	       "\"process_cpu_sec_per_gbit\": %.3f, \"zerocopy_mbytes\": %.1f, \"fallbacks\": %llu, \"max_pinned_sends\": %zu}",
+	       mode, isZeroCopy ? "true" : "false", gbits / elapsed, threadCpu / gbits, processCpu / gbits,
+	       (xop::Metrics::instance().get(zeroCopyBytesId) - zeroCopyBegin) / 1e6,
+	       (unsigned long long)(xop::Metrics::instance().get(fallbacksId) - fallbacksBegin), maxPinned);
+
+	::close(sender);
+	::close(receiver);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t bytes = (uint64_t)((argc > 1) ? atoi(argv[1]) : 2000) * 1000 * 1000;
+	uint32_t packetSize = (uint32_t)((argc > 2) ? atoi(argv[2]) : 65536);
+	uint32_t threshold = (uint32_t)((argc > 3) ? atoi(argv[3]) : 32768);
+
+	printf("[\n");
+	run("copy", bytes, packetSize, 0, false);
+	printf(",\n");
+	run("zerocopy", bytes, packetSize, threshold, false);
+	printf(",\n");
+	run("zerocopy_forced", bytes, packetSize, threshold, true);
+	printf("\n]\n");
+	return 0;
+}
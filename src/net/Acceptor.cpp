@@ -31,15 +31,27 @@ int Acceptor::listen()
     }
     _acceptChannel->setReadCallback([this]() { this->handleAccept(); });
     _acceptChannel->enableReading();
+    if (_eventLoop->isEdgeTriggered())
+    {
+        // loops sharing the listening socket are woken one at a time
+        _acceptChannel->setEdgeTriggered();
+        _acceptChannel->setExclusive();
+    }
     _eventLoop->updateChannel(_acceptChannel);
     return 0;
 }
 
 void Acceptor::handleAccept()
 {
-    SOCKET connfd = _tcpSocket->accept();
-    if (connfd > 0)
+    // edge triggered, the backlog is accepted until it is empty
+    do
     {
+        SOCKET connfd = _tcpSocket->accept();
+        if (connfd <= 0)
+        {
+            break;
+        }
+
         if (_newConnectionCallback)
         {
             _newConnectionCallback(connfd);
@@ -48,6 +60,6 @@ void Acceptor::handleAccept()
         {
             SocketUtil::close(connfd);
         }
-    }
+    } while (_acceptChannel->isEdgeTriggered());
 }
 
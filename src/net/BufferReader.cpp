@@ -67,7 +67,7 @@ int BufferReader::readFd(SOCKET sockfd)
     if(size < MAX_BYTES_PER_READ) // 重新调整BufferReader大小
     {
         uint32_t bufferReaderSize = (uint32_t)_buffer->size();
-        if(bufferReaderSize > MAX_BUFFER_SIZE)
+        if(bufferReaderSize > _maxBufferSize)
         {
             return 0; // close
         }
@@ -34,6 +34,10 @@ public:
     uint32_t writableBytes() const
     {  return (uint32_t)(_buffer->size() - _writerIndex); }
 
+    // readFd() fails once this much unparsed data is buffered
+    void setMaxSize(uint32_t size)
+    { _maxBufferSize = size; }
+
     char* peek() 
     { return begin() + _readerIndex; }
 
@@ -108,6 +112,7 @@ private:
     std::shared_ptr<std::vector<char>> _buffer;
     size_t _readerIndex = 0;
     size_t _writerIndex = 0;
+    uint32_t _maxBufferSize = MAX_BUFFER_SIZE;
 
     static const char kCRLF[];
 	static const uint32_t MAX_BYTES_PER_READ = 4096;
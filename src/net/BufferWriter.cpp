@@ -4,9 +4,20 @@
 #include "BufferWriter.h"
 #include "Socket.h"
 #include "SocketUtil.h"
+#include "Metrics.h"
+#include <algorithm>
+#if defined(__linux) || defined(__linux__)
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#endif
 
 using namespace xop;
 
+static const uint32_t s_sentBytesId = Metrics::instance().counter("xop_tcp_sent_bytes_total", "Bytes written to sockets.");
+static const uint32_t s_zeroCopyBytesId = Metrics::instance().counter("xop_tcp_zerocopy_bytes_total", "Bytes written with MSG_ZEROCOPY.");
+static const uint32_t s_zeroCopyFallbacksId = Metrics::instance().counter("xop_tcp_zerocopy_fallbacks_total", "Connections that went back to copying sends.");
+
 void xop::writeUint32BE(char* p, uint32_t value)
 {
     p[0] = value >> 24;
@@ -51,12 +62,13 @@ void xop::writeUint16LE(char* p, uint16_t value)
 
 BufferWriter::BufferWriter(int capacity) 
     : _maxQueueLength(capacity)
-	, _buffer(new std::queue<Packet>)
+	, _buffer(new std::deque<Packet>)
 {
 	
 }	
 
-bool BufferWriter::append(std::shared_ptr<char> data, uint32_t size, uint32_t index)
+bool BufferWriter::append(std::shared_ptr<char> data, uint32_t size, uint32_t index,
+                          int64_t arrivalTime, int64_t appendTime)
 {
     if(size <= index)
         return false;
@@ -64,8 +76,8 @@ bool BufferWriter::append(std::shared_ptr<char> data, uint32_t size, uint32_t in
     if((int)_buffer->size() >= _maxQueueLength)
         return false;		
 
-    Packet pkt = {data, size, index};
-    _buffer->emplace(std::move(pkt));
+    Packet pkt = {data, size, index, -1, 0, arrivalTime, appendTime};
+    _buffer->emplace_back(std::move(pkt));
 
     return true;
 }
@@ -83,35 +95,104 @@ bool BufferWriter::append(const char* data, uint32_t size, uint32_t index)
     memcpy(pkt.data.get(), data, size);
     pkt.size = size;
     pkt.writeIndex = index;
+    pkt.fd = -1;
+    pkt.offset = 0;
+    pkt.arrivalTime = 0;
+    pkt.appendTime = 0;
 
-    _buffer->emplace(std::move(pkt));
+    _buffer->emplace_back(std::move(pkt));
 
     return true;
 }
 
+bool BufferWriter::appendFile(std::shared_ptr<void> owner, int fd, uint64_t offset, uint64_t size)
+{
+#if defined(__linux) || defined(__linux__)
+    if(fd < 0 || size == 0)
+        return false;
+
+    if((int)_buffer->size() + (int)(size / kMaxFilePacketSize) >= _maxQueueLength)
+        return false;
+
+    while(size > 0)
+    {
+        uint32_t len = (uint32_t)std::min<uint64_t>(size, kMaxFilePacketSize);
+        Packet pkt = {std::shared_ptr<char>(owner, nullptr), len, 0, fd, offset, 0, 0};
+        _buffer->emplace_back(std::move(pkt));
+        offset += len;
+        size -= len;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
 int BufferWriter::send(SOCKET sockfd, int timeout)
 {		
     if(timeout > 0)
         SocketUtil::setBlock(sockfd, timeout); // 超时返回-1
 
 	int ret = 0;
-	int count = 1;
-	do
+	while (!_buffer->empty())
 	{
-		if (_buffer->empty())
-			return 0;
-
-		count -= 1;
 		Packet &pkt = _buffer->front();
-		ret = ::send(sockfd, pkt.data.get() + pkt.writeIndex, pkt.size - pkt.writeIndex, 0);
-		if (ret > 0)
+		int expected = (int)(pkt.size - pkt.writeIndex);
+#if defined(__linux) || defined(__linux__)
+		if (pkt.fd >= 0)
 		{
-			pkt.writeIndex += ret;
-			if (pkt.size == pkt.writeIndex)
+			off_t offset = (off_t)(pkt.offset + pkt.writeIndex);
+			ret = (int)::sendfile(sockfd, pkt.fd, &offset, pkt.size - pkt.writeIndex);
+		}
+		else
+		{
+			// the packets queued up to the next file leave in one writev()
+			struct iovec iov[kMaxIovecs];
+			int count = 0;
+			expected = 0;
+			for (auto iter = _buffer->begin(); iter != _buffer->end() && iter->fd < 0 && count < kMaxIovecs; ++iter)
 			{
+				uint32_t len = iter->size - iter->writeIndex;
+				if (expected + (int64_t)len > INT32_MAX)
+					break;
+				iov[count].iov_base = iter->data.get() + iter->writeIndex;
+				iov[count].iov_len = len;
+				expected += (int)len;
 				count += 1;
-				_buffer->pop();
 			}
+			ret = -1;
+			bool isZeroCopy = (_zeroCopyThreshold > 0 && (uint32_t)expected >= _zeroCopyThreshold);
+			if (isZeroCopy)
+			{
+				struct msghdr msg;
+				memset(&msg, 0, sizeof(msg));
+				msg.msg_iov = iov;
+				msg.msg_iovlen = count;
+				ret = (int)::sendmsg(sockfd, &msg, MSG_ZEROCOPY);
+				if (ret > 0)
+				{
+					_isZeroCopyUsed = true;
+					Metrics::add(s_zeroCopyBytesId, ret);
+					this->pin((uint32_t)ret);
+				}
+				isZeroCopy = (ret >= 0 || errno != ENOBUFS); // over the optmem limit, copy this one
+			}
+			if (!isZeroCopy)
+			{
+				if (count == 1)
+					ret = ::send(sockfd, iov[0].iov_base, iov[0].iov_len, 0);
+				else
+					ret = (int)::writev(sockfd, iov, count);
+			}
+		}
+#else
+		ret = ::send(sockfd, pkt.data.get() + pkt.writeIndex, pkt.size - pkt.writeIndex, 0);
+#endif
+		if (ret > 0)
+		{
+			Metrics::add(s_sentBytesId, ret);
+			this->consume((uint32_t)ret);
 		}
 		else if (ret < 0)
 		{
@@ -123,7 +204,10 @@ int BufferWriter::send(SOCKET sockfd, int timeout)
 #endif
 				ret = 0;
 		}
-	} while (count>0);
+
+		if (ret < expected) // socket buffer full or error
+			break;
+	}
 
     if(timeout > 0)
         SocketUtil::setNonBlock(sockfd);
@@ -131,4 +215,109 @@ int BufferWriter::send(SOCKET sockfd, int timeout)
     return ret;
 }
 
+bool BufferWriter::setZeroCopy(SOCKET sockfd, uint32_t threshold)
+{
+#if defined(__linux) || defined(__linux__)
+	if (threshold > 0 && !SocketUtil::setZeroCopy(sockfd))
+	{
+		_zeroCopyThreshold = 0;
+		return false;
+	}
+	_zeroCopyThreshold = threshold;
+	return true;
+#else
+	return threshold == 0;
+#endif
+}
+
+void BufferWriter::pin(uint32_t bytes)
+{
+	ZeroCopySend zeroCopySend;
+	zeroCopySend.id = _zeroCopyNextId++;
+	zeroCopySend.isDone = false;
+	for (auto iter = _buffer->begin(); iter != _buffer->end() && bytes > 0; ++iter)
+	{
+		zeroCopySend.data.push_back(iter->data);
+		bytes -= std::min(bytes, iter->size - iter->writeIndex);
+	}
+	_zeroCopySends.emplace_back(std::move(zeroCopySend));
+}
+
+bool BufferWriter::handleErrorQueue(SOCKET sockfd)
+{
+#if defined(__linux) || defined(__linux__)
+	while (true)
+	{
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (::recvmsg(sockfd, &msg, MSG_ERRQUEUE) < 0)
+		{
+			break; // EAGAIN: drained
+		}
+
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+			    && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+			{
+				continue;
+			}
+
+			struct sock_extended_err err;
+			memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+			if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0)
+			{
+				return false;
+			}
+
+			// ids ee_info..ee_data, in send order but possibly wrapped
+			for (auto& zeroCopySend : _zeroCopySends)
+			{
+				if (zeroCopySend.id - err.ee_info <= err.ee_data - err.ee_info)
+				{
+					zeroCopySend.isDone = true;
+				}
+			}
+
+			// loopback or a device without scatter-gather: the pinning buys nothing
+			if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && _zeroCopyThreshold > 0)
+			{
+				_zeroCopyThreshold = 0;
+				Metrics::add(s_zeroCopyFallbacksId);
+			}
+		}
+	}
+
+	while (!_zeroCopySends.empty() && _zeroCopySends.front().isDone)
+	{
+		_zeroCopySends.pop_front();
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void BufferWriter::consume(uint32_t bytes)
+{
+	while (bytes > 0 && !_buffer->empty())
+	{
+		Packet &pkt = _buffer->front();
+		uint32_t len = std::min(bytes, pkt.size - pkt.writeIndex);
+		pkt.writeIndex += len;
+		bytes -= len;
+		if (pkt.size == pkt.writeIndex)
+		{
+			if (pkt.arrivalTime != 0 && _sentCB)
+			{
+				_sentCB(pkt.arrivalTime, pkt.appendTime);
+			}
+			_buffer->pop_front();
+		}
+	}
+}
+
 
@@ -6,8 +6,10 @@
 
 #include <cstdint>
 #include <memory>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <string>
+#include <functional>
 #include "Socket.h"
 
 namespace xop
@@ -23,12 +25,41 @@ void writeUint16LE(char* p, uint16_t value);
 class BufferWriter
 {
 public:
+    // arrival and append time of a timed packet, called once its last byte is sent
+    using SentCallback = std::function<void(int64_t arrivalTime, int64_t appendTime)>;
+
     BufferWriter(int capacity=kMaxQueueLength);
     ~BufferWriter() {}
 
-    bool append(std::shared_ptr<char> data, uint32_t size, uint32_t index=0);
+    void setSentCallback(const SentCallback& cb)
+    { _sentCB = cb; }
+
+    // arrivalTime != 0 marks a timed packet, the times are passed back as they are
+    bool append(std::shared_ptr<char> data, uint32_t size, uint32_t index=0,
+                int64_t arrivalTime=0, int64_t appendTime=0);
     bool append(const char* data, uint32_t size, uint32_t index=0);
-    int send(SOCKET sockfd, int timeout=0); // timeout: ms
+    bool appendFile(std::shared_ptr<void> owner, int fd, uint64_t offset, uint64_t size); // sent with sendfile()
+    int send(SOCKET sockfd, int timeout=0); // timeout: ms, queued packets are gathered
+
+    void setCapacity(int capacity)
+    { _maxQueueLength = capacity; }
+
+    /* sends of at least threshold bytes use MSG_ZEROCOPY, their packets stay
+       referenced until the kernel reports them on the error queue. 0 turns it
+       off, false if the socket lacks SO_ZEROCOPY. Linux only. */
+    bool setZeroCopy(SOCKET sockfd, uint32_t threshold);
+
+    /* a zero-copy send was made, the socket's EPOLLERR carries completions */
+    bool isZeroCopyUsed() const
+    { return _isZeroCopyUsed; }
+
+    /* releases the packets of the completions queued on sockfd. A completion
+       the kernel had to copy turns zero copy off. false on other errors. */
+    bool handleErrorQueue(SOCKET sockfd);
+
+    /* zero-copy sends the kernel still references */
+    size_t getPinnedSends() const
+    { return _zeroCopySends.size(); }
 
     bool isEmpty() const 
     { return _buffer->empty(); }
@@ -36,6 +67,9 @@ public:
     bool isFull() const 
     { return ((int)_buffer->size()>=_maxQueueLength?true:false); }
 
+    bool hasRoom(int packets) const
+    { return ((int)_buffer->size()+packets<=_maxQueueLength); }
+
     uint32_t size() const 
     { return (uint32_t)_buffer->size(); }
 	
@@ -45,12 +79,34 @@ private:
         std::shared_ptr<char> data;
         uint32_t size;
         uint32_t writeIndex;
+        int fd;           // file packet if fd >= 0
+        uint64_t offset;  // file offset
+        int64_t arrivalTime;
+        int64_t appendTime;
     } Packet;
 
-    std::shared_ptr<std::queue<Packet>> _buffer;  		
+    void consume(uint32_t bytes);
+    void pin(uint32_t bytes); // the packets of a zero-copy send
+
+    struct ZeroCopySend
+    {
+        uint32_t id;     // kernel notification id, one per sendmsg()
+        bool isDone;
+        std::vector<std::shared_ptr<char>> data;
+    };
+
+    std::shared_ptr<std::deque<Packet>> _buffer;  		
     int _maxQueueLength = 0;
+    SentCallback _sentCB;
+
+    uint32_t _zeroCopyThreshold = 0;
+    uint32_t _zeroCopyNextId = 0;
+    bool _isZeroCopyUsed = false;
+    std::deque<ZeroCopySend> _zeroCopySends;
 	 
     static const int kMaxQueueLength = 10000;
+    static const int kMaxIovecs = 64;
+    static const uint32_t kMaxFilePacketSize = 1024 * 1024 * 1024;
 };
 
 }
@@ -19,7 +19,9 @@ enum EventType
     EVENT_OUT    = 4,
     EVENT_ERR    = 8,
     EVENT_HUP    = 16,
-    EVENT_RDHUP  = 8192
+    EVENT_RDHUP  = 8192,
+    EVENT_EXCLUSIVE = 1 << 28,      // one of the epoll sets sharing the fd is woken
+    EVENT_ET     = (int)(1u << 31)  // edge triggered, the handlers read and write until EAGAIN
 };
 
 class Channel 
@@ -65,7 +67,14 @@ public:
     void disableWriting() 
     { _events &= ~EVENT_OUT; }
        
-    bool isNoneEvent() const { return _events == EVENT_NONE; }
+    void setEdgeTriggered()
+    { _events |= EVENT_ET; }
+
+    void setExclusive()
+    { _events |= EVENT_EXCLUSIVE; }
+
+    bool isNoneEvent() const { return (_events & (EVENT_IN | EVENT_PRI | EVENT_OUT)) == 0; }
+    bool isEdgeTriggered() const { return (_events & EVENT_ET) != 0; }
     bool isWriting() const { return (_events & EVENT_OUT)!=0; }
     bool isReading() const { return (_events & EVENT_IN)!=0; }
     
@@ -0,0 +1,199 @@
+#include "ConfigFile.h"
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/stat.h>
+
+using namespace xop;
+
+static std::string trim(const std::string& text)
+{
+	size_t begin = text.find_first_not_of(" \t\r\n");
+	if (begin == std::string::npos)
+	{
+		return "";
+	}
+
+	size_t end = text.find_last_not_of(" \t\r\n");
+	return text.substr(begin, end - begin + 1);
+}
+
+bool ConfigFile::load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		m_errors.push_back(path + ": cannot be opened");
+		return false;
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return this->parse(text.str());
+}
+
+bool ConfigFile::parse(const std::string& text)
+{
+	m_sections.clear();
+	m_used.clear();
+	m_errors.clear();
+
+	std::istringstream lines(text);
+	std::string line;
+	std::string section;
+	int lineNumber = 0;
+	while (std::getline(lines, line))
+	{
+		lineNumber += 1;
+		size_t pos = line.find_first_of("#;");
+		if (pos != std::string::npos)
+		{
+			line.erase(pos);
+		}
+
+		line = trim(line);
+		if (line.empty())
+		{
+			continue;
+		}
+
+		if (line.front() == '[' && line.back() == ']')
+		{
+			section = trim(line.substr(1, line.size() - 2));
+			m_sections[section];
+			continue;
+		}
+
+		pos = line.find('=');
+		if (pos == std::string::npos || trim(line.substr(0, pos)).empty())
+		{
+			m_errors.push_back("line " + std::to_string(lineNumber) + ": expected KEY = value");
+			continue;
+		}
+
+		m_sections[section][trim(line.substr(0, pos))] = trim(line.substr(pos + 1));
+	}
+
+	return m_errors.empty();
+}
+
+bool ConfigFile::hasSection(const std::string& section) const
+{
+	return m_sections.find(section) != m_sections.end();
+}
+
+std::vector<std::string> ConfigFile::getSections() const
+{
+	std::vector<std::string> sections;
+	for (auto& iter : m_sections)
+	{
+		sections.push_back(iter.first);
+	}
+	return sections;
+}
+
+const std::string* ConfigFile::find(const std::string& section, const std::string& key)
+{
+	auto iter = m_sections.find(section);
+	if (iter == m_sections.end())
+	{
+		return nullptr;
+	}
+
+	auto value = iter->second.find(key);
+	if (value == iter->second.end())
+	{
+		return nullptr;
+	}
+
+	m_used[section + "." + key] = true;
+	return &value->second;
+}
+
+std::string ConfigFile::getString(const std::string& section, const std::string& key, const std::string& value)
+{
+	const std::string* text = this->find(section, key);
+	return (text != nullptr) ? *text : value;
+}
+
+int64_t ConfigFile::getInt(const std::string& section, const std::string& key, int64_t value, int64_t min, int64_t max)
+{
+	const std::string* text = this->find(section, key);
+	if (text == nullptr)
+	{
+		return value;
+	}
+
+	char *end = nullptr;
+	errno = 0;
+	long long number = strtoll(text->c_str(), &end, 0);
+	if (text->empty() || *end != '\0' || errno != 0)
+	{
+		m_errors.push_back(section + "." + key + ": " + *text + " is not a number");
+		return value;
+	}
+
+	if (number < min || number > max)
+	{
+		m_errors.push_back(section + "." + key + ": " + *text + " is out of range [" +
+		                   std::to_string(min) + ", " + std::to_string(max) + "]");
+		return value;
+	}
+
+	return (int64_t)number;
+}
+
+bool ConfigFile::getBool(const std::string& section, const std::string& key, bool value)
+{
+	const std::string* text = this->find(section, key);
+	if (text == nullptr)
+	{
+		return value;
+	}
+
+	if (*text == "1" || *text == "true" || *text == "on" || *text == "yes")
+	{
+		return true;
+	}
+
+	if (*text == "0" || *text == "false" || *text == "off" || *text == "no")
+	{
+		return false;
+	}
+
+	m_errors.push_back(section + "." + key + ": " + *text + " is not a boolean");
+	return value;
+}
+
+std::vector<std::string> ConfigFile::getUnusedKeys() const
+{
+	std::vector<std::string> keys;
+	for (auto& section : m_sections)
+	{
+		for (auto& value : section.second)
+		{
+			std::string key = section.first + "." + value.first;
+			if (m_used.find(key) == m_used.end())
+			{
+				keys.push_back(key);
+			}
+		}
+	}
+	return keys;
+}
+
+int64_t ConfigFile::getModifyTime(const std::string& path)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+	{
+		return 0;
+	}
+
+#if defined(__linux) || defined(__linux__)
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+	return (int64_t)st.st_mtime * 1000000000;
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef XOP_CONFIG_FILE_H
+#define XOP_CONFIG_FILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace xop
+{
+
+// INI style file: [section] lines, KEY = value lines, # and ; comments.
+// Typed getters check the value and remember an error for each bad one,
+// keys that were never asked for are reported by getUnusedKeys().
+class ConfigFile
+{
+public:
+	bool load(const std::string& path);
+	bool parse(const std::string& text);
+
+	bool hasSection(const std::string& section) const;
+	std::vector<std::string> getSections() const;
+
+	std::string getString(const std::string& section, const std::string& key, const std::string& value);
+	int64_t getInt(const std::string& section, const std::string& key, int64_t value, int64_t min, int64_t max);
+	bool getBool(const std::string& section, const std::string& key, bool value);
+
+	/* "section.KEY: reason" for every value that could not be used */
+	const std::vector<std::string>& getErrors() const
+	{ return m_errors; }
+
+	std::vector<std::string> getUnusedKeys() const;
+
+	/* modification time in ns, 0 if the file does not exist */
+	static int64_t getModifyTime(const std::string& path);
+
+private:
+	const std::string* find(const std::string& section, const std::string& key);
+
+	std::map<std::string, std::map<std::string, std::string>> m_sections;
+	std::map<std::string, bool> m_used; // "section.KEY"
+	std::vector<std::string> m_errors;
+};
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 // 2018-5-15
 
 #include "EpollTaskScheduler.h"
+#include <algorithm>
 
 #if defined(__linux) || defined(__linux__) 
 #include <sys/epoll.h>
@@ -29,23 +30,33 @@ void EpollTaskScheduler::updateChannel(ChannelPtr channel)
 	std::lock_guard<std::mutex> lock(_mutex);
 #if defined(__linux) || defined(__linux__) 
     int fd = channel->fd();
-    if(_channels.find(fd) != _channels.end())
+    if(fd < 0)
+    {
+        return;
+    }
+
+    if((size_t)fd < _channels.size() && _channels[fd] != nullptr)
     {
         if(channel->isNoneEvent())
         {
             update(EPOLL_CTL_DEL, channel);
-            _channels.erase(fd);
+            _channels[fd].reset();
         }
         else
         {
             update(EPOLL_CTL_MOD, channel);
+            _channels[fd] = channel;
         }
     }
     else
     {
         if(!channel->isNoneEvent())
         {
-            _channels.emplace(fd, channel);
+            if((size_t)fd >= _channels.size())
+            {
+                _channels.resize(std::max((size_t)fd + 1, _channels.size() * 2));
+            }
+            _channels[fd] = channel;
             update(EPOLL_CTL_ADD, channel);
         }
     }
@@ -61,11 +72,22 @@ void EpollTaskScheduler::update(int operation, ChannelPtr& channel)
     {
         event.data.ptr = channel.get();
         event.events = channel->events();
+        if(operation == EPOLL_CTL_MOD)
+        {
+            event.events &= ~EVENT_EXCLUSIVE; // only allowed when added
+        }
     }
 
+    _epollCtlCalls++;
+    _syscalls++;
     if(::epoll_ctl(_epollfd, operation, channel->fd(), &event) < 0)
     {
-
+        if(operation == EPOLL_CTL_ADD && errno == EINVAL && (event.events & EVENT_EXCLUSIVE))
+        {
+            // before linux 4.5
+            event.events &= ~EVENT_EXCLUSIVE;
+            ::epoll_ctl(_epollfd, operation, channel->fd(), &event);
+        }
     }
 #endif
 }
@@ -76,10 +98,10 @@ void EpollTaskScheduler::removeChannel(ChannelPtr& channel)
 #if defined(__linux) || defined(__linux__)
     int fd = channel->fd();
 
-    if(_channels.find(fd) != _channels.end())
+    if(fd >= 0 && (size_t)fd < _channels.size() && _channels[fd] != nullptr)
     {
         update(EPOLL_CTL_DEL, channel);
-        _channels.erase(fd);
+        _channels[fd].reset();
     }
 #endif
 }
@@ -91,6 +113,7 @@ bool EpollTaskScheduler::handleEvent(int timeout)
     int numEvents = -1;
 
     numEvents = epoll_wait(_epollfd, events, 512, timeout);
+    _syscalls++;
     if(numEvents < 0)  // 
     {
         if(errno != EINTR)
@@ -99,13 +122,15 @@ bool EpollTaskScheduler::handleEvent(int timeout)
         }
     }
 
+    int64_t begin = getMicroseconds();
     for(int n=0; n<numEvents; n++)
     {
         if(events[n].data.ptr)
         {
-            ((Channel *)events[n].data.ptr)->handleEvent(events[n].events);
+            this->handleChannelEvent((Channel *)events[n].data.ptr, events[n].events);
         }
     }
+    this->recordEventBatch(numEvents, getMicroseconds() - begin);
     return true;
 #else
     return false;
@@ -6,7 +6,7 @@
 
 #include "TaskScheduler.h"
 #include <mutex>
-#include <unordered_map>
+#include <vector>
 
 namespace xop
 {	
@@ -26,8 +26,8 @@ private:
     void update(int operation, ChannelPtr& channel);
 
     int _epollfd = -1;
-    std::mutex _mutex;
-    std::unordered_map<int, ChannelPtr> _channels;
+    std::mutex _mutex; // updates only, events find their channel in epoll_event.data
+    std::vector<ChannelPtr> _channels; // by fd
 };
 
 }
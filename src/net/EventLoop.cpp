@@ -2,6 +2,9 @@
 // 2019-10-18
 
 #include "EventLoop.h"
+#include "ThreadUtil.h"
+#include "Logger.h"
+#include <future>
 
 #if defined(WIN32) || defined(_WIN32) 
 #include<windows.h>
@@ -14,8 +17,9 @@
 
 using namespace xop;
 
-EventLoop::EventLoop(uint32_t nThreads)
-	: _index(1)
+EventLoop::EventLoop(uint32_t nThreads, IoBackend backend)
+	: _backend(backend)
+	, _index(1)
 {
     static std::once_flag oc_init;
 	std::call_once(oc_init, [] {
@@ -67,10 +71,34 @@ void EventLoop::loop()
 {
 	std::lock_guard<std::mutex> locker(_mutex);
 
+#if defined(__linux) || defined(__linux__) 
+	bool isIoUring = (_backend == IO_BACKEND_IO_URING) && IoUringTaskScheduler::isSupported();
+	if (_backend == IO_BACKEND_IO_URING && !isIoUring)
+	{
+		LOG_INFO("[EventLoop] io_uring is not available, using epoll.\n");
+	}
+#endif
+
 	for (uint32_t n = 0; n < _nThreads; n++)
 	{
 #if defined(__linux) || defined(__linux__) 
-		std::shared_ptr<TaskScheduler> taskSchedulerPtr(new EpollTaskScheduler(n));
+		std::shared_ptr<TaskScheduler> taskSchedulerPtr;
+		if (isIoUring)
+		{
+			std::shared_ptr<IoUringTaskScheduler> ioUringScheduler(new IoUringTaskScheduler(n));
+			if (ioUringScheduler->isValid())
+			{
+				taskSchedulerPtr = ioUringScheduler;
+			}
+			else
+			{
+				LOG_INFO("[EventLoop] thread %u: io_uring setup failed, using epoll.\n", n);
+			}
+		}
+		if (taskSchedulerPtr == nullptr)
+		{
+			taskSchedulerPtr.reset(new EpollTaskScheduler(n));
+		}
 #elif defined(WIN32) || defined(_WIN32) 
 		std::shared_ptr<TaskScheduler> taskSchedulerPtr(new SelectTaskScheduler(n));
 #endif
@@ -147,3 +175,129 @@ bool EventLoop::addTriggerEvent(TriggerEvent callback)
 {   
 	return _taskSchedulers[0]->addTriggerEvent(callback);
 }
+
+void EventLoop::setWriteCork(bool cork)
+{
+	std::lock_guard<std::mutex> locker(_mutex);
+	for (auto iter : _taskSchedulers)
+	{
+		iter->setWriteCork(cork);
+	}
+}
+
+void EventLoop::setSlowHandlerTime(uint32_t usec)
+{
+	std::lock_guard<std::mutex> locker(_mutex);
+	for (auto iter : _taskSchedulers)
+	{
+		iter->setSlowHandlerTime(usec);
+	}
+}
+
+void EventLoop::setBusyPoll(uint32_t usec)
+{
+	std::lock_guard<std::mutex> locker(_mutex);
+	for (size_t n = 0; n < _taskSchedulers.size(); n++)
+	{
+		if (n > 0 || _taskSchedulers.size() == 1)
+		{
+			_taskSchedulers[n]->setBusyPoll(usec);
+		}
+	}
+}
+
+void EventLoop::setEdgeTriggered(bool on)
+{
+#if defined(__linux) || defined(__linux__)
+	std::lock_guard<std::mutex> locker(_mutex);
+	for (auto iter : _taskSchedulers)
+	{
+		iter->setEdgeTriggered(on);
+	}
+#endif
+}
+
+bool EventLoop::isEdgeTriggered()
+{
+	std::lock_guard<std::mutex> locker(_mutex);
+	return _taskSchedulers[0]->isEdgeTriggered();
+}
+
+bool EventLoop::setThreadOptions(const ThreadOptions& options)
+{
+	std::vector<std::shared_ptr<TaskScheduler>> taskSchedulers;
+	{
+		std::lock_guard<std::mutex> locker(_mutex);
+		taskSchedulers = _taskSchedulers;
+	}
+
+	bool ret = true;
+	size_t count = taskSchedulers.size();
+	for (size_t n = 0; n < count; n++)
+	{
+		std::vector<int> cpus;
+		int priority = options.priority;
+		int nice = options.nice;
+		if (count > 1 && n == 0)
+		{
+			cpus = options.housekeepingCpus;
+			if (cpus.empty() && !options.cpus.empty())
+			{
+				cpus.push_back(options.cpus[0]);
+			}
+			priority = 0;
+			nice = 0;
+		}
+		else if (!options.cpus.empty())
+		{
+			size_t index = (count > 1 && !options.housekeepingCpus.empty()) ? n - 1 : n;
+			cpus.push_back(options.cpus[index % options.cpus.size()]);
+		}
+
+		// affinity, policy and nice are set by the thread itself
+		auto result = std::make_shared<std::promise<std::string>>();
+		std::future<std::string> future = result->get_future();
+		bool isAdded = taskSchedulers[n]->addTriggerEvent([cpus, priority, nice, result] {
+			std::string error;
+			ThreadUtil::placeCurrentThread(cpus, priority, nice, error);
+			result->set_value(error);
+		});
+
+		if (!isAdded || future.wait_for(std::chrono::seconds(1)) != std::future_status::ready)
+		{
+			LOG_INFO("[EventLoop] thread %u did not answer.\n", (uint32_t)n);
+			ret = false;
+			continue;
+		}
+
+		std::string error = future.get();
+		if (!error.empty())
+		{
+			LOG_INFO("[EventLoop] thread %u: %s failed.\n", (uint32_t)n, error.c_str());
+			ret = false;
+		}
+		else if (!cpus.empty())
+		{
+			LOG_INFO("[EventLoop] thread %u on cpu %s, numa node %d.\n", (uint32_t)n,
+			         ThreadUtil::toCpuList(cpus).c_str(), ThreadUtil::getNumaNode(cpus[0]));
+		}
+	}
+
+	if (!options.housekeepingCpus.empty() && !Logger::instance().setThreadAffinity(options.housekeepingCpus))
+	{
+		LOG_INFO("[EventLoop] logger affinity %s failed.\n", ThreadUtil::toCpuList(options.housekeepingCpus).c_str());
+		ret = false;
+	}
+
+	return ret;
+}
+
+void EventLoop::getStats(std::vector<TaskScheduler::Stats>& stats)
+{
+	std::lock_guard<std::mutex> locker(_mutex);
+	stats.resize(_taskSchedulers.size());
+	for (size_t n = 0; n < _taskSchedulers.size(); n++)
+	{
+		_taskSchedulers[n]->getStats(stats[n]);
+	}
+}
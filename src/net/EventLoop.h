@@ -14,6 +14,7 @@
 
 #include "SelectTaskScheduler.h"
 #include "EpollTaskScheduler.h"
+#include "IoUringTaskScheduler.h"
 #include "Pipe.h"
 #include "Timer.h"
 #include "RingBuffer.h"
@@ -27,12 +28,31 @@
 namespace xop
 {
 
+// Where the threads of an EventLoop run. With more than one thread, thread 0
+// runs the acceptors and the loop's own timers and events, it goes on the
+// housekeeping cpus with the logger thread, the others on cpus.
+struct ThreadOptions
+{
+	std::vector<int> cpus;             // one per thread, round robin, empty: not pinned
+	std::vector<int> housekeepingCpus; // thread 0 and the logger, empty: thread 0 takes cpus[0]
+	int priority = 0;                  // SCHED_FIFO 1-99 of the connection threads, 0: SCHED_OTHER
+	int nice = 0;                      // of the connection threads with SCHED_OTHER
+};
+
+// Readiness backend of the threads on Linux, io_uring falls back to epoll
+// where the kernel does not have it.
+enum IoBackend
+{
+	IO_BACKEND_EPOLL,
+	IO_BACKEND_IO_URING
+};
+
 class EventLoop 
 {
 public:
 	EventLoop(const EventLoop&) = delete;
 	EventLoop &operator = (const EventLoop&) = delete; 
-	EventLoop(uint32_t nThreads=1); //std::thread::hardware_concurrency()
+	EventLoop(uint32_t nThreads=1, IoBackend backend=IO_BACKEND_EPOLL); //std::thread::hardware_concurrency()
 	virtual ~EventLoop();
 
 	std::shared_ptr<TaskScheduler> getTaskScheduler();
@@ -42,6 +62,23 @@ public:
 	void removeTimer(TimerId timerId);	
 	void updateChannel(ChannelPtr channel);
 	void removeChannel(ChannelPtr& channel);
+
+	/* false if a thread could not be placed as asked, each failure is logged.
+	   Call it from outside the loop's threads. */
+	bool setThreadOptions(const ThreadOptions& options);
+	void getStats(std::vector<TaskScheduler::Stats>& stats);
+
+	/* TaskScheduler settings, for all threads */
+	void setWriteCork(bool cork);
+	void setSlowHandlerTime(uint32_t usec);
+
+	/* spin budget of the connection threads before they block, 0: off,
+	   thread 0 keeps blocking with more than one thread */
+	void setBusyPoll(uint32_t usec);
+
+	/* epoll mode of channels created afterwards, on Linux */
+	void setEdgeTriggered(bool on);
+	bool isEdgeTriggered();
 	
 private:
 	void loop();
@@ -49,6 +86,7 @@ private:
 
 	std::mutex _mutex;
 	uint32_t _nThreads = 1;
+	IoBackend _backend = IO_BACKEND_EPOLL;
 	uint32_t _index = 1;
 	std::vector<std::shared_ptr<TaskScheduler>> _taskSchedulers;
 	std::vector<std::shared_ptr<std::thread>> _threads;
@@ -0,0 +1,59 @@
+#include "Histogram.h"
+
+using namespace xop;
+
+Histogram::Snapshot Histogram::snapshot() const
+{
+	Snapshot snapshot;
+	for (uint32_t n = 0; n < kBuckets; n++)
+	{
+		snapshot.buckets[n] = _buckets[n].load(std::memory_order_relaxed);
+	}
+	snapshot.count = _count.load(std::memory_order_relaxed);
+	snapshot.sum = _sum.load(std::memory_order_relaxed);
+	snapshot.max = _max.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+uint64_t Histogram::getBound(uint32_t index)
+{
+	if (index >= kBuckets - 1)
+	{
+		return UINT64_MAX;
+	}
+
+	return (uint64_t)1 << index;
+}
+
+uint64_t Histogram::Snapshot::getPercentile(double p) const
+{
+	uint64_t total = 0;
+	for (uint32_t n = 0; n < kBuckets; n++)
+	{
+		total += buckets[n];
+	}
+
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t)(p * total + 0.5);
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+
+	uint64_t seen = 0;
+	for (uint32_t n = 0; n < kBuckets; n++)
+	{
+		seen += buckets[n];
+		if (seen >= rank)
+		{
+			uint64_t bound = getBound(n);
+			return (bound < max) ? bound : max;
+		}
+	}
+
+	return max;
+}
@@ -0,0 +1,101 @@
+#ifndef XOP_HISTOGRAM_H
+#define XOP_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace xop
+{
+
+// Fixed power-of-two buckets: le 1, 2, 4 ... 2^(kBuckets-2), +Inf.
+// Recorded by one thread without locks or read-modify-write instructions,
+// or with add() from several threads. Snapshots may be taken from any thread.
+class Histogram
+{
+public:
+	static const uint32_t kBuckets = 24;
+
+	struct Snapshot
+	{
+		uint64_t buckets[kBuckets] = { 0 }; // not cumulative
+		uint64_t count = 0;
+		uint64_t sum = 0;
+		uint64_t max = 0;
+
+		// upper bound of the bucket holding the p quantile, 0 < p <= 1
+		uint64_t getPercentile(double p) const;
+	};
+
+	Histogram()
+	{
+		for (uint32_t n = 0; n < kBuckets; n++)
+		{
+			_buckets[n].store(0, std::memory_order_relaxed);
+		}
+		_count.store(0, std::memory_order_relaxed);
+		_sum.store(0, std::memory_order_relaxed);
+		_max.store(0, std::memory_order_relaxed);
+	}
+
+	void record(uint64_t value)
+	{
+		increase(_buckets[getIndex(value)], 1);
+		increase(_count, 1);
+		increase(_sum, value);
+		if (value > _max.load(std::memory_order_relaxed))
+		{
+			_max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	// atomic increments for histograms shared by threads
+	void add(uint64_t value)
+	{
+		_buckets[getIndex(value)].fetch_add(1, std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+		uint64_t max = _max.load(std::memory_order_relaxed);
+		while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	Snapshot snapshot() const;
+
+	// UINT64_MAX for the last bucket
+	static uint64_t getBound(uint32_t index);
+
+	static uint32_t getIndex(uint64_t value)
+	{
+		if (value <= 1)
+		{
+			return 0;
+		}
+
+		uint32_t index = 0;
+#if defined(__GNUC__)
+		index = 64 - __builtin_clzll(value - 1);
+#else
+		for (uint64_t bound = 1; bound < value; bound <<= 1)
+		{
+			index++;
+		}
+#endif
+		return (index < kBuckets - 1) ? index : kBuckets - 1;
+	}
+
+private:
+	static void increase(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> _buckets[kBuckets];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum;
+	std::atomic<uint64_t> _max;
+};
+
+}
+
+#endif
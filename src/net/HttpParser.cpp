@@ -0,0 +1,391 @@
+#include "HttpParser.h"
+#include <cctype>
+#include <strings.h>
+
+using namespace xop;
+
+// RFC 7230 tchar
+static const bool kTokenChars[256] = {
+	0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+	0,1,0,1,1,1,1,1, 0,0,1,1,0,1,1,0, 1,1,1,1,1,1,1,1, 1,1,0,0,0,0,0,0, /*  !"#$%&'()*+,-./0-9:;<=>? */
+	0,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,0,0,0,1,1, /* @A-Z[\]^_ */
+	1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,0,1,0,1,0, /* `a-z{|}~ */
+};
+
+static inline bool isTokenChar(char c)
+{
+	return kTokenChars[(unsigned char)c];
+}
+
+static bool hasToken(const HttpSlice& value, const char *token)
+{
+	size_t len = strlen(token);
+	const char *p = value.data;
+	const char *end = value.data + value.size;
+
+	while (p < end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+		{
+			p++;
+		}
+
+		const char *s = p;
+		while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+		{
+			p++;
+		}
+
+		if ((size_t)(p - s) == len && strncasecmp(s, token, len) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool HttpSlice::equals(const char *s) const
+{
+	return strlen(s) == size && memcmp(data, s, size) == 0;
+}
+
+bool HttpSlice::iequals(const char *s) const
+{
+	return strlen(s) == size && strncasecmp(data, s, size) == 0;
+}
+
+bool HttpSlice::startsWith(const char *s) const
+{
+	size_t len = strlen(s);
+	return len <= size && memcmp(data, s, len) == 0;
+}
+
+bool HttpSlice::endsWith(const char *s) const
+{
+	size_t len = strlen(s);
+	return len <= size && memcmp(data + size - len, s, len) == 0;
+}
+
+HttpSlice HttpRequest::getHeader(const char *name) const
+{
+	for (uint32_t n = 0; n < headerCount; n++)
+	{
+		if (headers[n].name.iequals(name))
+		{
+			return headers[n].value;
+		}
+	}
+
+	return HttpSlice();
+}
+
+bool HttpRequest::getQuery(const char *key, HttpSlice& value) const
+{
+	size_t len = strlen(key);
+	const char *p = query.data;
+	const char *end = query.data + query.size;
+
+	while (p < end)
+	{
+		const char *s = p;
+		while (p < end && *p != '&')
+		{
+			p++;
+		}
+
+		const char *eq = (const char *)memchr(s, '=', p - s);
+		const char *keyEnd = eq ? eq : p;
+		if ((size_t)(keyEnd - s) == len && memcmp(s, key, len) == 0)
+		{
+			value.data = eq ? eq + 1 : p;
+			value.size = (uint32_t)(p - value.data);
+			return true;
+		}
+		p++;
+	}
+
+	return false;
+}
+
+HttpParser::Status HttpParser::parse(const char *data, uint32_t size)
+{
+	if (m_errorCode != 0)
+	{
+		return kError;
+	}
+
+	if (m_headerSize == 0)
+	{
+		// a blank line ends the header, only look at the bytes not seen yet
+		const char *end = data + size;
+		const char *p = data + m_scanned;
+		while (p < end)
+		{
+			const char *lf = (const char *)memchr(p, '\n', end - p);
+			if (lf == nullptr)
+			{
+				break;
+			}
+
+			uint32_t index = (uint32_t)(lf - data);
+			if ((index >= 1 && data[index - 1] == '\n')
+				|| (index >= 2 && data[index - 1] == '\r' && data[index - 2] == '\n'))
+			{
+				m_headerSize = index + 1;
+				break;
+			}
+			p = lf + 1;
+		}
+
+		if (m_headerSize == 0)
+		{
+			if (size > kMaxHeaderSize)
+			{
+				return error(431);
+			}
+
+			m_scanned = size;
+			return kIncomplete;
+		}
+
+		if (m_headerSize > kMaxHeaderSize)
+		{
+			return error(431);
+		}
+	}
+
+	// waiting for the body re-parses the header, the buffer may have moved
+	Status status = parseHeader(data, m_headerSize);
+	if (status != kComplete)
+	{
+		return status;
+	}
+
+	if (size < m_requestSize)
+	{
+		return kIncomplete;
+	}
+
+	m_request.body.data = data + m_headerSize;
+	m_request.body.size = m_request.contentLength;
+	return kComplete;
+}
+
+void HttpParser::reset()
+{
+	m_scanned = 0;
+	m_headerSize = 0;
+	m_requestSize = 0;
+	m_errorCode = 0;
+	m_request.headerCount = 0;
+}
+
+HttpParser::Status HttpParser::error(int code)
+{
+	m_errorCode = code;
+	return kError;
+}
+
+HttpParser::Status HttpParser::parseHeader(const char *data, uint32_t size)
+{
+	HttpRequest& req = m_request;
+	const char *p = data;
+	const char *end = data + size;
+
+	while (p < end && (*p == '\r' || *p == '\n'))
+	{
+		p++;
+	}
+
+	// request line: method SP target SP HTTP/1.x
+	const char *s = p;
+	while (p < end && isTokenChar(*p))
+	{
+		p++;
+	}
+	if (p == s || p >= end || *p != ' ')
+	{
+		return error(400);
+	}
+	req.method.data = s;
+	req.method.size = (uint32_t)(p - s);
+	p++;
+
+	s = p;
+	while (p < end && (unsigned char)*p > 0x20 && *p != 0x7f)
+	{
+		p++;
+	}
+	if ((uint32_t)(p - s) > kMaxTargetSize)
+	{
+		return error(414);
+	}
+	if (p == s || p >= end || *p != ' ')
+	{
+		return error(400);
+	}
+	req.target.data = s;
+	req.target.size = (uint32_t)(p - s);
+	p++;
+
+	if (end - p < 8 || memcmp(p, "HTTP/", 5) != 0)
+	{
+		return error(400);
+	}
+	if (p[5] != '1' || p[6] != '.' || !isdigit((unsigned char)p[7]))
+	{
+		return error((p[5] >= '2' && p[5] <= '9') ? 505 : 400);
+	}
+	req.minorVersion = p[7] - '0';
+	p += 8;
+
+	if (p < end && *p == '\r')
+	{
+		p++;
+	}
+	if (p >= end || *p != '\n')
+	{
+		return error(400);
+	}
+	p++;
+
+	req.keepAlive = (req.minorVersion >= 1);
+	req.contentLength = 0;
+	req.headerCount = 0;
+	req.body = HttpSlice();
+
+	while (p < end && *p != '\r' && *p != '\n')
+	{
+		if (*p == ' ' || *p == '\t')
+		{
+			return error(400); // obsolete line folding
+		}
+
+		s = p;
+		while (p < end && isTokenChar(*p))
+		{
+			p++;
+		}
+		if (p == s || p >= end || *p != ':')
+		{
+			return error(400);
+		}
+
+		HttpHeader header;
+		header.name.data = s;
+		header.name.size = (uint32_t)(p - s);
+		p++;
+
+		while (p < end && (*p == ' ' || *p == '\t'))
+		{
+			p++;
+		}
+
+		const char *lf = (const char *)memchr(p, '\n', end - p);
+		if (lf == nullptr)
+		{
+			return error(400);
+		}
+
+		const char *valueEnd = lf;
+		while (valueEnd > p && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+		{
+			valueEnd--;
+		}
+		header.value.data = p;
+		header.value.size = (uint32_t)(valueEnd - p);
+		p = lf + 1;
+
+		if (req.headerCount == HttpRequest::kMaxHeaders)
+		{
+			return error(431);
+		}
+		req.headers[req.headerCount++] = header;
+
+		if (header.name.iequals("Content-Length"))
+		{
+			uint64_t length = 0;
+			if (header.value.empty())
+			{
+				return error(400);
+			}
+			for (uint32_t n = 0; n < header.value.size; n++)
+			{
+				char c = header.value.data[n];
+				if (!isdigit((unsigned char)c))
+				{
+					return error(400);
+				}
+				length = length * 10 + (c - '0');
+				if (length > kMaxBodySize)
+				{
+					return error(413);
+				}
+			}
+			req.contentLength = (uint32_t)length;
+		}
+		else if (header.name.iequals("Transfer-Encoding"))
+		{
+			return error(501);
+		}
+		else if (header.name.iequals("Connection"))
+		{
+			if (hasToken(header.value, "close"))
+			{
+				req.keepAlive = false;
+			}
+			else if (hasToken(header.value, "keep-alive"))
+			{
+				req.keepAlive = true;
+			}
+		}
+	}
+
+	// absolute-form: http://host/path
+	const char *path = req.target.data;
+	const char *targetEnd = req.target.data + req.target.size;
+	if (req.target.startsWith("http://") || req.target.startsWith("https://"))
+	{
+		const char *authority = path + (req.target.data[4] == ':' ? 7 : 8);
+		path = (const char *)memchr(authority, '/', targetEnd - authority);
+		if (path == nullptr)
+		{
+			path = targetEnd;
+		}
+	}
+
+	const char *mark = (const char *)memchr(path, '?', targetEnd - path);
+	req.path.data = path;
+	req.path.size = (uint32_t)((mark ? mark : targetEnd) - path);
+	req.query.data = mark ? mark + 1 : targetEnd;
+	req.query.size = (uint32_t)(targetEnd - req.query.data);
+
+	m_requestSize = m_headerSize + req.contentLength;
+	return kComplete;
+}
+
+const char* HttpParser::getStatusText(int code)
+{
+	switch (code)
+	{
+	case 200: return "OK";
+	case 204: return "No Content";
+	case 301: return "Moved Permanently";
+	case 302: return "Found";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 408: return "Request Timeout";
+	case 413: return "Payload Too Large";
+	case 414: return "URI Too Long";
+	case 431: return "Request Header Fields Too Large";
+	case 500: return "Internal Server Error";
+	case 501: return "Not Implemented";
+	case 503: return "Service Unavailable";
+	case 505: return "HTTP Version Not Supported";
+	default:  return "Unknown";
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef XOP_HTTP_PARSER_H
+#define XOP_HTTP_PARSER_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace xop
+{
+
+// A view into the request bytes, valid until the read buffer is consumed.
+struct HttpSlice
+{
+	const char *data = nullptr;
+	uint32_t size = 0;
+
+	bool empty() const
+	{ return size == 0; }
+
+	std::string str() const
+	{ return std::string(data, size); }
+
+	bool equals(const char *s) const;
+	bool iequals(const char *s) const;
+	bool startsWith(const char *s) const;
+	bool endsWith(const char *s) const;
+};
+
+struct HttpHeader
+{
+	HttpSlice name;
+	HttpSlice value;
+};
+
+class HttpRequest
+{
+public:
+	static const uint32_t kMaxHeaders = 32;
+
+	HttpSlice method;
+	HttpSlice target;  // path?query as received
+	HttpSlice path;
+	HttpSlice query;
+	HttpSlice body;
+	int minorVersion = 1;
+	bool keepAlive = true;
+	uint32_t contentLength = 0;
+
+	HttpHeader headers[kMaxHeaders];
+	uint32_t headerCount = 0;
+
+	// case insensitive, empty if missing
+	HttpSlice getHeader(const char *name) const;
+
+	// value of key in the query string, false if missing
+	bool getQuery(const char *key, HttpSlice& value) const;
+};
+
+// Incremental HTTP/1.1 request parser. It never copies or allocates, the
+// request fields point into the caller's buffer. Bytes already scanned for
+// the end of the header are not scanned again when more data arrives.
+class HttpParser
+{
+public:
+	enum Status
+	{
+		kIncomplete,
+		kComplete,
+		kError,
+	};
+
+	// data: start of the request, size: bytes available
+	Status parse(const char *data, uint32_t size);
+	void reset();
+
+	const HttpRequest& getRequest() const
+	{ return m_request; }
+
+	// header and body bytes of the completed request
+	uint32_t getRequestSize() const
+	{ return m_requestSize; }
+
+	// http status code to answer with after kError
+	int getErrorCode() const
+	{ return m_errorCode; }
+
+	static const char* getStatusText(int code);
+
+	static const uint32_t kMaxHeaderSize = 8192;
+	static const uint32_t kMaxTargetSize = 4096;
+	static const uint32_t kMaxBodySize = 64 * 1024;
+
+private:
+	Status parseHeader(const char *data, uint32_t size);
+	Status error(int code);
+
+	HttpRequest m_request;
+	uint32_t m_scanned = 0;
+	uint32_t m_headerSize = 0;
+	uint32_t m_requestSize = 0;
+	int m_errorCode = 0;
+};
+
+}
+
+#endif
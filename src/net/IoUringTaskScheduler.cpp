@@ -0,0 +1,569 @@
+#include "IoUringTaskScheduler.h"
+#include "Logger.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#if (defined(__linux) || defined(__linux__)) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define XOP_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace xop
+{
+
+#if XOP_HAVE_IO_URING
+
+// The rings of one io_uring instance, mapped without liburing. Submission
+// entries are pushed under the scheduler's lock, completions are only reaped
+// by the loop thread.
+class IoUring
+{
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring()
+    {
+        if (_ringPtr != MAP_FAILED)
+        {
+            munmap(_ringPtr, _ringSize);
+        }
+        if (_sqes != MAP_FAILED)
+        {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_fd >= 0)
+        {
+            ::close(_fd);
+        }
+    }
+
+    bool init(unsigned entries, unsigned cqEntries)
+    {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (_fd < 0)
+        {
+            return false;
+        }
+
+        _features = params.features;
+        if (!(_features & IORING_FEAT_SINGLE_MMAP))
+        {
+            return false;
+        }
+
+        _ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                             params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+        _ringPtr = mmap(nullptr, _ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_ringPtr == MAP_FAILED)
+        {
+            return false;
+        }
+
+        _sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        _sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sqes == MAP_FAILED)
+        {
+            return false;
+        }
+
+        char *ring = (char *)_ringPtr;
+        _sqHead = (unsigned *)(ring + params.sq_off.head);
+        _sqTail = (unsigned *)(ring + params.sq_off.tail);
+        _sqMask = *(unsigned *)(ring + params.sq_off.ring_mask);
+        _sqEntries = params.sq_entries;
+        _cqHead = (unsigned *)(ring + params.cq_off.head);
+        _cqTail = (unsigned *)(ring + params.cq_off.tail);
+        _cqMask = *(unsigned *)(ring + params.cq_off.ring_mask);
+        _cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+        // entry i always lives in slot i
+        unsigned *array = (unsigned *)(ring + params.sq_off.array);
+        for (unsigned i = 0; i < _sqEntries; i++)
+        {
+            array[i] = i;
+        }
+        _localTail = *_sqTail;
+        return true;
+    }
+
+    int fd() const
+    { return _fd; }
+
+    bool hasFeatures(unsigned features) const
+    { return (_features & features) == features; }
+
+    /* zeroed, nullptr if the queue is still full after flushing it */
+    struct io_uring_sqe* getSqe()
+    {
+        if (_sqHead == nullptr)
+        {
+            return nullptr; // init failed
+        }
+
+        if (_localTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries)
+        {
+            this->enter(this->getPending(), 0, 0, nullptr, 0);
+            if (_localTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries)
+            {
+                return nullptr;
+            }
+        }
+
+        struct io_uring_sqe *sqe = &((struct io_uring_sqe *)_sqes)[_localTail & _sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    /* hands the entry of the last getSqe() to the kernel */
+    void advance()
+    { __atomic_store_n(_sqTail, ++_localTail, __ATOMIC_RELEASE); }
+
+    unsigned getPending() const
+    { return (_sqHead != nullptr) ? _localTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) : 0; }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags, const void *arg, size_t argSize)
+    {
+        _enterCalls++;
+        return (int)syscall(__NR_io_uring_enter, _fd, toSubmit, minComplete, flags, arg, argSize);
+    }
+
+    bool hasCompletions() const
+    { return _cqHead != nullptr && __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) != *_cqHead; }
+
+    /* copies up to max completions, loop thread only */
+    int reap(struct io_uring_cqe *cqes, int max)
+    {
+        if (_cqHead == nullptr)
+        {
+            return 0;
+        }
+
+        unsigned head = *_cqHead;
+        unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        int count = 0;
+        while (head != tail && count < max)
+        {
+            cqes[count++] = _cqes[head & _cqMask];
+            head++;
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    /* io_uring_enter calls since the last one, for the syscall counter */
+    uint64_t takeEnterCalls()
+    { return _enterCalls.exchange(0); }
+
+private:
+    int _fd = -1;
+    unsigned _features = 0;
+    void *_ringPtr = MAP_FAILED;
+    size_t _ringSize = 0;
+    void *_sqes = MAP_FAILED;
+    size_t _sqesSize = 0;
+
+    unsigned *_sqHead = nullptr;
+    unsigned *_sqTail = nullptr;
+    unsigned _sqMask = 0;
+    unsigned _sqEntries = 0;
+    unsigned _localTail = 0;
+
+    unsigned *_cqHead = nullptr;
+    unsigned *_cqTail = nullptr;
+    unsigned _cqMask = 0;
+    struct io_uring_cqe *_cqes = nullptr;
+
+    std::atomic<uint64_t> _enterCalls { 0 };
+};
+
+#else
+
+class IoUring
+{
+};
+
+#endif
+
+}
+
+using namespace xop;
+
+#if XOP_HAVE_IO_URING
+static const unsigned kSqEntries = 4096;
+static const unsigned kCqEntries = 16384;
+static const int kMaxEvents = 512;
+static const uint64_t kWakeupData = ~0ULL;
+static const uint64_t kIgnoreData = ~0ULL - 1;
+
+static inline uint64_t makeUserData(int fd, uint32_t generation)
+{
+    return ((uint64_t)generation << 32) | (uint32_t)fd;
+}
+
+// the scheduler running on this thread, the sender of msg_ring wakeups
+static thread_local IoUringTaskScheduler *s_current = nullptr;
+
+static bool probe()
+{
+    IoUring ring;
+    if (!ring.init(kSqEntries, kCqEntries))
+    {
+        LOG_INFO("[IoUring] io_uring_setup: %s\n", strerror(errno));
+        return false;
+    }
+
+    if (!ring.hasFeatures(IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_CQE_SKIP))
+    {
+        LOG_INFO("[IoUring] the kernel lacks NODROP, EXT_ARG or CQE_SKIP\n");
+        return false;
+    }
+
+    int fds[2] = { -1, -1 };
+    if (pipe(fds) != 0)
+    {
+        return false;
+    }
+
+    // a message to itself and a multishot poll on a writable pipe
+    struct io_uring_sqe *sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_MSG_RING;
+    sqe->fd = ring.fd();
+    sqe->addr = IORING_MSG_DATA;
+    sqe->off = 1;
+    sqe->user_data = 2;
+    ring.advance();
+
+    sqe = ring.getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fds[1];
+    sqe->poll32_events = POLLOUT;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = 3;
+    ring.advance();
+
+    bool hasMessage = false;
+    bool hasMultishot = false;
+    struct __kernel_timespec ts = { 0, 100000000 };
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    if (ring.enter(2, 3, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) >= 0 || errno == ETIME)
+    {
+        struct io_uring_cqe cqes[8];
+        int count = ring.reap(cqes, 8);
+        for (int n = 0; n < count; n++)
+        {
+            hasMessage |= (cqes[n].user_data == 1);
+            hasMultishot |= (cqes[n].user_data == 3 && cqes[n].res > 0 && (cqes[n].flags & IORING_CQE_F_MORE));
+        }
+    }
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+    if (!hasMessage || !hasMultishot)
+    {
+        LOG_INFO("[IoUring] the kernel lacks MSG_RING or multishot poll\n");
+    }
+    return hasMessage && hasMultishot;
+}
+#endif
+
+bool IoUringTaskScheduler::isSupported()
+{
+#if XOP_HAVE_IO_URING
+    static const bool isSupported = probe();
+    return isSupported;
+#else
+    return false;
+#endif
+}
+
+IoUringTaskScheduler::IoUringTaskScheduler(int id)
+    : TaskScheduler(id)
+    , _ring(new IoUring)
+{
+#if XOP_HAVE_IO_URING
+    _isValid = _ring->init(kSqEntries, kCqEntries);
+    if (!_isValid)
+    {
+        LOG_INFO("[IoUring] scheduler %d: io_uring_setup: %s\n", id, strerror(errno));
+        return;
+    }
+#endif
+    this->updateChannel(_wakeupChannel);
+}
+
+IoUringTaskScheduler::~IoUringTaskScheduler()
+{
+
+}
+
+void IoUringTaskScheduler::updateChannel(ChannelPtr channel)
+{
+#if XOP_HAVE_IO_URING
+    std::lock_guard<std::mutex> lock(_ringMutex);
+    int fd = channel->fd();
+    if (fd < 0)
+    {
+        return;
+    }
+
+    if ((size_t)fd >= _slots.size())
+    {
+        _slots.resize(std::max((size_t)fd + 1, _slots.size() * 2));
+    }
+
+    Slot& slot = _slots[fd];
+    if (channel->isNoneEvent())
+    {
+        this->disarm(fd, slot);
+        slot.channel.reset();
+    }
+    else
+    {
+        slot.channel = channel;
+        if (!slot.isArmed || slot.events != channel->events())
+        {
+            this->disarm(fd, slot);
+            this->arm(fd, slot);
+        }
+    }
+
+    if (!this->isInLoopThread())
+    {
+        this->submit(); // the loop may be waiting
+    }
+#endif
+}
+
+void IoUringTaskScheduler::removeChannel(ChannelPtr& channel)
+{
+#if XOP_HAVE_IO_URING
+    std::lock_guard<std::mutex> lock(_ringMutex);
+    int fd = channel->fd();
+    if (fd >= 0 && (size_t)fd < _slots.size() && _slots[fd].channel != nullptr)
+    {
+        this->disarm(fd, _slots[fd]);
+        _slots[fd].channel.reset();
+        if (!this->isInLoopThread())
+        {
+            this->submit();
+        }
+    }
+#endif
+}
+
+void IoUringTaskScheduler::arm(int fd, Slot& slot)
+{
+#if XOP_HAVE_IO_URING
+    struct io_uring_sqe *sqe = _ring->getSqe();
+    if (sqe == nullptr)
+    {
+        LOG_INFO("[IoUring] scheduler %d: submission queue full, fd %d not armed\n", _id, fd);
+        return;
+    }
+
+    int events = slot.channel->events();
+    slot.generation++;
+    slot.events = events;
+    slot.isArmed = true;
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = (uint32_t)(events & ~(EVENT_EXCLUSIVE | EVENT_ET));
+    if (events & EVENT_ET)
+    {
+        sqe->len = IORING_POLL_ADD_MULTI; // edge triggered unless IORING_POLL_ADD_LEVEL
+    }
+    sqe->user_data = makeUserData(fd, slot.generation);
+    _ring->advance();
+#endif
+}
+
+void IoUringTaskScheduler::disarm(int fd, Slot& slot)
+{
+#if XOP_HAVE_IO_URING
+    if (!slot.isArmed)
+    {
+        return;
+    }
+
+    struct io_uring_sqe *sqe = _ring->getSqe();
+    if (sqe != nullptr)
+    {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->addr = makeUserData(fd, slot.generation);
+        sqe->user_data = kIgnoreData;
+        _ring->advance();
+    }
+
+    // completions of the old request are stale from here on
+    slot.generation++;
+    slot.isArmed = false;
+#endif
+}
+
+void IoUringTaskScheduler::submit()
+{
+#if XOP_HAVE_IO_URING
+    unsigned pending = _ring->getPending();
+    if (pending > 0)
+    {
+        _ring->enter(pending, 0, 0, nullptr, 0);
+    }
+#endif
+}
+
+void IoUringTaskScheduler::sendWakeup(int ringFd)
+{
+#if XOP_HAVE_IO_URING
+    std::lock_guard<std::mutex> lock(_ringMutex);
+    struct io_uring_sqe *sqe = _ring->getSqe();
+    if (sqe == nullptr)
+    {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_MSG_RING;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->fd = ringFd;
+    sqe->addr = IORING_MSG_DATA;
+    sqe->off = kWakeupData;
+    sqe->user_data = kIgnoreData;
+    _ring->advance();
+
+    // also takes the polls queued so far, the target should not wait for this batch
+    this->submit();
+#endif
+}
+
+void IoUringTaskScheduler::notify()
+{
+#if XOP_HAVE_IO_URING
+    IoUringTaskScheduler *current = s_current;
+    if (current != nullptr && current != this)
+    {
+        current->sendWakeup(_ring->fd());
+        return;
+    }
+#endif
+    TaskScheduler::notify();
+}
+
+bool IoUringTaskScheduler::handleEvent(int timeout)
+{
+#if XOP_HAVE_IO_URING
+    s_current = this;
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    unsigned pending = 0;
+    {
+        std::lock_guard<std::mutex> lock(_ringMutex);
+        pending = _ring->getPending();
+    }
+
+    // polls armed and changed since the last pass go in with the wait
+    unsigned minComplete = _ring->hasCompletions() ? 0 : 1;
+    int ret = _ring->enter(pending, minComplete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    _syscalls += _ring->takeEnterCalls();
+    if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN)
+    {
+        return false;
+    }
+
+    struct io_uring_cqe cqes[kMaxEvents];
+    int count = _ring->reap(cqes, kMaxEvents);
+
+    {
+        std::lock_guard<std::mutex> lock(_ringMutex);
+        _batch++;
+        for (int n = 0; n < count; n++)
+        {
+            uint64_t data = cqes[n].user_data;
+            if (data == kWakeupData || data == kIgnoreData)
+            {
+                continue;
+            }
+
+            int fd = (int)(uint32_t)data;
+            if ((size_t)fd >= _slots.size())
+            {
+                continue;
+            }
+
+            Slot& slot = _slots[fd];
+            if (slot.channel == nullptr || slot.generation != (uint32_t)(data >> 32))
+            {
+                continue; // removed or re-armed since
+            }
+
+            if (!(cqes[n].flags & IORING_CQE_F_MORE))
+            {
+                slot.isArmed = false;
+                _fired.push_back(fd);
+            }
+
+            int events = (cqes[n].res >= 0) ? cqes[n].res : EVENT_ERR;
+            if (slot.batch == _batch)
+            {
+                _ready[slot.readyIndex].second |= events; // one call per channel, like epoll
+                continue;
+            }
+
+            slot.batch = _batch;
+            slot.readyIndex = (uint32_t)_ready.size();
+            _ready.emplace_back(slot.channel, events);
+        }
+    }
+
+    int64_t begin = getMicroseconds();
+    for (auto& ready : _ready)
+    {
+        this->handleChannelEvent(ready.first.get(), ready.second);
+    }
+    this->recordEventBatch((int)_ready.size(), getMicroseconds() - begin);
+    _ready.clear();
+
+    // one-shot polls go back in unless a handler already re-armed or removed them
+    if (!_fired.empty())
+    {
+        std::lock_guard<std::mutex> lock(_ringMutex);
+        for (int fd : _fired)
+        {
+            Slot& slot = _slots[fd];
+            if (slot.channel != nullptr && !slot.isArmed)
+            {
+                this->arm(fd, slot);
+            }
+        }
+        _fired.clear();
+    }
+    return true;
+#else
+    return false;
+#endif
+}
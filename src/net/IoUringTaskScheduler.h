@@ -0,0 +1,70 @@
+#ifndef XOP_IO_URING_TASK_SCHEDULER_H
+#define XOP_IO_URING_TASK_SCHEDULER_H
+
+#include "TaskScheduler.h"
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace xop
+{
+
+class IoUring;
+
+// Readiness through io_uring poll requests instead of epoll. Arming, changing
+// and removing channels only queue submission entries, they go to the kernel
+// with the wait of the next iteration: one io_uring_enter per loop pass.
+// Level triggered channels use one-shot polls, re-armed after dispatch, edge
+// triggered ones a multishot poll. Trigger events from another io_uring loop
+// wake this one with IORING_OP_MSG_RING instead of the pipe.
+class IoUringTaskScheduler : public TaskScheduler
+{
+public:
+    IoUringTaskScheduler(int id = 0);
+    virtual ~IoUringTaskScheduler();
+
+    /* the kernel has what the scheduler uses (5.18 or later), probed once */
+    static bool isSupported();
+
+    /* false if this instance's ring could not be set up, it must not be started */
+    bool isValid() const
+    { return _isValid; }
+
+    void updateChannel(ChannelPtr channel);
+    void removeChannel(ChannelPtr& channel);
+
+    // timeout: ms
+    bool handleEvent(int timeout);
+
+protected:
+    void notify();
+
+private:
+    struct Slot
+    {
+        ChannelPtr channel;
+        uint32_t generation = 0; // of the poll request in flight, stale completions are dropped
+        int events = 0;          // it was armed with
+        bool isArmed = false;
+        uint32_t batch = 0;      // last batch it was ready in, multishot polls complete once per wakeup
+        uint32_t readyIndex = 0; // of its entry in that batch
+    };
+
+    void arm(int fd, Slot& slot);
+    void disarm(int fd, Slot& slot);
+    void submit();
+    void sendWakeup(int ringFd); // from this loop's thread to another ring
+
+    std::unique_ptr<IoUring> _ring;
+    std::mutex _ringMutex; // the slots and the submission queue, updates come from other threads
+    std::vector<Slot> _slots; // by fd
+    std::vector<int> _fired;  // fds of the batch whose one-shot poll completed
+    std::vector<std::pair<ChannelPtr, int>> _ready;
+    uint32_t _batch = 0;
+    bool _isValid = false;
+};
+
+}
+
+#endif
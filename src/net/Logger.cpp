@@ -11,6 +11,10 @@
 #include <stdarg.h>
 #include <iostream>
 #include "Timestamp.h"
+#include "ThreadUtil.h"
+#if !defined(WIN32) && !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 using namespace xop;
 
@@ -25,8 +29,12 @@ const char* Priority_To_String[] =
 
 Logger::Logger() 
     : _shutdown(false)
+    , _cond(new std::condition_variable())
 {
-    _thread = std::thread(&Logger::run, this);
+    _thread.reset(new std::thread(&Logger::run, this));
+#if !defined(WIN32) && !defined(_WIN32)
+	pthread_atfork(&Logger::onForkPrepare, &Logger::onForkParent, &Logger::onForkChild);
+#endif
 }
 
 Logger& Logger::instance()
@@ -38,9 +46,39 @@ Logger& Logger::instance()
 Logger::~Logger()
 {
     _shutdown = true;
-    _cond.notify_all();
+    _cond->notify_all();
+
+    _thread->join();
+}
+
+void Logger::onForkPrepare()
+{
+	instance()._mutex.lock();
+}
 
-    _thread.join();
+void Logger::onForkParent()
+{
+	instance()._mutex.unlock();
+}
+
+void Logger::onForkChild()
+{
+	// only the forking thread exists in the child. It holds the mutex since
+	// onForkPrepare(), the writer thread is gone and the condition still counts
+	// it as a waiter: both objects are left behind, never destroyed, and the
+	// child starts over with new ones
+	Logger& logger = instance();
+	logger._thread.release();
+	logger._cond.release();
+	logger._cond.reset(new std::condition_variable());
+	logger._queue = std::queue<std::string>();
+	logger._mutex.unlock();
+	logger._thread.reset(new std::thread(&Logger::run, &logger));
+}
+
+bool Logger::setThreadAffinity(const std::vector<int>& cpus)
+{
+	return ThreadUtil::setAffinity(*_thread, cpus);
 }
 
 void Logger::setLogFile(char *pathname)
@@ -65,7 +103,7 @@ void Logger::log(Priority priority, const char* __file, const char* __func, int
     std::string entry(buf);
     std::unique_lock<std::mutex> lock(_mutex);	
     _queue.push(std::move(entry));
-    _cond.notify_all(); 
+    _cond->notify_all(); 
 }
 
 void Logger::log2(Priority priority, const char *fmt, ...)
@@ -81,7 +119,7 @@ void Logger::log2(Priority priority, const char *fmt, ...)
 	std::string entry(buf);
 	std::unique_lock<std::mutex> lock(_mutex); 
 	_queue.push(std::move(entry));
-	_cond.notify_all();
+	_cond->notify_all();
 }
 
 void Logger::run()
@@ -102,7 +140,7 @@ void Logger::run()
         }
         else
         {
-            _cond.wait(lock);
+            _cond->wait(lock);
         }
     }
 }
@@ -14,6 +14,8 @@
 #include <cstring>
 #include <iostream>
 #include <sstream>
+#include <vector>
+#include <memory>
 
 namespace xop
 {
@@ -32,17 +34,21 @@ public:
     ~Logger();
 
     void setLogFile(char *pathname);
+    bool setThreadAffinity(const std::vector<int>& cpus);
     void log(Priority priority, const char* __file, const char* __func, int __line, const char *fmt, ...);
 	void log2(Priority priority, const char *fmt, ...);
 
 private:
     Logger();
     void run();
+	static void onForkPrepare();
+	static void onForkParent();
+	static void onForkChild();
 
     std::atomic<bool> _shutdown;
-    std::thread _thread;
+    std::unique_ptr<std::thread> _thread;          // replaced in a forked child
     std::mutex _mutex;
-    std::condition_variable _cond;
+    std::unique_ptr<std::condition_variable> _cond; // replaced in a forked child
     std::queue<std::string> _queue;
     std::ofstream _ofs;
 };
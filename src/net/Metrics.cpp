@@ -0,0 +1,282 @@
+#include "Metrics.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace xop;
+
+thread_local Metrics::ThreadCounters* Metrics::s_threadCounters = nullptr;
+
+static std::string formatLabels(const MetricLabels& labels)
+{
+	if (labels.empty())
+	{
+		return "";
+	}
+
+	std::string str = "{";
+	for (auto& label : labels)
+	{
+		if (str.size() > 1)
+		{
+			str += ",";
+		}
+
+		str += label.first + "=\"";
+		for (char c : label.second)
+		{
+			if (c == '\\' || c == '"')
+			{
+				str += '\\';
+				str += c;
+			}
+			else if (c == '\n')
+			{
+				str += "\\n";
+			}
+			else
+			{
+				str += c;
+			}
+		}
+		str += "\"";
+	}
+
+	return str + "}";
+}
+
+void MetricsWriter::add(const std::string& name, const std::string& help, const char *type,
+                        const MetricLabels& labels, const std::string& value)
+{
+	// the _bucket, _sum and _count samples of a histogram are one family
+	std::string familyName = name;
+	if (strcmp(type, "histogram") == 0)
+	{
+		familyName = name.substr(0, name.rfind('_'));
+	}
+
+	Family& family = m_families[familyName];
+	if (family.type.empty())
+	{
+		family.help = help;
+		family.type = type;
+	}
+	family.samples.emplace_back(name + formatLabels(labels), value);
+}
+
+void MetricsWriter::counter(const std::string& name, const std::string& help, const MetricLabels& labels, uint64_t value)
+{
+	add(name, help, "counter", labels, std::to_string(value));
+}
+
+void MetricsWriter::gauge(const std::string& name, const std::string& help, const MetricLabels& labels, double value)
+{
+	char buf[32] = { 0 };
+	snprintf(buf, sizeof(buf), "%.17g", value);
+	add(name, help, "gauge", labels, buf);
+}
+
+void MetricsWriter::histogram(const std::string& name, const std::string& help, const MetricLabels& labels, const Histogram::Snapshot& snapshot)
+{
+	MetricLabels bucketLabels = labels;
+	bucketLabels.emplace_back("le", "");
+
+	uint64_t count = 0;
+	for (uint32_t n = 0; n < Histogram::kBuckets; n++)
+	{
+		count += snapshot.buckets[n];
+		uint64_t bound = Histogram::getBound(n);
+		bucketLabels.back().second = (bound == UINT64_MAX) ? "+Inf" : std::to_string(bound);
+		add(name + "_bucket", help, "histogram", bucketLabels, std::to_string(count));
+	}
+
+	add(name + "_sum", help, "histogram", labels, std::to_string(snapshot.sum));
+	add(name + "_count", help, "histogram", labels, std::to_string(count));
+}
+
+std::string MetricsWriter::str() const
+{
+	std::string text;
+	for (auto& iter : m_families)
+	{
+		text += "# HELP " + iter.first + " " + iter.second.help + "\n";
+		text += "# TYPE " + iter.first + " " + iter.second.type + "\n";
+		for (auto& sample : iter.second.samples)
+		{
+			text += sample.first + " " + sample.second + "\n";
+		}
+	}
+
+	return text;
+}
+
+Metrics::Metrics()
+{
+	m_series.resize(1); // kInvalidId
+}
+
+Metrics& Metrics::instance()
+{
+	static Metrics s_metrics;
+	return s_metrics;
+}
+
+uint32_t Metrics::counter(const std::string& name, const std::string& help, const MetricLabels& labels)
+{
+	std::string key = name + formatLabels(labels);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_seriesIds.find(key);
+	if (iter != m_seriesIds.end())
+	{
+		return iter->second;
+	}
+
+	uint32_t id = kInvalidId;
+	if (!m_freeIds.empty())
+	{
+		id = m_freeIds.back();
+		m_freeIds.pop_back();
+		m_series[id] = { name, help, labels };
+	}
+	else if (m_series.size() < kMaxChunks * kChunkSize)
+	{
+		id = (uint32_t)m_series.size();
+		m_series.push_back({ name, help, labels });
+	}
+	else
+	{
+		return kInvalidId;
+	}
+
+	m_seriesIds[key] = id;
+	return id;
+}
+
+void Metrics::release(uint32_t id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (id == kInvalidId || id >= m_series.size() || m_series[id].name.empty())
+	{
+		return;
+	}
+
+	m_seriesIds.erase(m_series[id].name + formatLabels(m_series[id].labels));
+	m_series[id] = Series();
+
+	// the next owner of the id starts from zero
+	for (auto counters : m_threads)
+	{
+		std::atomic<uint64_t> *chunk = counters->chunks[id >> kChunkBits].load(std::memory_order_acquire);
+		if (chunk != nullptr)
+		{
+			chunk[id & (kChunkSize - 1)].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	m_freeIds.push_back(id);
+}
+
+Metrics::ThreadCounters* Metrics::attachThread()
+{
+	ThreadCounters *counters = new ThreadCounters();
+
+	Metrics& metrics = instance();
+	std::lock_guard<std::mutex> lock(metrics.m_mutex);
+	metrics.m_threads.push_back(counters);
+	s_threadCounters = counters;
+	return counters;
+}
+
+std::atomic<uint64_t>* Metrics::allocChunk(ThreadCounters *counters, uint32_t index)
+{
+	std::atomic<uint64_t> *chunk = new std::atomic<uint64_t>[kChunkSize];
+	for (uint32_t n = 0; n < kChunkSize; n++)
+	{
+		chunk[n].store(0, std::memory_order_relaxed);
+	}
+
+	counters->chunks[index].store(chunk, std::memory_order_release);
+	return chunk;
+}
+
+uint64_t Metrics::get(uint32_t id)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint64_t value = 0;
+	for (auto counters : m_threads)
+	{
+		std::atomic<uint64_t> *chunk = counters->chunks[id >> kChunkBits].load(std::memory_order_acquire);
+		if (chunk != nullptr)
+		{
+			value += chunk[id & (kChunkSize - 1)].load(std::memory_order_relaxed);
+		}
+	}
+
+	return value;
+}
+
+uint32_t Metrics::addCollector(const Collector& collector)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_collectors[++m_lastCollectorId] = collector;
+	return m_lastCollectorId;
+}
+
+void Metrics::removeCollector(uint32_t collectorId)
+{
+	std::lock_guard<std::mutex> collectLock(m_collectMutex);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_collectors.erase(collectorId);
+}
+
+std::string Metrics::scrape()
+{
+	MetricsWriter writer;
+	std::vector<Collector> collectors;
+	std::lock_guard<std::mutex> collectLock(m_collectMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		std::vector<uint64_t> values(m_series.size(), 0);
+		for (auto counters : m_threads)
+		{
+			for (uint32_t index = 0; index * kChunkSize < values.size(); index++)
+			{
+				std::atomic<uint64_t> *chunk = counters->chunks[index].load(std::memory_order_acquire);
+				if (chunk == nullptr)
+				{
+					continue;
+				}
+
+				for (uint32_t n = 0; n < kChunkSize && index * kChunkSize + n < values.size(); n++)
+				{
+					values[index * kChunkSize + n] += chunk[n].load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		for (uint32_t id = 1; id < m_series.size(); id++)
+		{
+			if (m_series[id].name.empty())
+			{
+				continue;
+			}
+			writer.counter(m_series[id].name, m_series[id].help, m_series[id].labels, values[id]);
+		}
+
+		for (auto& iter : m_collectors)
+		{
+			collectors.push_back(iter.second);
+		}
+	}
+
+	// collectors take their own locks, not under ours
+	for (auto& collector : collectors)
+	{
+		collector(writer);
+	}
+
+	return writer.str();
+}
@@ -0,0 +1,124 @@
+#ifndef XOP_METRICS_H
+#define XOP_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include "Histogram.h"
+
+namespace xop
+{
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+// Samples of one scrape, grouped by metric name for the text format.
+class MetricsWriter
+{
+public:
+	void counter(const std::string& name, const std::string& help, const MetricLabels& labels, uint64_t value);
+	void gauge(const std::string& name, const std::string& help, const MetricLabels& labels, double value);
+	void histogram(const std::string& name, const std::string& help, const MetricLabels& labels, const Histogram::Snapshot& snapshot);
+
+	// Prometheus text exposition format 0.0.4
+	std::string str() const;
+
+private:
+	struct Family
+	{
+		std::string help;
+		std::string type;
+		std::vector<std::pair<std::string, std::string>> samples; // name{labels}, value
+	};
+
+	void add(const std::string& name, const std::string& help, const char *type,
+	         const MetricLabels& labels, const std::string& value);
+
+	std::map<std::string, Family> m_families;
+};
+
+// Counters are registered once (name + labels -> id) and incremented on the
+// hot path in a block owned by the calling thread: a plain load and store,
+// no lock prefix and no cache line shared with other threads. A scrape sums
+// the blocks of all threads. Gauges are read by collectors at scrape time.
+class Metrics
+{
+public:
+	using Collector = std::function<void(MetricsWriter& writer)>;
+
+	static Metrics& instance();
+
+	// same name and labels give the same id until it is released
+	uint32_t counter(const std::string& name, const std::string& help, const MetricLabels& labels = MetricLabels());
+
+	// drops the series from the scrape and reuses the id, nothing may add to it any more
+	void release(uint32_t id);
+
+	static void add(uint32_t id, uint64_t value = 1)
+	{
+		ThreadCounters *counters = s_threadCounters;
+		if (counters == nullptr)
+		{
+			counters = attachThread();
+		}
+
+		std::atomic<uint64_t> *chunk = counters->chunks[id >> kChunkBits].load(std::memory_order_relaxed);
+		if (chunk == nullptr)
+		{
+			chunk = allocChunk(counters, id >> kChunkBits);
+		}
+
+		std::atomic<uint64_t>& counter = chunk[id & (kChunkSize - 1)];
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	uint64_t get(uint32_t id);
+
+	// called on the scraping thread, once removed it is no longer running
+	uint32_t addCollector(const Collector& collector);
+	void removeCollector(uint32_t collectorId);
+
+	std::string scrape();
+
+	static const uint32_t kInvalidId = 0; // counters past the limit land here, never exported
+
+private:
+	Metrics();
+
+	static const uint32_t kChunkBits = 10;
+	static const uint32_t kChunkSize = 1 << kChunkBits;
+	static const uint32_t kMaxChunks = 64;
+
+	struct ThreadCounters
+	{
+		std::atomic<std::atomic<uint64_t>*> chunks[kMaxChunks];
+	};
+
+	struct Series
+	{
+		std::string name;
+		std::string help;
+		MetricLabels labels;
+	};
+
+	static ThreadCounters* attachThread();
+	static std::atomic<uint64_t>* allocChunk(ThreadCounters *counters, uint32_t index);
+
+	static thread_local ThreadCounters *s_threadCounters;
+
+	std::mutex m_mutex;
+	std::mutex m_collectMutex; // held while the collectors run
+	std::vector<Series> m_series;  // released ones have no name
+	std::map<std::string, uint32_t> m_seriesIds;
+	std::vector<uint32_t> m_freeIds;
+	std::vector<ThreadCounters*> m_threads; // kept after the thread exits, the counts stay valid
+	std::map<uint32_t, Collector> m_collectors;
+	uint32_t m_lastCollectorId = 0;
+};
+
+}
+
+#endif
@@ -206,10 +206,14 @@ bool SelectTaskScheduler::handleEvent(int timeout)
         }
     }	
 
+    int numEvents = 0;
+    int64_t begin = getMicroseconds();
     for(auto& iter: eventList)
     {
-        iter.first->handleEvent(iter.second);
+        this->handleChannelEvent(iter.first.get(), iter.second);
+        numEvents += 1;
     }
+    this->recordEventBatch(numEvents, getMicroseconds() - begin);
 
     return true;
 }
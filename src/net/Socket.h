@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <netinet/in.h> 
+#include <netinet/tcp.h>
 #include <netinet/ether.h>   
 #include <netinet/ip.h>  
 #include <netpacket/packet.h>   
@@ -21,6 +22,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <poll.h>
 #define SOCKET int
 #define INVALID_SOCKET  (-1)
 #define SOCKET_ERROR    (-1) 
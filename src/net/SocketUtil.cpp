@@ -72,20 +72,60 @@ void SocketUtil::setReusePort(SOCKET sockfd)
 #endif
 }
 
-void SocketUtil::setNoDelay(SOCKET sockfd)
+void SocketUtil::setNoDelay(SOCKET sockfd, bool noDelay)
 {
 #ifdef TCP_NODELAY
-    int on = 1;
+    int on = noDelay ? 1 : 0;
     int ret = setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, (char *)&on, sizeof(on));
 #endif
 }
 
+void SocketUtil::setCork(SOCKET sockfd, bool cork)
+{
+#ifdef TCP_CORK
+    int on = cork ? 1 : 0;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, (char *)&on, sizeof(on));
+#endif
+}
+
 void SocketUtil::setKeepAlive(SOCKET sockfd)
 {
     int on = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, (char *)&on, sizeof(on));
 }
 
+void SocketUtil::setBusyPoll(SOCKET sockfd, int usec)
+{
+#ifdef SO_BUSY_POLL
+    setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, (char *)&usec, sizeof(usec));
+#endif
+#ifdef SO_PREFER_BUSY_POLL
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char *)&on, sizeof(on));
+#endif
+}
+
+bool SocketUtil::setZeroCopy(SOCKET sockfd)
+{
+#ifdef SO_ZEROCOPY
+    int on = 1;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, (char *)&on, sizeof(on)) == 0;
+#else
+    return false;
+#endif
+}
+
+int SocketUtil::getError(SOCKET sockfd)
+{
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char *)&error, &len) != 0)
+    {
+        return -1;
+    }
+    return error;
+}
+
 void SocketUtil::setNoSigpipe(SOCKET sockfd)
 {
 #ifdef SO_NOSIGPIPE
@@ -161,6 +201,14 @@ bool SocketUtil::connect(SOCKET sockfd, std::string ip, uint16_t port, int timeo
 		if (timeout > 0)
 		{
 			isConnected = false;
+#if defined(__linux) || defined(__linux__)
+			// select() cannot take fds from 1024 on, a server's client sockets reach them
+			struct pollfd pfd = { sockfd, POLLOUT, 0 };
+			if (::poll(&pfd, 1, timeout) == 1 && (pfd.revents & POLLOUT))
+			{
+				isConnected = true;
+			}
+#else
 			fd_set fdWrite;
 			FD_ZERO(&fdWrite);
 			FD_SET(sockfd, &fdWrite);
@@ -170,6 +218,7 @@ bool SocketUtil::connect(SOCKET sockfd, std::string ip, uint16_t port, int timeo
 			{
 				isConnected = true;
 			}
+#endif
 			SocketUtil::setBlock(sockfd);
 		}
 		else
@@ -181,3 +230,23 @@ bool SocketUtil::connect(SOCKET sockfd, std::string ip, uint16_t port, int timeo
 	return isConnected;
 }
 
+bool SocketUtil::connectNonBlock(SOCKET sockfd, std::string ip, uint16_t port)
+{
+	SocketUtil::setNonBlock(sockfd);
+
+	struct sockaddr_in addr = { 0 };
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr(ip.c_str());
+	if (::connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR)
+	{
+#if defined(__linux) || defined(__linux__)
+		return (errno == EINPROGRESS);
+#elif defined(WIN32) || defined(_WIN32)
+		return (WSAGetLastError() == WSAEWOULDBLOCK);
+#endif
+	}
+
+	return true;
+}
+
@@ -18,8 +18,12 @@ public:
     static void setBlock(SOCKET fd, int writeTimeout=0);
     static void setReuseAddr(SOCKET fd);
     static void setReusePort(SOCKET sockfd);
-    static void setNoDelay(SOCKET sockfd);
+    static void setNoDelay(SOCKET sockfd, bool noDelay = true);
+    static void setCork(SOCKET sockfd, bool cork); // partial segments wait until uncorked
     static void setKeepAlive(SOCKET sockfd);
+    static void setBusyPoll(SOCKET sockfd, int usec); // SO_BUSY_POLL and SO_PREFER_BUSY_POLL, needs CAP_NET_ADMIN
+    static bool setZeroCopy(SOCKET sockfd); // SO_ZEROCOPY, linux 4.14
+    static int getError(SOCKET sockfd);     // SO_ERROR, cleared by the call
     static void setNoSigpipe(SOCKET sockfd);
     static void setSendBufSize(SOCKET sockfd, int size);
     static void setRecvBufSize(SOCKET sockfd, int size);
@@ -28,6 +32,7 @@ public:
     static int getPeerAddr(SOCKET sockfd, struct sockaddr_in *addr);
     static void close(SOCKET sockfd);
     static bool connect(SOCKET sockfd, std::string ip, uint16_t port, int timeout=0);
+    static bool connectNonBlock(SOCKET sockfd, std::string ip, uint16_t port); // true: connected or in progress
 };
 
 }
@@ -0,0 +1,94 @@
+#ifndef XOP_SPSC_QUEUE_H
+#define XOP_SPSC_QUEUE_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace xop
+{
+
+// Bounded lock-free queue, one producer thread and one consumer thread.
+template <typename T>
+class SpscQueue
+{
+public:
+    SpscQueue(uint32_t capacity = 1024)
+        : _head(0)
+        , _tail(0)
+    {
+        uint32_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        _buffer.resize(size);
+        _mask = size - 1;
+    }
+
+    ~SpscQueue() { }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer
+    bool push(T&& data)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) > _mask)
+        {
+            return false;
+        }
+
+        _buffer[tail & _mask] = std::move(data);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool push(const T& data)
+    {
+        T copy(data);
+        return push(std::move(copy));
+    }
+
+    // consumer
+    bool pop(T& data)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        data = std::move(_buffer[head & _mask]);
+        _buffer[head & _mask] = T();
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t size() const
+    {
+        return (uint32_t)(_tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire));
+    }
+
+    uint32_t capacity() const
+    { return _mask + 1; }
+
+    bool isEmpty() const
+    { return size() == 0; }
+
+    bool isFull() const
+    { return size() > _mask; }
+
+private:
+    std::vector<T> _buffer;
+    uint32_t _mask = 0;
+
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+};
+
+}
+
+#endif
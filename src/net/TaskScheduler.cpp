@@ -1,15 +1,37 @@
 #include "TaskScheduler.h"
+#include "TcpConnection.h"
+#include "Metrics.h"
+#include "Logger.h"
+#include <chrono>
+#include <algorithm>
 #if defined(__linux) || defined(__linux__) 
 #include <signal.h>
 #endif
 
 using namespace xop;
 
+static std::atomic<uint32_t> s_lastIndex(0);
+static const uint32_t s_triggerDropsId = Metrics::instance().counter("xop_trigger_event_drops_total", "Cross-thread events dropped because the queue was full.");
+
 TaskScheduler::TaskScheduler(int id)
 	: _id(id)
 	, _shutdown(false)
 	, _wakeupPipe(std::make_shared<Pipe>())
 	, _triggerEvents(new TriggerEventQueue(kMaxTriggetEvents))
+	, _isWriteCork(false)
+	, _isEdgeTriggered(false)
+	, _hasRemoteWrites(false)
+	, _epollCtlCalls(0)
+	, _syscalls(0)
+	, _busyPollTime(0)
+	, _spinBudget(0)
+	, _isSpinning(false)
+	, _isTimerAdded(false)
+	, _spinTime(0)
+	, _idleTime(0)
+	, _waitBegin(0)
+	, _spinHits(0)
+	, _spinMisses(0)
 {
     if (_wakeupPipe->create())
     {
@@ -17,11 +39,86 @@ TaskScheduler::TaskScheduler(int id)
         _wakeupChannel->enableReading();
         _wakeupChannel->setReadCallback([this]() { this->wake(); });		
     }        
+
+	_index = s_lastIndex++;
+	_slowHandlerTime = kSlowHandlerTime;
+	_metricsCollectorId = Metrics::instance().addCollector([this](MetricsWriter& writer) {
+		Stats stats;
+		this->getStats(stats);
+		MetricLabels labels = { { "scheduler", std::to_string(_index) } };
+		writer.histogram("xop_scheduler_handle_event_microseconds", "Time spent on the channels of one epoll batch.", labels, stats.handleEventTime);
+		writer.histogram("xop_scheduler_trigger_task_microseconds", "Run time of one trigger event.", labels, stats.triggerTaskTime);
+		writer.histogram("xop_scheduler_trigger_queue_depth", "Trigger events waiting when the queue is drained.", labels, stats.triggerQueueDepth);
+		writer.histogram("xop_scheduler_timer_lateness_microseconds", "Delay between the timeout of a timer and its callback.", labels, stats.timerLateness);
+		writer.histogram("xop_scheduler_events_per_wait", "Ready channels returned by one epoll_wait.", labels, stats.eventsPerWait);
+		writer.counter("xop_scheduler_epoll_ctl_total", "Channels added, changed or removed in the epoll set.", labels, stats.epollCtlCalls);
+		writer.counter("xop_scheduler_syscalls_total", "epoll, io_uring and wakeup pipe calls of the scheduler.", labels, stats.syscalls);
+		writer.counter("xop_scheduler_spin_microseconds_total", "Time spent busy polling before blocking.", labels, stats.spinTime);
+		writer.counter("xop_scheduler_idle_microseconds_total", "Time spent blocked waiting for events.", labels, stats.idleTime);
+		writer.counter("xop_scheduler_spin_hits_total", "Busy polls that found work within the budget.", labels, stats.spinHits);
+		writer.counter("xop_scheduler_spin_misses_total", "Busy polls that ran out of budget.", labels, stats.spinMisses);
+	});
 }
 
 TaskScheduler::~TaskScheduler()
 {
+	Metrics::instance().removeCollector(_metricsCollectorId);
+}
+
+void TaskScheduler::getStats(Stats& stats) const
+{
+	stats.handleEventTime = _handleEventTime.snapshot();
+	stats.triggerTaskTime = _triggerTaskTime.snapshot();
+	stats.triggerQueueDepth = _triggerQueueDepth.snapshot();
+	stats.timerLateness = _timerQueue.getLateness().snapshot();
+	stats.eventsPerWait = _eventsPerWait.snapshot();
+	stats.epollCtlCalls = _epollCtlCalls;
+	stats.syscalls = _syscalls;
+	stats.spinTime = _spinTime;
+	stats.idleTime = _idleTime;
+	int64_t waitBegin = _waitBegin;
+	if (waitBegin > 0)
+	{
+		stats.idleTime += std::max(getMicroseconds() - waitBegin, (int64_t)0); // a long wait counts before it ends
+	}
+	stats.spinHits = _spinHits;
+	stats.spinMisses = _spinMisses;
+}
+
+int64_t TaskScheduler::getMicroseconds()
+{
+	auto timePoint = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(timePoint.time_since_epoch()).count();
+}
+
+void TaskScheduler::handleChannelEvent(Channel *channel, int events)
+{
+	SOCKET fd = channel->fd(); // the channel may be gone after its handler
+	int64_t begin = getMicroseconds();
+	channel->handleEvent(events);
+	int64_t elapsed = getMicroseconds() - begin;
 
+	uint32_t slowHandlerTime = _slowHandlerTime;
+	if (slowHandlerTime > 0 && elapsed >= slowHandlerTime)
+	{
+		LOG_INFO("[Scheduler %u] slow handler: fd %d, events 0x%x, %lld us\n", _index, (int)fd, events, (long long)elapsed);
+	}
+}
+
+void TaskScheduler::recordEventBatch(int numEvents, int64_t usec)
+{
+	_lastBatchSize = numEvents;
+	_lastBatchTime = usec;
+	if (numEvents <= 0 && _isSpinning)
+	{
+		return; // empty polls are not waits
+	}
+
+	_eventsPerWait.record(numEvents > 0 ? numEvents : 0);
+	if (numEvents > 0)
+	{
+		_handleEventTime.record(usec > 0 ? usec : 0);
+	}
 }
 
 void TaskScheduler::start()
@@ -34,12 +131,93 @@ void TaskScheduler::start()
 	signal(SIGKILL, SIG_IGN);
 #endif     
 	_shutdown = false;
+	_threadId = std::this_thread::get_id();
 	while (!_shutdown)
 	{
 		this->handleTriggerEvent();
 		this->_timerQueue.handleTimerEvent();
+		this->flushPendingWrites(); // everything the last iteration sent
+		_isTimerAdded = false;
 		int64_t timeout = this->_timerQueue.getTimeRemaining();
-		this->handleEvent((int)timeout);
+		if (_spinBudget > 0)
+		{
+			if (this->spin(timeout))
+			{
+				continue;
+			}
+			timeout = this->_timerQueue.getTimeRemaining(); // less the time spun
+		}
+		this->wait(timeout);
+	}
+	this->flushPendingWrites();
+}
+
+bool TaskScheduler::spin(int64_t timeout)
+{
+	int64_t budget = _spinBudget;
+	if (timeout >= 0)
+	{
+		budget = std::min(budget, timeout * 1000);
+	}
+
+	_isSpinning = true;
+	int64_t begin = getMicroseconds();
+	int64_t now = begin;
+	bool isFound = false;
+	do
+	{
+		if (!_triggerEvents->isEmpty() || _isTimerAdded || _hasRemoteWrites)
+		{
+			isFound = true; // a new timer: the timeout is computed again
+			break;
+		}
+
+		_lastBatchSize = 0;
+		this->handleEvent(0);
+		now = getMicroseconds();
+		if (_lastBatchSize > 0)
+		{
+			isFound = true;
+			break;
+		}
+	} while (now - begin < budget && !_shutdown);
+
+	{
+		// a trigger event or timer added before this saw no wakeup, one added after writes it
+		std::lock_guard<std::mutex> lock(_mutex);
+		_isSpinning = false;
+		isFound = isFound || !_triggerEvents->isEmpty() || _isTimerAdded || _hasRemoteWrites;
+	}
+
+	_spinTime += now - begin;
+	if (isFound)
+	{
+		_spinHits++;
+	}
+	else
+	{
+		_spinMisses++;
+		_spinBudget = _spinBudget / 2;
+	}
+	return isFound;
+}
+
+void TaskScheduler::wait(int64_t timeout)
+{
+	_lastBatchSize = 0;
+	_lastBatchTime = 0;
+	int64_t begin = getMicroseconds();
+	_waitBegin = begin;
+	this->handleEvent((int)timeout);
+	int64_t idle = getMicroseconds() - begin - _lastBatchTime;
+	_waitBegin = 0;
+	_idleTime += (idle > 0) ? idle : 0;
+
+	// the event came soon enough for a spin to catch it
+	uint32_t busyPollTime = _busyPollTime;
+	if (busyPollTime > 0 && _lastBatchSize > 0 && idle <= (int64_t)busyPollTime)
+	{
+		_spinBudget = busyPollTime;
 	}
 }
 
@@ -53,6 +231,16 @@ void TaskScheduler::stop()
 TimerId TaskScheduler::addTimer(TimerEvent timerEvent, uint32_t msec)
 {
 	TimerId id = _timerQueue.addTimer(timerEvent, msec);
+	if (!this->isInLoopThread())
+	{
+		// the loop's timeout may have been computed without it
+		std::lock_guard<std::mutex> lock(_mutex);
+		_isTimerAdded = true;
+		if (!_isSpinning)
+		{
+			this->notify();
+		}
+	}
 	return id;
 }
 
@@ -66,31 +254,116 @@ bool TaskScheduler::addTriggerEvent(TriggerEvent callback)
 	if (_triggerEvents->size() < kMaxTriggetEvents)
 	{
 		std::lock_guard<std::mutex> lock(_mutex);
-		char event = kTriggetEvent;
 		_triggerEvents->push(std::move(callback));
-		_wakeupPipe->write(&event, 1);
+		if (!_isSpinning)
+		{
+			this->notify();
+		}
 		return true;
 	}
 
+	Metrics::add(s_triggerDropsId);
 	return false;
 }
 
+bool TaskScheduler::runInLoop(TriggerEvent callback)
+{
+	if (this->isInLoopThread())
+	{
+		callback();
+		return true;
+	}
+
+	return this->addTriggerEvent(std::move(callback));
+}
+
+void TaskScheduler::notify()
+{
+	char event = kTriggetEvent;
+	_syscalls++;
+	_wakeupPipe->write(&event, 1);
+}
+
 void TaskScheduler::wake()
 {
 	char event[10] = { 0 };
-	while (_wakeupPipe->read(event, 10) > 0);
+	do
+	{
+		_syscalls++;
+	} while (_wakeupPipe->read(event, 10) > 0);
 
 	return;
 }
 
 void TaskScheduler::handleTriggerEvent()
 {
+	_triggerQueueDepth.record(_triggerEvents->size());
+	uint32_t slowHandlerTime = _slowHandlerTime;
+
 	do
 	{
 		TriggerEvent callback;
 		if (_triggerEvents->pop(callback))
 		{
+			int64_t begin = getMicroseconds();
 			callback();
+			int64_t elapsed = getMicroseconds() - begin;
+			_triggerTaskTime.record(elapsed > 0 ? elapsed : 0);
+
+			if (slowHandlerTime > 0 && elapsed >= slowHandlerTime)
+			{
+				LOG_INFO("[Scheduler %u] slow trigger event: %lld us\n", _index, (long long)elapsed);
+			}
 		}
 	} while (_triggerEvents->size() > 0);
-}
\ No newline at end of file
+}
+
+void TaskScheduler::addPendingWrite(std::shared_ptr<TcpConnection> conn)
+{
+	_pendingWrites.push_back(std::move(conn));
+}
+
+void TaskScheduler::removePendingWrite(const std::shared_ptr<TcpConnection>& conn)
+{
+	_pendingWrites.erase(std::remove(_pendingWrites.begin(), _pendingWrites.end(), conn), _pendingWrites.end());
+}
+
+void TaskScheduler::addRemoteWrite(std::shared_ptr<TcpConnection> conn)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_remoteWrites.push_back(std::move(conn));
+	if (!_hasRemoteWrites.exchange(true) && !_isSpinning)
+	{
+		this->notify();
+	}
+}
+
+void TaskScheduler::flushPendingWrites()
+{
+	if (_hasRemoteWrites)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_takenRemoteWrites.swap(_remoteWrites);
+			_hasRemoteWrites = false;
+		}
+
+		for (auto& conn : _takenRemoteWrites)
+		{
+			conn->writeRemote();
+		}
+		_takenRemoteWrites.clear();
+	}
+
+	// close callbacks may write to other connections while flushing
+	while (!_pendingWrites.empty())
+	{
+		_flushingWrites.swap(_pendingWrites);
+		bool isCork = _isWriteCork;
+		for (auto& conn : _flushingWrites)
+		{
+			conn->flush(isCork);
+		}
+		_flushingWrites.clear();
+	}
+}
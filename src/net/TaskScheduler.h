@@ -8,10 +8,15 @@
 #include "Pipe.h"
 #include "Timer.h"
 #include "RingBuffer.h"
+#include "Histogram.h"
+#include <thread>
+#include <vector>
 
 namespace xop
 {
 
+class TcpConnection;
+
 typedef std::function<void(void)> TriggerEvent;
 
 class TaskScheduler 
@@ -26,16 +31,79 @@ public:
     void removeTimer(TimerId timerId);
     bool addTriggerEvent(TriggerEvent callback);
 
-    virtual void updateChannel(ChannelPtr channel) { };
-    virtual void removeChannel(ChannelPtr& channel) { };
-    virtual bool handleEvent(int timeout) { return false; };
+    /* calls it at once on the scheduler's own thread, queues it from others */
+    bool runInLoop(TriggerEvent callback);
+
+    virtual void updateChannel(ChannelPtr /* channel */) { };
+    virtual void removeChannel(ChannelPtr& /* channel */) { };
+    virtual bool handleEvent(int /* timeout */) { return false; };
 
     int getId() const 
     { return _id; }
 
+    struct Stats
+    {
+        Histogram::Snapshot handleEventTime;   // us spent on the channels of one epoll batch
+        Histogram::Snapshot triggerTaskTime;   // us per trigger event
+        Histogram::Snapshot triggerQueueDepth; // events waiting when the queue is drained
+        Histogram::Snapshot timerLateness;     // us between the timeout and the timer firing
+        Histogram::Snapshot eventsPerWait;
+        uint64_t epollCtlCalls = 0;
+        uint64_t syscalls = 0;      // waits, channel updates and wakeups
+        uint64_t spinTime = 0;      // us polling with a zero timeout in busy-poll mode
+        uint64_t idleTime = 0;      // us blocked in the wait
+        uint64_t spinHits = 0;      // spins that found work
+        uint64_t spinMisses = 0;    // spins that ran out of budget
+    };
+
+    void getStats(Stats& stats) const;
+
+    /* channels and trigger events running longer are logged, 0 disables */
+    void setSlowHandlerTime(uint32_t usec)
+    { _slowHandlerTime = usec; }
+
+    /* connections written on this thread are flushed once per loop iteration,
+       with cork the flush runs under TCP_CORK */
+    void addPendingWrite(std::shared_ptr<TcpConnection> conn);
+    void removePendingWrite(const std::shared_ptr<TcpConnection>& conn);
+
+    /* from other threads: conn is flushed with the pending writes of this
+       loop's next iteration, one wakeup for all connections queued meanwhile */
+    void addRemoteWrite(std::shared_ptr<TcpConnection> conn);
+    void setWriteCork(bool cork)
+    { _isWriteCork = cork; }
+
+    /* connections created afterwards are registered edge triggered, with
+       write interest kept on, where the backend supports it (epoll, io_uring) */
+    void setEdgeTriggered(bool on)
+    { _isEdgeTriggered = on; }
+    bool isEdgeTriggered() const
+    { return _isEdgeTriggered; }
+
+    /* before blocking, poll the trigger queue and the channels for up to usec,
+       0 disables. The budget halves after each spin that finds nothing and is
+       restored when a wait ends within it. Sockets of connections created
+       afterwards get SO_BUSY_POLL. */
+    void setBusyPoll(uint32_t usec)
+    { _busyPollTime = usec; _spinBudget = usec; }
+    uint32_t getBusyPoll() const
+    { return _busyPollTime; }
+
+    bool isInLoopThread() const
+    { return _threadId == std::this_thread::get_id(); }
+
+    /* monotonic clock of the stats and the frame latency */
+    static int64_t getMicroseconds();
+
 protected:
+    virtual void notify(); // wakes the loop for a trigger event, from any thread
     void wake();
     void handleTriggerEvent();
+    void handleChannelEvent(Channel *channel, int events); // timed
+    void recordEventBatch(int numEvents, int64_t usec);
+    bool spin(int64_t timeout);
+    void wait(int64_t timeout);
+    void flushPendingWrites();
 
     int _id = 0;
     std::atomic_bool _shutdown;
@@ -48,9 +116,41 @@ protected:
     std::mutex _mutex;
     TimerQueue _timerQueue;
 
+    std::thread::id _threadId;
+    std::vector<std::shared_ptr<TcpConnection>> _pendingWrites;
+    std::vector<std::shared_ptr<TcpConnection>> _flushingWrites;
+    std::vector<std::shared_ptr<TcpConnection>> _remoteWrites; // under _mutex
+    std::vector<std::shared_ptr<TcpConnection>> _takenRemoteWrites;
+    std::atomic_bool _hasRemoteWrites;
+    std::atomic_bool _isWriteCork;
+    std::atomic_bool _isEdgeTriggered;
+    std::atomic<uint64_t> _epollCtlCalls;
+    std::atomic<uint64_t> _syscalls;
+
+    std::atomic<uint32_t> _busyPollTime;
+    std::atomic<uint32_t> _spinBudget;
+    std::atomic_bool _isSpinning;  // the trigger queue is polled, no wakeup needed
+    std::atomic_bool _isTimerAdded; // by another thread since the timeout was computed
+    int _lastBatchSize = 0;        // channels of the last handleEvent()
+    int64_t _lastBatchTime = 0;    // us they took
+    std::atomic<uint64_t> _spinTime;
+    std::atomic<uint64_t> _idleTime;
+    std::atomic<int64_t> _waitBegin; // of the blocking wait in progress, 0: none
+    std::atomic<uint64_t> _spinHits;
+    std::atomic<uint64_t> _spinMisses;
+
+    uint32_t _index = 0; // unique in the process, the scheduler label
+    std::atomic<uint32_t> _slowHandlerTime;
+    Histogram _handleEventTime;
+    Histogram _triggerTaskTime;
+    Histogram _triggerQueueDepth;
+    Histogram _eventsPerWait;
+    uint32_t _metricsCollectorId = 0;
+
     static const char kTriggetEvent = 1;
     static const char kTimerEvent = 2;
     static const int kMaxTriggetEvents = 5000;
+    static const uint32_t kSlowHandlerTime = 50000; // us
 };
 
 }
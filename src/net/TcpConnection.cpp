@@ -1,27 +1,51 @@
 #include "TcpConnection.h"
 #include "SocketUtil.h"
+#include "Metrics.h"
+#include <cerrno>
 
 using namespace xop;
 
+static const uint32_t s_connectionsId = Metrics::instance().counter("xop_tcp_connections_total", "TCP connections opened.");
+static const uint32_t s_closedId = Metrics::instance().counter("xop_tcp_closed_total", "TCP connections closed.");
+static const uint32_t s_receivedBytesId = Metrics::instance().counter("xop_tcp_received_bytes_total", "Bytes read from sockets.");
+static const uint32_t s_dropsId = Metrics::instance().counter("xop_tcp_send_drops_total", "Sends dropped because the write queue was full.");
+static const uint32_t s_handoffsId = Metrics::instance().counter("xop_tcp_handoffs_total", "Connections moved to another event loop thread.");
+
 TcpConnection::TcpConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
 	: _taskScheduler(taskScheduler)
 	, _readBufferPtr(new BufferReader)
-	, _writeBufferPtr(new BufferWriter(500))
+	, _writeBufferPtr(new BufferWriter(TcpOptions().writeQueueLength))
 	, _channelPtr(new Channel(sockfd))
 {
     _isClosed = false;
+    _isRemoteWritePending = false;
 
     _channelPtr->setReadCallback([this]() { this->handleRead(); });
     _channelPtr->setWriteCallback([this]() { this->handleWrite(); });
     _channelPtr->setCloseCallback([this]() { this->handleClose(); });
     _channelPtr->setErrorCallback([this]() { this->handleError(); });
+    _writeBufferPtr->setSentCallback([this](int64_t arrivalTime, int64_t appendTime) {
+        this->onPacketSent(arrivalTime, appendTime);
+    });
 
     SocketUtil::setNonBlock(sockfd);
-    SocketUtil::setSendBufSize(sockfd, 100 * 1024);
+    SocketUtil::setSendBufSize(sockfd, TcpOptions().sendBufSize);
     SocketUtil::setKeepAlive(sockfd);
+    SocketUtil::setNoDelay(sockfd);
+    if (_taskScheduler->getBusyPoll() > 0)
+    {
+        SocketUtil::setBusyPoll(sockfd, (int)_taskScheduler->getBusyPoll());
+    }
 
     _channelPtr->enableReading();
+    if (_taskScheduler->isEdgeTriggered())
+    {
+        // write interest stays on, a full socket reports once when it drains
+        _channelPtr->enableWriting();
+        _channelPtr->setEdgeTriggered();
+    }
     _taskScheduler->updateChannel(_channelPtr);
+    Metrics::add(s_connectionsId);
 }
 
 TcpConnection::~TcpConnection()
@@ -33,65 +57,304 @@ TcpConnection::~TcpConnection()
     }
 }
 
-void TcpConnection::send(std::shared_ptr<char> data, uint32_t size)
+bool TcpConnection::send(std::shared_ptr<char> data, uint32_t size, int64_t arrivalTime)
 {
 	if (_isClosed)
-		return;
+		return false;
 
+	bool ret = false;
 	{
+		int64_t appendTime = (arrivalTime != 0) ? TaskScheduler::getMicroseconds() : 0;
 		std::lock_guard<std::mutex> lock(_mutex);
-		_writeBufferPtr->append(data, size);
+		ret = _writeBufferPtr->append(data, size, 0, arrivalTime, appendTime);
 	}
 
-    this->handleWrite();
-    return;
+	if (!ret)
+	{
+		Metrics::add(s_dropsId);
+	}
+
+    this->writeLater();
+    return ret;
+}
+
+bool TcpConnection::send(std::shared_ptr<char> header, uint32_t headerSize, std::shared_ptr<char> data, uint32_t size,
+                         int64_t arrivalTime)
+{
+	if (_isClosed)
+		return false;
+
+	bool ret = false;
+	{
+		int64_t appendTime = (arrivalTime != 0) ? TaskScheduler::getMicroseconds() : 0;
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_writeBufferPtr->hasRoom(2))
+		{
+			ret = _writeBufferPtr->append(header, headerSize)
+			   && _writeBufferPtr->append(data, size, 0, arrivalTime, appendTime);
+		}
+	}
+
+	if (!ret)
+	{
+		Metrics::add(s_dropsId);
+	}
+
+    this->writeLater();
+    return ret;
+}
+
+bool TcpConnection::send(const char *data, uint32_t size)
+{
+	if (_isClosed)
+		return false;
+
+	bool ret = false;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		ret = _writeBufferPtr->append(data, size);
+	}
+
+	if (!ret)
+	{
+		Metrics::add(s_dropsId);
+	}
+
+    this->writeLater();
+    return ret;
 }
 
-void TcpConnection::send(const char *data, uint32_t size)
+void TcpConnection::sendFile(std::shared_ptr<void> owner, int fd, uint64_t offset, uint64_t size)
 {
 	if (_isClosed)
 		return;
 
 	{
 		std::lock_guard<std::mutex> lock(_mutex);
-		_writeBufferPtr->append(data, size);
+		_writeBufferPtr->appendFile(owner, fd, offset, size);
 	}
 
-    this->handleWrite();
+    this->writeLater();
     return;
 }
 
-void TcpConnection::disconnect()
+void TcpConnection::setOptions(const TcpOptions& options)
 {
+	SOCKET sockfd = _channelPtr->fd();
+	if (options.sendBufSize > 0)
+	{
+		SocketUtil::setSendBufSize(sockfd, options.sendBufSize);
+	}
+	if (options.recvBufSize > 0)
+	{
+		SocketUtil::setRecvBufSize(sockfd, options.recvBufSize);
+	}
+	SocketUtil::setNoDelay(sockfd, options.noDelay);
+
 	std::lock_guard<std::mutex> lock(_mutex);
-	this->close();
+	_writeBufferPtr->setCapacity((int)options.writeQueueLength);
+	_writeBufferPtr->setZeroCopy(sockfd, options.zeroCopyThreshold);
+	_readBufferPtr->setMaxSize(options.maxReadBufferSize);
 }
 
-void TcpConnection::handleRead()
+void TcpConnection::moveTo(TaskScheduler *taskScheduler, const std::function<void()>& cb)
 {
+	_nextScheduler = taskScheduler;
+	_movedCB = cb;
+}
+
+// The old thread lets go of the socket: it leaves the epoll set and what was sent
+// so far is written. The new thread watches it from attach() on, the trigger event
+// orders everything done here before the reads and writes there.
+void TcpConnection::detach()
+{
+	TaskScheduler *taskScheduler = _nextScheduler;
+	std::function<void()> cb;
+	cb.swap(_movedCB);
+	_nextScheduler = nullptr;
+
 	{
 		std::lock_guard<std::mutex> lock(_mutex);
-
 		if (_isClosed)
 			return;
 
-		int ret = _readBufferPtr->readFd(_channelPtr->fd());
-		if (ret <= 0)
+		if (!_writeBufferPtr->isEmpty() && _writeBufferPtr->send(_channelPtr->fd()) < 0)
 		{
 			this->close();
 			return;
 		}
+
+		if (_isWritePending)
+		{
+			_isWritePending = false;
+			_taskScheduler->removePendingWrite(shared_from_this());
+		}
+
+		TaskScheduler *oldScheduler = _taskScheduler;
+		oldScheduler->removeChannel(_channelPtr);
+		_taskScheduler = taskScheduler;
+
+		auto conn = shared_from_this();
+		if (taskScheduler->addTriggerEvent([conn, cb] { conn->attach(cb); }))
+		{
+			return;
+		}
+
+		_taskScheduler = oldScheduler;
+		_taskScheduler->updateChannel(_channelPtr);
 	}
 
-    if (_readCB)
-    {
-        bool ret = _readCB(shared_from_this(), *_readBufferPtr);
-        if (false == ret)
-        {
+	if (cb)
+	{
+		cb();
+	}
+}
+
+void TcpConnection::attach(const std::function<void()>& cb)
+{
+	bool isEmpty = true;
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (_isClosed)
+			return;
+
+		_taskScheduler->updateChannel(_channelPtr);
+		isEmpty = _writeBufferPtr->isEmpty();
+		Metrics::add(s_handoffsId);
+	}
+
+	if (!isEmpty)
+	{
+		this->writeLater();
+	}
+
+	if (cb)
+	{
+		cb();
+	}
+}
+
+void TcpConnection::writeLater()
+{
+	if (!_taskScheduler->isInLoopThread())
+	{
+		// written by the connection's own loop, a fan-out to many players costs
+		// one wakeup per thread rather than one send() per player
+		if (!_isRemoteWritePending.exchange(true))
+		{
+			_taskScheduler->addRemoteWrite(shared_from_this());
+		}
+		return;
+	}
+
+	if (!_isWritePending)
+	{
+		_isWritePending = true;
+		_taskScheduler->addPendingWrite(shared_from_this());
+	}
+}
+
+// on the loop that took it from addRemoteWrite(), queued there unless the connection moved meanwhile
+void TcpConnection::writeRemote()
+{
+	_isRemoteWritePending = false;
+	if (!_isClosed)
+	{
+		this->writeLater();
+	}
+}
+
+void TcpConnection::flush(bool cork)
+{
+	_isWritePending = false;
+	if (_isClosed)
+		return;
+
+	if (cork)
+	{
+		SocketUtil::setCork(_channelPtr->fd(), true);
+		this->handleWrite();
+		SocketUtil::setCork(_channelPtr->fd(), false);
+	}
+	else
+	{
+		this->handleWrite();
+	}
+}
+
+// what is still queued goes out before the socket is closed, as far as it fits
+void TcpConnection::sendBeforeClose()
+{
+	if (!_isClosed && !_writeBufferPtr->isEmpty())
+	{
+		_writeBufferPtr->send(_channelPtr->fd());
+	}
+}
+
+void TcpConnection::disconnect()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	this->sendBeforeClose();
+	this->close();
+}
+
+void TcpConnection::handleRead()
+{
+	// edge triggered, the socket reports again only after it was read empty
+	bool isEdgeTriggered = _channelPtr->isEdgeTriggered();
+	int count = 0;
+	do
+	{
+		if (count++ == kMaxEdgeReads)
+		{
+			auto conn = shared_from_this();
+			TaskScheduler *taskScheduler = _taskScheduler;
+			if (taskScheduler->addTriggerEvent([conn, taskScheduler] {
+				if (conn->getTaskScheduler() == taskScheduler) // not moved meanwhile
+					conn->handleRead();
+			}))
+			{
+				return;
+			}
+		}
+
+		_readTime = TaskScheduler::getMicroseconds();
+
+		{
 			std::lock_guard<std::mutex> lock(_mutex);
-			this->close();
-        }
-    }
+
+			if (_isClosed)
+				return;
+
+			int ret = _readBufferPtr->readFd(_channelPtr->fd());
+			if (ret < 0 && isEdgeTriggered && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+			if (ret <= 0)
+			{
+				this->close();
+				return;
+			}
+			Metrics::add(s_receivedBytesId, ret);
+		}
+
+		if (_readCB)
+		{
+			auto conn = shared_from_this(); // the callback may drop every other reference
+			bool ret = _readCB(conn, *_readBufferPtr);
+			if (false == ret)
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				this->sendBeforeClose();
+				this->close();
+				return;
+			}
+			else if (_nextScheduler != nullptr)
+			{
+				this->detach(); // the new thread reads the rest
+				return;
+			}
+		}
+	} while (isEdgeTriggered);
 }
 
 void TcpConnection::handleWrite()
@@ -119,7 +382,11 @@ void TcpConnection::handleWrite()
         empty = _writeBufferPtr->isEmpty();
     } while (0);
 
-    if (empty)
+    if (_channelPtr->isEdgeTriggered())
+    {
+        // EPOLLOUT stays armed, no epoll_ctl per frame
+    }
+    else if (empty)
     {
         if (_channelPtr->isWriting())
         {
@@ -142,6 +409,7 @@ void TcpConnection::close()
 	{
 		_isClosed = true;
 		_taskScheduler->removeChannel(_channelPtr);
+		Metrics::add(s_closedId);
 
 		if (_closeCB)
 			_closeCB(shared_from_this());
@@ -160,5 +428,12 @@ void TcpConnection::handleClose()
 void TcpConnection::handleError()
 {
 	std::lock_guard<std::mutex> lock(_mutex);
+	if (_writeBufferPtr->isZeroCopyUsed())
+	{
+		// EPOLLERR also means zero-copy completions are queued
+		SOCKET fd = _channelPtr->fd();
+		if (_writeBufferPtr->handleErrorQueue(fd) && SocketUtil::getError(fd) == 0)
+			return;
+	}
 	this->close();
 }
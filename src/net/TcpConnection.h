@@ -11,6 +11,18 @@
 namespace xop
 {
 
+// Socket and buffer settings of a connection, applied by TcpServer to the
+// connections it accepts.
+struct TcpOptions
+{
+    int sendBufSize = 100 * 1024;  // SO_SNDBUF, 0 leaves the socket as it is
+    int recvBufSize = 0;           // SO_RCVBUF, 0 leaves the socket as it is
+    bool noDelay = true;
+    uint32_t writeQueueLength = 500;           // packets, further sends are dropped
+    uint32_t maxReadBufferSize = 1024 * 100000; // unparsed input before the connection is closed
+    uint32_t zeroCopyThreshold = 0;            // bytes per send for MSG_ZEROCOPY, 0: off
+};
+
 class TcpConnection : public std::enable_shared_from_this<TcpConnection>
 {
 public:
@@ -31,8 +43,21 @@ public:
     void setCloseCallback(const CloseCallback& cb)
     { _closeCB = cb; }
 
-    void send(std::shared_ptr<char> data, uint32_t size);
-    void send(const char *data, uint32_t size);
+    // false if the connection is closed or the frame was dropped because the write queue is full,
+    // arrivalTime != 0 reports the packet to onPacketSent() once its last byte is sent.
+    // On the connection's thread the data goes out when the loop iteration ends.
+    bool send(std::shared_ptr<char> data, uint32_t size, int64_t arrivalTime = 0);
+    bool send(const char *data, uint32_t size);
+    bool send(std::shared_ptr<char> header, uint32_t headerSize, std::shared_ptr<char> data, uint32_t size,
+              int64_t arrivalTime = 0); // both queued or both dropped
+    void sendFile(std::shared_ptr<void> owner, int fd, uint64_t offset, uint64_t size); // owner keeps fd open
+
+    void setOptions(const TcpOptions& options);
+
+    // From the read callback: the connection moves to another scheduler once the
+    // callback returns. cb runs on the new thread when the socket is watched there,
+    // or on this one if the new thread's queue is full.
+    void moveTo(TaskScheduler *taskScheduler, const std::function<void()>& cb);
 
 	void disconnect();
 
@@ -42,14 +67,22 @@ public:
     SOCKET fd() const
     { return _channelPtr->fd(); }
 
+    // TaskScheduler::getMicroseconds() when the last read started, before its bytes are parsed
+    int64_t getReadTime() const
+    { return _readTime; }
+
 protected:
     friend class TcpServer;
+    friend class TaskScheduler;
 
     virtual void handleRead();
     virtual void handleWrite();
     virtual void handleClose();
     virtual void handleError();
 
+    // times of a packet sent with an arrivalTime, on the connection's thread
+    virtual void onPacketSent(int64_t /* arrivalTime */, int64_t /* appendTime */) {}
+
     void setDisconnectCallback(const DisconnectCallback& cb)
     { _disconnectCB = cb; }
 
@@ -57,15 +90,28 @@ protected:
 	std::shared_ptr<xop::BufferReader> _readBufferPtr;
 	std::shared_ptr<xop::BufferWriter> _writeBufferPtr;
 	std::atomic_bool _isClosed;
+	int64_t _readTime = 0;
 
 private:
 	void close();
+	void writeLater();
+	void writeRemote();
+	void flush(bool cork);
+	void sendBeforeClose();
+	void detach();
+	void attach(const std::function<void()>& cb);
 
     std::shared_ptr<xop::Channel> _channelPtr;
     std::mutex _mutex;
     DisconnectCallback _disconnectCB ;
     CloseCallback _closeCB;
     ReadCallback _readCB;
+    bool _isWritePending = false; // queued on _taskScheduler
+    std::atomic_bool _isRemoteWritePending; // sent to from another thread, queued with addRemoteWrite()
+    TaskScheduler *_nextScheduler = nullptr; // set by moveTo()
+    std::function<void()> _movedCB;
+
+    static const int kMaxEdgeReads = 16; // per event, then the other channels go first
 };
 
 }
@@ -5,6 +5,7 @@
 #include "Acceptor.h"
 #include "EventLoop.h"
 #include "Logger.h"
+#include "SocketUtil.h"
 #include <cstdio>
 
 using namespace xop;
@@ -18,22 +19,34 @@ TcpServer::TcpServer(EventLoop* eventLoop, std::string ip, uint16_t port)
     _port = port;
 
     _acceptor->setNewConnectionCallback([this](SOCKET sockfd) {
-        TcpConnection::Ptr tcpConn = this->newConnection(sockfd);
-        if (tcpConn)
+        // built on the thread it runs on, which cannot report data before the
+        // constructors have set the callbacks
+        auto taskScheduler = _eventLoop->getTaskScheduler();
+        if (!taskScheduler->runInLoop([this, taskScheduler, sockfd] { this->createConnection(taskScheduler.get(), sockfd); }))
         {
-            this->addConnection(sockfd, tcpConn);
-            tcpConn->setDisconnectCallback([this] (TcpConnection::Ptr conn){
-                    auto taskScheduler = conn->getTaskScheduler();
-                    SOCKET sockfd = conn->fd();
-                    if (!taskScheduler->addTriggerEvent([this, sockfd] {this->removeConnection(sockfd); }))
-                    {
-                        taskScheduler->addTimer([this, sockfd]() {this->removeConnection(sockfd); return false;}, 1);
-                    }
-            });
+            SocketUtil::close(sockfd);
         }
     });
 }
 
+void TcpServer::createConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
+{
+    TcpConnection::Ptr tcpConn = this->newConnection(taskScheduler, sockfd);
+    if (tcpConn)
+    {
+        tcpConn->setOptions(this->getTcpOptions());
+        this->addConnection(sockfd, tcpConn);
+        tcpConn->setDisconnectCallback([this] (TcpConnection::Ptr conn){
+                auto taskScheduler = conn->getTaskScheduler();
+                SOCKET sockfd = conn->fd();
+                if (!taskScheduler->addTriggerEvent([this, sockfd] {this->removeConnection(sockfd); }))
+                {
+                    taskScheduler->addTimer([this, sockfd]() {this->removeConnection(sockfd); return false;}, 1);
+                }
+        });
+    }
+}
+
 TcpServer::~TcpServer()
 {
 
@@ -56,9 +69,21 @@ void TcpServer::run()
     }
 }
 
-TcpConnection::Ptr TcpServer::newConnection(SOCKET sockfd)
+void TcpServer::setTcpOptions(const TcpOptions& options)
+{
+	std::lock_guard<std::mutex> locker(_conn_mutex);
+	_tcpOptions = options;
+}
+
+TcpOptions TcpServer::getTcpOptions()
+{
+	std::lock_guard<std::mutex> locker(_conn_mutex);
+	return _tcpOptions;
+}
+
+TcpConnection::Ptr TcpServer::newConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
 {
-	return std::make_shared<TcpConnection>(_eventLoop->getTaskScheduler().get(), sockfd);
+	return std::make_shared<TcpConnection>(taskScheduler, sockfd);
 }
 
 void TcpServer::addConnection(SOCKET sockfd, TcpConnection::Ptr tcpConn)
@@ -31,8 +31,14 @@ namespace xop
             uint16_t getPort() const
             { return _port; }
 
+            /* for the connections accepted from now on */
+            void setTcpOptions(const TcpOptions& options);
+            TcpOptions getTcpOptions();
+
         protected:
-            virtual TcpConnection::Ptr newConnection(SOCKET sockfd);
+            /* on the thread of taskScheduler */
+            virtual TcpConnection::Ptr newConnection(TaskScheduler *taskScheduler, SOCKET sockfd);
+            void createConnection(TaskScheduler *taskScheduler, SOCKET sockfd);
             void addConnection(SOCKET sockfd, TcpConnection::Ptr tcpConn);
             void removeConnection(SOCKET sockfd);
 
@@ -42,6 +48,7 @@ namespace xop
             std::shared_ptr<Acceptor> _acceptor;
             std::mutex _conn_mutex;
             std::unordered_map<SOCKET, std::shared_ptr<TcpConnection>> _connections;
+            TcpOptions _tcpOptions;
     };
 
 }
@@ -0,0 +1,182 @@
+#include "ThreadUtil.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <set>
+#include <sstream>
+#if defined(__linux) || defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace xop;
+
+bool ThreadUtil::parseCpuList(const std::string& text, std::vector<int>& cpus)
+{
+	cpus.clear();
+	std::istringstream ranges(text);
+	std::string range;
+	while (std::getline(ranges, range, ','))
+	{
+		char *end = nullptr;
+		long first = strtol(range.c_str(), &end, 10);
+		long last = first;
+		if (end == range.c_str())
+		{
+			return false;
+		}
+
+		if (*end == '-')
+		{
+			const char *begin = end + 1;
+			last = strtol(begin, &end, 10);
+			if (end == begin)
+			{
+				return false;
+			}
+		}
+
+		if (*end != '\0' || first < 0 || last < first || last >= 1024)
+		{
+			return false;
+		}
+
+		for (long cpu = first; cpu <= last; cpu++)
+		{
+			cpus.push_back((int)cpu);
+		}
+	}
+
+	return !cpus.empty();
+}
+
+std::string ThreadUtil::toCpuList(const std::vector<int>& cpus)
+{
+	std::string text;
+	for (int cpu : cpus)
+	{
+		text += (text.empty() ? "" : ",") + std::to_string(cpu);
+	}
+	return text;
+}
+
+std::vector<int> ThreadUtil::getPhysicalCores()
+{
+	std::vector<int> cores;
+	std::set<std::string> seen;
+	int count = (int)std::thread::hardware_concurrency();
+	for (int cpu = 0; cpu < count; cpu++)
+	{
+		std::string siblings;
+		std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/thread_siblings_list");
+		if (file.is_open())
+		{
+			std::getline(file, siblings);
+		}
+		else
+		{
+			siblings = std::to_string(cpu); // no topology, every cpu is a core
+		}
+
+		if (seen.insert(siblings).second)
+		{
+			cores.push_back(cpu);
+		}
+	}
+	return cores;
+}
+
+int ThreadUtil::getNumaNode(int cpu)
+{
+	for (int node = 0; node < 64; node++)
+	{
+		std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		if (!file.is_open())
+		{
+			continue;
+		}
+
+		std::string text;
+		std::vector<int> cpus;
+		std::getline(file, text);
+		if (parseCpuList(text, cpus))
+		{
+			for (int n : cpus)
+			{
+				if (n == cpu)
+				{
+					return node;
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+bool ThreadUtil::placeCurrentThread(const std::vector<int>& cpus, int priority, int nice, std::string& error)
+{
+#if defined(__linux) || defined(__linux__)
+	if (!cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+		{
+			CPU_SET(cpu, &set);
+		}
+
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (ret != 0)
+		{
+			error = "affinity " + toCpuList(cpus) + ": " + strerror(ret);
+			return false;
+		}
+	}
+
+	if (priority > 0)
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = priority;
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret != 0)
+		{
+			error = "SCHED_FIFO " + std::to_string(priority) + ": " + strerror(ret);
+			return false;
+		}
+	}
+	else if (nice != 0)
+	{
+		// the nice value is per thread on linux, set through the kernel tid
+		if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), nice) != 0)
+		{
+			error = "nice " + std::to_string(nice) + ": " + strerror(errno);
+			return false;
+		}
+	}
+
+	return true;
+#else
+	error = "not supported";
+	return cpus.empty() && priority == 0 && nice == 0;
+#endif
+}
+
+bool ThreadUtil::setAffinity(std::thread& thread, const std::vector<int>& cpus)
+{
+#if defined(__linux) || defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+	{
+		CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
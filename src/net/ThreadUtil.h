@@ -0,0 +1,35 @@
+#ifndef XOP_THREAD_UTIL_H
+#define XOP_THREAD_UTIL_H
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xop
+{
+
+// Placement of threads on Linux. The calls return false elsewhere, and for
+// SCHED_FIFO or a negative nice without CAP_SYS_NICE.
+class ThreadUtil
+{
+public:
+	/* "0-3,8,10-11", false if malformed */
+	static bool parseCpuList(const std::string& text, std::vector<int>& cpus);
+	static std::string toCpuList(const std::vector<int>& cpus);
+
+	/* the first logical cpu of each physical core, hyperthread siblings left out */
+	static std::vector<int> getPhysicalCores();
+
+	/* node of the cpu, -1 if unknown */
+	static int getNumaNode(int cpu);
+
+	/* of the calling thread: cpus empty leaves the affinity, priority 1-99 is
+	   SCHED_FIFO, 0 keeps SCHED_OTHER with the nice value */
+	static bool placeCurrentThread(const std::vector<int>& cpus, int priority, int nice, std::string& error);
+
+	static bool setAffinity(std::thread& thread, const std::vector<int>& cpus);
+};
+
+}
+
+#endif
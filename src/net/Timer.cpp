@@ -63,6 +63,9 @@ void TimerQueue::handleTimerEvent()
         while(!_timers.empty() && _events.begin()->first.first<=timePoint)
         {	
             TimerId timerId = _events.begin()->first.second;
+            int64_t lateness = duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count()
+                               - _events.begin()->first.first * 1000;
+            _lateness.record(lateness > 0 ? (uint64_t)lateness : 0);
             bool flag = _events.begin()->second->eventCallback();
             if(flag == true)
             {
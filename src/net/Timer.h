@@ -13,6 +13,7 @@
 #include <memory>
 #include <mutex>
 #include <thread>
+#include "Histogram.h"
 
 namespace xop
 {
@@ -93,6 +94,9 @@ public:
     int64_t getTimeRemaining();
     void handleTimerEvent();
 
+    const Histogram& getLateness() const
+    { return _lateness; }
+
 private:
     int64_t getTimeNow();
 
@@ -101,6 +105,7 @@ private:
     std::map<std::pair<int64_t, TimerId>, std::shared_ptr<Timer>> _events;
     uint32_t _lastTimerId = 0;
     uint32_t _timeRemaining = 0;
+    Histogram _lateness; // us
 };
 
 }
@@ -0,0 +1,228 @@
+#include "WebSocket.h"
+#include <cstring>
+
+using namespace xop;
+
+static inline uint32_t rotateLeft(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+static void sha1(const uint8_t *data, size_t size, uint8_t digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	// message + 0x80 + zero padding + 64 bit length, in 64 byte blocks
+	size_t paddedSize = ((size + 8) / 64 + 1) * 64;
+	std::string message((const char *)data, size);
+	message.resize(paddedSize, 0);
+	message[size] = (char)0x80;
+	uint64_t bits = (uint64_t)size * 8;
+	for (int n = 0; n < 8; n++)
+	{
+		message[paddedSize - 1 - n] = (char)(bits >> (8 * n));
+	}
+
+	for (size_t offset = 0; offset < paddedSize; offset += 64)
+	{
+		const uint8_t *block = (const uint8_t *)message.data() + offset;
+		uint32_t w[80];
+		for (int n = 0; n < 16; n++)
+		{
+			w[n] = ((uint32_t)block[n * 4] << 24) | ((uint32_t)block[n * 4 + 1] << 16)
+				| ((uint32_t)block[n * 4 + 2] << 8) | (uint32_t)block[n * 4 + 3];
+		}
+		for (int n = 16; n < 80; n++)
+		{
+			w[n] = rotateLeft(w[n - 3] ^ w[n - 8] ^ w[n - 14] ^ w[n - 16], 1);
+		}
+
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int n = 0; n < 80; n++)
+		{
+			uint32_t f = 0, k = 0;
+			if (n < 20)
+			{
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			}
+			else if (n < 40)
+			{
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			}
+			else if (n < 60)
+			{
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			}
+			else
+			{
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+
+			uint32_t temp = rotateLeft(a, 5) + f + e + k + w[n];
+			e = d;
+			d = c;
+			c = rotateLeft(b, 30);
+			b = a;
+			a = temp;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for (int n = 0; n < 5; n++)
+	{
+		digest[n * 4] = (uint8_t)(h[n] >> 24);
+		digest[n * 4 + 1] = (uint8_t)(h[n] >> 16);
+		digest[n * 4 + 2] = (uint8_t)(h[n] >> 8);
+		digest[n * 4 + 3] = (uint8_t)h[n];
+	}
+}
+
+static std::string base64Encode(const uint8_t *data, size_t size)
+{
+	static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	out.reserve((size + 2) / 3 * 4);
+
+	for (size_t n = 0; n < size; n += 3)
+	{
+		uint32_t value = (uint32_t)data[n] << 16;
+		if (n + 1 < size) value |= (uint32_t)data[n + 1] << 8;
+		if (n + 2 < size) value |= data[n + 2];
+
+		out += table[(value >> 18) & 0x3f];
+		out += table[(value >> 12) & 0x3f];
+		out += (n + 1 < size) ? table[(value >> 6) & 0x3f] : '=';
+		out += (n + 2 < size) ? table[value & 0x3f] : '=';
+	}
+
+	return out;
+}
+
+std::string WebSocket::getAcceptKey(const std::string& key)
+{
+	std::string value = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+	uint8_t digest[20];
+	sha1((const uint8_t *)value.data(), value.size(), digest);
+	return base64Encode(digest, 20);
+}
+
+uint32_t WebSocket::getHeaderSize(uint64_t payloadSize)
+{
+	if (payloadSize <= 125)
+	{
+		return 2;
+	}
+	else if (payloadSize <= 0xffff)
+	{
+		return 4;
+	}
+
+	return 10;
+}
+
+uint32_t WebSocket::writeHeader(char *buf, uint8_t opcode, uint64_t payloadSize)
+{
+	uint32_t headerSize = getHeaderSize(payloadSize);
+	buf[0] = (char)(0x80 | (opcode & 0x0f)); // FIN
+
+	if (headerSize == 2)
+	{
+		buf[1] = (char)payloadSize;
+	}
+	else if (headerSize == 4)
+	{
+		buf[1] = 126;
+		buf[2] = (char)(payloadSize >> 8);
+		buf[3] = (char)payloadSize;
+	}
+	else
+	{
+		buf[1] = 127;
+		for (int n = 0; n < 8; n++)
+		{
+			buf[2 + n] = (char)(payloadSize >> (8 * (7 - n)));
+		}
+	}
+
+	return headerSize;
+}
+
+int WebSocket::parseHeader(const char *data, uint32_t size, Frame& frame)
+{
+	if (size < 2)
+	{
+		return 0;
+	}
+
+	const uint8_t *p = (const uint8_t *)data;
+	if (p[0] & 0x70)
+	{
+		return -1; // no extension negotiated
+	}
+
+	frame.fin = (p[0] & 0x80) != 0;
+	frame.opcode = p[0] & 0x0f;
+	frame.masked = (p[1] & 0x80) != 0;
+
+	uint32_t headerSize = 2;
+	uint64_t payloadSize = p[1] & 0x7f;
+	if (payloadSize == 126)
+	{
+		headerSize += 2;
+		if (size < headerSize)
+		{
+			return 0;
+		}
+		payloadSize = ((uint64_t)p[2] << 8) | p[3];
+	}
+	else if (payloadSize == 127)
+	{
+		headerSize += 8;
+		if (size < headerSize)
+		{
+			return 0;
+		}
+		payloadSize = 0;
+		for (int n = 0; n < 8; n++)
+		{
+			payloadSize = (payloadSize << 8) | p[2 + n];
+		}
+	}
+
+	if (frame.masked)
+	{
+		if (size < headerSize + 4)
+		{
+			return 0;
+		}
+		memcpy(frame.mask, p + headerSize, 4);
+		headerSize += 4;
+	}
+
+	// control frames are short and never fragmented
+	if ((frame.opcode & 0x08) && (payloadSize > 125 || !frame.fin))
+	{
+		return -1;
+	}
+
+	frame.headerSize = headerSize;
+	frame.payloadSize = payloadSize;
+	return 1;
+}
+
+void WebSocket::unmask(char *data, uint64_t size, const uint8_t mask[4])
+{
+	for (uint64_t n = 0; n < size; n++)
+	{
+		data[n] ^= mask[n & 3];
+	}
+}
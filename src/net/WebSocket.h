@@ -0,0 +1,50 @@
+#ifndef XOP_WEB_SOCKET_H
+#define XOP_WEB_SOCKET_H
+
+#include <cstdint>
+#include <string>
+
+namespace xop
+{
+
+// RFC 6455 helpers for the server side: handshake key and frame headers.
+class WebSocket
+{
+public:
+	enum Opcode
+	{
+		kContinuation = 0x0,
+		kText = 0x1,
+		kBinary = 0x2,
+		kClose = 0x8,
+		kPing = 0x9,
+		kPong = 0xa,
+	};
+
+	struct Frame
+	{
+		bool fin = false;
+		uint8_t opcode = 0;
+		bool masked = false;
+		uint8_t mask[4] = { 0 };
+		uint32_t headerSize = 0;
+		uint64_t payloadSize = 0;
+	};
+
+	// Sec-WebSocket-Accept for the client's Sec-WebSocket-Key
+	static std::string getAcceptKey(const std::string& key);
+
+	// server frames are never masked, returns the header size (2, 4 or 10)
+	static uint32_t getHeaderSize(uint64_t payloadSize);
+	static uint32_t writeHeader(char *buf, uint8_t opcode, uint64_t payloadSize);
+
+	// 1: header parsed, 0: need more data, -1: protocol error
+	static int parseHeader(const char *data, uint32_t size, Frame& frame);
+	static void unmask(char *data, uint64_t size, const uint8_t mask[4]);
+
+	static const uint32_t kMaxHeaderSize = 14;
+};
+
+}
+
+#endif
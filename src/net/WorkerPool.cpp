@@ -0,0 +1,145 @@
+#include "WorkerPool.h"
+#include "Logger.h"
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <thread>
+#include <chrono>
+
+using namespace xop;
+
+bool WorkerPool::s_isWorker = false;
+
+static volatile sig_atomic_t s_quit = 0;
+
+static void onQuitSignal(int)
+{
+	s_quit = 1;
+}
+
+WorkerPool::WorkerPool(uint32_t workers)
+	: m_workers(workers > 0 ? workers : 1)
+{
+
+}
+
+WorkerPool::~WorkerPool()
+{
+
+}
+
+pid_t WorkerPool::spawn(uint32_t workerId, const WorkerMain& workerMain)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		s_isWorker = true;
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		workerMain(workerId);
+		_exit(0);
+	}
+
+	if (pid < 0)
+	{
+		LOG_INFO("[Worker] fork failed, errno %d\n", errno);
+	}
+	else
+	{
+		LOG_INFO("[Worker] %u started, pid %d\n", workerId, (int)pid);
+	}
+
+	return pid;
+}
+
+int WorkerPool::run(const WorkerMain& workerMain)
+{
+	struct sigaction action = {};
+	action.sa_handler = onQuitSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	m_pids.assign(m_workers, -1);
+	for (uint32_t n = 0; n < m_workers; n++)
+	{
+		m_pids[n] = this->spawn(n, workerMain);
+	}
+
+	while (!s_quit)
+	{
+		// polled: the quit signal may be delivered to another thread of the parent
+		int status = 0;
+		pid_t pid = waitpid(-1, &status, WNOHANG);
+		if (pid == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)kWaitInterval));
+			continue;
+		}
+
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break; // no children left
+		}
+
+		for (uint32_t n = 0; n < m_workers; n++)
+		{
+			if (m_pids[n] != pid)
+			{
+				continue;
+			}
+
+			LOG_INFO("[Worker] %u (pid %d) exited, status %d\n", n, (int)pid, status);
+			m_pids[n] = -1;
+			if (m_exitCB)
+			{
+				m_exitCB(pid, n);
+			}
+
+			if (!s_quit)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)kRestartDelay));
+				m_pids[n] = this->spawn(n, workerMain);
+			}
+		}
+	}
+
+	for (auto pid : m_pids)
+	{
+		if (pid > 0)
+		{
+			kill(pid, SIGTERM);
+		}
+	}
+
+	// TaskScheduler ignores SIGTERM, workers that did not install a handler are killed
+	uint32_t waitTime = 0;
+	while (waitpid(-1, nullptr, WNOHANG) >= 0 || errno == EINTR)
+	{
+		if (waitTime >= kStopTimeout)
+		{
+			for (auto pid : m_pids)
+			{
+				if (pid > 0)
+				{
+					kill(pid, SIGKILL);
+				}
+			}
+			break;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds((uint32_t)kWaitInterval));
+		waitTime += kWaitInterval;
+	}
+
+	while (waitpid(-1, nullptr, 0) > 0 || errno == EINTR)
+	{
+
+	}
+
+	return 0;
+}
@@ -0,0 +1,51 @@
+#ifndef XOP_WORKER_POOL_H
+#define XOP_WORKER_POOL_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <sys/types.h>
+
+namespace xop
+{
+
+// Pre-forked worker processes. Every worker runs its own EventLoop and
+// servers, listeners use SO_REUSEPORT so the kernel spreads the connections.
+// The parent only supervises: a crashed worker is restarted, the others keep
+// running with their own memory.
+class WorkerPool
+{
+public:
+	using WorkerMain = std::function<void(uint32_t workerId)>;
+	using ExitCallback = std::function<void(pid_t pid, uint32_t workerId)>;
+
+	WorkerPool(uint32_t workers);
+	~WorkerPool();
+
+	// called in the parent after a worker exited, before it is restarted
+	void setExitCallback(const ExitCallback& cb)
+	{ m_exitCB = cb; }
+
+	// forks the workers and supervises them until SIGINT or SIGTERM,
+	// returns in the parent only
+	int run(const WorkerMain& workerMain);
+
+	static bool isWorker()
+	{ return s_isWorker; }
+
+private:
+	pid_t spawn(uint32_t workerId, const WorkerMain& workerMain);
+
+	uint32_t m_workers = 1;
+	std::vector<pid_t> m_pids;
+	ExitCallback m_exitCB;
+
+	static bool s_isWorker;
+	static const uint32_t kRestartDelay = 1000; // ms
+	static const uint32_t kWaitInterval = 100;  // ms
+	static const uint32_t kStopTimeout = 2000;  // ms, then SIGKILL
+};
+
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "ClusterRing.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace xop;
+
+ClusterRing::ClusterRing(const std::vector<ClusterMember>& members)
+	: m_members(members)
+{
+	m_points.reserve(m_members.size() * kVirtualNodes);
+
+	for (uint32_t index = 0; index < m_members.size(); index++)
+	{
+		for (uint32_t n = 0; n < kVirtualNodes; n++)
+		{
+			std::string point = m_members[index].name + "#" + std::to_string(n);
+			m_points.emplace_back(hash(point.data(), point.size()), index);
+		}
+	}
+
+	std::sort(m_points.begin(), m_points.end());
+}
+
+const ClusterMember* ClusterRing::getOwner(const std::string& streamPath) const
+{
+	if (m_points.empty())
+	{
+		return nullptr;
+	}
+
+	// first point clockwise from the key, wrapping around
+	uint64_t key = hash(streamPath.data(), streamPath.size());
+	auto iter = std::lower_bound(m_points.begin(), m_points.end(), std::make_pair(key, (uint32_t)0));
+	if (iter == m_points.end())
+	{
+		iter = m_points.begin();
+	}
+
+	return &m_members[iter->second];
+}
+
+bool ClusterRing::loadFile(const std::string& path, std::vector<ClusterMember>& members)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	members.clear();
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t pos = line.find('#');
+		if (pos != std::string::npos)
+		{
+			line.erase(pos);
+		}
+
+		ClusterMember member;
+		std::istringstream fields(line);
+		if (!(fields >> member.name))
+		{
+			continue; // blank line
+		}
+
+		if (!(fields >> member.rtmpUrl) || member.rtmpUrl.compare(0, 7, "rtmp://") != 0)
+		{
+			return false;
+		}
+
+		fields >> member.httpUrl;
+		members.push_back(member);
+	}
+
+	return true;
+}
+
+uint64_t ClusterRing::hash(const char *data, size_t size)
+{
+	// FNV-1a, then a 64 bit finalizer so that close names land far apart
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t n = 0; n < size; n++)
+	{
+		h ^= (uint8_t)data[n];
+		h *= 1099511628211ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
@@ -0,0 +1,49 @@
+#ifndef XOP_CLUSTER_RING_H
+#define XOP_CLUSTER_RING_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+namespace xop
+{
+
+struct ClusterMember
+{
+	std::string name;    // hashed onto the ring, keep it stable across restarts
+	std::string rtmpUrl; // rtmp://host:port
+	std::string httpUrl; // http://host:port, empty: no http-flv redirect
+};
+
+// Consistent-hash ring of the cluster members. Each member owns kVirtualNodes
+// points so adding or removing one of N members moves about 1/N of the streams.
+// Immutable once built, a new member list builds a new ring.
+class ClusterRing
+{
+public:
+	using Ptr = std::shared_ptr<ClusterRing>;
+
+	ClusterRing(const std::vector<ClusterMember>& members);
+
+	// owner of the stream path, nullptr if the ring is empty
+	const ClusterMember* getOwner(const std::string& streamPath) const;
+
+	const std::vector<ClusterMember>& getMembers() const
+	{ return m_members; }
+
+	// one member per line: name rtmp://host:port [http://host:port], '#' comments
+	static bool loadFile(const std::string& path, std::vector<ClusterMember>& members);
+
+	static uint64_t hash(const char *data, size_t size);
+
+private:
+	std::vector<ClusterMember> m_members;
+	std::vector<std::pair<uint64_t, uint32_t>> m_points; // sorted by hash
+
+	static const uint32_t kVirtualNodes = 160;
+};
+
+}
+
+#endif
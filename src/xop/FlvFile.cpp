@@ -0,0 +1,333 @@
+#include "FlvFile.h"
+#include "rtmp.h"
+#include "net/BufferReader.h"
+#include "net/Logger.h"
+#include "net/TaskScheduler.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#if defined(__linux) || defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace xop;
+
+std::mutex FlvFile::s_mutex;
+std::unordered_map<std::string, std::weak_ptr<FlvFile>> FlvFile::s_files;
+
+namespace
+{
+
+// Maps and indexes files for openAsync(), one at a time, away from the event loops.
+class FlvFileLoader
+{
+public:
+	static FlvFileLoader& instance()
+	{
+		static FlvFileLoader s_loader;
+		return s_loader;
+	}
+
+	~FlvFileLoader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_shutdown = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+
+	void add(const std::string& path, TaskScheduler *taskScheduler, const FlvFile::OpenCallback& cb)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_requests.push_back(Request{ path, taskScheduler, cb });
+		}
+		m_cond.notify_one();
+	}
+
+private:
+	struct Request
+	{
+		std::string path;
+		TaskScheduler *taskScheduler;
+		FlvFile::OpenCallback cb;
+	};
+
+	FlvFileLoader()
+	{
+		m_thread = std::thread(&FlvFileLoader::run, this);
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			Request request;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this] { return m_shutdown || !m_requests.empty(); });
+				if (m_shutdown)
+				{
+					break;
+				}
+				request = std::move(m_requests.front());
+				m_requests.pop_front();
+			}
+
+			FlvFile::Ptr file = FlvFile::open(request.path);
+			FlvFile::OpenCallback cb = std::move(request.cb);
+			TriggerEvent event = [cb, file] { cb(file); };
+			for (int n = 0; !request.taskScheduler->addTriggerEvent(event); n++)
+			{
+				if (n == kMaxRetries)
+				{
+					LOG_ERROR("open %s: the trigger queue is full.\n", request.path.c_str());
+					break;
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	bool m_shutdown = false;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Request> m_requests;
+
+	static const int kMaxRetries = 100;
+};
+
+}
+
+FlvFile::Ptr FlvFile::open(const std::string& path)
+{
+#if defined(__linux) || defined(__linux__)
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		return nullptr;
+	}
+
+	auto isCurrent = [&st](const Ptr& file) {
+		return file != nullptr && file->m_size == (uint64_t)st.st_size && file->m_mtime == (int64_t)st.st_mtime;
+	};
+
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		auto iter = s_files.find(path);
+		if (iter != s_files.end())
+		{
+			Ptr file = iter->second.lock();
+			if (isCurrent(file))
+			{
+				return file;
+			}
+		}
+	}
+
+	// mapped and indexed without the lock, opens of other files go on meanwhile
+	Ptr file(new FlvFile);
+	if (!file->load(path))
+	{
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	Ptr shared = s_files[path].lock();
+	if (isCurrent(shared))
+	{
+		return shared; // loaded by another thread in the meantime
+	}
+
+	s_files[path] = file;
+	return file;
+#else
+	return nullptr;
+#endif
+}
+
+void FlvFile::openAsync(const std::string& path, TaskScheduler *taskScheduler, const OpenCallback& cb)
+{
+	FlvFileLoader::instance().add(path, taskScheduler, cb);
+}
+
+FlvFile::~FlvFile()
+{
+#if defined(__linux) || defined(__linux__)
+	if (m_data != nullptr)
+	{
+		munmap(m_data, m_size);
+	}
+
+	if (m_fd >= 0)
+	{
+		::close(m_fd);
+	}
+#endif
+}
+
+bool FlvFile::load(const std::string& path)
+{
+#if defined(__linux) || defined(__linux__)
+	m_path = path;
+	m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0)
+	{
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size < 13)
+	{
+		return false;
+	}
+
+	// private: writes to the file after this are not seen, recordings are
+	// only renamed to .flv once complete
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (data == MAP_FAILED)
+	{
+		return false;
+	}
+
+	m_data = (char *)data;
+	m_size = st.st_size;
+	m_mtime = st.st_mtime;
+
+	if (memcmp(m_data, "FLV", 3) != 0)
+	{
+		LOG_ERROR("%s is not a flv file.\n", path.c_str());
+		return false;
+	}
+	m_firstTag = readUint32BE(m_data + 5) + 4;
+
+	// metadata and sequence headers live at the start of the file
+	uint64_t pos = m_firstTag;
+	FlvTag tag;
+	for (int n = 0; n < 10 && readTag(pos, tag); n++)
+	{
+		uint8_t *body = (uint8_t *)m_data + tag.offset;
+		if (tag.type == RTMP_NOTIFY && m_metaData.empty())
+		{
+			AmfDecoder amfDec;
+			amfDec.decode((const char *)body, tag.size);
+			m_metaData = amfDec.getObjects();
+		}
+		else if (tag.type == RTMP_VIDEO && tag.size > 1 && (body[0] & 0x0f) == RTMP_CODEC_ID_H264 && body[1] == 0)
+		{
+			m_avcSequenceHeader = tag;
+		}
+		else if (tag.type == RTMP_AUDIO && tag.size > 1 && ((body[0] >> 4) & 0x0f) == RTMP_CODEC_ID_AAC && body[1] == 0)
+		{
+			m_aacSequenceHeader = tag;
+		}
+	}
+
+	if (!FlvIndex::load(FlvIndex::getIndexPath(path), m_keyframes) || !checkIndex())
+	{
+		buildIndex();
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool FlvFile::readTag(uint64_t& pos, FlvTag& tag) const
+{
+	if (pos + 11 > m_size)
+	{
+		return false;
+	}
+
+	uint8_t *header = (uint8_t *)m_data + pos;
+	tag.type = header[0] & 0x1f;
+	tag.size = readUint24BE((char *)header + 1);
+	tag.timestamp = readUint24BE((char *)header + 4) | (header[7] << 24);
+	tag.offset = pos + 11;
+
+	if (tag.offset + tag.size > m_size)
+	{
+		return false;
+	}
+
+	pos = tag.offset + tag.size + 4;
+	return true;
+}
+
+std::shared_ptr<char> FlvFile::getData(const FlvTag& tag)
+{
+	return std::shared_ptr<char>(shared_from_this(), m_data + tag.offset);
+}
+
+std::shared_ptr<char> FlvFile::getTag(const FlvTag& tag, uint32_t& size)
+{
+	if (tag.offset < 11 || tag.offset + tag.size + 4 > m_size)
+	{
+		return nullptr;
+	}
+
+	size = 11 + tag.size + 4;
+	return std::shared_ptr<char>(shared_from_this(), m_data + tag.offset - 11);
+}
+
+uint64_t FlvFile::seek(uint32_t timestamp) const
+{
+	int index = FlvIndex::find(m_keyframes, timestamp);
+	if (index < 0)
+	{
+		return m_firstTag;
+	}
+
+	return m_keyframes[index].offset;
+}
+
+bool FlvFile::checkIndex() const
+{
+	for (auto& keyframe : m_keyframes)
+	{
+		uint64_t pos = keyframe.offset;
+		FlvTag tag;
+		if (!readTag(pos, tag) || tag.type != RTMP_VIDEO || tag.timestamp != keyframe.timestamp)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FlvFile::buildIndex()
+{
+	m_keyframes.clear();
+
+	uint64_t pos = m_firstTag;
+	FlvTag tag;
+	while (true)
+	{
+		uint64_t offset = pos;
+		if (!readTag(pos, tag))
+		{
+			break;
+		}
+
+		uint8_t *body = (uint8_t *)m_data + tag.offset;
+		if (tag.type == RTMP_VIDEO && tag.size > 1 && ((body[0] >> 4) & 0x0f) == 1
+			&& !((body[0] & 0x0f) == RTMP_CODEC_ID_H264 && body[1] == 0))
+		{
+			FlvKeyframe keyframe;
+			keyframe.timestamp = tag.timestamp;
+			keyframe.offset = offset;
+			m_keyframes.push_back(keyframe);
+		}
+	}
+}
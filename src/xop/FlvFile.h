@@ -0,0 +1,96 @@
+#ifndef XOP_FLV_FILE_H
+#define XOP_FLV_FILE_H
+
+#include <string>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "FlvIndex.h"
+#include "amf.h"
+
+namespace xop
+{
+
+class TaskScheduler;
+
+struct FlvTag
+{
+	uint8_t  type = 0;
+	uint32_t timestamp = 0;
+	uint64_t offset = 0;   // offset of the tag body
+	uint32_t size = 0;
+};
+
+// A read only flv file mapped into memory, shared by all viewers of the file.
+// Tag bodies are handed out as shared_ptr aliases of the mapping, no copy.
+class FlvFile : public std::enable_shared_from_this<FlvFile>
+{
+public:
+	using Ptr = std::shared_ptr<FlvFile>;
+	using OpenCallback = std::function<void(Ptr)>; // nullptr on failure
+
+	// blocks on the mapping and the index scan of a file not yet shared
+	static Ptr open(const std::string& path);
+
+	// opens on the loader thread, cb runs on taskScheduler
+	static void openAsync(const std::string& path, TaskScheduler *taskScheduler, const OpenCallback& cb);
+	~FlvFile();
+
+	// parse the tag at pos and move pos to the next one
+	bool readTag(uint64_t& pos, FlvTag& tag) const;
+	std::shared_ptr<char> getData(const FlvTag& tag);
+
+	// the whole tag, header, body and previous tag size, null if the file ends inside it
+	std::shared_ptr<char> getTag(const FlvTag& tag, uint32_t& size);
+
+	// offset of the last keyframe at or before timestamp (ms)
+	uint64_t seek(uint32_t timestamp) const;
+
+	uint64_t getFirstTag() const
+	{ return m_firstTag; }
+
+	uint64_t size() const
+	{ return m_size; }
+
+	int fd() const
+	{ return m_fd; }
+
+	AmfObjects getMetaData() const
+	{ return m_metaData; }
+
+	const FlvTag& getAvcSequenceHeader() const
+	{ return m_avcSequenceHeader; }
+
+	const FlvTag& getAacSequenceHeader() const
+	{ return m_aacSequenceHeader; }
+
+	const std::vector<FlvKeyframe>& getKeyframes() const
+	{ return m_keyframes; }
+
+private:
+	FlvFile() { }
+	bool load(const std::string& path);
+	bool checkIndex() const;
+	void buildIndex();
+
+	std::string m_path;
+	int m_fd = -1;
+	char *m_data = nullptr;
+	uint64_t m_size = 0;
+	uint64_t m_firstTag = 0;
+	int64_t m_mtime = 0;
+
+	AmfObjects m_metaData;
+	FlvTag m_avcSequenceHeader;
+	FlvTag m_aacSequenceHeader;
+	std::vector<FlvKeyframe> m_keyframes;
+
+	static std::mutex s_mutex;
+	static std::unordered_map<std::string, std::weak_ptr<FlvFile>> s_files;
+};
+
+}
+
+#endif
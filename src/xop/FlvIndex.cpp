@@ -0,0 +1,92 @@
+#include "FlvIndex.h"
+#include "net/BufferReader.h"
+#include "net/BufferWriter.h"
+#include <cstdio>
+#include <algorithm>
+
+using namespace xop;
+
+bool FlvIndex::save(const std::string& path, const std::vector<FlvKeyframe>& keyframes)
+{
+	std::vector<char> data(9 + keyframes.size() * 12);
+	char *p = data.data();
+
+	memcpy(p, "FLVX", 4);
+	p[4] = kVersion;
+	writeUint32BE(p + 5, (uint32_t)keyframes.size());
+	p += 9;
+
+	for (auto& keyframe : keyframes)
+	{
+		writeUint32BE(p, keyframe.timestamp);
+		writeUint32BE(p + 4, (uint32_t)(keyframe.offset >> 32));
+		writeUint32BE(p + 8, (uint32_t)(keyframe.offset & 0xffffffff));
+		p += 12;
+	}
+
+	std::string tmpPath = path + ".tmp";
+	FILE *fp = fopen(tmpPath.c_str(), "wb");
+	if (fp == NULL)
+	{
+		return false;
+	}
+
+	bool ret = (fwrite(data.data(), 1, data.size(), fp) == data.size());
+	fclose(fp);
+	if (!ret)
+	{
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	return (rename(tmpPath.c_str(), path.c_str()) == 0);
+}
+
+bool FlvIndex::load(const std::string& path, std::vector<FlvKeyframe>& keyframes)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (fp == NULL)
+	{
+		return false;
+	}
+
+	char header[9] = { 0 };
+	if (fread(header, 1, 9, fp) != 9 || memcmp(header, "FLVX", 4) != 0 || header[4] != kVersion)
+	{
+		fclose(fp);
+		return false;
+	}
+
+	uint32_t count = readUint32BE(header + 5);
+	std::vector<char> data((size_t)count * 12);
+	if (count > 0 && fread(data.data(), 1, data.size(), fp) != data.size())
+	{
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+
+	keyframes.resize(count);
+	char *p = data.data();
+	for (uint32_t n = 0; n < count; n++)
+	{
+		keyframes[n].timestamp = readUint32BE(p);
+		keyframes[n].offset = ((uint64_t)readUint32BE(p + 4) << 32) | readUint32BE(p + 8);
+		p += 12;
+	}
+
+	return true;
+}
+
+int FlvIndex::find(const std::vector<FlvKeyframe>& keyframes, uint32_t timestamp)
+{
+	auto iter = std::upper_bound(keyframes.begin(), keyframes.end(), timestamp,
+		[](uint32_t ts, const FlvKeyframe& keyframe) { return ts < keyframe.timestamp; });
+
+	if (iter == keyframes.begin())
+	{
+		return -1;
+	}
+
+	return (int)(iter - keyframes.begin()) - 1;
+}
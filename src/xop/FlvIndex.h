@@ -0,0 +1,36 @@
+#ifndef XOP_FLV_INDEX_H
+#define XOP_FLV_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace xop
+{
+
+struct FlvKeyframe
+{
+	uint32_t timestamp = 0; // ms, relative to the start of the file
+	uint64_t offset = 0;    // file offset of the video tag header
+};
+
+// Keyframe index sidecar (<file>.idx) written next to recorded flv files.
+// layout: "FLVX" | version(1) | count(4) | count * (timestamp(4) offset(8)), big endian
+class FlvIndex
+{
+public:
+	static std::string getIndexPath(const std::string& flvPath)
+	{ return flvPath + ".idx"; }
+
+	static bool save(const std::string& path, const std::vector<FlvKeyframe>& keyframes);
+	static bool load(const std::string& path, std::vector<FlvKeyframe>& keyframes);
+
+	// last keyframe at or before timestamp, -1 if none
+	static int find(const std::vector<FlvKeyframe>& keyframes, uint32_t timestamp);
+
+	static const uint8_t kVersion = 1;
+};
+
+}
+
+#endif
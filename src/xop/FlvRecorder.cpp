@@ -0,0 +1,426 @@
+#include "FlvRecorder.h"
+#include "rtmp.h"
+#include "net/BufferWriter.h"
+#include "net/Logger.h"
+#include <ctime>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+#if defined(__linux) || defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+using namespace xop;
+
+const int FlvRecordWriter::kPollInterval;
+
+FlvRecorder::FlvRecorder(std::string streamPath, const RecordOption& option)
+	: m_streamPath(streamPath)
+	, m_option(option)
+	, m_queue(option.queueSize)
+	, m_isStopped(false)
+	, m_droppedFrames(0)
+{
+
+}
+
+FlvRecorder::~FlvRecorder()
+{
+	closeFile();
+
+	if (m_buffer != nullptr)
+	{
+		free(m_buffer);
+	}
+}
+
+bool FlvRecorder::pushFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
+{
+	if (m_isStopped || size == 0)
+	{
+		return false;
+	}
+
+	Frame frame;
+	frame.type = type;
+	frame.timestamp = timestamp;
+	frame.size = size;
+	frame.data = std::move(data);
+	if (!m_queue.push(std::move(frame)))
+	{
+		m_droppedFrames++;
+		return false;
+	}
+
+	return true;
+}
+
+bool FlvRecorder::pushMetaData(AmfObjects& metaData)
+{
+	if (metaData.size() == 0)
+	{
+		return false;
+	}
+
+	AmfEncoder amfEnc;
+	amfEnc.encodeString("onMetaData", 10);
+	amfEnc.encodeECMA(metaData);
+
+	std::shared_ptr<char> data(new char[amfEnc.size()]);
+	memcpy(data.get(), amfEnc.data().get(), amfEnc.size());
+	return pushFrame(RTMP_NOTIFY, 0, data, amfEnc.size());
+}
+
+void FlvRecorder::stop()
+{
+	m_isStopped = true;
+}
+
+bool FlvRecorder::process()
+{
+	bool isStopped = m_isStopped;
+	Frame frame;
+
+	while (m_queue.pop(frame))
+	{
+		uint8_t *payload = (uint8_t *)frame.data.get();
+
+		if (frame.type == RTMP_NOTIFY)
+		{
+			m_metaData = frame;
+		}
+		else if (frame.type == RTMP_AVC_SEQUENCE_HEADER)
+		{
+			m_avcSequenceHeader = frame;
+			if (m_fd >= 0)
+			{
+				writeTag(RTMP_VIDEO, 0, frame.data.get(), frame.size);
+			}
+		}
+		else if (frame.type == RTMP_AAC_SEQUENCE_HEADER)
+		{
+			m_aacSequenceHeader = frame;
+			if (m_fd >= 0)
+			{
+				writeTag(RTMP_AUDIO, 0, frame.data.get(), frame.size);
+			}
+		}
+		else if (frame.type == RTMP_VIDEO)
+		{
+			uint8_t frameType = (payload[0] >> 4) & 0x0f;
+			bool isKeyFrame = (frameType == 1);
+
+			if (isKeyFrame && m_fd >= 0)
+			{
+				uint64_t duration = frame.timestamp - m_baseTimestamp;
+				if ((m_option.maxDuration > 0 && duration >= (uint64_t)m_option.maxDuration * 1000)
+					|| (m_option.maxFileSize > 0 && m_fileSize >= m_option.maxFileSize))
+				{
+					closeFile();
+				}
+			}
+
+			if (m_fd < 0)
+			{
+				if (!isKeyFrame || !openFile(frame.timestamp))
+				{
+					continue;
+				}
+			}
+
+			uint32_t timestamp = (uint32_t)(frame.timestamp - m_baseTimestamp);
+			if (isKeyFrame)
+			{
+				FlvKeyframe keyframe;
+				keyframe.timestamp = timestamp;
+				keyframe.offset = m_fileSize;
+				m_keyframes.push_back(keyframe);
+			}
+			writeTag(RTMP_VIDEO, timestamp, frame.data.get(), frame.size);
+		}
+		else if (frame.type == RTMP_AUDIO)
+		{
+			if (m_fd < 0)
+			{
+				// audio only stream
+				if (m_avcSequenceHeader.size > 0 || !openFile(frame.timestamp))
+				{
+					continue;
+				}
+			}
+
+			if (frame.timestamp >= m_baseTimestamp)
+			{
+				writeTag(RTMP_AUDIO, (uint32_t)(frame.timestamp - m_baseTimestamp), frame.data.get(), frame.size);
+			}
+		}
+	}
+
+	if (isStopped)
+	{
+		closeFile();
+		return false;
+	}
+
+	if (m_fd >= 0 && m_bufferSize >= kBufferCapacity / 4)
+	{
+		flush(false);
+	}
+
+	return true;
+}
+
+bool FlvRecorder::openFile(uint64_t timestamp)
+{
+#if defined(__linux) || defined(__linux__)
+	if (m_buffer == nullptr)
+	{
+		void *buffer = nullptr;
+		if (posix_memalign(&buffer, kBlockSize, kBufferCapacity) != 0)
+		{
+			return false;
+		}
+		m_buffer = (char *)buffer;
+	}
+
+	std::string name = m_streamPath;
+	std::replace(name.begin(), name.end(), '/', '_');
+	if (name.size() > 0 && name[0] == '_')
+	{
+		name.erase(0, 1);
+	}
+
+	char date[32] = { 0 };
+	time_t tt = time(NULL);
+	struct tm tm;
+	localtime_r(&tt, &tm);
+	strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+
+	// never over an existing recording, a rotation or republish within the same second gets a suffix.
+	// Written as .part and renamed when closed, vod never maps a file that is still growing.
+	std::string filePath = m_option.path + "/" + name + "-" + date;
+	for (int n = 0; n < kMaxFileSuffix; n++)
+	{
+		m_filePath = filePath + ((n > 0) ? "-" + std::to_string(n) : "") + ".flv";
+		if (::access(m_filePath.c_str(), F_OK) == 0)
+		{
+			continue;
+		}
+
+		m_fd = ::open((m_filePath + ".part").c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (m_fd >= 0 || errno != EEXIST)
+		{
+			break;
+		}
+	}
+
+	if (m_fd < 0)
+	{
+		LOG_ERROR("open %s.part failed, errno: %d\n", m_filePath.c_str(), errno);
+		return false;
+	}
+
+	m_fileSize = 0;
+	m_bufferSize = 0;
+	m_baseTimestamp = timestamp;
+	m_keyframes.clear();
+
+	char flvHeader[13] = { 0x46, 0x4c, 0x56, 0x01, 0x00, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00 };
+	if (m_avcSequenceHeader.size > 0)
+	{
+		flvHeader[4] |= 0x1;
+	}
+	if (m_aacSequenceHeader.size > 0)
+	{
+		flvHeader[4] |= 0x4;
+	}
+	write(flvHeader, 13);
+
+	if (m_metaData.size > 0)
+	{
+		writeTag(RTMP_NOTIFY, 0, m_metaData.data.get(), m_metaData.size);
+	}
+	if (m_avcSequenceHeader.size > 0)
+	{
+		writeTag(RTMP_VIDEO, 0, m_avcSequenceHeader.data.get(), m_avcSequenceHeader.size);
+	}
+	if (m_aacSequenceHeader.size > 0)
+	{
+		writeTag(RTMP_AUDIO, 0, m_aacSequenceHeader.data.get(), m_aacSequenceHeader.size);
+	}
+
+	LOG_INFO("[Record] %s -> %s\n", m_streamPath.c_str(), m_filePath.c_str());
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FlvRecorder::closeFile()
+{
+#if defined(__linux) || defined(__linux__)
+	if (m_fd < 0)
+	{
+		return;
+	}
+
+	flush(true);
+	::close(m_fd);
+	m_fd = -1;
+
+	// the index first, the file shows up with it
+	if (!FlvIndex::save(FlvIndex::getIndexPath(m_filePath), m_keyframes))
+	{
+		LOG_ERROR("save index of %s failed.\n", m_filePath.c_str());
+	}
+	m_keyframes.clear();
+
+	if (::rename((m_filePath + ".part").c_str(), m_filePath.c_str()) != 0)
+	{
+		LOG_ERROR("rename %s.part failed, errno: %d\n", m_filePath.c_str(), errno);
+	}
+#endif
+}
+
+void FlvRecorder::writeTag(uint8_t type, uint32_t timestamp, const char *data, uint32_t size)
+{
+	char tagHeader[11] = { 0 };
+	char previousTagSize[4] = { 0 };
+
+	tagHeader[0] = type;
+	writeUint24BE(tagHeader + 1, size);
+	tagHeader[4] = (timestamp >> 16) & 0xff;
+	tagHeader[5] = (timestamp >> 8) & 0xff;
+	tagHeader[6] = timestamp & 0xff;
+	tagHeader[7] = (timestamp >> 24) & 0xff;
+	writeUint32BE(previousTagSize, size + 11);
+
+	write(tagHeader, 11);
+	write(data, size);
+	write(previousTagSize, 4);
+}
+
+void FlvRecorder::write(const char *data, uint32_t size)
+{
+	m_fileSize += size;
+
+	while (size > 0)
+	{
+		uint32_t len = std::min(size, kBufferCapacity - m_bufferSize);
+		memcpy(m_buffer + m_bufferSize, data, len);
+		m_bufferSize += len;
+		data += len;
+		size -= len;
+
+		if (m_bufferSize == kBufferCapacity)
+		{
+			flush(false);
+		}
+	}
+}
+
+void FlvRecorder::flush(bool all)
+{
+#if defined(__linux) || defined(__linux__)
+	// keep the file offset block aligned, the tail waits for the next batch
+	uint32_t len = all ? m_bufferSize : (m_bufferSize & ~(kBlockSize - 1));
+	uint32_t pos = 0;
+
+	while (pos < len && m_fd >= 0)
+	{
+		ssize_t ret = ::write(m_fd, m_buffer + pos, len - pos);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+
+			LOG_ERROR("write %s failed, errno: %d\n", m_filePath.c_str(), errno);
+			break;
+		}
+		pos += (uint32_t)ret;
+	}
+
+	if (len < m_bufferSize)
+	{
+		memmove(m_buffer, m_buffer + len, m_bufferSize - len);
+	}
+	m_bufferSize -= len;
+#endif
+}
+
+FlvRecordWriter::FlvRecordWriter()
+	: m_shutdown(false)
+{
+	m_thread = std::thread(&FlvRecordWriter::run, this);
+}
+
+FlvRecordWriter& FlvRecordWriter::instance()
+{
+	static FlvRecordWriter s_writer;
+	return s_writer;
+}
+
+FlvRecordWriter::~FlvRecordWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_shutdown = true;
+		for (auto& recorder : m_recorders)
+		{
+			recorder->stop();
+		}
+	}
+
+	m_cond.notify_all();
+	m_thread.join();
+}
+
+void FlvRecordWriter::addRecorder(FlvRecorder::Ptr recorder)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_recorders.push_back(recorder);
+}
+
+void FlvRecordWriter::run()
+{
+	std::vector<FlvRecorder::Ptr> recorders;
+	std::vector<FlvRecorder::Ptr> finished;
+
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			if (m_shutdown && m_recorders.empty())
+			{
+				break;
+			}
+
+			if (!finished.empty())
+			{
+				for (auto& recorder : finished)
+				{
+					m_recorders.erase(std::remove(m_recorders.begin(), m_recorders.end(), recorder), m_recorders.end());
+				}
+				finished.clear();
+			}
+
+			m_cond.wait_for(lock, std::chrono::milliseconds(kPollInterval));
+			recorders = m_recorders;
+		}
+
+		// disk i/o happens outside the lock, addRecorder() never waits for it
+		for (auto& recorder : recorders)
+		{
+			if (!recorder->process())
+			{
+				finished.push_back(recorder);
+			}
+		}
+		recorders.clear();
+	}
+}
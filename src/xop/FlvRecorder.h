@@ -0,0 +1,115 @@
+#ifndef XOP_FLV_RECORDER_H
+#define XOP_FLV_RECORDER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "net/SpscQueue.h"
+#include "FlvIndex.h"
+#include "amf.h"
+
+namespace xop
+{
+
+struct RecordOption
+{
+	std::string path = ".";      // output directory
+	uint32_t maxDuration = 0;    // seconds per file, 0: no limit
+	uint64_t maxFileSize = 0;    // bytes per file, 0: no limit
+	uint32_t queueSize = 2048;   // frames buffered between ingest and writer
+};
+
+// Attached to a RtmpSession, records the live stream to flv files.
+// pushFrame() is called on the ingest thread and never touches the disk,
+// frames are handed to the FlvRecordWriter thread by reference.
+class FlvRecorder
+{
+public:
+	using Ptr = std::shared_ptr<FlvRecorder>;
+
+	FlvRecorder(std::string streamPath, const RecordOption& option);
+	~FlvRecorder();
+
+	bool pushFrame(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
+	bool pushMetaData(AmfObjects& metaData);
+	void stop();
+
+	uint64_t getDroppedFrames() const
+	{ return m_droppedFrames; }
+
+	std::string getStreamPath() const
+	{ return m_streamPath; }
+
+private:
+	friend class FlvRecordWriter;
+
+	struct Frame
+	{
+		uint8_t  type = 0;
+		uint64_t timestamp = 0;
+		uint32_t size = 0;
+		std::shared_ptr<char> data;
+	};
+
+	// writer thread
+	bool process();
+	bool openFile(uint64_t timestamp);
+	void closeFile();
+	void writeTag(uint8_t type, uint32_t timestamp, const char *data, uint32_t size);
+	void write(const char *data, uint32_t size);
+	void flush(bool all);
+
+	std::string m_streamPath;
+	RecordOption m_option;
+	SpscQueue<Frame> m_queue;
+	std::atomic_bool m_isStopped;
+	std::atomic<uint64_t> m_droppedFrames;
+
+	int m_fd = -1;
+	std::string m_filePath;
+	uint64_t m_fileSize = 0;
+	uint64_t m_baseTimestamp = 0;
+	std::vector<FlvKeyframe> m_keyframes;
+	Frame m_metaData;
+	Frame m_avcSequenceHeader;
+	Frame m_aacSequenceHeader;
+
+	char *m_buffer = nullptr;
+	uint32_t m_bufferSize = 0;
+
+	static const uint32_t kBlockSize = 4096;
+	static const uint32_t kBufferCapacity = 1024 * 1024;
+	static const int kMaxFileSuffix = 1000;
+};
+
+// The dedicated disk I/O thread shared by all recorders.
+class FlvRecordWriter
+{
+public:
+	FlvRecordWriter &operator=(const FlvRecordWriter &) = delete;
+	FlvRecordWriter(const FlvRecordWriter &) = delete;
+	static FlvRecordWriter& instance();
+	~FlvRecordWriter();
+
+	void addRecorder(FlvRecorder::Ptr recorder);
+
+private:
+	FlvRecordWriter();
+	void run();
+
+	std::atomic<bool> m_shutdown;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::vector<FlvRecorder::Ptr> m_recorders;
+
+	static const int kPollInterval = 20; // ms
+};
+
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "FlvTagPacket.h"
+#include "net/BufferWriter.h"
+#include "net/WebSocket.h"
+#include "rtmp.h"
+#include <cstring>
+
+using namespace xop;
+
+FlvTagPacket::Ptr FlvTagPacket::create(uint8_t type, uint64_t timestamp, const char *payload, uint32_t payloadSize)
+{
+	Ptr packet = std::make_shared<FlvTagPacket>();
+	packet->m_type = type;
+	packet->m_tagSize = 11 + payloadSize + 4;
+	std::shared_ptr<char> buffer(new char[kHeaderRoom + packet->m_tagSize], std::default_delete<char[]>());
+
+	if (type == RTMP_VIDEO && payloadSize > 0)
+	{
+		uint8_t frameType = ((uint8_t)payload[0] >> 4) & 0x0f;
+		uint8_t codecId = (uint8_t)payload[0] & 0x0f;
+		packet->m_isKeyFrame = (frameType == 1 && codecId == RTMP_CODEC_ID_H264);
+	}
+
+	char *tag = buffer.get() + kHeaderRoom;
+	tag[0] = type;
+	writeUint24BE(tag + 1, payloadSize);
+	tag[4] = (timestamp >> 16) & 0xff;
+	tag[5] = (timestamp >> 8) & 0xff;
+	tag[6] = timestamp & 0xff;
+	tag[7] = (timestamp >> 24) & 0xff;
+	tag[8] = tag[9] = tag[10] = 0;
+	memcpy(tag + 11, payload, payloadSize);
+	writeUint32BE(tag + 11 + payloadSize, payloadSize + 11);
+
+	packet->m_wsHeaderSize = WebSocket::getHeaderSize(packet->m_tagSize);
+	WebSocket::writeHeader(tag - packet->m_wsHeaderSize, WebSocket::kBinary, packet->m_tagSize);
+	packet->m_tag = std::shared_ptr<char>(buffer, tag);
+	packet->m_wsHeader = std::shared_ptr<char>(buffer, tag - packet->m_wsHeaderSize);
+
+	return packet;
+}
+
+FlvTagPacket::Ptr FlvTagPacket::wrap(uint8_t type, std::shared_ptr<char> tag, uint32_t tagSize)
+{
+	Ptr packet = std::make_shared<FlvTagPacket>();
+	packet->m_type = type;
+	packet->m_tag = tag;
+	packet->m_tagSize = tagSize;
+	packet->m_isContiguous = false;
+
+	if (type == RTMP_VIDEO && tagSize > 11 + 4)
+	{
+		uint8_t flags = (uint8_t)tag.get()[11];
+		packet->m_isKeyFrame = (((flags >> 4) & 0x0f) == 1 && (flags & 0x0f) == RTMP_CODEC_ID_H264);
+	}
+
+	packet->m_wsHeader.reset(new char[kHeaderRoom], std::default_delete<char[]>());
+	packet->m_wsHeaderSize = WebSocket::writeHeader(packet->m_wsHeader.get(), WebSocket::kBinary, tagSize);
+
+	return packet;
+}
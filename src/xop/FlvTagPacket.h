@@ -0,0 +1,62 @@
+#ifndef XOP_FLV_TAG_PACKET_H
+#define XOP_FLV_TAG_PACKET_H
+
+#include <cstdint>
+#include <memory>
+
+namespace xop
+{
+
+// One flv tag (header, body, previous tag size) framed once per frame and
+// shared by every http viewer of a session. The buffer keeps room in front
+// of the tag for the websocket frame header, server frames are unmasked so
+// websocket viewers share the very same bytes.
+class FlvTagPacket
+{
+public:
+	using Ptr = std::shared_ptr<FlvTagPacket>;
+
+	// type: RTMP_VIDEO or RTMP_AUDIO, the flv tag types
+	static Ptr create(uint8_t type, uint64_t timestamp, const char *payload, uint32_t payloadSize);
+
+	// a tag already framed in memory (a mapped file), referenced without a copy,
+	// the websocket header goes out on its own
+	static Ptr wrap(uint8_t type, std::shared_ptr<char> tag, uint32_t tagSize);
+
+	uint8_t getType() const
+	{ return m_type; }
+
+	bool isKeyFrame() const
+	{ return m_isKeyFrame; }
+
+	std::shared_ptr<char> getTag() const
+	{ return m_tag; }
+
+	uint32_t getTagSize() const
+	{ return m_tagSize; }
+
+	std::shared_ptr<char> getWebSocketHeader() const
+	{ return m_wsHeader; }
+
+	uint32_t getWebSocketHeaderSize() const
+	{ return m_wsHeaderSize; }
+
+	// the websocket header is right in front of the tag, one frame from getWebSocketHeader()
+	bool isContiguous() const
+	{ return m_isContiguous; }
+
+private:
+	static const uint32_t kHeaderRoom = 10; // largest server websocket header
+
+	std::shared_ptr<char> m_tag;
+	uint32_t m_tagSize = 0;
+	std::shared_ptr<char> m_wsHeader;
+	uint32_t m_wsHeaderSize = 0;
+	bool m_isContiguous = true;
+	uint8_t m_type = 0;
+	bool m_isKeyFrame = false;
+};
+
+}
+
+#endif
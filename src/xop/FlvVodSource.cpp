@@ -0,0 +1,116 @@
+#include "FlvVodSource.h"
+#include "rtmp.h"
+
+using namespace xop;
+
+FlvVodSource::FlvVodSource(FlvFile::Ptr file)
+	: m_file(file)
+	, m_isStopped(false)
+{
+
+}
+
+FlvVodSource::~FlvVodSource()
+{
+
+}
+
+bool FlvVodSource::start(TaskScheduler *taskScheduler, uint32_t startTime)
+{
+	if (!m_frameCB)
+	{
+		return false;
+	}
+
+	auto& avcSequenceHeader = m_file->getAvcSequenceHeader();
+	if (avcSequenceHeader.size > 0)
+	{
+		m_frameCB(RTMP_AVC_SEQUENCE_HEADER, 0, m_file->getData(avcSequenceHeader), avcSequenceHeader.size, avcSequenceHeader);
+	}
+
+	auto& aacSequenceHeader = m_file->getAacSequenceHeader();
+	if (aacSequenceHeader.size > 0)
+	{
+		m_frameCB(RTMP_AAC_SEQUENCE_HEADER, 0, m_file->getData(aacSequenceHeader), aacSequenceHeader.size, aacSequenceHeader);
+	}
+
+	m_pos = m_file->seek(startTime);
+
+	FlvTag tag;
+	uint64_t pos = m_pos;
+	m_baseTimestamp = m_file->readTag(pos, tag) ? tag.timestamp : 0;
+	m_clock.reset();
+
+	std::weak_ptr<FlvVodSource> source = shared_from_this();
+	taskScheduler->addTimer([source] {
+		auto sourcePtr = source.lock();
+		if (sourcePtr == nullptr)
+		{
+			return false;
+		}
+		return sourcePtr->onTimer();
+	}, kInterval);
+
+	return true;
+}
+
+void FlvVodSource::stop()
+{
+	m_isStopped = true;
+}
+
+bool FlvVodSource::onTimer()
+{
+	if (m_isStopped)
+	{
+		return false;
+	}
+
+	uint64_t playTime = m_baseTimestamp + m_clock.elapsed() + kPreload;
+	FlvTag tag;
+
+	while (true)
+	{
+		uint64_t pos = m_pos;
+		if (!m_file->readTag(pos, tag))
+		{
+			m_isStopped = true;
+			if (m_endCB)
+			{
+				m_endCB();
+			}
+			return false; // end of file
+		}
+
+		if (tag.timestamp > playTime)
+		{
+			break;
+		}
+
+		m_pos = pos;
+		if (tag.size < 2 || (tag.type != RTMP_VIDEO && tag.type != RTMP_AUDIO))
+		{
+			continue;
+		}
+
+		uint8_t type = tag.type;
+		auto data = m_file->getData(tag);
+		uint8_t *body = (uint8_t *)data.get();
+		if (type == RTMP_VIDEO && (body[0] & 0x0f) == RTMP_CODEC_ID_H264 && body[1] == 0)
+		{
+			type = RTMP_AVC_SEQUENCE_HEADER;
+		}
+		else if (type == RTMP_AUDIO && ((body[0] >> 4) & 0x0f) == RTMP_CODEC_ID_AAC && body[1] == 0)
+		{
+			type = RTMP_AAC_SEQUENCE_HEADER;
+		}
+
+		if (!m_frameCB(type, tag.timestamp, data, tag.size, tag))
+		{
+			m_isStopped = true;
+			return false;
+		}
+	}
+
+	return true;
+}
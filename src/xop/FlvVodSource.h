@@ -0,0 +1,57 @@
+#ifndef XOP_FLV_VOD_SOURCE_H
+#define XOP_FLV_VOD_SOURCE_H
+
+#include <atomic>
+#include <functional>
+#include "FlvFile.h"
+#include "net/TaskScheduler.h"
+#include "net/Timestamp.h"
+
+namespace xop
+{
+
+// Plays a FlvFile to one viewer, paced by the tag timestamps.
+// Runs on the viewer's TaskScheduler, the payloads reference the shared mapping.
+class FlvVodSource : public std::enable_shared_from_this<FlvVodSource>
+{
+public:
+	using Ptr = std::shared_ptr<FlvVodSource>;
+	// data is the tag body, tag its place in the file
+	using FrameCallback = std::function<bool(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size,
+	                                         const FlvTag& tag)>;
+	using EndCallback = std::function<void()>;
+
+	FlvVodSource(FlvFile::Ptr file);
+	~FlvVodSource();
+
+	void setFrameCallback(const FrameCallback& cb)
+	{ m_frameCB = cb; }
+
+	// after the last tag went out
+	void setEndCallback(const EndCallback& cb)
+	{ m_endCB = cb; }
+
+	bool start(TaskScheduler *taskScheduler, uint32_t startTime = 0); // startTime: ms
+	void stop();
+
+	FlvFile::Ptr getFile() const
+	{ return m_file; }
+
+private:
+	bool onTimer();
+
+	FlvFile::Ptr m_file;
+	FrameCallback m_frameCB;
+	EndCallback m_endCB;
+	std::atomic_bool m_isStopped;
+	xop::Timestamp m_clock;
+	uint64_t m_pos = 0;
+	uint32_t m_baseTimestamp = 0;
+
+	static const uint32_t kInterval = 20;   // ms
+	static const uint32_t kPreload = 1000;  // ms sent ahead of real time
+};
+
+}
+
+#endif
@@ -1,8 +1,179 @@
 ﻿#include "H264Parser.h"
 #include <cstring>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define XOP_X86_SIMD 1
+#endif
 
 using namespace xop;
 
+// A start code at q needs q[0] == 0, q[1] == 0 and q[2] == 1: a byte > 1
+// at p[2] rules out q = p, p+1 and p+2, a 1 rules out p+1 and p+2.
+static const uint8_t* findStartCodeScalar(const uint8_t *data, const uint8_t *end)
+{
+    const uint8_t *p = data;
+    while (p + 3 <= end)
+    {
+        if (p[2] > 1)
+        {
+            p += 3;
+        }
+        else if (p[2] == 0)
+        {
+            p += 1;
+        }
+        else if (p[0] == 0 && p[1] == 0)
+        {
+            return p;
+        }
+        else
+        {
+            p += 3;
+        }
+    }
+
+    return end;
+}
+
+#ifdef XOP_X86_SIMD
+// 16 candidates per step: bytes p..p+15 == 0, p+1..p+16 == 0 and p+2..p+17 == 1
+static const uint8_t* findStartCodeSse2(const uint8_t *data, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const uint8_t *p = data;
+
+    while (end - p >= 18)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+                                      _mm_cmpeq_epi8(b2, one));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(match);
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+
+    return findStartCodeScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t* findStartCodeAvx2(const uint8_t *data, const uint8_t *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const uint8_t *p = data;
+
+    while (end - p >= 34)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+                                         _mm256_cmpeq_epi8(b2, one));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+
+    return findStartCodeSse2(p, end);
+}
+#endif
+
+typedef const uint8_t* (*StartCodeFinder)(const uint8_t *data, const uint8_t *end);
+
+static H264Parser::Scanner selectScanner()
+{
+#ifdef XOP_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return H264Parser::SCANNER_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return H264Parser::SCANNER_SSE2;
+    }
+#endif
+    return H264Parser::SCANNER_SCALAR;
+}
+
+static StartCodeFinder getFinder(H264Parser::Scanner scanner)
+{
+#ifdef XOP_X86_SIMD
+    if (scanner == H264Parser::SCANNER_AVX2)
+    {
+        return findStartCodeAvx2;
+    }
+    if (scanner == H264Parser::SCANNER_SSE2)
+    {
+        return findStartCodeSse2;
+    }
+#endif
+    return findStartCodeScalar;
+}
+
+static const H264Parser::Scanner s_scanner = selectScanner();
+static const StartCodeFinder s_finder = getFinder(s_scanner);
+
+H264Parser::Scanner H264Parser::getScanner()
+{
+    return s_scanner;
+}
+
+bool H264Parser::isSupported(Scanner scanner)
+{
+    return scanner <= s_scanner;
+}
+
+const char* H264Parser::getScannerName(Scanner scanner)
+{
+    switch (scanner)
+    {
+    case SCANNER_AVX2:
+        return "avx2";
+    case SCANNER_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+const uint8_t* H264Parser::findStartCode(const uint8_t *data, const uint8_t *end)
+{
+    // called before the static initialization of this file is done
+    StartCodeFinder finder = (s_finder != nullptr) ? s_finder : getFinder(selectScanner());
+    return finder(data, end);
+}
+
+const uint8_t* H264Parser::findStartCode(const uint8_t *data, const uint8_t *end, Scanner scanner)
+{
+    if (!isSupported(scanner))
+    {
+        return findStartCode(data, end);
+    }
+
+    return getFinder(scanner)(data, end);
+}
+
+uint32_t H264Parser::findNals(const uint8_t *data, uint32_t size, std::vector<NalUnit>& nals)
+{
+    nals.clear();
+    for (const NalUnit& nal : NalUnits(data, size))
+    {
+        nals.push_back(nal);
+    }
+
+    return (uint32_t)nals.size();
+}
+
 Nal H264Parser::findNal(const uint8_t *data, uint32_t size)
 {
     Nal nal(nullptr, nullptr);
@@ -12,61 +183,58 @@ Nal H264Parser::findNal(const uint8_t *data, uint32_t size)
         return nal;
     }
 
-    nal.second = const_cast<uint8_t*>(data) + (size-1);
+    const uint8_t *end = data + size;
+    const uint8_t *start = findStartCode(data, end);
+    if (end - start <= 3)
+    {
+        return nal;
+    }
 
-    //uint32_t startCode = 0;
-    uint32_t pos = 0;
-    uint8_t prefix[3] = {0};
-    memcpy(prefix, data, 3);
-    size -= 3;
-    data += 2;
+    nal.first = const_cast<uint8_t*>(start) + 3;
 
-    while(size--)
+    const uint8_t *next = findStartCode(nal.first, end);
+    if (next != end && next > nal.first && next[-1] == 0) // 00 00 00 01
     {
-        if ((prefix[pos % 3] == 0) && (prefix[(pos + 1) % 3] == 0) && (prefix[(pos + 2) % 3] == 1))
+        next -= 1;
+    }
+    nal.second = const_cast<uint8_t*>(next) - 1; // last byte
+
+    return nal;
+}
+
+NalUnits::Iterator::Iterator(const uint8_t *next, const uint8_t *end)
+    : _next(next)
+    , _end(end)
+{
+    ++(*this);
+}
+
+NalUnits::Iterator& NalUnits::Iterator::operator++()
+{
+    // empty units between adjacent start codes are skipped
+    do
+    {
+        if (_end - _next <= 3)
         {
-            if(nal.first == nullptr) // 00 00 01 
-            {
-                nal.first = const_cast<uint8_t*>(data) + 1;
-                //startCode = 3;
-            }
-            else if(data  > nal.first + 3)
-            {
-                nal.second = const_cast<uint8_t*>(data) - 3;
-                break;
-            }               
+            _nal.data = _end;
+            _nal.size = 0;
+            _next = _end;
+            return *this;
         }
-        else if ((prefix[pos % 3] == 0) && (prefix[(pos + 1) % 3] == 0) && (prefix[(pos + 2) % 3] == 0))
+
+        const uint8_t *begin = _next + 3;
+        _next = H264Parser::findStartCode(begin, _end);
+
+        const uint8_t *last = _next;
+        while (last > begin && last[-1] == 0) // trailing_zero_8bits and the 4 byte start code
         {
-            if (*(data+1) == 0x01) // 00 00 00 01 
-            {              
-                if(nal.first == nullptr)
-                {
-                    if(size >= 1)
-                    {
-                        nal.first = const_cast<uint8_t*>(data) + 2;
-                    }                       
-                    else
-                    {
-                        break;  
-                    }                  
-                    //startCode = 4;
-                }
-                else //if(startCode == 4)
-                {
-                    nal.second = const_cast<uint8_t*>(data) - 3;
-                    break;
-                }                    
-            }
+            last--;
         }
 
-        prefix[(pos++) % 3] = *(++data);
-    }
-        
-    if(nal.first == nullptr)
-        nal.second = nullptr;
+        _nal.data = begin;
+        _nal.size = (uint32_t)(last - begin);
+    } while (_nal.size == 0);
 
-    return nal;
+    return *this;
 }
 
-
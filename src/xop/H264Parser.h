@@ -1,24 +1,95 @@
 ﻿#ifndef XOP_H264_PARSER_H
 #define XOP_H264_PARSER_H
 
-#include <cstdint> 
-#include <utility> 
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 namespace xop
 {
 
 typedef std::pair<uint8_t*, uint8_t*> Nal; // <nal begin, nal end>
 
+// One NAL unit of an Annex-B buffer, start code and trailing zeros stripped.
+struct NalUnit
+{
+    const uint8_t *data = nullptr;
+    uint32_t size = 0;
+
+    uint8_t getType() const
+    { return data[0] & 0x1f; }
+};
+
 class H264Parser
 {
-public:    
+public:
+    enum Scanner
+    {
+        SCANNER_SCALAR,
+        SCANNER_SSE2,
+        SCANNER_AVX2,
+    };
+
     static Nal findNal(const uint8_t *data, uint32_t size);
-        
+
+    /* first 00 00 01 in [data, end), end if none, with the best scanner of the cpu */
+    static const uint8_t* findStartCode(const uint8_t *data, const uint8_t *end);
+    static const uint8_t* findStartCode(const uint8_t *data, const uint8_t *end, Scanner scanner);
+
+    /* all nal units of the buffer in one pass, bytes before the first start code are skipped */
+    static uint32_t findNals(const uint8_t *data, uint32_t size, std::vector<NalUnit>& nals);
+
+    static Scanner getScanner();
+    static bool isSupported(Scanner scanner);
+    static const char* getScannerName(Scanner scanner);
+
+private:
+
+};
+
+// The nal units of an Annex-B buffer found as they are iterated:
+//     for (const NalUnit& nal : NalUnits(data, size)) ...
+class NalUnits
+{
+public:
+    class Iterator
+    {
+    public:
+        Iterator(const uint8_t *next, const uint8_t *end);
+
+        const NalUnit& operator*() const
+        { return _nal; }
+
+        const NalUnit* operator->() const
+        { return &_nal; }
+
+        Iterator& operator++();
+
+        bool operator!=(const Iterator& other) const
+        { return _nal.data != other._nal.data; }
+
+    private:
+        NalUnit _nal;
+        const uint8_t *_next; // start code after _nal
+        const uint8_t *_end;
+    };
+
+    NalUnits(const uint8_t *data, uint32_t size)
+        : _data(data), _end(data + size)
+    { }
+
+    Iterator begin() const
+    { return Iterator(H264Parser::findStartCode(_data, _end), _end); }
+
+    Iterator end() const
+    { return Iterator(_end, _end); }
+
 private:
-  
+    const uint8_t *_data;
+    const uint8_t *_end;
 };
-    
+
 }
 
-#endif 
+#endif
 
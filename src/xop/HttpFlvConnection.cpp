@@ -1,13 +1,15 @@
 #include "HttpFlvConnection.h"
+#include "HttpFlvServer.h"
 #include "RtmpServer.h"
 #include "net/Logger.h"
+#include "net/WebSocket.h"
 
 using namespace xop;
 
-HttpFlvConnection::HttpFlvConnection(RtmpServer *rtmpServer, TaskScheduler* taskScheduler, SOCKET sockfd)
+HttpFlvConnection::HttpFlvConnection(HttpFlvServer *httpFlvServer, RtmpServer *rtmpServer, TaskScheduler* taskScheduler, SOCKET sockfd)
 	: TcpConnection(taskScheduler, sockfd)
+	, m_httpFlvServer(httpFlvServer)
 	, m_rtmpServer(rtmpServer)
-	, m_taskScheduler(taskScheduler)
 {
 	this->setReadCallback([this](std::shared_ptr<TcpConnection> conn, xop::BufferReader& buffer) {
 		return this->onRead(buffer);
@@ -25,54 +27,379 @@ HttpFlvConnection::~HttpFlvConnection()
 
 bool HttpFlvConnection::onRead(BufferReader& buffer)
 {
-	if (buffer.findLastCrlfCrlf() == nullptr)
+	// pipelined requests are answered in order, the response of a
+	// streaming request is the last one on the connection
+	if (m_isWebSocket)
 	{
-		return (buffer.readableBytes() >= 4096) ? false : true;
+		return handleWebSocket(buffer);
 	}
 
-	const char *firstCrlf = buffer.findFirstCrlf();
-	if (firstCrlf == nullptr)
+	while (buffer.readableBytes() > 0)
 	{
-		return false;
+		if (m_isStreaming || m_closeAfterWrite)
+		{
+			buffer.retrieveAll();
+			break;
+		}
+
+		if (m_isVodOpening)
+		{
+			break; // answered in order, after the file
+		}
+
+		HttpParser::Status status = m_httpParser.parse(buffer.peek(), buffer.readableBytes());
+		if (status == HttpParser::kIncomplete)
+		{
+			break;
+		}
+
+		if (status == HttpParser::kError)
+		{
+			m_keepAlive = false;
+			m_isHead = false;
+			sendError(m_httpParser.getErrorCode());
+			buffer.retrieveAll();
+			break;
+		}
+
+		handleRequest(m_httpParser.getRequest());
+		buffer.retrieve(m_httpParser.getRequestSize());
+		m_httpParser.reset();
 	}
 
-	std::string buf(buffer.peek(), firstCrlf - buffer.peek());
-	printf("%s\n", buf.c_str());
+	return true;
+}
 
-	auto pos1 = buf.find("GET");
-	auto pos2 = buf.find(".flv");
-	if (pos1 == std::string::npos || pos2 == std::string::npos)
+bool HttpFlvConnection::handleWebSocket(BufferReader& buffer)
+{
+	// viewers only send control frames, data frames are dropped
+	while (buffer.readableBytes() > 0)
 	{
-		return false;
+		WebSocket::Frame frame;
+		int ret = WebSocket::parseHeader(buffer.peek(), buffer.readableBytes(), frame);
+		if (ret < 0 || (ret > 0 && (!frame.masked || frame.payloadSize > kMaxWebSocketMessage)))
+		{
+			return false;
+		}
+
+		uint32_t frameSize = frame.headerSize + (uint32_t)frame.payloadSize;
+		if (ret == 0 || buffer.readableBytes() < frameSize)
+		{
+			break;
+		}
+
+		char *payload = buffer.peek() + frame.headerSize;
+		WebSocket::unmask(payload, frame.payloadSize, frame.mask);
+
+		if (frame.opcode == WebSocket::kClose)
+		{
+			if (!m_closeAfterWrite)
+			{
+				// echo the status code and close once it is written
+				sendWebSocketFrame(WebSocket::kClose, payload, frame.payloadSize >= 2 ? 2 : 0);
+				m_closeAfterWrite = true;
+				this->handleWrite();
+			}
+			buffer.retrieveAll();
+			break;
+		}
+		else if (frame.opcode == WebSocket::kPing)
+		{
+			sendWebSocketFrame(WebSocket::kPong, payload, (uint32_t)frame.payloadSize);
+		}
+
+		buffer.retrieve(frameSize);
 	}
 
-	m_streamPath = buf.substr(pos1 + 3, pos2 - 3).c_str();
+	return true;
+}
 
-	pos1 = m_streamPath.find_first_not_of(" ");
-	pos2 = m_streamPath.find_last_not_of(" ");
-	m_streamPath = m_streamPath.substr(pos1, pos2);
-	printf("%s\n", m_streamPath.c_str());
+void HttpFlvConnection::handleRequest(const HttpRequest& request)
+{
+	m_keepAlive = request.keepAlive;
+	m_isHead = request.method.equals("HEAD");
 
-	if (m_rtmpServer != nullptr)
+	if (m_httpFlvServer != nullptr)
 	{
-		std::string httpFlvHeader = "HTTP/1.1 200 OK\r\nContent-Type: video/x-flv\r\n\r\n";
-		this->send(httpFlvHeader.c_str(), (uint32_t)httpFlvHeader.size());
+		auto handler = m_httpFlvServer->getRoute(request.path);
+		if (handler != nullptr)
+		{
+			(*handler)(std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this()), request);
+			return;
+		}
+	}
 
-		auto sessionPtr = m_rtmpServer->getSession(m_streamPath);
-		if (sessionPtr != nullptr)
+	if (request.path.endsWith(".flv"))
+	{
+		handleFlv(request);
+		return;
+	}
+
+	sendError(404);
+}
+
+void HttpFlvConnection::handleFlv(const HttpRequest& request)
+{
+	if (!request.method.equals("GET"))
+	{
+		sendResponse(405, "text/plain", nullptr, 0, "Allow: GET\r\n");
+		return;
+	}
+
+	if (m_rtmpServer == nullptr)
+	{
+		sendError(404);
+		return;
+	}
+
+	bool isUpgrade = request.getHeader("Upgrade").iequals("websocket");
+	if (isUpgrade && (request.getHeader("Sec-WebSocket-Key").empty()
+		|| !request.getHeader("Sec-WebSocket-Version").equals("13")))
+	{
+		sendResponse(400, "text/plain", nullptr, 0, "Sec-WebSocket-Version: 13\r\n");
+		return;
+	}
+
+	std::string streamPath(request.path.data, request.path.size - 4);
+	size_t pos = streamPath.find('/', 1);
+	if (pos != std::string::npos)
+	{
+		std::string vodPath;
+		if (m_rtmpServer->getVodPath(streamPath.substr(1, pos - 1), streamPath.substr(pos + 1), vodPath))
+		{
+			openFile(vodPath, request);
+			return;
+		}
+	}
+
+	ClusterMember owner;
+	if (m_rtmpServer->getRedirect(streamPath, owner) && !owner.httpUrl.empty())
+	{
+		std::string location = "Location: " + owner.httpUrl + request.path.str();
+		if (!request.query.empty())
+		{
+			location += "?" + request.query.str();
+		}
+		location += "\r\n";
+		sendResponse(302, "text/plain", nullptr, 0, location.c_str());
+		return;
+	}
+
+	auto sessionPtr = m_rtmpServer->findSession(streamPath);
+	if (sessionPtr == nullptr || sessionPtr->getPublisher() == nullptr)
+	{
+		if (!m_rtmpServer->startPull(streamPath))
 		{
+			sendError(404);
+			return;
+		}
+		sessionPtr = m_rtmpServer->getSession(streamPath);
+	}
+
+	LOG_INFO("[HTTP-FLV] play %s%s\n", streamPath.c_str(), isUpgrade ? " (websocket)" : "");
+
+	startStream(isUpgrade ? request.getHeader("Sec-WebSocket-Key").str() : std::string());
+	m_streamPath = streamPath;
+
+	TaskScheduler *taskScheduler = m_rtmpServer->getPlayerScheduler(sessionPtr, _taskScheduler);
+	if (taskScheduler != nullptr)
+	{
+		this->moveTo(taskScheduler, [this, sessionPtr] {
 			sessionPtr->addHttpClient(std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this()));
+		});
+	}
+	else
+	{
+		sessionPtr->addHttpClient(std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this()));
+	}
+}
+
+void HttpFlvConnection::openFile(const std::string& path, const HttpRequest& request)
+{
+	// the request does not outlive the parser buffer, keep what playing needs
+	uint32_t startTime = 0;
+	HttpSlice value;
+
+	if (request.getQuery("start", value))
+	{
+		startTime = (uint32_t)(atof(value.str().c_str()) * 1000);
+	}
+
+	bool isUpgrade = request.getHeader("Upgrade").iequals("websocket");
+	bool isDownload = !isUpgrade && request.getQuery("download", value) && value.equals("1");
+	std::string webSocketKey = isUpgrade ? request.getHeader("Sec-WebSocket-Key").str() : std::string();
+	m_isVodOpening = true;
+
+	std::weak_ptr<HttpFlvConnection> conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
+	FlvFile::openAsync(path, _taskScheduler, [conn, startTime, isDownload, webSocketKey](FlvFile::Ptr filePtr) {
+		auto connPtr = conn.lock();
+		if (connPtr == nullptr || connPtr->isClosed())
+		{
+			return;
+		}
+
+		connPtr->m_isVodOpening = false;
+		if (filePtr == nullptr)
+		{
+			connPtr->sendError(404);
+			return;
+		}
+		connPtr->playFile(filePtr, startTime, isDownload, webSocketKey);
+	});
+}
+
+void HttpFlvConnection::playFile(FlvFile::Ptr filePtr, uint32_t startTime, bool isDownload, const std::string& webSocketKey)
+{
+	if (isDownload)
+	{
+		// the whole file goes out through sendfile(), it never enters user space
+		char httpHeader[256] = { 0 };
+		snprintf(httpHeader, sizeof(httpHeader), "HTTP/1.1 200 OK\r\nContent-Type: video/x-flv\r\nContent-Length: %llu\r\nConnection: %s\r\n\r\n",
+			(unsigned long long)filePtr->size(), m_keepAlive ? "keep-alive" : "close");
+		this->send(httpHeader, (uint32_t)strlen(httpHeader));
+		this->sendFile(filePtr, filePtr->fd(), 0, filePtr->size());
+
+		if (!m_keepAlive)
+		{
+			m_closeAfterWrite = true;
+			this->handleWrite();
 		}
+		return;
+	}
+
+	startStream(webSocketKey);
+
+	std::weak_ptr<HttpFlvConnection> conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
+	m_vodSource = std::make_shared<FlvVodSource>(filePtr);
+	m_vodSource->setFrameCallback([conn, filePtr](uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize,
+	                                              const FlvTag& tag) {
+		auto connPtr = conn.lock();
+		if (connPtr == nullptr || connPtr->isClosed())
+		{
+			return false;
+		}
+
+		// media tags go out from the mapping as they are in the file
+		uint32_t tagSize = 0;
+		std::shared_ptr<char> tagData;
+		if ((type == RTMP_VIDEO || type == RTMP_AUDIO) && (tagData = filePtr->getTag(tag, tagSize)) != nullptr)
+		{
+			connPtr->sendFlvTag(FlvTagPacket::wrap(type, tagData, tagSize));
+			return true;
+		}
+
+		connPtr->sendMediaData(type, timestamp, payload, payloadSize);
+		return true;
+	});
+	m_vodSource->setEndCallback([conn] {
+		auto connPtr = conn.lock();
+		if (connPtr != nullptr && !connPtr->isClosed())
+		{
+			connPtr->finishStream();
+		}
+	});
+
+	if (!m_vodSource->start(_taskScheduler, startTime))
+	{
+		m_closeAfterWrite = true;
+		this->handleWrite();
+	}
+}
+
+void HttpFlvConnection::startStream(const std::string& webSocketKey)
+{
+	if (!webSocketKey.empty())
+	{
+		// flv.js style: the same tag stream inside binary messages
+		std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+			"Sec-WebSocket-Accept: " + WebSocket::getAcceptKey(webSocketKey) + "\r\n\r\n";
+		this->send(response.c_str(), (uint32_t)response.size());
+		m_isWebSocket = true;
+	}
+	else
+	{
+		std::string httpFlvHeader = "HTTP/1.1 200 OK\r\nContent-Type: video/x-flv\r\nConnection: close\r\n\r\n";
+		this->send(httpFlvHeader.c_str(), (uint32_t)httpFlvHeader.size());
+	}
+
+	m_isStreaming = true;
+}
+
+void HttpFlvConnection::finishStream()
+{
+	// the response has no length, closing the connection ends it
+	if (m_isWebSocket)
+	{
+		const char status[2] = { (char)(1000 >> 8), (char)(1000 & 0xff) };
+		sendWebSocketFrame(WebSocket::kClose, status, sizeof(status));
+	}
+
+	m_closeAfterWrite = true;
+	this->handleWrite();
+}
+
+void HttpFlvConnection::sendResponse(int code, const char *contentType, const char *body, uint32_t size, const char *extraHeaders)
+{
+	char header[1024] = { 0 };
+	int headerSize = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n%s\r\n",
+		code, HttpParser::getStatusText(code), contentType, size, m_keepAlive ? "keep-alive" : "close",
+		extraHeaders != nullptr ? extraHeaders : "");
+	if (headerSize < 0 || headerSize >= (int)sizeof(header))
+	{
+		return;
+	}
+
+	// one packet per response
+	uint32_t bodySize = (m_isHead || body == nullptr) ? 0 : size;
+	std::shared_ptr<char> data(new char[headerSize + bodySize]);
+	memcpy(data.get(), header, headerSize);
+	if (bodySize > 0)
+	{
+		memcpy(data.get() + headerSize, body, bodySize);
+	}
+	this->send(data, headerSize + bodySize);
+
+	if (!m_keepAlive)
+	{
+		m_closeAfterWrite = true;
+		this->handleWrite();
+	}
+}
+
+void HttpFlvConnection::sendError(int code)
+{
+	char body[128] = { 0 };
+	int size = snprintf(body, sizeof(body), "%d %s\n", code, HttpParser::getStatusText(code));
+	sendResponse(code, "text/plain", body, (uint32_t)size);
+}
+
+void HttpFlvConnection::handleWrite()
+{
+	TcpConnection::handleWrite();
+
+	if (m_closeAfterWrite && !this->isClosed() && _writeBufferPtr->isEmpty())
+	{
+		this->disconnect();
 	}
-	
-	return true;
 }
 
 void HttpFlvConnection::onClose()
 {
-	if (m_rtmpServer != nullptr)
+	std::string latency = m_latency.getSummary(LatencyStats::kTotal);
+	if (!latency.empty())
 	{
-		auto sessionPtr = m_rtmpServer->getSession(m_streamPath);
+		LOG_INFO("[%s] http-flv player %d latency: %s\n", m_streamPath.c_str(), (int)this->fd(), latency.c_str());
+	}
+
+	if (m_vodSource != nullptr)
+	{
+		m_vodSource->stop();
+		return;
+	}
+
+	if (m_rtmpServer != nullptr && !m_streamPath.empty())
+	{
+		auto sessionPtr = m_rtmpServer->findSession(m_streamPath);
 		if (sessionPtr != nullptr)
 		{
 			auto conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
@@ -92,71 +419,100 @@ bool HttpFlvConnection::sendMediaData(uint8_t type, uint64_t timestamp, std::sha
 		return false;
 	}
 
-	m_isPlaying = true;
-
 	if (type == RTMP_AVC_SEQUENCE_HEADER)
 	{
+		m_isPlaying = true;
 		m_avcSequenceHeader = payload;
 		m_avcSequenceHeaderSize = payloadSize;
 		return true;
 	}
 	else if (type == RTMP_AAC_SEQUENCE_HEADER)
 	{
+		m_isPlaying = true;
 		m_aacSequenceHeader = payload;
 		m_aacSequenceHeaderSize = payloadSize;
 		return true;
 	}
+	else if (type != RTMP_VIDEO && type != RTMP_AUDIO)
+	{
+		return false;
+	}
+
+	return sendFlvTag(FlvTagPacket::create(type, timestamp, payload.get(), payloadSize));
+}
+
+void HttpFlvConnection::onPacketSent(int64_t arrivalTime, int64_t appendTime)
+{
+	m_latency.recordSent(arrivalTime, appendTime, TaskScheduler::getMicroseconds(),
+	                     (m_metrics != nullptr) ? &m_metrics->latency : nullptr);
+}
+
+bool HttpFlvConnection::sendFlvTag(FlvTagPacket::Ptr packet, const FrameTiming *timing)
+{
+	if (this->isClosed())
+	{
+		return false;
+	}
+
+	m_isPlaying = true;
+
+	FrameTiming frameTiming;
+	if (timing != nullptr && timing->arrivalTime != 0)
+	{
+		frameTiming = *timing;
+		frameTiming.enqueueTime = TaskScheduler::getMicroseconds();
+	}
 
 	auto conn = std::dynamic_pointer_cast<HttpFlvConnection>(shared_from_this());
-	m_taskScheduler->addTriggerEvent([conn, type, timestamp, payload, payloadSize] {
-		if (type == RTMP_VIDEO)
+	bool ret = _taskScheduler->runInLoop([conn, packet, frameTiming] {
+		if (conn->m_closeAfterWrite)
 		{
-			if (!conn->m_hasKeyFrame)
+			return ;
+		}
+
+		if (!conn->m_hasKeyFrame)
+		{
+			if (packet->getType() == RTMP_VIDEO)
 			{
-				uint8_t frameType = (payload.get()[0] >> 4) & 0x0f;
-				uint8_t codecId = payload.get()[0] & 0x0f;
-				if (frameType == 1 && codecId == RTMP_CODEC_ID_H264)
-				{
-					conn->m_hasKeyFrame = true;
-				}
-				else
+				if (!packet->isKeyFrame())
 				{
 					return ;
 				}
+				conn->m_hasKeyFrame = true;
 			}
-
-			if (!conn->m_hasFlvHeader)
+			else if (conn->m_avcSequenceHeaderSize > 0)
 			{
-				conn->sendFlvHeader();
-				conn->sendFlvTag(conn->FLV_TAG_TYPE_VIDEO, 0, conn->m_avcSequenceHeader, conn->m_avcSequenceHeaderSize);
-				conn->sendFlvTag(conn->FLV_TAG_TYPE_AUDIO, 0, conn->m_aacSequenceHeader, conn->m_aacSequenceHeaderSize);
+				return ;
 			}
-
-			conn->sendFlvTag(conn->FLV_TAG_TYPE_VIDEO, timestamp, payload, payloadSize);
 		}
-		else if (type == RTMP_AUDIO)
+
+		if (!conn->m_hasFlvHeader)
 		{
-			if (!conn->m_hasKeyFrame && conn->m_avcSequenceHeaderSize>0)
-			{
-				return ;
-			}
+			conn->sendFlvHeader();
+		}
 
-			if (!conn->m_hasFlvHeader)
-			{
-				conn->sendFlvHeader();
-				conn->sendFlvTag(conn->FLV_TAG_TYPE_AUDIO, 0, conn->m_aacSequenceHeader, conn->m_aacSequenceHeaderSize);
-			}
+		if (frameTiming.arrivalTime != 0)
+		{
+			conn->m_latency.recordDequeue(frameTiming, TaskScheduler::getMicroseconds(),
+			                              (conn->m_metrics != nullptr) ? &conn->m_metrics->latency : nullptr);
+		}
 
-			conn->sendFlvTag(conn->FLV_TAG_TYPE_AUDIO, timestamp, payload, payloadSize);
+		if (!conn->sendPacket(packet, frameTiming.arrivalTime) && conn->m_metrics != nullptr && !conn->isClosed())
+		{
+			Metrics::add(conn->m_metrics->droppedFrames);
 		}
 	});
 
-	return true;
+	if (!ret && m_metrics != nullptr)
+	{
+		Metrics::add(m_metrics->droppedFrames);
+	}
+	return ret;
 }
 
 void HttpFlvConnection::sendFlvHeader()
 {
-	char flvHeader[9] = { 0x46, 0x4c, 0x56, 0x01, 0x00, 0x00, 0x00, 0x00, 0x09 };
+	char flvHeader[13] = { 0x46, 0x4c, 0x56, 0x01, 0x00, 0x00, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00 };
 
 	if (m_avcSequenceHeaderSize > 0)
 	{
@@ -168,35 +524,55 @@ void HttpFlvConnection::sendFlvHeader()
 		flvHeader[4] |= 0x4;
 	}
 
-	this->send(flvHeader, 9);
-	char previousTagSize[4] = { 0x0, 0x0, 0x0, 0x0 };
-	this->send(previousTagSize, 4);
+	this->sendData(flvHeader, 13);
+
+	if (m_avcSequenceHeaderSize > 0)
+	{
+		sendPacket(FlvTagPacket::create(FLV_TAG_TYPE_VIDEO, 0, m_avcSequenceHeader.get(), m_avcSequenceHeaderSize));
+	}
+
+	if (m_aacSequenceHeaderSize > 0)
+	{
+		sendPacket(FlvTagPacket::create(FLV_TAG_TYPE_AUDIO, 0, m_aacSequenceHeader.get(), m_aacSequenceHeaderSize));
+	}
 
 	m_hasFlvHeader = true;
 }
 
-int HttpFlvConnection::sendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize)
+bool HttpFlvConnection::sendPacket(const FlvTagPacket::Ptr& packet, int64_t arrivalTime)
 {
-	if (payloadSize == 0)
+	if (m_isWebSocket)
 	{
-		return -1;
+		if (!packet->isContiguous())
+		{
+			return this->send(packet->getWebSocketHeader(), packet->getWebSocketHeaderSize(),
+			                  packet->getTag(), packet->getTagSize(), arrivalTime);
+		}
+		return this->send(packet->getWebSocketHeader(), packet->getWebSocketHeaderSize() + packet->getTagSize(), arrivalTime);
 	}
 
-	char tagHeader[11] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-	char previousTagSize[4] = { 0x0, 0x0, 0x0, 0x0 };
-
-	tagHeader[0] = type;
-	writeUint24BE(tagHeader + 1, payloadSize);
-	tagHeader[4] = (timestamp >> 16) & 0xff;
-	tagHeader[5] = (timestamp >> 8) & 0xff;
-	tagHeader[6] = timestamp & 0xff;
-	tagHeader[7] = (timestamp >> 24) & 0xff;
-
-	writeUint32BE(previousTagSize, payloadSize + 11);
+	return this->send(packet->getTag(), packet->getTagSize(), arrivalTime);
+}
 
-	this->send(tagHeader, 11);
-	this->send(payload.get(), payloadSize);
-	this->send(previousTagSize, 4);
+void HttpFlvConnection::sendData(const char *data, uint32_t size)
+{
+	if (m_isWebSocket)
+	{
+		sendWebSocketFrame(WebSocket::kBinary, data, size);
+	}
+	else
+	{
+		this->send(data, size);
+	}
+}
 
-	return 0;
-}
\ No newline at end of file
+void HttpFlvConnection::sendWebSocketFrame(uint8_t opcode, const char *data, uint32_t size)
+{
+	std::shared_ptr<char> frame(new char[WebSocket::kMaxHeaderSize + size], std::default_delete<char[]>());
+	uint32_t headerSize = WebSocket::writeHeader(frame.get(), opcode, size);
+	if (size > 0)
+	{
+		memcpy(frame.get() + headerSize, data, size);
+	}
+	this->send(frame, headerSize + size);
+}
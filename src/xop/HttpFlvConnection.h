@@ -3,18 +3,28 @@
 
 #include "net/EventLoop.h"
 #include "net/TcpConnection.h"
+#include "net/HttpParser.h"
+#include "FlvVodSource.h"
+#include "FlvTagPacket.h"
+#include "StreamMetrics.h"
 
 namespace xop
 {
 
 class RtmpServer;
+class HttpFlvServer;
 
 class HttpFlvConnection : public TcpConnection
 {
 public:
-	HttpFlvConnection(RtmpServer *rtmpServer, TaskScheduler* taskScheduler, SOCKET sockfd);
+	using Ptr = std::shared_ptr<HttpFlvConnection>;
+
+	HttpFlvConnection(HttpFlvServer *httpFlvServer, RtmpServer *rtmpServer, TaskScheduler* taskScheduler, SOCKET sockfd);
 	~HttpFlvConnection();
 
+	/* answer the current request, extraHeaders: "Name: value\r\n"... */
+	void sendResponse(int code, const char *contentType, const char *body, uint32_t size, const char *extraHeaders = nullptr);
+
 	bool hasFlvHeader() const 
 	{ return m_hasFlvHeader; }
 	
@@ -22,21 +32,41 @@ public:
 	{ return m_isPlaying; }
 
 	bool sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize);
+	bool sendFlvTag(FlvTagPacket::Ptr packet, const FrameTiming *timing = nullptr); // packet may be shared with other viewers
+
+	bool isWebSocket() const
+	{ return m_isWebSocket; }
 
 	void resetKeyFrame()
 	{ m_hasKeyFrame = false; }
 
+	/* of the frames sent to this viewer */
+	const LatencyStats& getLatency() const
+	{ return m_latency; }
+
 private:
 	friend class RtmpSession;
 
 	bool onRead(BufferReader& buffer);
 	void onClose();
+	void onPacketSent(int64_t arrivalTime, int64_t appendTime);
+	void handleWrite();
+	void handleRequest(const HttpRequest& request);
+	void handleFlv(const HttpRequest& request);
+	bool handleWebSocket(BufferReader& buffer);
+	void startStream(const std::string& webSocketKey); // empty: plain HTTP
+	void finishStream();
+	void sendError(int code);
+	void openFile(const std::string& path, const HttpRequest& request);
+	void playFile(FlvFile::Ptr filePtr, uint32_t startTime, bool isDownload, const std::string& webSocketKey);
 	
 	void sendFlvHeader();
-	int  sendFlvTag(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize);
+	bool sendPacket(const FlvTagPacket::Ptr& packet, int64_t arrivalTime = 0);
+	void sendData(const char *data, uint32_t size);
+	void sendWebSocketFrame(uint8_t opcode, const char *data, uint32_t size);
 
+	HttpFlvServer *m_httpFlvServer = nullptr;
 	RtmpServer *m_rtmpServer = nullptr;
-	TaskScheduler* m_taskScheduler = nullptr;
 	std::string m_streamPath;
 
 	std::shared_ptr<char> m_avcSequenceHeader;
@@ -44,11 +74,23 @@ private:
 	uint32_t m_avcSequenceHeaderSize = 0;
 	uint32_t m_aacSequenceHeaderSize = 0;
 	bool m_hasKeyFrame = false;
+	StreamMetrics::Ptr m_metrics; // of the session played, set by RtmpSession
+	LatencyStats m_latency;
 	bool m_hasFlvHeader = false;
 	bool m_isPlaying = false;
+	FlvVodSource::Ptr m_vodSource;
+
+	HttpParser m_httpParser;
+	bool m_keepAlive = true;
+	bool m_isHead = false;
+	bool m_isStreaming = false;
+	bool m_closeAfterWrite = false;
+	bool m_isVodOpening = false; // requests after it wait for the file
+	bool m_isWebSocket = false;
 
 	const uint8_t FLV_TAG_TYPE_AUDIO = 0x8;
 	const uint8_t FLV_TAG_TYPE_VIDEO = 0x9;
+	static const uint32_t kMaxWebSocketMessage = 64 * 1024;
 };
 
 };
@@ -2,6 +2,7 @@
 #include "RtmpServer.h"
 #include "net/SocketUtil.h"
 #include "net/Logger.h"
+#include "net/Metrics.h"
 
 using namespace xop;
 
@@ -29,8 +30,57 @@ void HttpFlvServer::attach(RtmpServer *rtmpServer)
 	m_rtmpServer = rtmpServer;
 }
 
-TcpConnection::Ptr HttpFlvServer::newConnection(SOCKET sockfd)
+void HttpFlvServer::addRoute(std::string path, const HttpHandler& handler)
 {
-	return std::make_shared<HttpFlvConnection>(m_rtmpServer, _eventLoop->getTaskScheduler().get(), sockfd);
+	std::lock_guard<std::mutex> locker(m_mutex);
+	for (auto& route : m_routes)
+	{
+		if (route.first == path)
+		{
+			route.second = std::make_shared<HttpHandler>(handler);
+			return;
+		}
+	}
+
+	m_routes.emplace_back(path, std::make_shared<HttpHandler>(handler));
+}
+
+void HttpFlvServer::addMetricsRoute(std::string path)
+{
+	this->addRoute(path, [](HttpFlvConnection::Ptr conn, const HttpRequest& request) {
+		std::string body = Metrics::instance().scrape();
+		conn->sendResponse(200, "text/plain; version=0.0.4", body.data(), (uint32_t)body.size());
+	});
+}
+
+std::shared_ptr<HttpFlvServer::HttpHandler> HttpFlvServer::getRoute(const HttpSlice& path)
+{
+	std::lock_guard<std::mutex> locker(m_mutex);
+	std::shared_ptr<HttpHandler> handler;
+	size_t matchLen = 0;
+
+	// exact match first, then the longest prefix
+	for (auto& route : m_routes)
+	{
+		const std::string& routePath = route.first;
+		if (routePath.size() == path.size && memcmp(routePath.data(), path.data, path.size) == 0)
+		{
+			return route.second;
+		}
+
+		if (!routePath.empty() && routePath.back() == '/' && routePath.size() > matchLen
+			&& path.startsWith(routePath.c_str()))
+		{
+			handler = route.second;
+			matchLen = routePath.size();
+		}
+	}
+
+	return handler;
+}
+
+TcpConnection::Ptr HttpFlvServer::newConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
+{
+	return std::make_shared<HttpFlvConnection>(this, m_rtmpServer, taskScheduler, sockfd);
 }
 
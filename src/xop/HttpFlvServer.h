@@ -4,6 +4,7 @@
 #include "net/TcpServer.h"
 #include "HttpFlvConnection.h"
 #include <mutex>
+#include <vector>
 
 namespace xop
 {
@@ -15,14 +16,27 @@ public:
 	HttpFlvServer(xop::EventLoop *loop, std::string ip, uint16_t port = 8000);
 	~HttpFlvServer();
 
+	using HttpHandler = std::function<void(HttpFlvConnection::Ptr conn, const HttpRequest& request)>;
+
 	void attach(RtmpServer *rtmpServer);
 
+	/* handler runs on the connection's thread and answers with conn->sendResponse(),
+	   a path ending with '/' matches every path below it */
+	void addRoute(std::string path, const HttpHandler& handler);
+
+	/* Prometheus text format of all the counters and stream gauges of the process */
+	void addMetricsRoute(std::string path = "/metrics");
+
 private:
-	TcpConnection::Ptr newConnection(SOCKET sockfd);
+	friend class HttpFlvConnection;
+
+	TcpConnection::Ptr newConnection(TaskScheduler *taskScheduler, SOCKET sockfd);
+	std::shared_ptr<HttpHandler> getRoute(const HttpSlice& path);
 
 	std::mutex m_mutex;
 	RtmpServer *m_rtmpServer = nullptr;
 	xop::EventLoop *m_eventLoop = nullptr;
+	std::vector<std::pair<std::string, std::shared_ptr<HttpHandler>>> m_routes;
 };
 
 }
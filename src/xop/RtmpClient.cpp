@@ -1,5 +1,7 @@
 #include "RtmpClient.h"
+#include "net/SocketUtil.h"
 #include "net/Logger.h"
+#include <future>
 
 using namespace xop;
 
@@ -21,26 +23,40 @@ void RtmpClient::setFrameCB(const FrameCallback& cb)
 }
 
 int RtmpClient::openUrl(std::string url, int msec, std::string& status)
+{
+	std::shared_ptr<std::promise<std::pair<int, std::string>>> promise(new std::promise<std::pair<int, std::string>>());
+	std::future<std::pair<int, std::string>> future = promise->get_future();
+	int ret = this->openUrlAsync(url, msec, [promise](int result, std::string status) {
+		promise->set_value(std::make_pair(result, status));
+	});
+
+	if (ret != 0)
+	{
+		return -1;
+	}
+
+	std::pair<int, std::string> result = future.get();
+	status = result.second;
+	return result.first;
+}
+
+int RtmpClient::openUrlAsync(std::string url, int msec, const OpenCallback& cb)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
 
-	static xop::Timestamp tp;
 	int timeout = msec;
 	if (timeout <= 0)
 	{
 		timeout = 10000;
 	}
 
-	tp.reset();
-
+	m_streamPath.clear(); // parseRtmpUrl() appends to it
 	if (this->parseRtmpUrl(url) != 0)
 	{
-		LOG_INFO("[RtmpPublisher] rtmp url(%s) was illegal.\n", url.c_str());
+		LOG_INFO("[RtmpClient] rtmp url(%s) was illegal.\n", url.c_str());
 		return -1;
 	}
 
-	//LOG_INFO("[RtmpPublisher] ip:%s, port:%hu, stream path:%s\n", m_ip.c_str(), m_port, m_streamPath.c_str());
-
 	if (m_rtmpConn != nullptr)
 	{
 		std::shared_ptr<RtmpConnection> rtmpConn = m_rtmpConn;
@@ -53,46 +69,46 @@ int RtmpClient::openUrl(std::string url, int msec, std::string& status)
 
 	TcpSocket tcpSocket;
 	tcpSocket.create();
-	if (!tcpSocket.connect(m_ip, m_port, timeout))
+	if (!SocketUtil::connectNonBlock(tcpSocket.fd(), m_ip, m_port))
 	{
 		tcpSocket.close();
 		return -1;
 	}
 
 	m_taskScheduler = m_eventLoop->getTaskScheduler().get();
-	m_rtmpConn.reset(new RtmpConnection((RtmpClient*)this, m_taskScheduler, tcpSocket.fd()));
-	m_taskScheduler->addTriggerEvent([this]() {
-		if (m_frameCB)
-		{
-			m_rtmpConn->setPlayCB(m_frameCB);
-		}
-		m_rtmpConn->handshake();
-	});
-
-	timeout -= (int)tp.elapsed();
-	if (timeout < 0)
+	std::shared_ptr<RtmpConnection> rtmpConn(new RtmpConnection((RtmpClient*)this, m_taskScheduler, tcpSocket.fd()));
+	if (m_frameCB)
 	{
-		timeout = 1000;
+		rtmpConn->setPlayCB(m_frameCB);
 	}
 
-	do
-	{
-		xop::Timer::sleep(100);
-		timeout -= 100;
-	} while (!m_rtmpConn->isClosed() && !m_rtmpConn->isPlaying() && timeout > 0);
+	std::weak_ptr<RtmpConnection> weakConn = rtmpConn;
+	bool ret = rtmpConn->open(timeout, [this, weakConn, cb](bool isStarted, std::string status) {
+		auto conn = weakConn.lock();
+		if (!isStarted && conn != nullptr)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_rtmpConn == conn)
+				{
+					m_rtmpConn = nullptr;
+				}
+			}
+			if (!conn->isClosed())
+			{
+				conn->disconnect();
+			}
+		}
+		cb(isStarted ? 0 : -1, status);
+	});
 
-	status = m_rtmpConn->getStatus();
-	if (!m_rtmpConn->isPlaying())
+	if (!ret)
 	{
-		std::shared_ptr<RtmpConnection> rtmpConn = m_rtmpConn;
-		SOCKET sockfd = rtmpConn->fd();
-		m_taskScheduler->addTriggerEvent([sockfd, rtmpConn]() {
-			rtmpConn->disconnect();
-		});
-		m_rtmpConn = nullptr;
+		rtmpConn->disconnect();
 		return -1;
 	}
 
+	m_rtmpConn = rtmpConn;
 	return 0;
 }
 
@@ -14,6 +14,7 @@ class RtmpClient : public Rtmp
 {
 public:
 	using FrameCallback = std::function<void(uint8_t* payload, uint32_t length, uint8_t codecId, uint32_t timestamp)>;
+	using OpenCallback = std::function<void(int result, std::string status)>;
 
 	RtmpClient & operator=(const RtmpClient &) = delete;
 	RtmpClient(const RtmpClient &) = delete;
@@ -22,6 +23,10 @@ public:
 
 	void setFrameCB(const FrameCallback& cb);
 	int openUrl(std::string url, int msec, std::string& status);
+
+	/* returns at once, cb is called on the event loop thread with 0 once playing,
+	   or -1 when refused, closed or not playing after msec. Not called if this fails. */
+	int openUrlAsync(std::string url, int msec, const OpenCallback& cb);
 	void close();
 	bool isConnected();
 
@@ -2,11 +2,15 @@
 #include "RtmpServer.h"
 #include "RtmpPublisher.h"
 #include "RtmpClient.h"
+#include "RtmpRelay.h"
 #include "net/Logger.h"
 #include <random>
+#include <algorithm>
 
 using namespace xop;
 
+static const uint32_t s_handshakeFailuresId = Metrics::instance().counter("xop_rtmp_handshake_failures_total", "RTMP handshakes rejected.");
+
 RtmpConnection::RtmpConnection(RtmpServer *rtmpServer, TaskScheduler *taskScheduler, SOCKET sockfd)
 	: RtmpConnection(taskScheduler, sockfd)
 {
@@ -33,6 +37,7 @@ RtmpConnection::RtmpConnection(RtmpPublisher *rtmpPublisher, TaskScheduler *task
 	m_streamPath = m_rtmpPublisher->getStreamPath();
 	m_streamName = m_rtmpPublisher->getStreamName();
 	m_app = m_rtmpPublisher->getApp();
+	m_isFastStart = m_rtmpPublisher->isFastStart();
 }
 
 RtmpConnection::RtmpConnection(RtmpClient *rtmpClient, TaskScheduler *taskScheduler, SOCKET sockfd)
@@ -46,11 +51,27 @@ RtmpConnection::RtmpConnection(RtmpClient *rtmpClient, TaskScheduler *taskSchedu
 	m_streamPath = m_rtmpClient->getStreamPath();
 	m_streamName = m_rtmpClient->getStreamName();
 	m_app = m_rtmpClient->getApp();
+	m_isFastStart = m_rtmpClient->isFastStart();
+}
+
+RtmpConnection::RtmpConnection(RtmpRelay *rtmpRelay, ConnectionMode mode, TaskScheduler *taskScheduler, SOCKET sockfd)
+	: RtmpConnection(taskScheduler, sockfd)
+{
+	m_rtmpRelay = rtmpRelay;
+	m_connMode = mode;
+	m_connState = HANDSHAKE_S0S1S2;
+	m_chunkParseState = PARSE_HEADER;
+	m_peerBandwidth = m_rtmpRelay->getPeerBandwidth();
+	m_acknowledgementSize = m_rtmpRelay->getAcknowledgementSize();
+	m_maxChunkSize = m_rtmpRelay->getChunkSize();
+	m_streamPath = m_rtmpRelay->getStreamPath();
+	m_streamName = m_rtmpRelay->getStreamName();
+	m_app = m_rtmpRelay->getApp();
+	m_isFastStart = m_rtmpRelay->isFastStart();
 }
 
 RtmpConnection::RtmpConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
 	: TcpConnection(taskScheduler, sockfd)
-	, m_taskScheduler(taskScheduler)
 	, m_channelPtr(new Channel(sockfd))
 {
 	this->setReadCallback([this](std::shared_ptr<TcpConnection> conn, xop::BufferReader& buffer) {
@@ -78,6 +99,10 @@ bool RtmpConnection::onRead(BufferReader& buffer)
 			|| m_connState == HANDSHAKE_S0S1S2)
 	{
 		ret = this->handleHandshake(buffer);
+		if (!ret)
+		{
+			Metrics::add(s_handshakeFailuresId);
+		}
 
 		if (m_connState == HANDSHAKE_COMPLETE && buffer.readableBytes() > 0)
 		{
@@ -88,6 +113,21 @@ bool RtmpConnection::onRead(BufferReader& buffer)
 		{
 			this->setChunkSize();
 			this->connect();
+			if (m_isFastStart)
+			{
+				// one round trip instead of three, publish/play goes on the
+				// stream id servers hand out first and is resent if it differs
+				this->cretaeStream();
+				m_streamId = kStreamId;
+				if (m_connMode == RTMP_PUBLISHER)
+				{
+					this->publish();
+				}
+				else
+				{
+					this->play();
+				}
+			}
 		}
 	}
 
@@ -96,6 +136,17 @@ bool RtmpConnection::onRead(BufferReader& buffer)
 
 void RtmpConnection::onClose()
 {
+	this->completeOpen(false, this->getStatus(), true);
+
+	if (m_isPlaying)
+	{
+		std::string latency = m_latency.getSummary(LatencyStats::kTotal);
+		if (!latency.empty())
+		{
+			LOG_INFO("[%s] player %d latency: %s\n", m_streamPath.c_str(), (int)this->fd(), latency.c_str());
+		}
+	}
+
 	if (m_rtmpServer != nullptr)
 	{
 		this->handDeleteStream();
@@ -106,6 +157,22 @@ void RtmpConnection::onClose()
 	}
 }
 
+void RtmpConnection::onPacketSent(int64_t arrivalTime, int64_t appendTime)
+{
+	m_latency.recordSent(arrivalTime, appendTime, TaskScheduler::getMicroseconds(),
+	                     (m_metrics != nullptr) ? &m_metrics->latency : nullptr);
+}
+
+// The random part of C1/S1, std::random_device costs a read of the entropy pool per call.
+static void fillRandom(uint8_t *data, uint32_t size)
+{
+	static thread_local std::mt19937 random(std::random_device{}());
+	for (uint32_t n = 0; n < size; n++)
+	{
+		data[n] = (uint8_t)random();
+	}
+}
+
 bool RtmpConnection::handshake()
 {
 	std::shared_ptr<char> res;
@@ -115,17 +182,66 @@ bool RtmpConnection::handshake()
 	memset(res.get(), 0, 1537);
 	res.get()[0] = RTMP_VERSION;
 
-	std::random_device rd;
-	uint8_t *p = (uint8_t *)res.get(); p += 9;
-	for (int i = 0; i < 1528; i++)
-	{
-		*p++ = rd();
-	}
+	fillRandom((uint8_t *)res.get() + 9, 1528);
 
 	this->send(res, resSize);
 	return true;
 }
 
+// Client side: handshake, connect, createStream then publish or play, driven by
+// the replies. cb gets the result once on the connection's thread, false if the
+// connection closed, was refused or did not start within msec.
+bool RtmpConnection::open(uint32_t msec, const OpenCallback& cb)
+{
+	auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
+	return _taskScheduler->addTriggerEvent([conn, msec, cb]() {
+		if (conn->isClosed()) // refused before we got here
+		{
+			cb(false, conn->getStatus());
+			return;
+		}
+
+		std::weak_ptr<RtmpConnection> weakConn = conn;
+		conn->m_openCB = cb;
+		conn->m_openTimerId = conn->_taskScheduler->addTimer([weakConn]() {
+			auto connPtr = weakConn.lock();
+			if (connPtr != nullptr)
+			{
+				connPtr->m_openTimerId = 0;
+				connPtr->completeOpen(false, "timeout");
+				connPtr->disconnect();
+			}
+			return false;
+		}, msec);
+		conn->handshake(); // queued until the non-blocking connect completes
+	});
+}
+
+void RtmpConnection::completeOpen(bool isStarted, std::string status, bool isDeferred)
+{
+	if (!m_openCB)
+	{
+		return;
+	}
+
+	OpenCallback cb;
+	cb.swap(m_openCB);
+	if (m_openTimerId != 0)
+	{
+		_taskScheduler->removeTimer(m_openTimerId);
+		m_openTimerId = 0;
+	}
+
+	if (isDeferred) // not from under the connection's lock
+	{
+		_taskScheduler->addTriggerEvent([cb, isStarted, status]() {
+			cb(isStarted, status);
+		});
+		return;
+	}
+	cb(isStarted, status);
+}
+
 bool RtmpConnection::handleHandshake(BufferReader& buffer)
 {
     uint8_t *buf = (uint8_t*)buffer.peek();
@@ -133,7 +249,6 @@ bool RtmpConnection::handleHandshake(BufferReader& buffer)
     uint32_t pos = 0;
     std::shared_ptr<char> res;
     uint32_t resSize = 0;
-	std::random_device rd;
 
 	if (m_connState == HANDSHAKE_S0S1S2)
 	{
@@ -173,10 +288,8 @@ bool RtmpConnection::handleHandshake(BufferReader& buffer)
             res.get()[0] = RTMP_VERSION;
 
             char *p = res.get(); p += 9;
-            for(int i=0; i<1528; i++)
-            {
-                *p++ = rd();
-            }
+            fillRandom((uint8_t *)p, 1528);
+            p += 1528;
             memcpy(p, buf+1, 1536);
             m_connState = HANDSHAKE_C2;
         }
@@ -321,7 +434,8 @@ int RtmpConnection::parseChunkHeader(BufferReader& buffer)
 	{
 		uint32_t length = readUint24BE((char*)header.length);
 
-		if (rtmpMsg.length != length || rtmpMsg.payload == nullptr)
+		/* the previous payload may still be referenced by players or the recorder */
+		if (rtmpMsg.length != length || rtmpMsg.payload == nullptr || rtmpMsg.payload.use_count() > 1)
 		{
 			rtmpMsg.length = length;
 			rtmpMsg.payload.reset(new char[rtmpMsg.length]);
@@ -499,10 +613,16 @@ bool RtmpConnection::handleInvoke(RtmpMessage& rtmpMsg)
 
 	if (m_connMode == RTMP_PUBLISHER || m_connMode == RTMP_CLIENT)
 	{
-		bytesUsed += m_amfDec.decode(rtmpMsg.payload.get() + bytesUsed, rtmpMsg.length - bytesUsed);
+		bytesUsed += m_amfDec.decode(rtmpMsg.payload.get() + bytesUsed, rtmpMsg.length - bytesUsed, 1);
+		uint32_t transactionId = (uint32_t)m_amfDec.getNumber();
+		if ((int)rtmpMsg.length > bytesUsed)
+		{
+			bytesUsed += m_amfDec.decode(rtmpMsg.payload.get() + bytesUsed, rtmpMsg.length - bytesUsed);
+		}
+
 		if (method == "_result")
 		{
-			ret = handleResult(rtmpMsg);
+			ret = handleResult(rtmpMsg, transactionId);
 		}
 		else if (method == "onStatus")
 		{
@@ -529,6 +649,18 @@ bool RtmpConnection::handleInvoke(RtmpMessage& rtmpMsg)
 			m_streamName = m_amfDec.getString();
 			m_streamPath = "/" + m_app + "/" + m_streamName;
 
+			m_playStart = 0;
+			if(method == "play" && (int)rtmpMsg.length > bytesUsed)
+			{
+				// start: -2 live or recorded, -1 live only, >= 0 offset in seconds
+				bytesUsed += m_amfDec.decode((const char *)rtmpMsg.payload.get()+bytesUsed, rtmpMsg.length-bytesUsed, 1);
+				AmfObject start = m_amfDec.getObject();
+				if (start.type == AMF_NUMBER && start.amf_number > 0)
+				{
+					m_playStart = (uint32_t)(start.amf_number * 1000);
+				}
+			}
+
 			if((int)rtmpMsg.length > bytesUsed)
 			{
 				bytesUsed += m_amfDec.decode((const char *)rtmpMsg.payload.get()+bytesUsed, rtmpMsg.length-bytesUsed);
@@ -573,7 +705,22 @@ bool RtmpConnection::handleNotify(RtmpMessage& rtmpMsg)
         return false;
     }
 
-    if(m_amfDec.getString() == "@setDataFrame")
+    std::unique_lock<std::mutex> relayLock(m_relayMutex, std::defer_lock);
+    if(m_rtmpRelay != nullptr)
+    {
+        relayLock.lock();
+    }
+
+    std::string method = m_amfDec.getString();
+    if(method == "onMetaData" && m_relaySession != nullptr)
+    {
+        m_amfDec.reset();
+        m_amfDec.decode((const char *)rtmpMsg.payload.get()+bytesUsed, rtmpMsg.length-bytesUsed);
+        m_metaData = m_amfDec.getObjects();
+        m_relaySession->setMetaData(m_metaData);
+        m_relaySession->sendMetaData(m_metaData);
+    }
+    else if(method == "@setDataFrame")
     {
         m_amfDec.reset();
         bytesUsed = m_amfDec.decode((const char *)rtmpMsg.payload.get()+bytesUsed, rtmpMsg.length-bytesUsed, 1);
@@ -613,16 +760,26 @@ bool RtmpConnection::handleVideo(RtmpMessage& rtmpMsg)
 	// printf("\nframeType: %d", frameType);
 	// printf("\ncodecId: %d", codecId);
 
-	if (m_connMode == RTMP_CLIENT && m_connState == START_PLAY && m_isPlaying)
+	std::unique_lock<std::mutex> relayLock(m_relayMutex, std::defer_lock);
+	if (m_rtmpRelay != nullptr)
+	{
+		relayLock.lock(); // a stopping pull relay detaches the session under it
+	}
+
+	if (m_connMode == RTMP_CLIENT && m_relaySession == nullptr)
 	{
-		if (m_playCB)
+		if (m_connState == START_PLAY && m_isPlaying && m_playCB)
 		{
 			m_playCB(payload, length, codecId, (uint32_t)rtmpMsg._timestamp);
 		}
 	}
 	else
 	{
-		RtmpSession::Ptr sessionPtr = m_rtmpServer->getSession(m_streamPath);
+		RtmpSession::Ptr sessionPtr = m_relaySession;
+		if (sessionPtr == nullptr)
+		{
+			sessionPtr = m_rtmpServer->getSession(m_streamPath);
+		}
 		if (sessionPtr == nullptr)
 		{
 			return false;
@@ -640,7 +797,7 @@ bool RtmpConnection::handleVideo(RtmpMessage& rtmpMsg)
 			}
 		}
 
-		sessionPtr->sendMediaData(type, rtmpMsg._timestamp, rtmpMsg.payload, rtmpMsg.length);
+		sessionPtr->sendMediaData(type, rtmpMsg._timestamp, rtmpMsg.payload, rtmpMsg.length, this->getReadTime());
 	}
 
     return true;
@@ -656,16 +813,26 @@ bool RtmpConnection::handleAudio(RtmpMessage& rtmpMsg)
 	uint8_t soundRate = (payload[0] >> 2) & 0x03;
 	uint8_t codecId = payload[0] & 0x0f;
 
-	if (m_connMode == RTMP_CLIENT && m_connState == START_PLAY && m_isPlaying)
+	std::unique_lock<std::mutex> relayLock(m_relayMutex, std::defer_lock);
+	if (m_rtmpRelay != nullptr)
 	{
-		if (m_playCB)
+		relayLock.lock();
+	}
+
+	if (m_connMode == RTMP_CLIENT && m_relaySession == nullptr)
+	{
+		if (m_connState == START_PLAY && m_isPlaying && m_playCB)
 		{
 			m_playCB(payload, length, codecId, (uint32_t)rtmpMsg._timestamp);
 		}
 	}
 	else
 	{
-		RtmpSession::Ptr sessionPtr = m_rtmpServer->getSession(m_streamPath);
+		RtmpSession::Ptr sessionPtr = m_relaySession;
+		if (sessionPtr == nullptr)
+		{
+			sessionPtr = m_rtmpServer->getSession(m_streamPath);
+		}
 		if (sessionPtr == nullptr)
 		{
 			return false;
@@ -680,7 +847,7 @@ bool RtmpConnection::handleAudio(RtmpMessage& rtmpMsg)
 			type = RTMP_AAC_SEQUENCE_HEADER;
 		}
 
-		sessionPtr->sendMediaData(type, rtmpMsg._timestamp, rtmpMsg.payload, rtmpMsg.length);
+		sessionPtr->sendMediaData(type, rtmpMsg._timestamp, rtmpMsg.payload, rtmpMsg.length, this->getReadTime());
 	}
 
     return true;
@@ -695,10 +862,16 @@ bool RtmpConnection::connect()
 
 	m_amfEnc.encodeString("connect", 7);
 	m_amfEnc.encodeNumber((double)(++m_number));
+	m_connectTransactionId = m_number;
 	objects["app"] = AmfObject(m_app);
 	objects["type"] = AmfObject(std::string("nonprivate"));
 
-	if (m_connMode == RTMP_PUBLISHER)
+	if (m_rtmpRelay != nullptr)
+	{
+		objects["swfUrl"] = AmfObject(m_rtmpRelay->getSwfUrl());
+		objects["tcUrl"] = AmfObject(m_rtmpRelay->getTcUrl());
+	}
+	else if (m_connMode == RTMP_PUBLISHER)
 	{
 		objects["swfUrl"] = AmfObject(m_rtmpPublisher->getSwfUrl());
 		objects["tcUrl"] = AmfObject(m_rtmpPublisher->getTcUrl());
@@ -722,6 +895,7 @@ bool RtmpConnection::cretaeStream()
 
 	m_amfEnc.encodeString("createStream", 12);
 	m_amfEnc.encodeNumber((double)(++m_number));
+	m_createStreamTransactionId = m_number;
 	m_amfEnc.encodeObjects(objects);
 
 	m_connState = START_CREATE_STREAM;
@@ -788,6 +962,10 @@ bool RtmpConnection::handleConnect()
         return false;
     }
 
+    AppConfig appConfig = m_rtmpServer->getAppConfig(m_app);
+    m_maxChunkSize = appConfig.chunkSize;
+    m_maxGopCacheLen = appConfig.gopCache;
+
     sendAcknowledgement();
     setPeerBandwidth();
     setChunkSize();
@@ -832,6 +1010,12 @@ bool RtmpConnection::handlePublish()
     LOG_INFO("[Publish] app: %s, stream name: %s, stream path: %s", m_app.c_str(), m_streamName.c_str(), m_streamPath.c_str());
 	LOG_INFO("[+++++++] ----------------------------------\n");
 
+    ClusterMember owner;
+    if(m_rtmpServer->getRedirect(m_streamPath, owner))
+    {
+        return this->sendRedirect(owner.rtmpUrl + m_streamPath);
+    }
+
     AmfObjects objects;
     m_amfEnc.reset();
     m_amfEnc.encodeString("onStatus", 8);
@@ -853,6 +1037,13 @@ bool RtmpConnection::handlePublish()
         objects["code"] = AmfObject(std::string("NetStream.Publish.BadConnection"));
         objects["description"] = AmfObject(std::string("Connection already publishing."));
     }
+    else if(!m_rtmpServer->startShare(m_streamPath, m_rtmpServer->getSession(m_streamPath)))
+    {
+        isError = true;
+        objects["level"] = AmfObject(std::string("error"));
+        objects["code"] = AmfObject(std::string("NetStream.Publish.BadName"));
+        objects["description"] = AmfObject(std::string("Stream already publishing in another worker."));
+    }
     /* else if(0)
     {
         //认证处理
@@ -862,6 +1053,7 @@ bool RtmpConnection::handlePublish()
         objects["level"] = AmfObject(std::string("status"));
         objects["code"] = AmfObject(std::string("NetStream.Publish.Start"));
         objects["description"] = AmfObject(std::string("Start publising."));
+        m_rtmpServer->stopPull(m_streamPath); // the local publisher wins over the origin
         m_rtmpServer->addSession(m_streamPath);
     }
 
@@ -883,6 +1075,17 @@ bool RtmpConnection::handlePublish()
     {
 		sessionPtr->setGopCache(m_maxGopCacheLen);
         sessionPtr->addRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
+
+		RecordOption recordOption;
+		if (!isError && m_rtmpServer->getRecordOption(m_app, recordOption))
+		{
+			sessionPtr->startRecord(m_streamPath, recordOption);
+		}
+
+		if (!isError)
+		{
+			m_rtmpServer->startPush(m_app, m_streamName, sessionPtr);
+		}
     }
     return true;
 }
@@ -891,6 +1094,15 @@ bool RtmpConnection::handlePlay()
 {
 	LOG_INFO("[Play] app: %s, stream name: %s, stream path: %s\n", m_app.c_str(), m_streamName.c_str(), m_streamPath.c_str());
 
+    std::string vodPath;
+    bool isVod = m_rtmpServer->getVodPath(m_app, m_streamName, vodPath);
+
+    ClusterMember owner;
+    if(!isVod && m_rtmpServer->getRedirect(m_streamPath, owner))
+    {
+        return this->sendRedirect(owner.rtmpUrl + m_streamPath);
+    }
+
     AmfObjects objects;
     m_amfEnc.reset();
     m_amfEnc.encodeString("onStatus", 8);
@@ -929,16 +1141,140 @@ bool RtmpConnection::handlePlay()
     }
              
     m_connState = START_PLAY; 
+
+    if(isVod)
+    {
+        return openFile(vodPath);
+    }
     
+    if(!m_rtmpServer->hasPublisher(m_streamPath))
+    {
+        m_rtmpServer->startPull(m_streamPath);
+    }
+
     auto sessionPtr = m_rtmpServer->getSession(m_streamPath); 
     if(sessionPtr)
     {   
-        sessionPtr->addRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
+        TaskScheduler *taskScheduler = m_rtmpServer->getPlayerScheduler(sessionPtr, _taskScheduler);
+        if (taskScheduler != nullptr)
+        {
+            // joins on the publisher's thread, no frame is ever queued on this one
+            this->moveTo(taskScheduler, [this, sessionPtr] {
+                sessionPtr->addRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
+            });
+        }
+        else
+        {
+            sessionPtr->addRtmpClient(std::dynamic_pointer_cast<RtmpConnection>(shared_from_this()));
+        }
     }  
     
     return true;
 }
 
+bool RtmpConnection::openFile(std::string path)
+{
+	m_isVodOpening = true;
+
+	std::weak_ptr<RtmpConnection> conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
+	FlvFile::openAsync(path, _taskScheduler, [conn](FlvFile::Ptr filePtr) {
+		auto connPtr = conn.lock();
+		if (connPtr == nullptr || connPtr->isClosed() || !connPtr->m_isVodOpening)
+		{
+			return; // closed or deleteStream meanwhile
+		}
+
+		connPtr->m_isVodOpening = false;
+		if (filePtr == nullptr)
+		{
+			connPtr->sendStatus("error", "NetStream.Play.StreamNotFound", "File not playable.");
+			return;
+		}
+		connPtr->playFile(filePtr);
+	});
+
+	return true;
+}
+
+bool RtmpConnection::playFile(FlvFile::Ptr filePtr)
+{
+	LOG_INFO("[Play] vod: %s, start: %u ms\n", m_streamPath.c_str(), m_playStart);
+
+	this->sendMetaData(filePtr->getMetaData());
+
+	std::weak_ptr<RtmpConnection> conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
+	m_vodSource = std::make_shared<FlvVodSource>(filePtr);
+	m_vodSource->setFrameCallback([conn](uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize,
+	                                     const FlvTag& /* tag */) {
+		auto connPtr = conn.lock();
+		if (connPtr == nullptr || connPtr->isClosed())
+		{
+			return false;
+		}
+		connPtr->sendMediaData(type, timestamp, payload, payloadSize);
+		return true;
+	});
+	m_vodSource->setEndCallback([conn] {
+		auto connPtr = conn.lock();
+		if (connPtr != nullptr && !connPtr->isClosed())
+		{
+			connPtr->sendPlayComplete();
+		}
+	});
+
+	return m_vodSource->start(_taskScheduler, m_playStart);
+}
+
+bool RtmpConnection::sendPlayComplete()
+{
+	LOG_INFO("[Play] vod complete: %s\n", m_streamPath.c_str());
+
+	AmfObjects objects;
+	m_amfEnc.reset();
+	m_amfEnc.encodeString("onPlayStatus", 12);
+	objects["level"] = AmfObject(std::string("status"));
+	objects["code"] = AmfObject(std::string("NetStream.Play.Complete"));
+	m_amfEnc.encodeObjects(objects);
+	if (!sendNotifyMessage(RTMP_CHUNK_DATA_ID, m_amfEnc.data(), m_amfEnc.size()))
+	{
+		return false;
+	}
+
+	return sendStatus("status", "NetStream.Play.Stop", "Stopped playing.");
+}
+
+bool RtmpConnection::sendStatus(const char *level, const char *code, const char *description)
+{
+	AmfObjects objects;
+	m_amfEnc.reset();
+	m_amfEnc.encodeString("onStatus", 8);
+	m_amfEnc.encodeNumber(0);
+	m_amfEnc.encodeObjects(objects);
+	objects["level"] = AmfObject(std::string(level));
+	objects["code"] = AmfObject(std::string(code));
+	objects["description"] = AmfObject(std::string(description));
+	m_amfEnc.encodeObjects(objects);
+	return sendInvokeMessage(RTMP_CHUNK_INVOKE_ID, m_amfEnc.data(), m_amfEnc.size());
+}
+
+bool RtmpConnection::sendRedirect(std::string url)
+{
+	LOG_INFO("[Cluster] %s redirect to %s\n", m_streamPath.c_str(), url.c_str());
+
+	AmfObjects objects;
+	m_amfEnc.reset();
+	m_amfEnc.encodeString("onStatus", 8);
+	m_amfEnc.encodeNumber(0);
+	m_amfEnc.encodeObjects(objects);
+	objects["level"] = AmfObject(std::string("error"));
+	objects["code"] = AmfObject(std::string("NetConnection.Connect.Rejected"));
+	objects["description"] = AmfObject(std::string("Redirect to ") + url);
+	objects["redirect"] = AmfObject(url);
+	m_amfEnc.encodeObjects(objects);
+	sendInvokeMessage(RTMP_CHUNK_INVOKE_ID, m_amfEnc.data(), m_amfEnc.size());
+	return false; // closes the connection once the status is out
+}
+
 bool RtmpConnection::handlePlay2()
 {
     printf("[Play2] stream path: %s\n", m_streamPath.c_str());
@@ -947,6 +1283,13 @@ bool RtmpConnection::handlePlay2()
 
 bool RtmpConnection::handDeleteStream()
 {
+	m_isVodOpening = false;
+	if (m_vodSource != nullptr)
+	{
+		m_vodSource->stop();
+		m_vodSource.reset();
+	}
+
     if(m_streamPath != "")
     {
         auto sessionPtr = m_rtmpServer->getSession(m_streamPath); 
@@ -968,34 +1311,43 @@ bool RtmpConnection::handDeleteStream()
 	return true;
 }
 
-bool RtmpConnection::handleResult(RtmpMessage& rtmpMsg)
+// Replies are matched by transaction id, with fast start they arrive after
+// everything up to publish/play went out.
+bool RtmpConnection::handleResult(RtmpMessage& rtmpMsg, uint32_t transactionId)
 {
 	bool ret = false;
 
-	if (m_connState == START_CONNECT)
+	if (transactionId == m_connectTransactionId)
 	{
 		if (m_amfDec.hasObject("code"))
 		{
 			AmfObject amfObj = m_amfDec.getObject("code");
 			if (amfObj.amf_string == "NetConnection.Connect.Success")
 			{
-				this->cretaeStream();
+				if (!m_isFastStart)
+				{
+					this->cretaeStream();
+				}
 				ret = true;
 			}
 		}
 	}
-	else if (m_connState == START_CREATE_STREAM)
+	else if (transactionId == m_createStreamTransactionId)
 	{
 		if (m_amfDec.getNumber() > 0)
 		{
-			m_streamId = (uint32_t)m_amfDec.getNumber();
-			if (m_connMode == RTMP_PUBLISHER)
+			uint32_t streamId = (uint32_t)m_amfDec.getNumber();
+			if (!m_isFastStart || streamId != m_streamId)
 			{
-				this->publish();
-			}
-			else if (m_connMode == RTMP_CLIENT)
-			{
-				this->play();
+				m_streamId = streamId;
+				if (m_connMode == RTMP_PUBLISHER)
+				{
+					this->publish();
+				}
+				else if (m_connMode == RTMP_CLIENT)
+				{
+					this->play();
+				}
 			}
 
 			ret = true;
@@ -1020,12 +1372,14 @@ bool RtmpConnection::handleOnStatus(RtmpMessage& rtmpMsg)
 				if (m_status == "NetStream.Publish.Start")
 				{
 					m_isPublishing = true;					
+					this->completeOpen(true, m_status);
 				}		
 				else if(m_status == "NetStream.publish.Unauthorized"
 						|| m_status == "NetStream.Publish.BadConnection" /*"Connection already publishing"*/
 						|| m_status == "NetStream.Publish.BadName")      /*Stream already publishing*/
 				{
 					ret = false;
+					this->completeOpen(false, m_status);
 				}
 			}
 			else if (m_connMode == RTMP_CLIENT)
@@ -1033,12 +1387,14 @@ bool RtmpConnection::handleOnStatus(RtmpMessage& rtmpMsg)
 				if (/*amfObj.amf_string == "NetStream.Play.Reset" || */m_status == "NetStream.Play.Start")
 				{
 					m_isPlaying = true;
+					this->completeOpen(true, m_status);
 				}
 				else if(m_status == "NetStream.play.Unauthorized"
 						|| m_status == "NetStream.Play.UnpublishNotify"  /*"stream is now unpublished."*/
 						|| m_status == "NetStream.Play.BadConnection")   /*"Connection already playing"*/
 				{
 					ret = false;
+					this->completeOpen(false, m_status);
 				}
 			}
 		}
@@ -1071,6 +1427,10 @@ bool RtmpConnection::sendMetaData(AmfObjects metaData)
 	}
 
     m_amfEnc.reset();
+    if(m_connMode == RTMP_PUBLISHER)
+    {
+        m_amfEnc.encodeString("@setDataFrame", 13);
+    }
     m_amfEnc.encodeString("onMetaData", 10);
     m_amfEnc.encodeECMA(metaData);
     if(!sendNotifyMessage(RTMP_CHUNK_DATA_ID, m_amfEnc.data(), m_amfEnc.size()))
@@ -1128,6 +1488,12 @@ void RtmpConnection::setPlayCB(const PlayCallback& cb)
 	m_playCB = cb;
 }
 
+void RtmpConnection::setRelaySession(std::shared_ptr<RtmpSession> session)
+{
+	std::lock_guard<std::mutex> lock(m_relayMutex);
+	m_relaySession = session;
+}
+
 bool RtmpConnection::sendInvokeMessage(uint32_t csid, std::shared_ptr<char> payload, uint32_t payloadSize)
 {
     if(this->isClosed())
@@ -1169,7 +1535,8 @@ bool RtmpConnection::isKeyFrame(std::shared_ptr<char> payload, uint32_t payloadS
 	return (frameType == 1 && codecId == RTMP_CODEC_ID_H264);
 }
 
-bool RtmpConnection::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize)
+bool RtmpConnection::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize,
+                                   std::vector<RtmpChunks> *chunkCache, const FrameTiming *timing)
 {
     if(this->isClosed())
     {
@@ -1194,13 +1561,64 @@ bool RtmpConnection::sendMediaData(uint8_t type, uint64_t timestamp, std::shared
 		m_aacSequenceHeaderSize = payloadSize;
 	}
 
+	RtmpMessage rtmpMsg;
+	rtmpMsg._timestamp = timestamp;
+	rtmpMsg.streamId = m_streamId;
+	rtmpMsg.payload = payload;
+	rtmpMsg.length = payloadSize;
+	uint32_t csid = 0;
+
+	if (type == RTMP_VIDEO || type == RTMP_AVC_SEQUENCE_HEADER)
+	{
+		rtmpMsg.typeId = RTMP_VIDEO;
+		csid = RTMP_CHUNK_VIDEO_ID;
+	}
+	else if (type == RTMP_AUDIO || type == RTMP_AAC_SEQUENCE_HEADER)
+	{
+		rtmpMsg.typeId = RTMP_AUDIO;
+		csid = RTMP_CHUNK_AUDIO_ID;
+	}
+	else
+	{
+		return false;
+	}
+
+	// connections with the same chunk size and stream id get the same bytes
+	RtmpChunks chunks;
+	if (chunkCache != nullptr)
+	{
+		for (auto& iter : *chunkCache)
+		{
+			if (iter.chunkSize == m_outChunkSize && iter.streamId == m_streamId)
+			{
+				chunks = iter;
+				break;
+			}
+		}
+
+		if (chunks.data == nullptr)
+		{
+			chunks.chunkSize = m_outChunkSize;
+			chunks.streamId = m_streamId;
+			chunks.data = this->createRtmpChunks(csid, rtmpMsg, m_outChunkSize, chunks.size);
+			chunkCache->push_back(chunks);
+		}
+	}
+
+	FrameTiming frameTiming;
+	if (timing != nullptr && timing->arrivalTime != 0 && chunks.data != nullptr)
+	{
+		frameTiming = *timing;
+		frameTiming.enqueueTime = TaskScheduler::getMicroseconds();
+	}
+
 	auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
-	m_taskScheduler->addTriggerEvent([conn, type, timestamp, payload, payloadSize] {
+	bool ret = _taskScheduler->runInLoop([conn, type, csid, rtmpMsg, chunks, frameTiming] () mutable {
 		if (!conn->m_hasKeyFrame && conn->m_avcSequenceHeaderSize > 0
 			&& (type != RTMP_AVC_SEQUENCE_HEADER)
 			&& (type != RTMP_AAC_SEQUENCE_HEADER))
 		{
-			if (conn->isKeyFrame(payload, payloadSize))
+			if (conn->isKeyFrame(rtmpMsg.payload, rtmpMsg.length))
 			{
 				conn->m_hasKeyFrame = true;
 			}
@@ -1210,25 +1628,32 @@ bool RtmpConnection::sendMediaData(uint8_t type, uint64_t timestamp, std::shared
 			}
 		}
 
-		RtmpMessage rtmpMsg;
-		rtmpMsg._timestamp = timestamp;
-		rtmpMsg.streamId = conn->m_streamId;
-		rtmpMsg.payload = payload;
-		rtmpMsg.length = payloadSize;
-
-		if (type == RTMP_VIDEO || type == RTMP_AVC_SEQUENCE_HEADER)
+		bool isSent = false;
+		if (chunks.data != nullptr)
 		{
-			rtmpMsg.typeId = RTMP_VIDEO;
-			conn->sendRtmpChunks(RTMP_CHUNK_VIDEO_ID, rtmpMsg);
+			if (frameTiming.arrivalTime != 0)
+			{
+				conn->m_latency.recordDequeue(frameTiming, TaskScheduler::getMicroseconds(),
+				                              (conn->m_metrics != nullptr) ? &conn->m_metrics->latency : nullptr);
+			}
+			isSent = conn->send(chunks.data, chunks.size, frameTiming.arrivalTime);
 		}
-		else if (type == RTMP_AUDIO || type == RTMP_AAC_SEQUENCE_HEADER)
+		else
 		{
-			rtmpMsg.typeId = RTMP_AUDIO;
-			conn->sendRtmpChunks(RTMP_CHUNK_AUDIO_ID, rtmpMsg);
+			isSent = conn->sendRtmpChunks(csid, rtmpMsg);
+		}
+
+		if (!isSent && conn->m_metrics != nullptr && !conn->isClosed())
+		{
+			Metrics::add(conn->m_metrics->droppedFrames);
 		}
 	});
-   
-    return true;
+
+	if (!ret && m_metrics != nullptr)
+	{
+		Metrics::add(m_metrics->droppedFrames);
+	}
+    return ret;
 }
 
 bool RtmpConnection::sendVideoData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize)
@@ -1239,7 +1664,7 @@ bool RtmpConnection::sendVideoData(uint64_t timestamp, std::shared_ptr<char> pay
 	}
 	
 	auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
-	m_taskScheduler->addTriggerEvent([conn, timestamp, payload, payloadSize] {
+	_taskScheduler->runInLoop([conn, timestamp, payload, payloadSize] {
 		RtmpMessage rtmpMsg;
 		rtmpMsg.typeId = RTMP_VIDEO;
 		rtmpMsg._timestamp = timestamp;
@@ -1260,7 +1685,7 @@ bool RtmpConnection::sendAudioData(uint64_t timestamp, std::shared_ptr<char> pay
 	}
 
 	auto conn = std::dynamic_pointer_cast<RtmpConnection>(shared_from_this());
-	m_taskScheduler->addTriggerEvent([conn, timestamp, payload, payloadSize] {
+	_taskScheduler->runInLoop([conn, timestamp, payload, payloadSize] {
 		RtmpMessage rtmpMsg;
 		rtmpMsg.typeId = RTMP_AUDIO;
 		rtmpMsg._timestamp = timestamp;
@@ -1272,48 +1697,77 @@ bool RtmpConnection::sendAudioData(uint64_t timestamp, std::shared_ptr<char> pay
 	return true;
 }
 
-void RtmpConnection::sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg)
+bool RtmpConnection::sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg)
 {    
-    uint32_t bufferOffset = 0, payloadOffset = 0;
-    uint32_t capacity = rtmpMsg.length + rtmpMsg.length/m_outChunkSize*5 + 1024; 
-    std::shared_ptr<char> bufferPtr(new char[capacity]);
+    uint32_t size = 0;
+    std::shared_ptr<char> bufferPtr = this->createRtmpChunks(csid, rtmpMsg, m_outChunkSize, size);
+    return this->send(bufferPtr, size);
+}
+
+bool RtmpConnection::sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg, const RtmpPayloadPart *parts, int count)
+{
+    uint32_t size = 0;
+    std::shared_ptr<char> bufferPtr = this->createRtmpChunks(csid, rtmpMsg, parts, count, m_outChunkSize, size);
+    return this->send(bufferPtr, size);
+}
+
+std::shared_ptr<char> RtmpConnection::createRtmpChunks(uint32_t csid, const RtmpMessage& rtmpMsg, uint32_t chunkSize, uint32_t& size)
+{
+    RtmpPayloadPart part;
+    part.data = rtmpMsg.payload.get();
+    part.size = rtmpMsg.length;
+    return this->createRtmpChunks(csid, rtmpMsg, &part, 1, chunkSize, size);
+}
+
+std::shared_ptr<char> RtmpConnection::createRtmpChunks(uint32_t csid, const RtmpMessage& rtmpMsg, const RtmpPayloadPart *parts, int count,
+                                                       uint32_t chunkSize, uint32_t& size)
+{
+    RtmpMessage msg = rtmpMsg;
+    uint32_t bufferOffset = 0, chunkLeft = chunkSize;
+    uint32_t capacity = msg.length + msg.length/chunkSize*5 + 1024; 
+    std::shared_ptr<char> bufferPtr(new char[capacity], std::default_delete<char[]>());
     char* buffer = bufferPtr.get();
 
     bufferOffset += this->createChunkBasicHeader(0, csid, buffer + bufferOffset); //first chunk
-    bufferOffset += this->createChunkMessageHeader(0, rtmpMsg, buffer + bufferOffset);
-    if(rtmpMsg._timestamp >= 0xffffff)
+    bufferOffset += this->createChunkMessageHeader(0, msg, buffer + bufferOffset);
+    if(msg._timestamp >= 0xffffff)
     {
-        writeUint32BE((char*)buffer + bufferOffset, (uint32_t)rtmpMsg._timestamp);
+        writeUint32BE((char*)buffer + bufferOffset, (uint32_t)msg._timestamp);
         bufferOffset += 4;
     }
-	int a = 0, p = rtmpMsg.length;
-    while(rtmpMsg.length > 0)
+
+    // the payload may be split over several parts, a chunk header goes before
+    // the first byte of every chunk after the first one
+    for (int n = 0; n < count && msg.length > 0; n++)
     {
-		a++;
-        if(rtmpMsg.length > m_outChunkSize)
+        const char *data = parts[n].data;
+        uint32_t length = std::min(parts[n].size, msg.length);
+        msg.length -= length;
+
+        while (length > 0)
         {
-            memcpy(buffer+bufferOffset, rtmpMsg.payload.get()+payloadOffset, m_outChunkSize);         
-            payloadOffset += m_outChunkSize;
-            bufferOffset += m_outChunkSize;
-            rtmpMsg.length -= m_outChunkSize;
-            
-            bufferOffset += this->createChunkBasicHeader(3, csid, buffer + bufferOffset);
-            if(rtmpMsg._timestamp >= 0xffffff)
+            if (chunkLeft == 0)
             {
-                writeUint32BE(buffer + bufferOffset, (uint32_t)rtmpMsg._timestamp);
-                bufferOffset += 4;
+                bufferOffset += this->createChunkBasicHeader(3, csid, buffer + bufferOffset);
+                if(msg._timestamp >= 0xffffff)
+                {
+                    writeUint32BE(buffer + bufferOffset, (uint32_t)msg._timestamp);
+                    bufferOffset += 4;
+                }
+                chunkLeft = chunkSize;
             }
-        }
-        else
-        {
-            memcpy(buffer+bufferOffset, rtmpMsg.payload.get()+payloadOffset, rtmpMsg.length);            
-            bufferOffset += rtmpMsg.length;
-            rtmpMsg.length = 0;            
-            break;
+
+            uint32_t bytes = std::min(length, chunkLeft);
+            memcpy(buffer + bufferOffset, data, bytes);
+            data += bytes;
+            length -= bytes;
+            chunkLeft -= bytes;
+            bufferOffset += bytes;
         }
     }
 
-    this->send(bufferPtr, bufferOffset);
+    size = bufferOffset;
+    return bufferPtr;
 }
 
 int RtmpConnection::createChunkBasicHeader(uint8_t fmt, uint32_t csid, char* buf)
@@ -5,6 +5,8 @@
 #include "net/TcpConnection.h"
 #include "amf.h"
 #include "rtmp.h"
+#include "FlvVodSource.h"
+#include "StreamMetrics.h"
 #include <vector>
 
 namespace xop
@@ -13,11 +15,31 @@ namespace xop
 class RtmpServer;
 class RtmpPublisher;
 class RtmpClient;
+class RtmpRelay;
+class RtmpSession;
+
+// The chunked bytes of one media message, built once per chunk size and
+// stream id and shared by the connections a session feeds.
+struct RtmpChunks
+{
+	uint32_t chunkSize = 0;
+	uint32_t streamId = 0;
+	std::shared_ptr<char> data;
+	uint32_t size = 0;
+};
+
+// A piece of a message payload, chunked without joining the pieces first.
+struct RtmpPayloadPart
+{
+	const char *data = nullptr;
+	uint32_t size = 0;
+};
 
 class RtmpConnection : public TcpConnection
 {
 public:    
 	using PlayCallback = std::function<void(uint8_t* payload, uint32_t length, uint8_t codecId, uint32_t timestamp)>;
+	using OpenCallback = std::function<void(bool isStarted, std::string status)>;
 
     enum ConnectionState
     {
@@ -48,6 +70,7 @@ public:
     RtmpConnection(RtmpServer* rtmpServer, TaskScheduler* taskScheduler, SOCKET sockfd);
 	RtmpConnection(RtmpPublisher *rtmpPublisher, TaskScheduler *taskScheduler, SOCKET sockfd);
 	RtmpConnection(RtmpClient *rtmpPublisher, TaskScheduler *taskScheduler, SOCKET sockfd);
+	RtmpConnection(RtmpRelay *rtmpRelay, ConnectionMode mode, TaskScheduler *taskScheduler, SOCKET sockfd);
     ~RtmpConnection();
 
     std::string getStreamPath() const
@@ -74,6 +97,10 @@ public:
 	bool isPublishing() const
 	{ return m_isPublishing; }
 
+	/* of the frames sent to this player */
+	const LatencyStats& getLatency() const
+	{ return m_latency; }
+
 	std::string getStatus()
 	{ 
 		if (m_status == "")
@@ -88,16 +115,21 @@ private:
 	friend class RtmpServer;
 	friend class RtmpPublisher;
 	friend class RtmpClient;
+	friend class RtmpPullRelay;
+	friend class RtmpPushRelay;
 
 	RtmpConnection(TaskScheduler *taskScheduler, SOCKET sockfd);
 
     bool onRead(BufferReader& buffer);
     void onClose();
+    void onPacketSent(int64_t arrivalTime, int64_t appendTime);
 
 	int parseChunkHeader(BufferReader& buffer);
 	int parseChunkBody(BufferReader& buffer);
 
 	bool handshake();
+	bool open(uint32_t msec, const OpenCallback& cb);
+	void completeOpen(bool isStarted, std::string status, bool isDeferred = false);
     bool handleHandshake(BufferReader& buffer);
     bool handleChunk(BufferReader& buffer);
     bool handleMessage(RtmpMessage& rtmpMsg);
@@ -117,31 +149,42 @@ private:
     bool handlePublish();
     bool handlePlay();
     bool handlePlay2();
+    bool openFile(std::string path);
+    bool playFile(FlvFile::Ptr filePtr);
+    bool sendPlayComplete();
+    bool sendStatus(const char *level, const char *code, const char *description);
+    bool sendRedirect(std::string url);
     bool handDeleteStream();
-	bool handleResult(RtmpMessage& rtmpMsg);
+	bool handleResult(RtmpMessage& rtmpMsg, uint32_t transactionId);
 	bool handleOnStatus(RtmpMessage& rtmpMsg);
 
     void setPeerBandwidth();
     void sendAcknowledgement();
     void setChunkSize();
 	void setPlayCB(const PlayCallback& cb);
+	void setRelaySession(std::shared_ptr<RtmpSession> session);
 
     bool sendInvokeMessage(uint32_t csid, std::shared_ptr<char> payload, uint32_t payloadSize);
     bool sendNotifyMessage(uint32_t csid, std::shared_ptr<char> payload, uint32_t payloadSize);   
     bool sendMetaData(AmfObjects metaData);
 	bool isKeyFrame(std::shared_ptr<char> payload, uint32_t payloadSize);
-    bool sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize);
+    bool sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize,
+                       std::vector<RtmpChunks> *chunkCache = nullptr, const FrameTiming *timing = nullptr);
 	bool sendVideoData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize);
 	bool sendAudioData(uint64_t timestamp, std::shared_ptr<char> payload, uint32_t payloadSize);
-    void sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg);
+    bool sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg);
+    bool sendRtmpChunks(uint32_t csid, RtmpMessage& rtmpMsg, const RtmpPayloadPart *parts, int count);
+    std::shared_ptr<char> createRtmpChunks(uint32_t csid, const RtmpMessage& rtmpMsg, uint32_t chunkSize, uint32_t& size);
+    std::shared_ptr<char> createRtmpChunks(uint32_t csid, const RtmpMessage& rtmpMsg, const RtmpPayloadPart *parts, int count,
+                                           uint32_t chunkSize, uint32_t& size);
     int createChunkBasicHeader(uint8_t fmt, uint32_t csid, char* buf);
     int createChunkMessageHeader(uint8_t fmt, RtmpMessage& rtmpMsg, char* buf);   
 
 	RtmpServer *m_rtmpServer = nullptr;
 	RtmpPublisher *m_rtmpPublisher = nullptr;
 	RtmpClient *m_rtmpClient = nullptr;
+	RtmpRelay *m_rtmpRelay = nullptr;
 	ConnectionMode m_connMode = RTMP_SERVER;
-	TaskScheduler *m_taskScheduler;
 	std::shared_ptr<xop::Channel> m_channelPtr;
 
 	uint32_t m_peerBandwidth = 5000000;
@@ -152,6 +195,9 @@ private:
 	uint32_t m_outChunkSize = 128;
 	uint32_t m_streamId = 0;
 	uint32_t m_number = 0;
+	uint32_t m_connectTransactionId = 0;
+	uint32_t m_createStreamTransactionId = 0;
+	bool m_isFastStart = false;
 	std::string m_app;
 	std::string m_streamName;
 	std::string m_streamPath;
@@ -167,11 +213,20 @@ private:
 	bool m_isPlaying = false;
 	bool m_isPublishing = false;
 	bool m_hasKeyFrame = false;
+	StreamMetrics::Ptr m_metrics; // of the session played, set by RtmpSession
+	LatencyStats m_latency;
 	std::shared_ptr<char> m_avcSequenceHeader;
 	std::shared_ptr<char> m_aacSequenceHeader;
 	uint32_t m_avcSequenceHeaderSize = 0;
 	uint32_t m_aacSequenceHeaderSize = 0;
 	PlayCallback m_playCB;
+	OpenCallback m_openCB;
+	TimerId m_openTimerId = 0;
+	std::shared_ptr<RtmpSession> m_relaySession; // pulled frames go to this session
+	std::mutex m_relayMutex; // held while they do, nullptr afterwards drops them
+	uint32_t m_playStart = 0; // ms
+	FlvVodSource::Ptr m_vodSource;
+	bool m_isVodOpening = false; // FlvFile::openAsync() pending
 
 	const uint32_t kStreamId = 1;
 	const int kChunkMessageLen[4] = { 11, 7, 3, 0 };
@@ -1,18 +1,29 @@
 #include "RtmpPublisher.h"
+#include "net/SocketUtil.h"
 #include "net/Logger.h"
 #include "net/log.h"
+#include <future>
 
 using namespace xop;
 
 RtmpPublisher::RtmpPublisher(xop::EventLoop *loop)
 	: m_eventLoop(loop)
+	, m_videoQueue(kSubmitQueueSize)
+	, m_audioQueue(kSubmitQueueSize)
+	, m_submitScheduler(nullptr)
+	, m_processPending(false)
+	, m_submitGuard(new SubmitGuard)
+	, m_videoDropped(false)
+	, m_droppedFrames(0)
 {
-
+	m_submitGuard->publisher = this;
 }
 
 RtmpPublisher::~RtmpPublisher()
 {
-
+	// waits for a batch being sent, a pending one finds nothing to do
+	std::lock_guard<std::mutex> lock(m_submitGuard->mutex);
+	m_submitGuard->publisher = nullptr;
 }
 
 int RtmpPublisher::setMediaInfo(MediaInfo mediaInfo)
@@ -54,46 +65,9 @@ int RtmpPublisher::setMediaInfo(MediaInfo mediaInfo)
 
 	if (m_mediaIinfo.videoCodecId == RTMP_CODEC_ID_H264)
 	{
-		if (m_mediaIinfo.spsSize > 0 && m_mediaIinfo.pps > 0)
+		if (m_mediaIinfo.spsSize > 0 && m_mediaIinfo.ppsSize > 0)
 		{
-			m_avcSequenceHeader.reset(new char[4096]);
-			uint8_t *data = (uint8_t *)m_avcSequenceHeader.get();
-			uint32_t index = 0;
-
-			data[index++] = 0x17; // 1:keyframe  7:avc
-			data[index++] = 0;    // 0: avc sequence header
-
-			data[index++] = 0;
-			data[index++] = 0;
-			data[index++] = 0;
-
-			// AVCDecoderConfigurationRecord
-			data[index++] = 0x01; // configurationVersion
-			data[index++] = m_mediaIinfo.sps.get()[1]; // AVCProfileIndication
-			data[index++] = m_mediaIinfo.sps.get()[2]; // profile_compatibility
-			data[index++] = m_mediaIinfo.sps.get()[3]; // AVCLevelIndication
-			data[index++] = 0xff; // lengthSizeMinusOne
-
-			// sps nums
-			data[index++] = 0xE1; //&0x1f
-
-			// sps data length
-			data[index++] = m_mediaIinfo.spsSize >> 8;
-			data[index++] = m_mediaIinfo.spsSize & 0xff;
-			// sps data
-			memcpy(data + index, m_mediaIinfo.sps.get(), m_mediaIinfo.spsSize);
-			index += m_mediaIinfo.spsSize;
-
-			// pps nums
-			data[index++] = 0x01; //&0x1f
-			 // pps data length
-			data[index++] = m_mediaIinfo.ppsSize >> 8;
-			data[index++] = m_mediaIinfo.ppsSize & 0xff;
-			// sps data
-			memcpy(data + index, m_mediaIinfo.pps.get(), m_mediaIinfo.ppsSize);
-			index += m_mediaIinfo.ppsSize;
-
-			m_avcSequenceHeaderSize = index;
+			this->createAvcSequenceHeader();
 		}
 		else
 		{
@@ -101,22 +75,167 @@ int RtmpPublisher::setMediaInfo(MediaInfo mediaInfo)
 		}
 	}
 
+	if (m_taskScheduler != nullptr)
+	{
+		CodecConfig config = this->getCodecConfig();
+		m_taskScheduler->addTriggerEvent([this, config]() {
+			m_codecConfig = config;
+		});
+	}
+
 	return 0;
 }
 
+void RtmpPublisher::createAvcSequenceHeader()
+{
+	m_avcSequenceHeader = createAvcSequenceHeader(m_mediaIinfo.sps.get(), m_mediaIinfo.spsSize,
+	                                              m_mediaIinfo.pps.get(), m_mediaIinfo.ppsSize, m_avcSequenceHeaderSize);
+}
+
+std::shared_ptr<char> RtmpPublisher::createAvcSequenceHeader(const uint8_t *sps, uint32_t spsSize, const uint8_t *pps, uint32_t ppsSize, uint32_t& size)
+{
+	size = 16 + spsSize + ppsSize;
+	std::shared_ptr<char> sequenceHeader(new char[size], std::default_delete<char[]>());
+	uint8_t *data = (uint8_t *)sequenceHeader.get();
+	uint32_t index = 0;
+
+	data[index++] = 0x17; // 1:keyframe  7:avc
+	data[index++] = 0;    // 0: avc sequence header
+
+	data[index++] = 0;
+	data[index++] = 0;
+	data[index++] = 0;
+
+	// AVCDecoderConfigurationRecord
+	data[index++] = 0x01; // configurationVersion
+	data[index++] = sps[1]; // AVCProfileIndication
+	data[index++] = sps[2]; // profile_compatibility
+	data[index++] = sps[3]; // AVCLevelIndication
+	data[index++] = 0xff; // lengthSizeMinusOne
+
+	// sps nums
+	data[index++] = 0xE1; //&0x1f
+
+	// sps data length
+	data[index++] = spsSize >> 8;
+	data[index++] = spsSize & 0xff;
+	// sps data
+	memcpy(data + index, sps, spsSize);
+	index += spsSize;
+
+	// pps nums
+	data[index++] = 0x01; //&0x1f
+	 // pps data length
+	data[index++] = ppsSize >> 8;
+	data[index++] = ppsSize & 0xff;
+	// sps data
+	memcpy(data + index, pps, ppsSize);
+	index += ppsSize;
+
+	return sequenceHeader;
+}
+
+RtmpPublisher::CodecConfig RtmpPublisher::getCodecConfig()
+{
+	CodecConfig config;
+	if (m_mediaIinfo.videoCodecId == RTMP_CODEC_ID_H264)
+	{
+		config.sps.assign(m_mediaIinfo.sps.get(), m_mediaIinfo.sps.get() + m_mediaIinfo.spsSize);
+		config.pps.assign(m_mediaIinfo.pps.get(), m_mediaIinfo.pps.get() + m_mediaIinfo.ppsSize);
+		config.avcSequenceHeader = m_avcSequenceHeader;
+		config.avcSequenceHeaderSize = m_avcSequenceHeaderSize;
+		config.hasVideo = true;
+	}
+
+	if (m_mediaIinfo.audioCodecId == RTMP_CODEC_ID_AAC)
+	{
+		config.aacSequenceHeader = m_aacSequenceHeader;
+		config.aacSequenceHeaderSize = m_aacSequenceHeaderSize;
+		config.audioTag = m_audioTag;
+	}
+
+	return config;
+}
+
+bool RtmpPublisher::updateParameterSets(const NalUnit *sps, const NalUnit *pps)
+{
+	if (sps == nullptr || pps == nullptr || sps->size < 4
+		|| (sps->size == m_mediaIinfo.spsSize && memcmp(sps->data, m_mediaIinfo.sps.get(), sps->size) == 0
+			&& pps->size == m_mediaIinfo.ppsSize && memcmp(pps->data, m_mediaIinfo.pps.get(), pps->size) == 0))
+	{
+		return false;
+	}
+
+	m_mediaIinfo.sps.reset(new uint8_t[sps->size], std::default_delete<uint8_t[]>());
+	memcpy(m_mediaIinfo.sps.get(), sps->data, sps->size);
+	m_mediaIinfo.spsSize = sps->size;
+	m_mediaIinfo.pps.reset(new uint8_t[pps->size], std::default_delete<uint8_t[]>());
+	memcpy(m_mediaIinfo.pps.get(), pps->data, pps->size);
+	m_mediaIinfo.ppsSize = pps->size;
+	this->createAvcSequenceHeader();
+	return true;
+}
+
+std::shared_ptr<char> RtmpPublisher::getPayloadBuffer(uint32_t size)
+{
+	for (auto& buffer : m_payloadBuffers)
+	{
+		// the connection dropped its reference once the chunks were created
+		if (buffer.data.use_count() == 1)
+		{
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (buffer.capacity < size)
+			{
+				buffer.capacity = size + size / 2;
+				buffer.data.reset(new char[buffer.capacity], std::default_delete<char[]>());
+			}
+			return buffer.data;
+		}
+	}
+
+	if (m_payloadBuffers.size() < kMaxPayloadBuffers)
+	{
+		PayloadBuffer buffer;
+		buffer.capacity = size + size / 2;
+		buffer.data.reset(new char[buffer.capacity], std::default_delete<char[]>());
+		m_payloadBuffers.push_back(buffer);
+		return buffer.data;
+	}
+
+	// all in flight, the sender is behind
+	return std::shared_ptr<char>(new char[size], std::default_delete<char[]>());
+}
+
 int RtmpPublisher::openUrl(std::string url, int msec, std::string& status)
+{
+	std::shared_ptr<std::promise<std::pair<int, std::string>>> promise(new std::promise<std::pair<int, std::string>>());
+	std::future<std::pair<int, std::string>> future = promise->get_future();
+	int ret = this->openUrlAsync(url, msec, [promise](int result, std::string status) {
+		promise->set_value(std::make_pair(result, status));
+	});
+
+	if (ret != 0)
+	{
+		return -1;
+	}
+
+	std::pair<int, std::string> result = future.get();
+	status = result.second;
+	return result.first;
+}
+
+int RtmpPublisher::openUrlAsync(std::string url, int msec, const OpenCallback& cb)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
-	
-	static xop::Timestamp tp;
+
+	m_submitScheduler = nullptr;
 	int timeout = msec;
 	if (timeout <= 0)
 	{
 		timeout = 10000;
 	}
 
-	tp.reset();
-
+	m_streamPath.clear(); // parseRtmpUrl() appends to it
 	if (this->parseRtmpUrl(url) != 0)
 	{
 		LOG_INFO("[RtmpPublisher] rtmp url(%s) was illegal.\n", url.c_str());
@@ -125,54 +244,72 @@ int RtmpPublisher::openUrl(std::string url, int msec, std::string& status)
 
 	//LOG_INFO("[RtmpPublisher] ip:%s, port:%hu, stream path:%s\n", m_ip.c_str(), m_port, m_streamPath.c_str());
 
-	if (m_rtmpConn != nullptr)
-	{		
-		std::shared_ptr<RtmpConnection> rtmpConn = m_rtmpConn;
-		SOCKET sockfd = rtmpConn->fd();
-		m_taskScheduler->addTriggerEvent([sockfd, rtmpConn]() {
-			rtmpConn->disconnect();
-		});
-		m_rtmpConn = nullptr;
+	for (auto rtmpConnPtr : { &m_rtmpConn, &m_openingConn })
+	{
+		if (*rtmpConnPtr != nullptr)
+		{
+			std::shared_ptr<RtmpConnection> rtmpConn = *rtmpConnPtr;
+			m_taskScheduler->addTriggerEvent([rtmpConn]() {
+				rtmpConn->disconnect();
+			});
+			*rtmpConnPtr = nullptr;
+		}
 	}
 
 	TcpSocket tcpSocket;
 	tcpSocket.create();
-	if (!tcpSocket.connect(m_ip, m_port, timeout))
+	if (!SocketUtil::connectNonBlock(tcpSocket.fd(), m_ip, m_port))
 	{
 		tcpSocket.close();
 		return -1;
 	}
 
-	m_taskScheduler = m_eventLoop->getTaskScheduler().get();
-	m_rtmpConn.reset(new RtmpConnection((RtmpPublisher*)this, m_taskScheduler, tcpSocket.fd()));
-	m_taskScheduler->addTriggerEvent([this]() {
-		m_rtmpConn->handshake();
+	if (m_taskScheduler == nullptr) // submitted frames stay on one thread
+	{
+		m_taskScheduler = m_eventLoop->getTaskScheduler().get();
+	}
+
+	std::shared_ptr<RtmpConnection> rtmpConn(new RtmpConnection((RtmpPublisher*)this, m_taskScheduler, tcpSocket.fd()));
+	std::weak_ptr<RtmpConnection> weakConn = rtmpConn;
+	bool ret = rtmpConn->open(timeout, [this, weakConn, cb](bool isStarted, std::string status) {
+		isStarted = this->handleOpen(weakConn.lock(), isStarted);
+		cb(isStarted ? 0 : -1, status);
 	});
 
-	timeout -= (int)tp.elapsed();
-	if (timeout < 0)
+	if (!ret)
 	{
-		timeout = 1000;
+		rtmpConn->disconnect();
+		return -1;
 	}
 
-	do
+	m_openingConn = rtmpConn;
+	return 0;
+}
+
+bool RtmpPublisher::handleOpen(std::shared_ptr<RtmpConnection> rtmpConn, bool isStarted)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (rtmpConn == nullptr || rtmpConn != m_openingConn) // closed or opened again meanwhile
 	{
-		xop::Timer::sleep(100);
-		timeout -= 100;	
-	} while (!m_rtmpConn->isClosed() && !m_rtmpConn->isPublishing() && timeout>0);
-	
-	status = m_rtmpConn->getStatus();
-	if (!m_rtmpConn->isPublishing())
+		if (rtmpConn != nullptr && !rtmpConn->isClosed())
+		{
+			rtmpConn->disconnect();
+		}
+		return false;
+	}
+
+	m_openingConn = nullptr;
+	if (!isStarted)
 	{
-		std::shared_ptr<RtmpConnection> rtmpConn = m_rtmpConn;
-		SOCKET sockfd = rtmpConn->fd();
-		m_taskScheduler->addTriggerEvent([sockfd, rtmpConn]() {
+		if (!rtmpConn->isClosed())
+		{
 			rtmpConn->disconnect();
-		});
-		m_rtmpConn = nullptr;
-		return -1;
+		}
+		return false;
 	}
 
+	m_rtmpConn = rtmpConn;
 	m_videoTimestamp = 0;
 	m_audioTimestamp = 0;
 	m_hasKeyFrame = true;
@@ -181,19 +318,41 @@ int RtmpPublisher::openUrl(std::string url, int msec, std::string& status)
 		m_hasKeyFrame = false;
 	}
 
-	return 0;
+	// on the loop thread already
+	m_submitConn = rtmpConn;
+	m_codecConfig = this->getCodecConfig();
+	m_isStarted = false;
+	m_waitKeyFrame = true;
+	m_hasNewParameterSets = false;
+	m_submitScheduler = m_taskScheduler;
+	return true;
 }
 
 void RtmpPublisher::close()
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
 
+	m_submitScheduler = nullptr;
+	if (m_openingConn != nullptr)
+	{
+		std::shared_ptr<RtmpConnection> rtmpConn = m_openingConn;
+		m_taskScheduler->addTriggerEvent([rtmpConn]() {
+			rtmpConn->disconnect();
+		});
+		m_openingConn = nullptr;
+	}
+
 	if (m_rtmpConn != nullptr)
 	{		
 		std::shared_ptr<RtmpConnection> rtmpConn = m_rtmpConn;
-		SOCKET sockfd = rtmpConn->fd();
-		m_taskScheduler->addTriggerEvent([sockfd, rtmpConn]() {
+		std::shared_ptr<SubmitGuard> guard = m_submitGuard;
+		m_taskScheduler->addTriggerEvent([guard, rtmpConn]() {
 			rtmpConn->disconnect();
+			std::lock_guard<std::mutex> lock(guard->mutex);
+			if (guard->publisher != nullptr && guard->publisher->m_submitConn == rtmpConn)
+			{
+				guard->publisher->m_submitConn = nullptr;
+			}
 		});
 		m_rtmpConn = nullptr;
 		m_videoTimestamp = 0;
@@ -214,25 +373,10 @@ bool RtmpPublisher::isConnected()
 	return false;
 }
 
-bool RtmpPublisher::isKeyFrame(uint8_t *data, uint32_t size)
+void RtmpPublisher::setKeepInbandNals(bool keep)
 {
-	int startCode = 0;
-	if (data[0] == 0 && data[1] == 0 && data[2] == 1)
-	{
-		startCode = 3;
-	}
-	else if (data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 1)
-	{
-		startCode = 4;
-	}
-
-	int type = data[startCode] & 0x1f;
-	if (type == 5 || type == 7) /* sps_pps_idr or idr */
-	{
-		return true;
-	}
-	
-	return false;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_keepInbandNals = keep;
 }
 
 int RtmpPublisher::pushVideoFrame(uint8_t *data, uint32_t size)
@@ -246,10 +390,43 @@ int RtmpPublisher::pushVideoFrame(uint8_t *data, uint32_t size)
 
 	if (m_mediaIinfo.videoCodecId == RTMP_CODEC_ID_H264)
 	{
-		if (!m_hasKeyFrame)
+		if (H264Parser::findNals(data, size, m_nals) == 0)
+		{
+			NalUnit nal; // a single nal unit without start code
+			nal.data = data;
+			nal.size = size;
+			m_nals.push_back(nal);
+		}
+
+		bool isKeyFrame = false;
+		const NalUnit *sps = nullptr, *pps = nullptr;
+		uint32_t payloadSize = 5;
+		for (auto& nal : m_nals)
 		{
+			uint8_t type = nal.getType();
+			if (type == 5) /* idr */
+			{
+				isKeyFrame = true;
+			}
+			else if (type == 7)
+			{
+				sps = &nal;
+			}
+			else if (type == 8)
+			{
+				pps = &nal;
+			}
+
+			if (m_keepInbandNals || (type != 7 && type != 8 && type != 9))
+			{
+				payloadSize += 4 + nal.size;
+			}
+		}
 
-			if (this->isKeyFrame(data, size))
+		bool hasNewParameterSets = this->updateParameterSets(sps, pps);
+		if (!m_hasKeyFrame)
+		{
+			if (isKeyFrame)
 			{
 				m_hasKeyFrame = true;
 				m_timestamp.reset();
@@ -263,6 +440,15 @@ int RtmpPublisher::pushVideoFrame(uint8_t *data, uint32_t size)
 				return 0;
 			}
 		}
+		else if (hasNewParameterSets)
+		{
+			m_rtmpConn->sendVideoData(m_timestamp.elapsed(), m_avcSequenceHeader, m_avcSequenceHeaderSize);
+		}
+
+		if (payloadSize == 5)
+		{
+			return 0; // only parameter sets and delimiters
+		}
 
 		uint64_t timestamp = m_timestamp.elapsed();
 		//uint64_t timestamp_delta = 0;
@@ -273,26 +459,31 @@ int RtmpPublisher::pushVideoFrame(uint8_t *data, uint32_t size)
 		//timestamp_delta = timestamp - m_videoTimestamp;
 		//m_videoTimestamp = timestamp;
 
-		std::shared_ptr<char> payload(new char[size + 4096]);
-		uint32_t payloadSize = 0;
-
+		std::shared_ptr<char> payload = this->getPayloadBuffer(payloadSize);
 		uint8_t *buffer = (uint8_t *)payload.get();
 		uint32_t index = 0;
-		buffer[index++] = this->isKeyFrame(data, size) ? 0x17: 0x27;
+		buffer[index++] = isKeyFrame ? 0x17: 0x27;
 		buffer[index++] = 1;
 
 		buffer[index++] = 0;
 		buffer[index++] = 0;
 		buffer[index++] = 0;
 
-		buffer[index++] = (size >> 24) & 0xff;
-		buffer[index++] = (size >> 16) & 0xff;
-		buffer[index++] = (size >> 8) & 0xff;
-		buffer[index++] = (size) & 0xff;
+		// AVCC: every nal unit with its 4 byte length
+		for (auto& nal : m_nals)
+		{
+			uint8_t type = nal.getType();
+			if (!m_keepInbandNals && (type == 7 || type == 8 || type == 9))
+			{
+				continue;
+			}
+
+			writeUint32BE((char *)buffer + index, nal.size);
+			index += 4;
+			memcpy(buffer + index, nal.data, nal.size);
+			index += nal.size;
+		}
 
-		memcpy(buffer + index, data, size);
-		index += size;
-		payloadSize = index;
 		//m_taskScheduler->addTriggerEvent([=]() {
 			m_rtmpConn->sendVideoData(timestamp, payload, payloadSize);
 		//});
@@ -332,4 +523,317 @@ int RtmpPublisher::pushAudioFrame(uint8_t *data, uint32_t size)
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+RtmpPublisher::SubmitStatus RtmpPublisher::submitVideoFrame(std::shared_ptr<char> data, uint32_t size, uint64_t pts, uint64_t dts)
+{
+	if (data == nullptr || size == 0)
+	{
+		return SUBMIT_INVALID;
+	}
+
+	MediaFrame frame;
+	frame.data = std::move(data);
+	frame.size = size;
+	frame.pts = pts;
+	frame.dts = dts;
+	return this->submitFrame(m_videoQueue, frame);
+}
+
+RtmpPublisher::SubmitStatus RtmpPublisher::submitVideoFrame(std::shared_ptr<char> data, const NalUnit *nals, uint32_t count,
+                                                            uint64_t pts, uint64_t dts)
+{
+	if (data == nullptr || nals == nullptr || count == 0)
+	{
+		return SUBMIT_INVALID;
+	}
+
+	MediaFrame frame;
+	frame.nals.reserve(count);
+	for (uint32_t n = 0; n < count; n++)
+	{
+		if (nals[n].data != nullptr && nals[n].size > 0)
+		{
+			frame.nals.push_back(nals[n]);
+			frame.size += nals[n].size;
+		}
+	}
+
+	if (frame.nals.empty())
+	{
+		return SUBMIT_INVALID;
+	}
+
+	frame.data = std::move(data);
+	frame.pts = pts;
+	frame.dts = dts;
+	return this->submitFrame(m_videoQueue, frame);
+}
+
+RtmpPublisher::SubmitStatus RtmpPublisher::submitAudioFrame(std::shared_ptr<char> data, uint32_t size, uint64_t pts)
+{
+	if (data == nullptr || size == 0)
+	{
+		return SUBMIT_INVALID;
+	}
+
+	MediaFrame frame;
+	frame.data = std::move(data);
+	frame.size = size;
+	frame.pts = frame.dts = pts;
+	return this->submitFrame(m_audioQueue, frame);
+}
+
+RtmpPublisher::SubmitStatus RtmpPublisher::submitFrame(SpscQueue<MediaFrame>& queue, MediaFrame& frame)
+{
+	TaskScheduler *taskScheduler = m_submitScheduler.load(std::memory_order_acquire);
+	if (taskScheduler == nullptr)
+	{
+		return SUBMIT_NOT_CONNECTED;
+	}
+
+	if (!queue.push(std::move(frame)))
+	{
+		m_droppedFrames++;
+		if (&queue == &m_videoQueue)
+		{
+			m_videoDropped = true;
+		}
+		return SUBMIT_QUEUE_FULL;
+	}
+
+	// one trigger event per batch, posted when the loop thread is not already on its way
+	if (!m_processPending.exchange(true))
+	{
+		std::shared_ptr<SubmitGuard> guard = m_submitGuard;
+		if (!taskScheduler->addTriggerEvent([guard]() {
+			std::lock_guard<std::mutex> lock(guard->mutex);
+			if (guard->publisher != nullptr)
+			{
+				guard->publisher->processFrames();
+			}
+		}))
+		{
+			m_processPending = false; // posted again by the next frame
+		}
+	}
+
+	return SUBMIT_OK;
+}
+
+void RtmpPublisher::processFrames()
+{
+	m_processPending = false;
+
+	// both queues in timestamp order
+	MediaFrame video, audio;
+	bool hasVideo = m_videoQueue.pop(video);
+	bool hasAudio = m_audioQueue.pop(audio);
+	while (hasVideo || hasAudio)
+	{
+		if (hasVideo && (!hasAudio || video.dts <= audio.dts))
+		{
+			this->sendVideoFrame(video);
+			hasVideo = m_videoQueue.pop(video);
+		}
+		else
+		{
+			this->sendAudioFrame(audio);
+			hasAudio = m_audioQueue.pop(audio);
+		}
+	}
+}
+
+void RtmpPublisher::sendSubmittedData(uint8_t type, uint64_t timestamp, const RtmpPayloadPart *parts, int count)
+{
+	RtmpMessage rtmpMsg;
+	rtmpMsg.typeId = type;
+	rtmpMsg._timestamp = (timestamp > m_baseTimestamp) ? timestamp - m_baseTimestamp : 0;
+	rtmpMsg.streamId = m_submitConn->m_streamId;
+	for (int n = 0; n < count; n++)
+	{
+		rtmpMsg.length += parts[n].size;
+	}
+
+	// sent in place rather than through sendVideoData(), which would queue it behind this frame
+	m_submitConn->sendRtmpChunks(type == RTMP_VIDEO ? RTMP_CHUNK_VIDEO_ID : RTMP_CHUNK_AUDIO_ID, rtmpMsg, parts, count);
+}
+
+void RtmpPublisher::sendSequenceHeader(uint8_t type, uint64_t timestamp)
+{
+	RtmpPayloadPart part;
+	if (type == RTMP_VIDEO)
+	{
+		part.data = m_codecConfig.avcSequenceHeader.get();
+		part.size = m_codecConfig.avcSequenceHeaderSize;
+	}
+	else
+	{
+		part.data = m_codecConfig.aacSequenceHeader.get();
+		part.size = m_codecConfig.aacSequenceHeaderSize;
+	}
+
+	if (part.data != nullptr)
+	{
+		this->sendSubmittedData(type, timestamp, &part, 1);
+	}
+}
+
+void RtmpPublisher::sendVideoFrame(MediaFrame& frame)
+{
+	if (m_videoDropped.exchange(false))
+	{
+		m_waitKeyFrame = true;
+	}
+
+	if (m_submitConn == nullptr || m_submitConn->isClosed())
+	{
+		m_submitScheduler = nullptr;
+		return;
+	}
+
+	std::vector<NalUnit>& nals = frame.nals.empty() ? m_frameNals : frame.nals;
+	if (frame.nals.empty() && H264Parser::findNals((const uint8_t *)frame.data.get(), frame.size, m_frameNals) == 0)
+	{
+		NalUnit nal; // a single nal unit without start code
+		nal.data = (const uint8_t *)frame.data.get();
+		nal.size = frame.size;
+		m_frameNals.push_back(nal);
+	}
+
+	bool isKeyFrame = false;
+	const NalUnit *sps = nullptr, *pps = nullptr;
+	uint32_t count = 0;
+	for (auto& nal : nals)
+	{
+		uint8_t type = nal.getType();
+		if (type == 5) /* idr */
+		{
+			isKeyFrame = true;
+		}
+		else if (type == 7)
+		{
+			sps = &nal;
+		}
+		else if (type == 8)
+		{
+			pps = &nal;
+		}
+
+		if (m_keepInbandNals || (type != 7 && type != 8 && type != 9))
+		{
+			count++;
+		}
+	}
+
+	CodecConfig& config = m_codecConfig;
+	config.hasVideo = true;
+	if (sps != nullptr && pps != nullptr && sps->size >= 4
+		&& (config.sps.size() != sps->size || memcmp(config.sps.data(), sps->data, sps->size) != 0
+			|| config.pps.size() != pps->size || memcmp(config.pps.data(), pps->data, pps->size) != 0))
+	{
+		config.sps.assign(sps->data, sps->data + sps->size);
+		config.pps.assign(pps->data, pps->data + pps->size);
+		config.avcSequenceHeader = createAvcSequenceHeader(sps->data, sps->size, pps->data, pps->size, config.avcSequenceHeaderSize);
+		m_hasNewParameterSets = true;
+	}
+
+	if (m_waitKeyFrame)
+	{
+		if (!isKeyFrame || config.avcSequenceHeader == nullptr)
+		{
+			return;
+		}
+		m_waitKeyFrame = false;
+	}
+
+	if (!m_isStarted)
+	{
+		m_isStarted = true;
+		m_hasNewParameterSets = false;
+		m_baseTimestamp = frame.dts;
+		this->sendSequenceHeader(RTMP_VIDEO, frame.dts);
+		this->sendSequenceHeader(RTMP_AUDIO, frame.dts);
+	}
+	else if (m_hasNewParameterSets)
+	{
+		m_hasNewParameterSets = false;
+		this->sendSequenceHeader(RTMP_VIDEO, frame.dts);
+	}
+
+	if (count == 0)
+	{
+		return; // only parameter sets and delimiters
+	}
+
+	// composition time, pts - dts, 24 bits signed
+	int32_t compositionTime = (int32_t)(frame.pts - frame.dts);
+	char header[5];
+	header[0] = isKeyFrame ? 0x17 : 0x27;
+	header[1] = 1;
+	header[2] = (char)((compositionTime >> 16) & 0xff);
+	header[3] = (char)((compositionTime >> 8) & 0xff);
+	header[4] = (char)(compositionTime & 0xff);
+
+	// AVCC straight from the submitted buffer, the only copy is into the chunks
+	m_nalLengths.resize(count * 4);
+	m_frameParts.resize(1 + count * 2);
+	m_frameParts[0].data = header;
+	m_frameParts[0].size = sizeof(header);
+	uint32_t index = 0;
+	for (auto& nal : nals)
+	{
+		uint8_t type = nal.getType();
+		if (!m_keepInbandNals && (type == 7 || type == 8 || type == 9))
+		{
+			continue;
+		}
+
+		char *length = m_nalLengths.data() + index * 4;
+		writeUint32BE(length, nal.size);
+		m_frameParts[1 + index * 2].data = length;
+		m_frameParts[1 + index * 2].size = 4;
+		m_frameParts[2 + index * 2].data = (const char *)nal.data;
+		m_frameParts[2 + index * 2].size = nal.size;
+		index++;
+	}
+
+	this->sendSubmittedData(RTMP_VIDEO, frame.dts, m_frameParts.data(), (int)m_frameParts.size());
+}
+
+void RtmpPublisher::sendAudioFrame(MediaFrame& frame)
+{
+	if (m_submitConn == nullptr || m_submitConn->isClosed())
+	{
+		m_submitScheduler = nullptr;
+		return;
+	}
+
+	if (m_codecConfig.aacSequenceHeader == nullptr)
+	{
+		return;
+	}
+
+	if (!m_isStarted)
+	{
+		if (m_codecConfig.hasVideo)
+		{
+			return; // starts with the first idr frame
+		}
+		m_isStarted = true;
+		m_baseTimestamp = frame.dts;
+		this->sendSequenceHeader(RTMP_AUDIO, frame.dts);
+	}
+
+	char header[2];
+	header[0] = m_codecConfig.audioTag;
+	header[1] = 1; // 0: aac sequence header, 1: aac raw data
+
+	RtmpPayloadPart parts[2];
+	parts[0].data = header;
+	parts[0].size = sizeof(header);
+	parts[1].data = frame.data.get();
+	parts[1].size = frame.size;
+
+	this->sendSubmittedData(RTMP_AUDIO, frame.dts, parts, 2);
+}
@@ -3,9 +3,12 @@
 
 #include <string>
 #include <mutex>
+#include <atomic>
 #include "RtmpConnection.h"
 #include "net/EventLoop.h"
+#include "net/SpscQueue.h"
 #include "net/Timestamp.h"
+#include "H264Parser.h"
 
 namespace xop
 {
@@ -13,29 +16,102 @@ namespace xop
 class RtmpPublisher : public Rtmp
 {
 public:
+	enum SubmitStatus
+	{
+		SUBMIT_OK = 0,
+		SUBMIT_QUEUE_FULL = 1,      // not queued, the connection is behind
+		SUBMIT_NOT_CONNECTED = -1,
+		SUBMIT_INVALID = -2,
+	};
+
+	using OpenCallback = std::function<void(int result, std::string status)>;
+
 	RtmpPublisher(xop::EventLoop *loop);
 	~RtmpPublisher();
 
 	int setMediaInfo(MediaInfo mediaInfo);
 
 	int openUrl(std::string url, int msec, std::string& status);
+
+	/* returns at once, cb is called on the event loop thread with 0 once publishing,
+	   or -1 when refused, closed or not publishing after msec. Not called if this fails. */
+	int openUrlAsync(std::string url, int msec, const OpenCallback& cb);
 	void close();
 	bool isConnected();
 
-	int pushVideoFrame(uint8_t *data, uint32_t size); /* (sps pps)idr frame or p frame */
+	/* Annex-B access unit, (sps pps)idr frame or p frame, sent as AVCC */
+	int pushVideoFrame(uint8_t *data, uint32_t size);
+
+	/* in-band sps, pps and access unit delimiters are dropped by default,
+	   changed parameter sets go out as a new sequence header either way */
+	void setKeepInbandNals(bool keep);
 
 	int pushAudioFrame(uint8_t *data, uint32_t size);
 
+	/* Non-blocking submission, one producer thread per media type. The frame is
+	   queued with a reference to data, parsed and sent from the loop thread.
+	   pts and dts are in milliseconds. A refused video frame makes the stream
+	   resume at the next idr frame. Not to be mixed with push*Frame(). */
+	SubmitStatus submitVideoFrame(std::shared_ptr<char> data, uint32_t size, uint64_t pts, uint64_t dts); /* Annex-B */
+	SubmitStatus submitVideoFrame(std::shared_ptr<char> data, const NalUnit *nals, uint32_t count,
+	                              uint64_t pts, uint64_t dts); /* nal units without start code, inside data */
+	SubmitStatus submitAudioFrame(std::shared_ptr<char> data, uint32_t size, uint64_t pts); /* raw aac */
+
+	uint64_t getDroppedFrames() const
+	{ return m_droppedFrames; }
+
 private:
 	friend class RtmpConnection;
 
-	RtmpPublisher() {}
-	bool isKeyFrame(uint8_t *data, uint32_t size);
+	// submitted frames waiting for the loop thread
+	struct MediaFrame
+	{
+		std::shared_ptr<char> data;
+		uint32_t size = 0;
+		uint64_t pts = 0;
+		uint64_t dts = 0;
+		std::vector<NalUnit> nals; // empty: Annex-B
+	};
+
+	// codec state of the submit path, only used on the loop thread
+	struct CodecConfig
+	{
+		std::vector<uint8_t> sps;
+		std::vector<uint8_t> pps;
+		std::shared_ptr<char> avcSequenceHeader;
+		uint32_t avcSequenceHeaderSize = 0;
+		std::shared_ptr<char> aacSequenceHeader;
+		uint32_t aacSequenceHeaderSize = 0;
+		uint8_t audioTag = 0;
+		bool hasVideo = false;
+	};
+
+	// held by the posted processing task, cleared when the publisher goes away
+	struct SubmitGuard
+	{
+		std::mutex mutex;
+		RtmpPublisher *publisher = nullptr;
+	};
+
+	RtmpPublisher() : RtmpPublisher(nullptr) {}
+	void createAvcSequenceHeader();
+	static std::shared_ptr<char> createAvcSequenceHeader(const uint8_t *sps, uint32_t spsSize, const uint8_t *pps, uint32_t ppsSize, uint32_t& size);
+	bool handleOpen(std::shared_ptr<RtmpConnection> rtmpConn, bool isStarted);
+	CodecConfig getCodecConfig();
+	SubmitStatus submitFrame(SpscQueue<MediaFrame>& queue, MediaFrame& frame);
+	void processFrames();
+	void sendVideoFrame(MediaFrame& frame);
+	void sendAudioFrame(MediaFrame& frame);
+	void sendSequenceHeader(uint8_t type, uint64_t timestamp);
+	void sendSubmittedData(uint8_t type, uint64_t timestamp, const RtmpPayloadPart *parts, int count);
+	bool updateParameterSets(const NalUnit *sps, const NalUnit *pps);
+	std::shared_ptr<char> getPayloadBuffer(uint32_t size);
 
 	xop::EventLoop *m_eventLoop = nullptr;
 	TaskScheduler *m_taskScheduler = nullptr;
 	std::mutex m_mutex;
 	std::shared_ptr<RtmpConnection> m_rtmpConn;
+	std::shared_ptr<RtmpConnection> m_openingConn; // until publishing
 
 	MediaInfo m_mediaIinfo;
 	std::shared_ptr<char> m_avcSequenceHeader;
@@ -44,7 +120,39 @@ private:
 	uint32_t m_aacSequenceHeaderSize = 0;
 	uint8_t m_audioTag = 0;
 	bool m_hasKeyFrame = false;
+	bool m_keepInbandNals = false;
+	std::vector<NalUnit> m_nals;
+
+	// video payloads reused once the connection is done with them
+	struct PayloadBuffer
+	{
+		std::shared_ptr<char> data;
+		uint32_t capacity = 0;
+	};
+	std::vector<PayloadBuffer> m_payloadBuffers;
+	static const size_t kMaxPayloadBuffers = 8;
 	xop::Timestamp m_timestamp;
+
+	SpscQueue<MediaFrame> m_videoQueue;
+	SpscQueue<MediaFrame> m_audioQueue;
+	std::atomic<TaskScheduler*> m_submitScheduler; // null when not publishing
+	std::atomic_bool m_processPending;
+	std::shared_ptr<SubmitGuard> m_submitGuard;
+	std::atomic_bool m_videoDropped;
+	std::atomic<uint64_t> m_droppedFrames;
+
+	// loop thread
+	std::shared_ptr<RtmpConnection> m_submitConn;
+	CodecConfig m_codecConfig;
+	bool m_isStarted = false;
+	bool m_waitKeyFrame = true;
+	bool m_hasNewParameterSets = false;
+	uint64_t m_baseTimestamp = 0;
+	std::vector<NalUnit> m_frameNals;
+	std::vector<RtmpPayloadPart> m_frameParts;
+	std::vector<char> m_nalLengths;
+
+	static const uint32_t kSubmitQueueSize = 64;
 	uint64_t m_videoTimestamp = 0;
 	uint64_t m_audioTimestamp = 0;
 
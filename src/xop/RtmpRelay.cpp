@@ -0,0 +1,310 @@
+#include "RtmpRelay.h"
+#include "RtmpConnection.h"
+#include "net/SocketUtil.h"
+#include "net/TcpSocket.h"
+#include "net/Logger.h"
+
+using namespace xop;
+
+RtmpPullRelay::RtmpPullRelay(TaskScheduler *taskScheduler, RtmpSession::Ptr session, std::vector<std::string> urls)
+	: m_taskScheduler(taskScheduler)
+	, m_session(session)
+	, m_urls(urls)
+	, m_isStopped(false)
+	, m_isTouched(false)
+{
+
+}
+
+RtmpPullRelay::~RtmpPullRelay()
+{
+
+}
+
+void RtmpPullRelay::start()
+{
+	std::weak_ptr<RtmpPullRelay> relay = shared_from_this();
+
+	m_taskScheduler->addTriggerEvent([relay] {
+		auto relayPtr = relay.lock();
+		if (relayPtr != nullptr && !relayPtr->isStopped())
+		{
+			relayPtr->m_idleClock.reset();
+			relayPtr->connect();
+		}
+	});
+
+	m_taskScheduler->addTimer([relay] {
+		auto relayPtr = relay.lock();
+		if (relayPtr == nullptr)
+		{
+			return false;
+		}
+		return relayPtr->onTimer();
+	}, kInterval);
+}
+
+void RtmpPullRelay::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isStopped = true;
+		if (m_rtmpConn != nullptr)
+		{
+			m_rtmpConn->setRelaySession(nullptr); // waits for a frame being relayed
+		}
+	}
+
+	auto relay = shared_from_this();
+	m_taskScheduler->addTriggerEvent([relay] {
+		relay->close();
+	});
+}
+
+bool RtmpPullRelay::onTimer()
+{
+	if (m_isStopped)
+	{
+		this->close();
+		return false;
+	}
+
+	if (m_isTouched.exchange(false) || m_session->getClients() > 0)
+	{
+		m_idleClock.reset();
+	}
+	else if (m_idleClock.elapsed() >= m_idleTime)
+	{
+		LOG_INFO("[Relay] %s idle, stop pulling.\n", m_streamPath.c_str());
+		m_isStopped = true;
+		this->close();
+		if (m_closeCB)
+		{
+			m_closeCB(shared_from_this());
+		}
+		return false;
+	}
+
+	if (m_rtmpConn != nullptr)
+	{
+		if (m_rtmpConn->isClosed())
+		{
+			LOG_INFO("[Relay] %s disconnected.\n", this->getUrl().c_str());
+		}
+		else if (!m_rtmpConn->isPlaying() && m_connectClock.elapsed() >= kConnectTimeout)
+		{
+			LOG_INFO("[Relay] %s timeout.\n", this->getUrl().c_str());
+		}
+		else
+		{
+			return true;
+		}
+
+		// fail over to the next origin
+		this->close();
+		m_urlIndex = (m_urlIndex + 1) % m_urls.size();
+		m_retryClock.reset();
+	}
+
+	if (m_retryClock.elapsed() >= kRetryInterval && !this->connect())
+	{
+		m_urlIndex = (m_urlIndex + 1) % m_urls.size();
+		m_retryClock.reset();
+	}
+
+	return true;
+}
+
+bool RtmpPullRelay::connect()
+{
+	if (m_urls.empty())
+	{
+		return false;
+	}
+
+	if (!this->setUrl(m_urls[m_urlIndex]))
+	{
+		LOG_INFO("[Relay] rtmp url(%s) was illegal.\n", m_urls[m_urlIndex].c_str());
+		return false;
+	}
+
+	TcpSocket tcpSocket;
+	tcpSocket.create();
+	if (!SocketUtil::connectNonBlock(tcpSocket.fd(), m_ip, m_port))
+	{
+		tcpSocket.close();
+		return false;
+	}
+
+	LOG_INFO("[Relay] pull %s\n", m_url.c_str());
+
+	// the handshake is queued until the connection completes
+	std::shared_ptr<RtmpConnection> rtmpConn(new RtmpConnection((RtmpRelay*)this, RtmpConnection::RTMP_CLIENT, m_taskScheduler, tcpSocket.fd()));
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_isStopped)
+		{
+			rtmpConn->setRelaySession(m_session);
+		}
+		m_rtmpConn = rtmpConn;
+	}
+	rtmpConn->handshake();
+	m_connectClock.reset();
+	return true;
+}
+
+void RtmpPullRelay::close()
+{
+	std::shared_ptr<RtmpConnection> rtmpConn;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		rtmpConn.swap(m_rtmpConn);
+	}
+
+	if (rtmpConn != nullptr)
+	{
+		rtmpConn->disconnect();
+	}
+}
+
+RtmpPushRelay::RtmpPushRelay(TaskScheduler *taskScheduler, std::string url)
+	: m_taskScheduler(taskScheduler)
+	, m_targetUrl(url)
+	, m_isStopped(false)
+{
+
+}
+
+RtmpPushRelay::~RtmpPushRelay()
+{
+
+}
+
+void RtmpPushRelay::start()
+{
+	std::weak_ptr<RtmpPushRelay> relay = shared_from_this();
+
+	m_taskScheduler->addTriggerEvent([relay] {
+		auto relayPtr = relay.lock();
+		if (relayPtr != nullptr && !relayPtr->isStopped() && !relayPtr->connect())
+		{
+			relayPtr->m_retryClock.reset();
+		}
+	});
+
+	m_taskScheduler->addTimer([relay] {
+		auto relayPtr = relay.lock();
+		if (relayPtr == nullptr)
+		{
+			return false;
+		}
+		return relayPtr->onTimer();
+	}, kInterval);
+}
+
+void RtmpPushRelay::stop()
+{
+	m_isStopped = true;
+}
+
+std::shared_ptr<RtmpConnection> RtmpPushRelay::getConnection()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_rtmpConn != nullptr && m_rtmpConn->isPublishing() && !m_rtmpConn->isClosed())
+	{
+		return m_rtmpConn;
+	}
+
+	return nullptr;
+}
+
+bool RtmpPushRelay::onTimer()
+{
+	if (m_isStopped)
+	{
+		this->close();
+		return false;
+	}
+
+	std::shared_ptr<RtmpConnection> rtmpConn;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		rtmpConn = m_rtmpConn;
+	}
+
+	if (rtmpConn != nullptr)
+	{
+		if (rtmpConn->isClosed())
+		{
+			LOG_INFO("[Relay] %s disconnected.\n", m_targetUrl.c_str());
+		}
+		else if (!rtmpConn->isPublishing() && m_connectClock.elapsed() >= kConnectTimeout)
+		{
+			LOG_INFO("[Relay] %s timeout.\n", m_targetUrl.c_str());
+		}
+		else
+		{
+			if (rtmpConn->isPublishing())
+			{
+				m_retryInterval = kMinRetryInterval;
+			}
+			return true;
+		}
+
+		this->close();
+		m_retryClock.reset();
+		return true;
+	}
+
+	if (m_retryClock.elapsed() >= m_retryInterval)
+	{
+		m_retryInterval = (m_retryInterval * 2 < kMaxRetryInterval) ? m_retryInterval * 2 : kMaxRetryInterval;
+		if (!this->connect())
+		{
+			m_retryClock.reset();
+		}
+	}
+
+	return true;
+}
+
+bool RtmpPushRelay::connect()
+{
+	if (!this->setUrl(m_targetUrl))
+	{
+		LOG_INFO("[Relay] rtmp url(%s) was illegal.\n", m_targetUrl.c_str());
+		return false;
+	}
+
+	TcpSocket tcpSocket;
+	tcpSocket.create();
+	if (!SocketUtil::connectNonBlock(tcpSocket.fd(), m_ip, m_port))
+	{
+		tcpSocket.close();
+		return false;
+	}
+
+	LOG_INFO("[Relay] push %s\n", m_url.c_str());
+
+	std::shared_ptr<RtmpConnection> rtmpConn(new RtmpConnection((RtmpRelay*)this, RtmpConnection::RTMP_PUBLISHER, m_taskScheduler, tcpSocket.fd()));
+	rtmpConn->handshake();
+	m_connectClock.reset();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_rtmpConn = rtmpConn;
+	return true;
+}
+
+void RtmpPushRelay::close()
+{
+	std::shared_ptr<RtmpConnection> rtmpConn;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		rtmpConn.swap(m_rtmpConn);
+	}
+
+	if (rtmpConn != nullptr)
+	{
+		rtmpConn->disconnect();
+	}
+}
@@ -0,0 +1,139 @@
+#ifndef XOP_RTMP_RELAY_H
+#define XOP_RTMP_RELAY_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include "rtmp.h"
+#include "RtmpSession.h"
+#include "net/TaskScheduler.h"
+#include "net/Timestamp.h"
+
+namespace xop
+{
+
+class RtmpConnection;
+
+// Base of the connections the server opens itself, holds the peer's url.
+class RtmpRelay : public Rtmp
+{
+public:
+	virtual ~RtmpRelay() {};
+
+protected:
+	friend class RtmpConnection;
+
+	bool setUrl(std::string url)
+	{
+		m_streamPath.clear(); // parseRtmpUrl() appends to it
+		return (this->parseRtmpUrl(url) == 0);
+	}
+};
+
+// Pulls a stream from the origins into a local session while it has viewers.
+// Origins are tried in order, everything after start() runs on the relay's
+// TaskScheduler and never blocks it.
+class RtmpPullRelay : public RtmpRelay, public std::enable_shared_from_this<RtmpPullRelay>
+{
+public:
+	using Ptr = std::shared_ptr<RtmpPullRelay>;
+	using CloseCallback = std::function<void(RtmpPullRelay::Ptr relay)>;
+
+	RtmpPullRelay(TaskScheduler *taskScheduler, RtmpSession::Ptr session, std::vector<std::string> urls);
+	~RtmpPullRelay();
+
+	// stops after the session had no viewers for msec
+	void setIdleTime(uint32_t msec)
+	{ m_idleTime = msec; }
+
+	// called on the relay's thread when it stopped by itself
+	void setCloseCallback(const CloseCallback& cb)
+	{ m_closeCB = cb; }
+
+	void start();
+
+	// detaches from the session before it returns, frames still arriving
+	// are dropped, the connection closes on the relay's thread
+	void stop();
+
+	// a viewer is about to join, restarts the idle period
+	void touch()
+	{ m_isTouched = true; }
+
+	bool isStopped() const
+	{ return m_isStopped; }
+
+	RtmpSession::Ptr getSession() const
+	{ return m_session; }
+
+private:
+	bool onTimer();
+	bool connect();
+	void close();
+
+	TaskScheduler *m_taskScheduler = nullptr;
+	RtmpSession::Ptr m_session;
+	std::vector<std::string> m_urls;
+	size_t m_urlIndex = 0;
+	std::mutex m_mutex; // m_rtmpConn and m_isStopped, for stop() from other threads
+	std::shared_ptr<RtmpConnection> m_rtmpConn;
+	CloseCallback m_closeCB;
+
+	std::atomic_bool m_isStopped;
+	std::atomic_bool m_isTouched;
+	uint32_t m_idleTime = 10000;
+	xop::Timestamp m_idleClock;
+	xop::Timestamp m_connectClock;
+	xop::Timestamp m_retryClock;
+
+	static const uint32_t kInterval = 500;        // ms
+	static const uint32_t kConnectTimeout = 5000; // ms until the origin answers play
+	static const uint32_t kRetryInterval = 1000;  // ms between two attempts
+};
+
+// Pushes a local session to a downstream server while it is published.
+// The session feeds the connection directly from its fan-out, reconnecting
+// with backoff happens on the relay's TaskScheduler and never on the ingest thread.
+class RtmpPushRelay : public RtmpRelay, public std::enable_shared_from_this<RtmpPushRelay>
+{
+public:
+	using Ptr = std::shared_ptr<RtmpPushRelay>;
+
+	RtmpPushRelay(TaskScheduler *taskScheduler, std::string url);
+	~RtmpPushRelay();
+
+	void start();
+	void stop();
+
+	bool isStopped() const
+	{ return m_isStopped; }
+
+	// the connection once the downstream accepted the publish, or nullptr
+	std::shared_ptr<RtmpConnection> getConnection();
+
+private:
+	bool onTimer();
+	bool connect();
+	void close();
+
+	TaskScheduler *m_taskScheduler = nullptr;
+	std::string m_targetUrl;
+	std::mutex m_mutex;
+	std::shared_ptr<RtmpConnection> m_rtmpConn;
+
+	std::atomic_bool m_isStopped;
+	uint32_t m_retryInterval = kMinRetryInterval;
+	xop::Timestamp m_connectClock;
+	xop::Timestamp m_retryClock;
+
+	static const uint32_t kInterval = 500;             // ms
+	static const uint32_t kConnectTimeout = 5000;      // ms until the downstream accepts the publish
+	static const uint32_t kMinRetryInterval = 1000;    // ms, doubled after each failure
+	static const uint32_t kMaxRetryInterval = 30000;   // ms
+};
+
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include "RtmpConnection.h"
 #include "net/SocketUtil.h"
 #include "net/Logger.h"
+#include "net/ConfigFile.h"
+#include <sys/stat.h>
 
 using namespace xop;
 
@@ -22,7 +24,8 @@ RtmpServer::RtmpServer(EventLoop* loop, std::string ip, uint16_t port)
 		std::lock_guard<std::mutex> lock(m_mutex);
 		for (auto iter = m_rtmpSessions.begin(); iter != m_rtmpSessions.end(); )
 		{
-			if (iter->second->getClients() == 0)
+			if (iter->second->getClients() == 0 && m_pullRelays.find(iter->first) == m_pullRelays.end()
+				&& m_sharedReaders.find(iter->first) == m_sharedReaders.end())
 			{
 				m_rtmpSessions.erase(iter++);
 			}
@@ -33,16 +36,36 @@ RtmpServer::RtmpServer(EventLoop* loop, std::string ip, uint16_t port)
 		}
 		return true;
 	}, 10000); // 30000
+
+	m_metricsCollectorId = Metrics::instance().addCollector([this](MetricsWriter& writer) {
+		std::vector<RtmpSession::Ptr> sessions;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& iter : m_rtmpSessions)
+			{
+				sessions.push_back(iter.second);
+			}
+		}
+
+		for (auto& session : sessions)
+		{
+			session->collectMetrics(writer);
+		}
+	});
 }
 
 RtmpServer::~RtmpServer()
 {
-
+	Metrics::instance().removeCollector(m_metricsCollectorId);
+	if (m_clusterTimerId != 0)
+	{
+		m_eventLoop->removeTimer(m_clusterTimerId);
+	}
 }
 
-TcpConnection::Ptr RtmpServer::newConnection(SOCKET sockfd)
+TcpConnection::Ptr RtmpServer::newConnection(TaskScheduler *taskScheduler, SOCKET sockfd)
 {
-    return std::make_shared<RtmpConnection>((RtmpServer*)this, _eventLoop->getTaskScheduler().get(), sockfd);
+    return std::make_shared<RtmpConnection>((RtmpServer*)this, taskScheduler, sockfd);
 }
 
 void RtmpServer::addSession(std::string streamPath)
@@ -50,7 +73,7 @@ void RtmpServer::addSession(std::string streamPath)
     std::lock_guard<std::mutex> lock(m_mutex);
     if(m_rtmpSessions.find(streamPath) == m_rtmpSessions.end())
     {
-        m_rtmpSessions[streamPath] = std::make_shared<RtmpSession>();
+        m_rtmpSessions[streamPath] = std::make_shared<RtmpSession>(streamPath);
     }
 }
 
@@ -71,15 +94,27 @@ RtmpSession::Ptr RtmpServer::getSession(std::string streamPath)
     std::lock_guard<std::mutex> lock(m_mutex);
     if(m_rtmpSessions.find(streamPath) == m_rtmpSessions.end())
     {
-        m_rtmpSessions[streamPath] = std::make_shared<RtmpSession>();
+        m_rtmpSessions[streamPath] = std::make_shared<RtmpSession>(streamPath);
     }
 
     return m_rtmpSessions[streamPath];
 }
 
+RtmpSession::Ptr RtmpServer::findSession(std::string streamPath)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_rtmpSessions.find(streamPath);
+    if(iter == m_rtmpSessions.end())
+    {
+        return nullptr;
+    }
+
+    return iter->second;
+}
+
 bool RtmpServer::hasPublisher(std::string streamPath)
 {
-    auto sessionPtr = this->getSession(streamPath);
+    auto sessionPtr = this->findSession(streamPath);
     if(sessionPtr == nullptr)
     {
        return false;
@@ -89,3 +124,424 @@ bool RtmpServer::hasPublisher(std::string streamPath)
 }
 
 
+
+void RtmpServer::setConfig(const ServerConfig& config)
+{
+	this->setChunkSize(config.app.chunkSize);
+	this->setGopCache(config.app.gopCache);
+	this->setTcpOptions(config.tcp);
+	this->setStreamAffinity(config.streamAffinity);
+
+	std::vector<std::pair<RtmpSession::Ptr, uint32_t>> sessions;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_appConfigs = config.apps;
+		for (auto& iter : m_rtmpSessions)
+		{
+			std::string app = iter.first.substr(1, iter.first.find('/', 1) - 1); // /app/stream
+			sessions.emplace_back(iter.second, config.getApp(app).gopCache);
+		}
+	}
+
+	for (auto& iter : sessions)
+	{
+		iter.first->setGopCache(iter.second);
+	}
+}
+
+AppConfig RtmpServer::getAppConfig(std::string app)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_appConfigs.find(app);
+	if (iter != m_appConfigs.end())
+	{
+		return iter->second;
+	}
+
+	AppConfig config;
+	config.chunkSize = this->getChunkSize();
+	config.gopCache = this->getGopCacheLen();
+	return config;
+}
+
+TaskScheduler* RtmpServer::getPlayerScheduler(RtmpSession::Ptr session, TaskScheduler *current)
+{
+	uint32_t maxPlayers = m_streamAffinity;
+	if (maxPlayers == 0)
+	{
+		return nullptr;
+	}
+
+	auto publisher = session->getPublisher();
+	if (publisher == nullptr || (uint32_t)session->getClients() > maxPlayers) // the publisher is a client too
+	{
+		return nullptr;
+	}
+
+	TaskScheduler *taskScheduler = publisher->getTaskScheduler();
+	return (taskScheduler != current) ? taskScheduler : nullptr;
+}
+
+void RtmpServer::setRecord(std::string app, const RecordOption& option)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_recordOptions[app] = option;
+}
+
+bool RtmpServer::getRecordOption(std::string app, RecordOption& option)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_recordOptions.find(app);
+	if (iter == m_recordOptions.end())
+	{
+		iter = m_recordOptions.find("*");
+		if (iter == m_recordOptions.end())
+		{
+			return false;
+		}
+	}
+
+	option = iter->second;
+	return true;
+}
+
+void RtmpServer::setVod(std::string app, std::string path)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_vodPaths[app] = path;
+}
+
+bool RtmpServer::getVodPath(std::string app, std::string streamName, std::string& filePath)
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_vodPaths.find(app);
+		if (iter == m_vodPaths.end())
+		{
+			return false;
+		}
+		path = iter->second;
+	}
+
+	if (streamName.empty() || streamName.find("..") != std::string::npos)
+	{
+		return false;
+	}
+
+	if (streamName.size() < 4 || streamName.compare(streamName.size() - 4, 4, ".flv") != 0)
+	{
+		streamName += ".flv";
+	}
+
+	// only a stat here, FlvFile::openAsync() maps the file
+	struct stat st;
+	filePath = path + "/" + streamName;
+	return ::stat(filePath.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFREG;
+}
+
+void RtmpServer::addOrigin(std::string app, std::string url)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_origins[app].push_back(url);
+}
+
+void RtmpServer::setPullIdleTime(uint32_t msec)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pullIdleTime = msec;
+}
+
+bool RtmpServer::startPull(std::string streamPath)
+{
+	size_t pos = streamPath.find('/', 1);
+	if (pos == std::string::npos)
+	{
+		return false;
+	}
+
+	// published in another worker, no need to go to the origin
+	if (this->startSharedRead(streamPath))
+	{
+		return true;
+	}
+
+	std::string app = streamPath.substr(1, pos - 1);
+	std::string streamName = streamPath.substr(pos + 1);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// players arriving while the pull is running share it
+	auto relayIter = m_pullRelays.find(streamPath);
+	if (relayIter != m_pullRelays.end())
+	{
+		relayIter->second->touch();
+		return true;
+	}
+
+	auto originIter = m_origins.find(app);
+	if (originIter == m_origins.end())
+	{
+		return false;
+	}
+
+	std::vector<std::string> urls;
+	for (auto& url : originIter->second)
+	{
+		urls.push_back(url + "/" + streamName);
+	}
+
+	auto sessionIter = m_rtmpSessions.find(streamPath);
+	if (sessionIter == m_rtmpSessions.end())
+	{
+		sessionIter = m_rtmpSessions.emplace(streamPath, std::make_shared<RtmpSession>(streamPath)).first;
+	}
+
+	auto relay = std::make_shared<RtmpPullRelay>(m_eventLoop->getTaskScheduler().get(), sessionIter->second, urls);
+	relay->setChunkSize(this->getChunkSize());
+	relay->setIdleTime(m_pullIdleTime);
+	relay->setCloseCallback([this, streamPath](RtmpPullRelay::Ptr relay) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_pullRelays.find(streamPath);
+		if (iter != m_pullRelays.end() && iter->second == relay)
+		{
+			m_pullRelays.erase(iter);
+		}
+	});
+	m_pullRelays[streamPath] = relay;
+	relay->start();
+	return true;
+}
+
+void RtmpServer::stopPull(std::string streamPath)
+{
+	RtmpPullRelay::Ptr relay;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_pullRelays.find(streamPath);
+		if (iter == m_pullRelays.end())
+		{
+			return;
+		}
+		relay = iter->second;
+		m_pullRelays.erase(iter);
+	}
+
+	// no pulled frame reaches the session once this returns
+	relay->stop();
+}
+
+void RtmpServer::setSharedStreams(SharedStreamRegistry::Ptr registry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sharedStreams = registry;
+}
+
+bool RtmpServer::startSharedRead(std::string streamPath)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_sharedStreams == nullptr)
+	{
+		return false;
+	}
+
+	auto readerIter = m_sharedReaders.find(streamPath);
+	if (readerIter != m_sharedReaders.end())
+	{
+		readerIter->second->touch();
+		return true;
+	}
+
+	if (m_sharedStreams->findStream(streamPath) < 0)
+	{
+		return false;
+	}
+
+	auto sessionIter = m_rtmpSessions.find(streamPath);
+	if (sessionIter == m_rtmpSessions.end())
+	{
+		sessionIter = m_rtmpSessions.emplace(streamPath, std::make_shared<RtmpSession>(streamPath)).first;
+	}
+
+	auto reader = SharedStreamReader::create(m_sharedStreams, streamPath, sessionIter->second);
+	if (reader == nullptr)
+	{
+		return false;
+	}
+
+	reader->setIdleTime(m_pullIdleTime);
+	reader->setCloseCallback([this, streamPath](SharedStreamReader::Ptr reader) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_sharedReaders.find(streamPath);
+		if (iter != m_sharedReaders.end() && iter->second == reader)
+		{
+			m_sharedReaders.erase(iter);
+		}
+	});
+	m_sharedReaders[streamPath] = reader;
+	reader->start(m_eventLoop->getTaskScheduler().get());
+	return true;
+}
+
+bool RtmpServer::startShare(std::string streamPath, RtmpSession::Ptr session)
+{
+	SharedStreamRegistry::Ptr registry;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		registry = m_sharedStreams;
+	}
+
+	if (registry == nullptr)
+	{
+		return true;
+	}
+
+	auto writer = SharedStreamWriter::create(registry, streamPath);
+	if (writer == nullptr)
+	{
+		if (registry->findStream(streamPath) >= 0)
+		{
+			return false;
+		}
+		LOG_INFO("[Shared] no free slot for %s, played in this worker only.\n", streamPath.c_str());
+		return true;
+	}
+
+	session->setSharedWriter(writer);
+	return true;
+}
+
+void RtmpServer::addPushTarget(std::string app, std::string url)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pushTargets[app].push_back(url);
+}
+
+void RtmpServer::startPush(std::string app, std::string streamName, RtmpSession::Ptr session)
+{
+	std::vector<std::string> urls;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_pushTargets.find(app);
+		if (iter == m_pushTargets.end())
+		{
+			return;
+		}
+		urls = iter->second;
+	}
+
+	for (auto& url : urls)
+	{
+		auto relay = std::make_shared<RtmpPushRelay>(m_eventLoop->getTaskScheduler().get(), url + "/" + streamName);
+		relay->setChunkSize(this->getChunkSize());
+		session->addPushRelay(relay);
+		relay->start();
+	}
+}
+
+void RtmpServer::setCluster(std::string self, const std::vector<ClusterMember>& members)
+{
+	auto ring = std::make_shared<ClusterRing>(members);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clusterSelf = self;
+	m_clusterRing = ring;
+}
+
+bool RtmpServer::setClusterFile(std::string self, std::string path)
+{
+	TimerId timerId = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_clusterSelf = self;
+		m_clusterFile = path;
+		m_clusterFileTime = 0;
+		std::swap(timerId, m_clusterTimerId);
+	}
+
+	// one reload timer, for the latest file
+	if (timerId != 0)
+	{
+		m_eventLoop->removeTimer(timerId);
+	}
+
+	if (!this->reloadClusterFile())
+	{
+		return false;
+	}
+
+	timerId = m_eventLoop->addTimer([this] {
+		this->reloadClusterFile();
+		return true;
+	}, 1000);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clusterTimerId = timerId;
+	return true;
+}
+
+bool RtmpServer::reloadClusterFile()
+{
+	std::string path;
+	int64_t fileTime = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		path = m_clusterFile;
+		fileTime = m_clusterFileTime;
+	}
+
+	// only a stat per tick, the file is read once per change
+	int64_t modifyTime = ConfigFile::getModifyTime(path);
+	if (modifyTime == 0)
+	{
+		return false;
+	}
+
+	if (modifyTime == fileTime)
+	{
+		return true;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_clusterFileTime = modifyTime; // a broken version is not read again either
+	}
+
+	// a broken file keeps the previous members
+	std::vector<ClusterMember> members;
+	if (!ClusterRing::loadFile(path, members))
+	{
+		LOG_INFO("[Cluster] %s was illegal.\n", path.c_str());
+		return false;
+	}
+
+	auto ring = std::make_shared<ClusterRing>(members);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clusterRing = ring;
+	LOG_INFO("[Cluster] %u members loaded from %s\n", (uint32_t)members.size(), path.c_str());
+	return true;
+}
+
+bool RtmpServer::getRedirect(std::string streamPath, ClusterMember& owner)
+{
+	ClusterRing::Ptr ring;
+	std::string self;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		ring = m_clusterRing;
+		self = m_clusterSelf;
+	}
+
+	if (ring == nullptr)
+	{
+		return false;
+	}
+
+	const ClusterMember* member = ring->getOwner(streamPath);
+	if (member == nullptr || member->name == self)
+	{
+		return false;
+	}
+
+	owner = *member;
+	return true;
+}
@@ -3,8 +3,14 @@
 
 #include <string>
 #include <mutex>
+#include <atomic>
 #include "rtmp.h"
 #include "RtmpSession.h"
+#include "FlvFile.h"
+#include "RtmpRelay.h"
+#include "ClusterRing.h"
+#include "SharedStream.h"
+#include "ServerConfig.h"
 #include "net/TcpServer.h"
 
 namespace xop
@@ -16,6 +22,44 @@ public:
     RtmpServer(xop::EventLoop *loop, std::string ip, uint16_t port = 1935);
     ~RtmpServer();
 
+	/* chunk size, gop cache and socket options. Per app settings apply from the
+	   next connect, the gop cache of live streams changes at once */
+	void setConfig(const ServerConfig& config);
+
+	/* players joining a stream with fewer viewers move to the publisher's thread,
+	   frames then reach them without crossing threads. Bigger audiences stay spread
+	   over the threads they were accepted on, 0 never moves players */
+	void setStreamAffinity(uint32_t players)
+	{ m_streamAffinity = players; }
+
+	/* record streams of the app to flv files, app "*" matches all apps */
+	void setRecord(std::string app, const RecordOption& option);
+
+	/* serve <path>/<stream>.flv as video on demand for the app */
+	void setVod(std::string app, std::string path);
+
+	/* pull unknown streams of the app from rtmp://host:port/app on demand,
+	   origins added to the same app are tried in order */
+	void addOrigin(std::string app, std::string url);
+
+	/* stop pulling a stream after it had no viewers for msec */
+	void setPullIdleTime(uint32_t msec);
+
+	/* push streams published to the app to rtmp://host:port/app as well */
+	void addPushTarget(std::string app, std::string url);
+
+	/* place live streams on the cluster members by consistent hashing, players
+	   and publishers of streams owned by another member are redirected to it.
+	   self: the name of this server in the member list */
+	void setCluster(std::string self, const std::vector<ClusterMember>& members);
+
+	/* same with the members read from a file, reloaded when it changes */
+	bool setClusterFile(std::string self, std::string path);
+
+	/* worker mode: streams published in one worker are played from the others
+	   through the registry, which must be created before the workers are forked */
+	void setSharedStreams(SharedStreamRegistry::Ptr registry);
+
 private:
 	friend class RtmpConnection;
 	friend class HttpFlvConnection;
@@ -24,14 +68,42 @@ private:
 	void removeSession(std::string streamPath);
 
 	RtmpSession::Ptr getSession(std::string streamPath);
+	RtmpSession::Ptr findSession(std::string streamPath); // nullptr instead of creating it
 	bool hasSession(std::string streamPath);
 	bool hasPublisher(std::string streamPath);
+	bool getRecordOption(std::string app, RecordOption& option);
+	AppConfig getAppConfig(std::string app);
+	TaskScheduler* getPlayerScheduler(RtmpSession::Ptr session, TaskScheduler *current); // nullptr: stay
+	bool getVodPath(std::string app, std::string streamName, std::string& filePath); // false: not a file to play
+	bool startPull(std::string streamPath); // false: no origin for the app
+	bool startSharedRead(std::string streamPath); // false: not published by another worker
+	bool startShare(std::string streamPath, RtmpSession::Ptr session); // false: published by another worker
+	void stopPull(std::string streamPath);
+	void startPush(std::string app, std::string streamName, RtmpSession::Ptr session);
+	bool getRedirect(std::string streamPath, ClusterMember& owner); // false: served here
+	bool reloadClusterFile();
 
-    virtual TcpConnection::Ptr newConnection(SOCKET sockfd);
+    virtual TcpConnection::Ptr newConnection(TaskScheduler *taskScheduler, SOCKET sockfd);
 
 	xop::EventLoop *m_eventLoop = nullptr;
     std::mutex m_mutex;
     std::unordered_map<std::string, RtmpSession::Ptr> m_rtmpSessions;
+	std::unordered_map<std::string, RecordOption> m_recordOptions;
+	std::unordered_map<std::string, AppConfig> m_appConfigs;
+	std::unordered_map<std::string, std::string> m_vodPaths;
+	std::unordered_map<std::string, std::vector<std::string>> m_origins;
+	std::unordered_map<std::string, RtmpPullRelay::Ptr> m_pullRelays;
+	uint32_t m_pullIdleTime = 10000;
+	std::atomic<uint32_t> m_streamAffinity{0};
+	std::unordered_map<std::string, std::vector<std::string>> m_pushTargets;
+	SharedStreamRegistry::Ptr m_sharedStreams;
+	std::unordered_map<std::string, SharedStreamReader::Ptr> m_sharedReaders;
+	uint32_t m_metricsCollectorId = 0;
+	ClusterRing::Ptr m_clusterRing;
+	std::string m_clusterSelf;
+	std::string m_clusterFile;
+	int64_t m_clusterFileTime = 0;
+	TimerId m_clusterTimerId = 0;
 };
 
 }
@@ -1,13 +1,18 @@
 #include "RtmpSession.h"
 #include "RtmpConnection.h"
 #include "HttpFlvConnection.h"
+#include "RtmpRelay.h"
+#include "SharedStream.h"
 #include "net/Logger.h"
 
 using namespace xop;
 
-RtmpSession::RtmpSession()
+RtmpSession::RtmpSession(std::string streamPath)
 {
-    
+	if (!streamPath.empty())
+	{
+		m_metrics = StreamMetrics::get(streamPath);
+	}
 }
 
 RtmpSession::~RtmpSession()
@@ -35,18 +40,62 @@ void RtmpSession::sendMetaData(AmfObjects& metaData)
 			iter++;
         }
     }
+
+	for (auto& relay : m_pushRelays)
+	{
+		auto conn = relay->getConnection();
+		if (conn != nullptr && conn->isPlaying())
+		{
+			conn->sendMetaData(metaData);
+		}
+	}
 } 
 
-void RtmpSession::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
+void RtmpSession::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size, int64_t arrivalTime)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
 
+	FrameTiming timing;
+	if (arrivalTime != 0 && (type == RTMP_VIDEO || type == RTMP_AUDIO))
+	{
+		timing.arrivalTime = arrivalTime;
+		timing.dispatchTime = TaskScheduler::getMicroseconds();
+		if (m_metrics != nullptr)
+		{
+			m_metrics->latency.addParse(timing.dispatchTime - arrivalTime);
+		}
+	}
+
+	if (m_metrics != nullptr)
+	{
+		Metrics::add(m_metrics->ingestBytes, size);
+		if (type == RTMP_VIDEO)
+		{
+			Metrics::add(m_metrics->ingestVideoFrames);
+		}
+		else if (type == RTMP_AUDIO)
+		{
+			Metrics::add(m_metrics->ingestAudioFrames);
+		}
+	}
+	uint32_t players = 0;
+
 	if (this->m_maxGopCacheLen > 0)
 	{
 		this->saveGop(type, timestamp, data, size);
 	}
 
-	//LOG_INFO("\n[+] [[[[[[[[[[[[[[[[[[[PING]]]]]]]]]]]]]]]]]]] ");
+	if (m_recorder != nullptr)
+	{
+		m_recorder->pushFrame(type, timestamp, data, size);
+	}
+
+	if (m_sharedWriter != nullptr)
+	{
+		m_sharedWriter->writeFrame(type, timestamp, data.get(), size);
+	}
+
+	std::vector<RtmpChunks> chunkCache; // chunked once per chunk size, shared by players and push relays
     for (auto iter = m_rtmpClients.begin(); iter != m_rtmpClients.end(); )
     {
         auto conn = iter->second.lock();
@@ -60,35 +109,32 @@ void RtmpSession::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_pt
             {
 				if (!conn->isPlaying())
 				{
-
-					conn->sendMetaData(m_metaData);
-					conn->sendMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, this->m_avcSequenceHeader, this->m_avcSequenceHeaderSize);
-					conn->sendMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, this->m_aacSequenceHeader, this->m_aacSequenceHeaderSize);
-
-					if (m_gopCache.size() > 0)
-					{
-						auto gop = m_gopCache.begin()->second;
-						for (auto iter : *gop)
-						{
-							if (iter->type == RTMP_VIDEO)
-							{
-								conn->sendVideoData(iter->timestamp, iter->data, iter->size);
-							}
-							else if (iter->type == RTMP_AUDIO)
-							{
-								conn->sendAudioData(iter->timestamp, iter->data, iter->size);
-							}
-						}
-					}
+					this->sendStartData(conn);
 				}
-				//LOG_INFO("\n[+] ------------------ HHHHHHHHHHHHHHHHHHHHHHh --------------data: ", data);
 
-				conn->sendMediaData(type, timestamp, data, size);
+				conn->sendMediaData(type, timestamp, data, size, &chunkCache, &timing);
+				players += 1;
             }
 			iter++;
         }
     }
 
+	for (auto& relay : m_pushRelays)
+	{
+		auto conn = relay->getConnection();
+		if (conn != nullptr)
+		{
+			if (!conn->isPlaying())
+			{
+				this->sendStartData(conn);
+			}
+
+			conn->sendMediaData(type, timestamp, data, size, &chunkCache, &timing);
+			players += 1;
+		}
+	}
+
+	FlvTagPacket::Ptr flvTag; // framed once, shared by all http and websocket viewers
 	for (auto iter = m_httpClients.begin(); iter != m_httpClients.end(); )
 	{
 		auto conn = iter->second.lock();
@@ -122,12 +168,51 @@ void RtmpSession::sendMediaData(uint8_t type, uint64_t timestamp, std::shared_pt
 				}
 			}
 			// LOG_INFO("\n[+] ------------------ HHHHHHHHHHHHHHHHHHHHHHh --------------data: ", data);
-			conn->sendMediaData(type, timestamp, data, size);
+			if (type == RTMP_VIDEO || type == RTMP_AUDIO)
+			{
+				if (flvTag == nullptr)
+				{
+					flvTag = FlvTagPacket::create(type, timestamp, data.get(), size);
+				}
+				conn->sendFlvTag(flvTag, &timing);
+			}
+			else
+			{
+				conn->sendMediaData(type, timestamp, data, size);
+			}
+			players += 1;
 			iter++;
 		}
 	}
 
-	return;
+	if (m_metrics != nullptr && players > 0)
+	{
+		Metrics::add(m_metrics->egressFrames, players);
+		Metrics::add(m_metrics->egressBytes, (uint64_t)size * players);
+	}
+}
+
+void RtmpSession::sendStartData(std::shared_ptr<RtmpConnection> conn)
+{
+	conn->sendMetaData(m_metaData);
+	conn->sendMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, this->m_avcSequenceHeader, this->m_avcSequenceHeaderSize);
+	conn->sendMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, this->m_aacSequenceHeader, this->m_aacSequenceHeaderSize);
+
+	if (m_gopCache.size() > 0)
+	{
+		auto gop = m_gopCache.begin()->second;
+		for (auto iter : *gop)
+		{
+			if (iter->type == RTMP_VIDEO)
+			{
+				conn->sendVideoData(iter->timestamp, iter->data, iter->size);
+			}
+			else if (iter->type == RTMP_AUDIO)
+			{
+				conn->sendAudioData(iter->timestamp, iter->data, iter->size);
+			}
+		}
+	}
 }
 
 void RtmpSession::saveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size)
@@ -203,6 +288,7 @@ void RtmpSession::saveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char
 void RtmpSession::addRtmpClient(std::shared_ptr<RtmpConnection> conn)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
+	conn->m_metrics = m_metrics;
 	m_rtmpClients[conn->fd()] = conn;
     if(conn->isPublisher())
     {
@@ -230,13 +316,80 @@ void RtmpSession::removeRtmpClient(std::shared_ptr<RtmpConnection> conn)
 		m_gopCache.clear();
 		m_gopIndex = 0;
         m_hasPublisher = false;
+		if (m_recorder != nullptr)
+		{
+			m_recorder->stop();
+			m_recorder = nullptr;
+		}
+		for (auto& relay : m_pushRelays)
+		{
+			relay->stop();
+		}
+		m_pushRelays.clear();
+		if (m_sharedWriter != nullptr)
+		{
+			m_sharedWriter->close();
+			m_sharedWriter = nullptr;
+		}
     }
 	m_rtmpClients.erase(conn->fd());
 }
 
+void RtmpSession::startRecord(std::string streamPath, const RecordOption& option)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_recorder != nullptr)
+	{
+		m_recorder->stop();
+	}
+
+	m_recorder = std::make_shared<FlvRecorder>(streamPath, option);
+	m_recorder->pushMetaData(m_metaData);
+	if (m_avcSequenceHeaderSize > 0)
+	{
+		m_recorder->pushFrame(RTMP_AVC_SEQUENCE_HEADER, 0, m_avcSequenceHeader, m_avcSequenceHeaderSize);
+	}
+	if (m_aacSequenceHeaderSize > 0)
+	{
+		m_recorder->pushFrame(RTMP_AAC_SEQUENCE_HEADER, 0, m_aacSequenceHeader, m_aacSequenceHeaderSize);
+	}
+	FlvRecordWriter::instance().addRecorder(m_recorder);
+}
+
+void RtmpSession::stopRecord()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_recorder != nullptr)
+	{
+		m_recorder->stop();
+		m_recorder = nullptr;
+	}
+}
+
+void RtmpSession::addPushRelay(std::shared_ptr<RtmpPushRelay> relay)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_pushRelays.push_back(relay);
+}
+
+void RtmpSession::setSharedWriter(std::shared_ptr<SharedStreamWriter> writer)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sharedWriter = writer;
+}
+
+void RtmpSession::writeSharedMetaData()
+{
+	if (m_sharedWriter != nullptr)
+	{
+		m_sharedWriter->writeMetaData(m_metaData);
+	}
+}
+
 void RtmpSession::addHttpClient(std::shared_ptr<HttpFlvConnection> conn)
 {
 	std::lock_guard<std::mutex> lock(m_mutex);
+	conn->m_metrics = m_metrics;
 	m_httpClients[conn->fd()] = conn;
 }
 
@@ -288,3 +441,98 @@ std::shared_ptr<RtmpConnection> RtmpSession::getPublisher()
 	std::lock_guard<std::mutex> lock(m_mutex);
 	return m_publisher.lock();
 }
+
+void RtmpSession::collectMetrics(MetricsWriter& writer)
+{
+	if (m_metrics == nullptr)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	uint32_t rtmpPlayers = 0, httpPlayers = 0, gopFrames = 0;
+	for (auto& iter : m_rtmpClients)
+	{
+		auto conn = iter.second.lock();
+		if (conn != nullptr && conn->isPlayer())
+		{
+			rtmpPlayers += 1;
+		}
+	}
+
+	for (auto& iter : m_httpClients)
+	{
+		if (!iter.second.expired())
+		{
+			httpPlayers += 1;
+		}
+	}
+
+	for (auto& iter : m_gopCache)
+	{
+		gopFrames += (uint32_t)iter.second->size();
+	}
+
+	for (int stage = 0; stage < LatencyStats::kStages; stage++)
+	{
+		MetricLabels stageLabels = m_metrics->labels;
+		stageLabels.emplace_back("stage", LatencyStats::getStageName(stage));
+		writer.histogram("xop_stream_latency_microseconds", "Server internal latency of the frames sent to the players, by stage.",
+		                 stageLabels, m_metrics->latency.snapshot(stage));
+	}
+
+	for (auto& iter : m_rtmpClients)
+	{
+		auto conn = iter.second.lock();
+		if (conn != nullptr && conn->isPlayer())
+		{
+			collectPlayerLatency(writer, "rtmp", iter.first, conn->m_latency);
+		}
+	}
+
+	for (auto& iter : m_httpClients)
+	{
+		auto conn = iter.second.lock();
+		if (conn != nullptr)
+		{
+			collectPlayerLatency(writer, "http-flv", iter.first, conn->m_latency);
+		}
+	}
+
+	MetricLabels labels = m_metrics->labels;
+	labels.emplace_back("protocol", "rtmp");
+	writer.gauge("xop_stream_players", "Players of the stream.", labels, rtmpPlayers);
+	labels.back().second = "http-flv";
+	writer.gauge("xop_stream_players", "Players of the stream.", labels, httpPlayers);
+	writer.gauge("xop_stream_publishing", "1 while the stream has a publisher.", m_metrics->labels, m_hasPublisher ? 1 : 0);
+	writer.gauge("xop_stream_gop_cache_frames", "Frames held in the gop cache.", m_metrics->labels, gopFrames);
+}
+
+void RtmpSession::collectPlayerLatency(MetricsWriter& writer, const char *protocol, SOCKET fd, const LatencyStats& latency)
+{
+	static const std::pair<double, const char*> s_quantiles[] = { { 0.5, "0.5" }, { 0.99, "0.99" }, { 0.999, "0.999" } };
+
+	MetricLabels labels = m_metrics->labels;
+	labels.emplace_back("protocol", protocol);
+	labels.emplace_back("fd", std::to_string(fd));
+	labels.emplace_back("stage", "");
+	labels.emplace_back("quantile", "");
+
+	for (int stage = 0; stage < LatencyStats::kStages; stage++)
+	{
+		Histogram::Snapshot snapshot = latency.snapshot(stage);
+		if (snapshot.count == 0)
+		{
+			continue;
+		}
+
+		labels[labels.size() - 2].second = LatencyStats::getStageName(stage);
+		for (auto& quantile : s_quantiles)
+		{
+			labels.back().second = quantile.second;
+			writer.gauge("xop_player_latency_microseconds", "Server internal latency of the frames sent to one player, bucket bound of the quantile.",
+			             labels, (double)snapshot.getPercentile(quantile.first));
+		}
+	}
+}
@@ -3,6 +3,8 @@
 
 #include "net/Socket.h"
 #include "amf.h"
+#include "FlvRecorder.h"
+#include "StreamMetrics.h"
 #include <memory>
 #include <mutex>
 #include <list>
@@ -12,19 +14,26 @@ namespace xop
     
 class RtmpConnection;
 class HttpFlvConnection;
+class RtmpPushRelay;
+class SharedStreamWriter;
 
 class RtmpSession
 {
 public:
 	using Ptr = std::shared_ptr<RtmpSession>;
 
-	RtmpSession();
+	RtmpSession(std::string streamPath = "");
 	~RtmpSession();
 
 	void setMetaData(AmfObjects metaData)
 	{
 		std::lock_guard<std::mutex> lock(m_mutex);
 		m_metaData = metaData;
+		if (m_recorder != nullptr)
+		{
+			m_recorder->pushMetaData(m_metaData);
+		}
+		this->writeSharedMetaData();
 	}
 
 	void setAvcSequenceHeader(std::shared_ptr<char> avcSequenceHeader, uint32_t avcSequenceHeaderSize)
@@ -52,9 +61,13 @@ public:
 	void addHttpClient(std::shared_ptr<HttpFlvConnection> conn);
 	void removeHttpClient(std::shared_ptr<HttpFlvConnection> conn);
 	int  getClients();
+
+	/* players, publisher, gop cache and latency of the stream */
+	void collectMetrics(MetricsWriter& writer);
 	
 	void sendMetaData(AmfObjects& metaData);
-	void sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
+	/* arrivalTime: read time of the publisher connection, the latency of the frame is tracked if set */
+	void sendMediaData(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size, int64_t arrivalTime = 0);
 
 	std::shared_ptr<RtmpConnection> getPublisher();
 
@@ -66,7 +79,20 @@ public:
 
 	void saveGop(uint8_t type, uint64_t timestamp, std::shared_ptr<char> data, uint32_t size);
 
+	void startRecord(std::string streamPath, const RecordOption& option);
+	void stopRecord();
+
+	/* fed with the same frames as the players until the publisher leaves */
+	void addPushRelay(std::shared_ptr<RtmpPushRelay> relay);
+
+	/* publishes the stream to the other worker processes until the publisher leaves */
+	void setSharedWriter(std::shared_ptr<SharedStreamWriter> writer);
+
 private:        
+	void sendStartData(std::shared_ptr<RtmpConnection> conn);
+	void writeSharedMetaData();
+	void collectPlayerLatency(MetricsWriter& writer, const char *protocol, SOCKET fd, const LatencyStats& latency);
+
 
     std::mutex m_mutex;
     AmfObjects m_metaData;
@@ -81,6 +107,10 @@ private:
 	uint32_t m_aacSequenceHeaderSize = 0;
 	uint64_t m_gopIndex = 0;
 	uint32_t m_maxGopCacheLen = 0;
+	FlvRecorder::Ptr m_recorder;
+	std::vector<std::shared_ptr<RtmpPushRelay>> m_pushRelays;
+	std::shared_ptr<SharedStreamWriter> m_sharedWriter;
+	StreamMetrics::Ptr m_metrics;
 
 	struct AVFrame
 	{
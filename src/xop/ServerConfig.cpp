@@ -0,0 +1,167 @@
+#include "ServerConfig.h"
+#include "net/ConfigFile.h"
+#include "net/EventLoop.h"
+#include "net/Logger.h"
+#include "net/ThreadUtil.h"
+#include <memory>
+
+using namespace xop;
+
+static const char *kMainSection = "micron";
+static const char *kSocketSection = "socket";
+static const std::string kAppPrefix = "app:";
+
+static void readCpus(ConfigFile& file, const std::string& key, std::vector<int>& cpus, std::vector<std::string>& errors)
+{
+	std::string text = file.getString(kMainSection, key, "");
+	if (text == "auto")
+	{
+		cpus = ThreadUtil::getPhysicalCores();
+	}
+	else if (!text.empty() && !ThreadUtil::parseCpuList(text, cpus))
+	{
+		errors.push_back(std::string(kMainSection) + "." + key + ": " + text + " is not a cpu list");
+	}
+}
+
+static void readAppConfig(ConfigFile& file, const std::string& section, AppConfig& app)
+{
+	app.chunkSize = (uint32_t)file.getInt(section, "CHUNK_SIZE", app.chunkSize, 1, 60000);
+	app.gopCache = (uint32_t)file.getInt(section, "GOP_CACHE", app.gopCache, 0, 1000000);
+}
+
+const AppConfig& ServerConfig::getApp(const std::string& name) const
+{
+	auto iter = apps.find(name);
+	return (iter != apps.end()) ? iter->second : app;
+}
+
+bool ServerConfig::isRestartNeeded(const ServerConfig& config) const
+{
+	return ip != config.ip || rtmpPort != config.rtmpPort || httpPort != config.httpPort || threads != config.threads
+		|| workers != config.workers
+		|| threadOptions.cpus != config.threadOptions.cpus
+		|| threadOptions.housekeepingCpus != config.threadOptions.housekeepingCpus
+		|| threadOptions.priority != config.threadOptions.priority || threadOptions.nice != config.threadOptions.nice
+		|| ioBackend != config.ioBackend || metricsPath != config.metricsPath;
+}
+
+bool ServerConfig::load(const std::string& path, ServerConfig& config, std::string& error)
+{
+	ConfigFile file;
+	file.load(path);
+
+	ServerConfig result;
+	result.ip = file.getString(kMainSection, "LISTEN_IP", result.ip);
+	result.rtmpPort = (uint16_t)file.getInt(kMainSection, "STREAM_PORT", result.rtmpPort, 1, 65535);
+	result.httpPort = (uint16_t)file.getInt(kMainSection, "HTTP_PORT", result.httpPort, 1, 65535);
+	result.threads = (uint32_t)file.getInt(kMainSection, "THREADS", result.threads, 0, 1024);
+	result.workers = (uint32_t)file.getInt(kMainSection, "WORKERS", result.workers, 0, 256);
+	result.threadOptions.priority = (int)file.getInt(kMainSection, "SCHED_FIFO", 0, 0, 99);
+	result.threadOptions.nice = (int)file.getInt(kMainSection, "NICE", 0, -20, 19);
+	result.slowHandlerTime = (uint32_t)file.getInt(kMainSection, "SLOW_HANDLER_US", result.slowHandlerTime, 0, 60000000);
+	result.streamAffinity = (uint32_t)file.getInt(kMainSection, "STREAM_AFFINITY", result.streamAffinity, 0, 1000000);
+	result.busyPollTime = (uint32_t)file.getInt(kMainSection, "BUSY_POLL_US", result.busyPollTime, 0, 1000000);
+	result.metricsPath = file.getString(kMainSection, "METRICS_PATH", result.metricsPath);
+	readAppConfig(file, kMainSection, result.app);
+
+	TcpOptions& tcp = result.tcp;
+	tcp.sendBufSize = (int)file.getInt(kSocketSection, "SEND_BUFFER", tcp.sendBufSize, 0, 64 * 1024 * 1024);
+	tcp.recvBufSize = (int)file.getInt(kSocketSection, "RECV_BUFFER", tcp.recvBufSize, 0, 64 * 1024 * 1024);
+	tcp.noDelay = file.getBool(kSocketSection, "TCP_NODELAY", tcp.noDelay);
+	tcp.writeQueueLength = (uint32_t)file.getInt(kSocketSection, "WRITE_QUEUE", tcp.writeQueueLength, 1, 1000000);
+	tcp.maxReadBufferSize = (uint32_t)file.getInt(kSocketSection, "MAX_READ_BUFFER", tcp.maxReadBufferSize, 4096, 0xffffffffLL);
+	tcp.zeroCopyThreshold = (uint32_t)file.getInt(kSocketSection, "ZEROCOPY_THRESHOLD", tcp.zeroCopyThreshold, 0, 0xffffffffLL);
+	result.writeCork = file.getBool(kSocketSection, "TCP_CORK", result.writeCork);
+	result.edgeTriggered = file.getBool(kSocketSection, "EDGE_TRIGGERED", result.edgeTriggered);
+
+	for (const std::string& section : file.getSections())
+	{
+		if (section.compare(0, kAppPrefix.size(), kAppPrefix) == 0)
+		{
+			AppConfig& app = result.apps[section.substr(kAppPrefix.size())];
+			app = result.app;
+			readAppConfig(file, section, app);
+		}
+	}
+
+	std::vector<std::string> errors = file.getErrors();
+	readCpus(file, "CPUS", result.threadOptions.cpus, errors);
+	readCpus(file, "HOUSEKEEPING_CPUS", result.threadOptions.housekeepingCpus, errors);
+
+	if (!result.metricsPath.empty() && result.metricsPath[0] != '/')
+	{
+		errors.push_back(std::string(kMainSection) + ".METRICS_PATH: " + result.metricsPath + " does not start with /");
+	}
+
+	std::string backend = file.getString(kMainSection, "IO_BACKEND", "epoll");
+	if (backend == "io_uring")
+	{
+		result.ioBackend = IO_BACKEND_IO_URING;
+	}
+	else if (backend != "epoll")
+	{
+		errors.push_back(std::string(kMainSection) + ".IO_BACKEND: " + backend + " is not epoll or io_uring");
+	}
+
+	// other programs share [micron], typos in the server's own sections are errors
+	for (const std::string& key : file.getUnusedKeys())
+	{
+		if (key.compare(0, 7, "socket.") == 0 || key.compare(0, kAppPrefix.size(), kAppPrefix) == 0)
+		{
+			errors.push_back(key + ": unknown key");
+		}
+	}
+
+	if (!errors.empty())
+	{
+		error.clear();
+		for (const std::string& text : errors)
+		{
+			error += (error.empty() ? "" : ", ") + text;
+		}
+		return false;
+	}
+
+	config = result;
+	return true;
+}
+
+void ServerConfig::watch(EventLoop *loop, const std::string& path, const ServerConfig& config, const ReloadCallback& cb)
+{
+	struct State
+	{
+		ServerConfig config; // the one the process started with
+		int64_t modifyTime = 0;
+	};
+
+	std::shared_ptr<State> state(new State);
+	state->config = config;
+	state->modifyTime = ConfigFile::getModifyTime(path);
+
+	loop->addTimer([state, path, cb] {
+		int64_t modifyTime = ConfigFile::getModifyTime(path);
+		if (modifyTime == 0 || modifyTime == state->modifyTime)
+		{
+			return true;
+		}
+		state->modifyTime = modifyTime;
+
+		ServerConfig config;
+		std::string error;
+		if (!ServerConfig::load(path, config, error))
+		{
+			LOG_INFO("[Config] %s was illegal, keeping the previous settings: %s\n", path.c_str(), error.c_str());
+			return true;
+		}
+
+		if (state->config.isRestartNeeded(config))
+		{
+			LOG_INFO("[Config] listen address, ports, threads, workers, io backend and metrics path of %s apply after a restart.\n", path.c_str());
+		}
+
+		LOG_INFO("[Config] %s reloaded.\n", path.c_str());
+		cb(config);
+		return true;
+	}, 1000);
+}
@@ -0,0 +1,90 @@
+#ifndef XOP_SERVER_CONFIG_H
+#define XOP_SERVER_CONFIG_H
+
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include "net/TcpConnection.h"
+#include "net/EventLoop.h"
+
+namespace xop
+{
+
+// Settings of an app, [micron] gives the defaults and [app:<name>] overrides them.
+struct AppConfig
+{
+	uint32_t chunkSize = 60000; // outgoing rtmp chunk size
+	uint32_t gopCache = 0;      // frames kept for joining players, 0: they wait for a key frame
+};
+
+// Typed view of config.txt:
+//
+//     [micron]              # address, ports and threads are read at startup only
+//     LISTEN_IP = 0.0.0.0
+//     STREAM_PORT = 1935
+//     HTTP_PORT = 5391
+//     THREADS = 0           # 0: one per cpu
+//     WORKERS = 0           # processes sharing the ports, each with THREADS, 0: no fork
+//     CPUS = auto           # cpu list "2-5,8" or one per physical core, empty: not pinned
+//     HOUSEKEEPING_CPUS = 0 # acceptor, timers and logger
+//     SCHED_FIFO = 0        # real-time priority of the connection threads
+//     NICE = 0
+//     IO_BACKEND = epoll    # or io_uring, epoll where the kernel lacks it
+//     CHUNK_SIZE = 60000
+//     GOP_CACHE = 0
+//     SLOW_HANDLER_US = 50000
+//     STREAM_AFFINITY = 0   # players of smaller streams move to the publisher's thread
+//     BUSY_POLL_US = 0      # spin of the connection threads before they block
+//     METRICS_PATH = /metrics # Prometheus scrape on the HTTP port, empty: none
+//
+//     [socket]              # connections accepted after a reload
+//     SEND_BUFFER = 102400
+//     RECV_BUFFER = 0
+//     TCP_NODELAY = 1
+//     TCP_CORK = 0
+//     EDGE_TRIGGERED = 0    # epoll mode, listening sockets keep the one of the startup
+//     WRITE_QUEUE = 500     # packets per connection before frames are dropped
+//     MAX_READ_BUFFER = 102400000
+//     ZEROCOPY_THRESHOLD = 0 # bytes per send for MSG_ZEROCOPY, 0: off
+//
+//     [app:live]
+//     GOP_CACHE = 10000
+struct ServerConfig
+{
+	std::string ip = "0.0.0.0";
+	uint16_t rtmpPort = 1935;
+	uint16_t httpPort = 5391;
+	uint32_t threads = 0;
+	uint32_t workers = 0;             // forked processes, 0: the servers run in this one
+	ThreadOptions threadOptions;
+	IoBackend ioBackend = IO_BACKEND_EPOLL;
+
+	AppConfig app;
+	std::unordered_map<std::string, AppConfig> apps;
+	TcpOptions tcp;
+	bool writeCork = false;
+	bool edgeTriggered = false;
+	uint32_t slowHandlerTime = 50000; // us
+	uint32_t streamAffinity = 0;      // players, 0: never moved
+	uint32_t busyPollTime = 0;        // us, 0: the threads block at once
+	std::string metricsPath;          // HTTP route of the scrape, empty: not served
+
+	const AppConfig& getApp(const std::string& name) const;
+
+	/* ip, ports, threads and their placement or the metrics route differ, which a reload cannot change */
+	bool isRestartNeeded(const ServerConfig& config) const;
+
+	/* false and the reasons in error if a value is missing its type or range,
+	   config is only changed on success */
+	static bool load(const std::string& path, ServerConfig& config, std::string& error);
+
+	/* checks the file every second and calls cb on the event loop with each valid
+	   new version, a broken file keeps the previous settings */
+	using ReloadCallback = std::function<void(const ServerConfig& config)>;
+	static void watch(EventLoop *loop, const std::string& path, const ServerConfig& config, const ReloadCallback& cb);
+};
+
+}
+
+#endif
@@ -0,0 +1,484 @@
+#include "SharedStream.h"
+#include "rtmp.h"
+#include "net/Logger.h"
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace xop
+{
+
+enum SlotState
+{
+	kSlotFree = 0,
+	kSlotClaimed,
+	kSlotLive,
+};
+
+struct SharedStreamSlot
+{
+	std::atomic<uint32_t> state;
+	std::atomic<uint32_t> generation;    // bumped when the slot is released
+	std::atomic<int32_t>  pid;           // worker publishing the stream
+	char streamPath[256];
+
+	std::atomic<uint64_t> writePos;      // ring bytes published to the readers
+	std::atomic<uint64_t> reservePos;    // ring bytes the writer may be overwriting
+
+	std::atomic<uint32_t> headerVersion; // seqlock of the fields below, odd while written
+	std::atomic<uint32_t> metaDataSize;
+	std::atomic<uint32_t> avcSequenceHeaderSize;
+	std::atomic<uint32_t> aacSequenceHeaderSize;
+	char metaData[4096];                 // onMetaData ECMA array, AMF0
+	char avcSequenceHeader[4096];
+	char aacSequenceHeader[256];
+};
+
+struct SharedFrameHeader
+{
+	uint32_t size;
+	uint32_t type;
+	uint64_t timestamp;
+};
+
+}
+
+using namespace xop;
+
+static inline uint32_t alignSize(uint32_t size)
+{
+	return (size + 7) & ~7u;
+}
+
+static void copyToRing(char *ring, uint32_t ringSize, uint64_t pos, const char *data, uint32_t size)
+{
+	uint32_t offset = (uint32_t)(pos % ringSize);
+	uint32_t first = (size < ringSize - offset) ? size : ringSize - offset;
+	memcpy(ring + offset, data, first);
+	memcpy(ring, data + first, size - first);
+}
+
+static void copyFromRing(const char *ring, uint32_t ringSize, uint64_t pos, char *data, uint32_t size)
+{
+	uint32_t offset = (uint32_t)(pos % ringSize);
+	uint32_t first = (size < ringSize - offset) ? size : ringSize - offset;
+	memcpy(data, ring + offset, first);
+	memcpy(data + first, ring, size - first);
+}
+
+SharedStreamRegistry::Ptr SharedStreamRegistry::create(uint32_t maxStreams, uint32_t ringSize)
+{
+	Ptr registry(new SharedStreamRegistry);
+	registry->m_maxStreams = maxStreams;
+	registry->m_ringSize = alignSize(ringSize);
+	registry->m_slotSize = alignSize(sizeof(SharedStreamSlot)) + registry->m_ringSize;
+	registry->m_mapSize = registry->m_slotSize * maxStreams;
+
+	// anonymous and shared: inherited by fork(), pages are only backed once touched
+	void *base = mmap(nullptr, registry->m_mapSize, PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		LOG_INFO("[Shared] mmap %zu bytes failed.\n", registry->m_mapSize);
+		return nullptr;
+	}
+
+	registry->m_base = (char *)base;
+	for (uint32_t n = 0; n < maxStreams; n++)
+	{
+		new (registry->getSlot(n)) SharedStreamSlot();
+	}
+
+	return registry;
+}
+
+SharedStreamRegistry::~SharedStreamRegistry()
+{
+	if (m_base != nullptr)
+	{
+		munmap(m_base, m_mapSize);
+	}
+}
+
+SharedStreamSlot* SharedStreamRegistry::getSlot(int index)
+{
+	return (SharedStreamSlot *)(m_base + m_slotSize * index);
+}
+
+char* SharedStreamRegistry::getRing(int index)
+{
+	return m_base + m_slotSize * index + alignSize(sizeof(SharedStreamSlot));
+}
+
+int SharedStreamRegistry::claim(const std::string& streamPath)
+{
+	if (streamPath.size() >= sizeof(SharedStreamSlot::streamPath))
+	{
+		return -1;
+	}
+
+	if (this->findStream(streamPath) >= 0)
+	{
+		return -1;
+	}
+
+	int index = -1;
+	for (uint32_t n = 0; n < m_maxStreams && index < 0; n++)
+	{
+		SharedStreamSlot *slot = getSlot(n);
+		uint32_t state = kSlotFree;
+		if (slot->state.compare_exchange_strong(state, kSlotClaimed))
+		{
+			strcpy(slot->streamPath, streamPath.c_str());
+			slot->pid = (int32_t)getpid();
+			slot->metaDataSize = 0;
+			slot->avcSequenceHeaderSize = 0;
+			slot->aacSequenceHeaderSize = 0;
+			slot->state.store(kSlotLive, std::memory_order_release);
+			index = (int)n;
+		}
+	}
+
+	// two workers published the same path at once, the lower slot wins
+	if (index >= 0)
+	{
+		for (int n = 0; n < index; n++)
+		{
+			SharedStreamSlot *slot = getSlot(n);
+			if (slot->state.load(std::memory_order_acquire) == kSlotLive
+				&& strcmp(slot->streamPath, streamPath.c_str()) == 0)
+			{
+				SharedStreamSlot *mine = getSlot(index);
+				mine->generation++;
+				mine->state.store(kSlotFree, std::memory_order_release);
+				return -1;
+			}
+		}
+	}
+
+	return index;
+}
+
+int SharedStreamRegistry::findStream(const std::string& streamPath)
+{
+	int32_t self = (int32_t)getpid();
+
+	for (uint32_t n = 0; n < m_maxStreams; n++)
+	{
+		SharedStreamSlot *slot = getSlot(n);
+		if (slot->state.load(std::memory_order_acquire) != kSlotLive || slot->pid == self)
+		{
+			continue;
+		}
+
+		uint32_t generation = slot->generation.load(std::memory_order_acquire);
+		if (strncmp(slot->streamPath, streamPath.c_str(), sizeof(slot->streamPath)) == 0
+			&& slot->generation.load(std::memory_order_acquire) == generation
+			&& slot->state.load(std::memory_order_acquire) == kSlotLive)
+		{
+			return (int)n;
+		}
+	}
+
+	return -1;
+}
+
+void SharedStreamRegistry::releaseProcess(pid_t pid)
+{
+	for (uint32_t n = 0; n < m_maxStreams; n++)
+	{
+		SharedStreamSlot *slot = getSlot(n);
+		if (slot->state.load(std::memory_order_acquire) != kSlotFree && slot->pid == (int32_t)pid)
+		{
+			slot->generation++;
+			slot->state.store(kSlotFree, std::memory_order_release);
+		}
+	}
+}
+
+SharedStreamWriter::Ptr SharedStreamWriter::create(SharedStreamRegistry::Ptr registry, const std::string& streamPath)
+{
+	int index = registry->claim(streamPath);
+	if (index < 0)
+	{
+		return nullptr;
+	}
+
+	return Ptr(new SharedStreamWriter(registry, index));
+}
+
+SharedStreamWriter::SharedStreamWriter(SharedStreamRegistry::Ptr registry, int index)
+	: m_registry(registry)
+	, m_slot(registry->getSlot(index))
+	, m_ring(registry->getRing(index))
+{
+
+}
+
+SharedStreamWriter::~SharedStreamWriter()
+{
+	this->close();
+}
+
+void SharedStreamWriter::close()
+{
+	if (!m_isClosed)
+	{
+		m_isClosed = true;
+		m_slot->generation++;
+		m_slot->state.store(kSlotFree, std::memory_order_release);
+	}
+}
+
+void SharedStreamWriter::writeHeader(uint32_t offset, uint32_t maxSize, std::atomic<uint32_t>& size, const char *data, uint32_t dataSize)
+{
+	if (m_isClosed || dataSize > maxSize)
+	{
+		return;
+	}
+
+	m_slot->headerVersion.fetch_add(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy((char *)m_slot + offset, data, dataSize);
+	size.store(dataSize, std::memory_order_relaxed);
+	m_slot->headerVersion.fetch_add(1, std::memory_order_release);
+}
+
+void SharedStreamWriter::writeMetaData(AmfObjects& metaData)
+{
+	AmfEncoder amfEnc;
+	amfEnc.encodeECMA(metaData);
+	writeHeader(offsetof(SharedStreamSlot, metaData), sizeof(m_slot->metaData),
+	            m_slot->metaDataSize, amfEnc.data().get(), amfEnc.size());
+}
+
+void SharedStreamWriter::writeFrame(uint8_t type, uint64_t timestamp, const char *data, uint32_t size)
+{
+	if (m_isClosed || size == 0)
+	{
+		return;
+	}
+
+	if (type == RTMP_AVC_SEQUENCE_HEADER)
+	{
+		writeHeader(offsetof(SharedStreamSlot, avcSequenceHeader), sizeof(m_slot->avcSequenceHeader),
+		            m_slot->avcSequenceHeaderSize, data, size);
+		return;
+	}
+	else if (type == RTMP_AAC_SEQUENCE_HEADER)
+	{
+		writeHeader(offsetof(SharedStreamSlot, aacSequenceHeader), sizeof(m_slot->aacSequenceHeader),
+		            m_slot->aacSequenceHeaderSize, data, size);
+		return;
+	}
+	else if (type != RTMP_VIDEO && type != RTMP_AUDIO)
+	{
+		return;
+	}
+
+	uint32_t ringSize = m_registry->getRingSize();
+	uint32_t total = alignSize(sizeof(SharedFrameHeader) + size);
+	if (total > ringSize / 2)
+	{
+		return;
+	}
+
+	SharedFrameHeader header;
+	header.size = size;
+	header.type = type;
+	header.timestamp = timestamp;
+
+	// readers that copied from the reserved range throw the frame away
+	uint64_t pos = m_slot->writePos.load(std::memory_order_relaxed);
+	m_slot->reservePos.store(pos + total, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	copyToRing(m_ring, ringSize, pos, (const char *)&header, sizeof(header));
+	copyToRing(m_ring, ringSize, pos + sizeof(header), data, size);
+	m_slot->writePos.store(pos + total, std::memory_order_release);
+}
+
+SharedStreamReader::Ptr SharedStreamReader::create(SharedStreamRegistry::Ptr registry, const std::string& streamPath, RtmpSession::Ptr session)
+{
+	int index = registry->findStream(streamPath);
+	if (index < 0)
+	{
+		return nullptr;
+	}
+
+	return Ptr(new SharedStreamReader(registry, index, session));
+}
+
+SharedStreamReader::SharedStreamReader(SharedStreamRegistry::Ptr registry, int index, RtmpSession::Ptr session)
+	: m_registry(registry)
+	, m_slot(registry->getSlot(index))
+	, m_ring(registry->getRing(index))
+	, m_session(session)
+	, m_isStopped(false)
+	, m_isTouched(false)
+{
+	m_generation = m_slot->generation.load(std::memory_order_acquire);
+	m_readPos = m_slot->writePos.load(std::memory_order_acquire);
+}
+
+SharedStreamReader::~SharedStreamReader()
+{
+
+}
+
+void SharedStreamReader::start(TaskScheduler *taskScheduler)
+{
+	std::weak_ptr<SharedStreamReader> reader = shared_from_this();
+	taskScheduler->addTimer([reader] {
+		auto readerPtr = reader.lock();
+		if (readerPtr == nullptr)
+		{
+			return false;
+		}
+		return readerPtr->onTimer();
+	}, kInterval);
+}
+
+void SharedStreamReader::stop()
+{
+	m_isStopped = true;
+}
+
+bool SharedStreamReader::isAlive()
+{
+	return m_slot->state.load(std::memory_order_acquire) == kSlotLive
+		&& m_slot->generation.load(std::memory_order_acquire) == m_generation;
+}
+
+bool SharedStreamReader::onTimer()
+{
+	if (m_isStopped)
+	{
+		return false;
+	}
+
+	if (m_isTouched.exchange(false) || m_session->getClients() > 0)
+	{
+		m_idleClock.reset();
+	}
+	else if (m_idleClock.elapsed() >= m_idleTime)
+	{
+		m_isStopped = true;
+	}
+
+	if (!m_isStopped && !this->isAlive())
+	{
+		LOG_INFO("[Shared] %s unpublished.\n", m_slot->streamPath);
+		m_isStopped = true;
+	}
+
+	if (m_isStopped)
+	{
+		if (m_closeCB)
+		{
+			m_closeCB(shared_from_this());
+		}
+		return false;
+	}
+
+	this->readHeaders();
+	this->readFrames();
+	return true;
+}
+
+void SharedStreamReader::readHeaders()
+{
+	uint32_t version = m_slot->headerVersion.load(std::memory_order_acquire);
+	if (version == m_headerVersion || (version & 1))
+	{
+		return;
+	}
+
+	uint32_t metaDataSize = m_slot->metaDataSize.load(std::memory_order_relaxed);
+	uint32_t avcSize = m_slot->avcSequenceHeaderSize.load(std::memory_order_relaxed);
+	uint32_t aacSize = m_slot->aacSequenceHeaderSize.load(std::memory_order_relaxed);
+	std::string metaData(m_slot->metaData, metaDataSize);
+	std::shared_ptr<char> avcSequenceHeader(new char[avcSize + 1], std::default_delete<char[]>());
+	std::shared_ptr<char> aacSequenceHeader(new char[aacSize + 1], std::default_delete<char[]>());
+	memcpy(avcSequenceHeader.get(), m_slot->avcSequenceHeader, avcSize);
+	memcpy(aacSequenceHeader.get(), m_slot->aacSequenceHeader, aacSize);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (m_slot->headerVersion.load(std::memory_order_relaxed) != version)
+	{
+		return; // changed while copying, next tick
+	}
+	m_headerVersion = version;
+
+	if (metaDataSize > 0)
+	{
+		AmfDecoder amfDec;
+		amfDec.decode(metaData.data(), (int)metaData.size());
+		AmfObjects objects = amfDec.getObjects();
+		m_session->setMetaData(objects);
+		m_session->sendMetaData(objects);
+	}
+
+	if (avcSize > 0)
+	{
+		m_session->setAvcSequenceHeader(avcSequenceHeader, avcSize);
+		m_session->sendMediaData(RTMP_AVC_SEQUENCE_HEADER, 0, avcSequenceHeader, avcSize);
+	}
+
+	if (aacSize > 0)
+	{
+		m_session->setAacSequenceHeader(aacSequenceHeader, aacSize);
+		m_session->sendMediaData(RTMP_AAC_SEQUENCE_HEADER, 0, aacSequenceHeader, aacSize);
+	}
+}
+
+bool SharedStreamReader::readFrames()
+{
+	uint32_t ringSize = m_registry->getRingSize();
+	uint64_t writePos = m_slot->writePos.load(std::memory_order_acquire);
+
+	while (m_readPos < writePos)
+	{
+		bool isValid = (writePos - m_readPos <= ringSize);
+
+		SharedFrameHeader header = { 0, 0, 0 };
+		std::shared_ptr<char> payload;
+		uint32_t total = 0;
+		if (isValid)
+		{
+			copyFromRing(m_ring, ringSize, m_readPos, (char *)&header, sizeof(header));
+			total = alignSize(sizeof(header) + header.size);
+			isValid = (header.size > 0 && total <= ringSize / 2 && m_readPos + total <= writePos);
+		}
+
+		if (isValid)
+		{
+			payload.reset(new char[header.size], std::default_delete<char[]>());
+			copyFromRing(m_ring, ringSize, m_readPos + sizeof(header), payload.get(), header.size);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			isValid = (m_slot->reservePos.load(std::memory_order_relaxed) - m_readPos <= ringSize);
+		}
+
+		if (!isValid)
+		{
+			// overrun by the writer, start again from the next keyframe
+			m_readPos = m_slot->writePos.load(std::memory_order_acquire);
+			m_waitKeyFrame = true;
+			return false;
+		}
+
+		m_readPos += total;
+
+		if (m_waitKeyFrame)
+		{
+			const uint8_t *p = (const uint8_t *)payload.get();
+			if (header.type != RTMP_VIDEO || header.size < 2 || (p[0] >> 4) != 1 || p[1] != 1)
+			{
+				continue;
+			}
+			m_waitKeyFrame = false;
+		}
+
+		m_session->sendMediaData((uint8_t)header.type, header.timestamp, payload, header.size);
+	}
+
+	return true;
+}
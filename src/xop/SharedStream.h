@@ -0,0 +1,139 @@
+#ifndef XOP_SHARED_STREAM_H
+#define XOP_SHARED_STREAM_H
+
+#include <atomic>
+#include <string>
+#include <memory>
+#include <functional>
+#include <sys/types.h>
+#include "amf.h"
+#include "RtmpSession.h"
+#include "net/TaskScheduler.h"
+#include "net/Timestamp.h"
+
+namespace xop
+{
+
+struct SharedStreamSlot;
+
+// Streams published in one worker process and played in the others.
+// The registry is one MAP_SHARED mapping created before the workers are
+// forked: a table of slots, each with the stream's metadata and sequence
+// headers and a ring of frames written by the publisher's worker only.
+// Readers never lock, they copy a frame out and check it was not overwritten.
+class SharedStreamRegistry
+{
+public:
+	using Ptr = std::shared_ptr<SharedStreamRegistry>;
+
+	// call before forking, maxStreams live streams of at most ringSize bytes in flight
+	static Ptr create(uint32_t maxStreams = 64, uint32_t ringSize = 4 * 1024 * 1024);
+	~SharedStreamRegistry();
+
+	// frees the slots of a dead worker, its readers stop (parent side)
+	void releaseProcess(pid_t pid);
+
+	// slot published by another process, -1 if none
+	int findStream(const std::string& streamPath);
+
+	uint32_t getMaxStreams() const
+	{ return m_maxStreams; }
+
+	uint32_t getRingSize() const
+	{ return m_ringSize; }
+
+private:
+	friend class SharedStreamWriter;
+	friend class SharedStreamReader;
+
+	SharedStreamRegistry() {}
+	SharedStreamSlot* getSlot(int index);
+	char* getRing(int index);
+	int claim(const std::string& streamPath); // -1: full or published elsewhere
+
+	char *m_base = nullptr;
+	size_t m_mapSize = 0;
+	size_t m_slotSize = 0;
+	uint32_t m_maxStreams = 0;
+	uint32_t m_ringSize = 0;
+};
+
+// Publisher side, fed from the RtmpSession fan-out on the ingest thread.
+class SharedStreamWriter
+{
+public:
+	using Ptr = std::shared_ptr<SharedStreamWriter>;
+
+	// nullptr if the stream is published by another worker or no slot is free
+	static Ptr create(SharedStreamRegistry::Ptr registry, const std::string& streamPath);
+	~SharedStreamWriter();
+
+	void writeMetaData(AmfObjects& metaData);
+	void writeFrame(uint8_t type, uint64_t timestamp, const char *data, uint32_t size);
+	void close();
+
+private:
+	SharedStreamWriter(SharedStreamRegistry::Ptr registry, int index);
+	void writeHeader(uint32_t offset, uint32_t maxSize, std::atomic<uint32_t>& size, const char *data, uint32_t dataSize);
+
+	SharedStreamRegistry::Ptr m_registry;
+	SharedStreamSlot *m_slot = nullptr;
+	char *m_ring = nullptr;
+	bool m_isClosed = false;
+};
+
+// Player side, polls the ring on a worker's TaskScheduler and injects the
+// frames into the local session while it has viewers, like RtmpPullRelay.
+class SharedStreamReader : public std::enable_shared_from_this<SharedStreamReader>
+{
+public:
+	using Ptr = std::shared_ptr<SharedStreamReader>;
+	using CloseCallback = std::function<void(SharedStreamReader::Ptr reader)>;
+
+	static Ptr create(SharedStreamRegistry::Ptr registry, const std::string& streamPath, RtmpSession::Ptr session);
+	~SharedStreamReader();
+
+	void setIdleTime(uint32_t msec)
+	{ m_idleTime = msec; }
+
+	// called on the reader's thread when it stopped by itself
+	void setCloseCallback(const CloseCallback& cb)
+	{ m_closeCB = cb; }
+
+	void start(TaskScheduler *taskScheduler);
+	void stop();
+
+	void touch()
+	{ m_isTouched = true; }
+
+	bool isStopped() const
+	{ return m_isStopped; }
+
+private:
+	SharedStreamReader(SharedStreamRegistry::Ptr registry, int index, RtmpSession::Ptr session);
+	bool onTimer();
+	bool isAlive();
+	void readHeaders();
+	bool readFrames();
+
+	SharedStreamRegistry::Ptr m_registry;
+	SharedStreamSlot *m_slot = nullptr;
+	char *m_ring = nullptr;
+	uint32_t m_generation = 0;
+	uint64_t m_readPos = 0;
+	uint32_t m_headerVersion = 0;
+	bool m_waitKeyFrame = true;
+	RtmpSession::Ptr m_session;
+	CloseCallback m_closeCB;
+
+	std::atomic_bool m_isStopped;
+	std::atomic_bool m_isTouched;
+	uint32_t m_idleTime = 10000;
+	xop::Timestamp m_idleClock;
+
+	static const uint32_t kInterval = 5; // ms, the only added latency
+};
+
+}
+
+#endif
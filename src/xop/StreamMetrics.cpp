@@ -0,0 +1,103 @@
+#include "StreamMetrics.h"
+#include <mutex>
+#include <cstdio>
+#include <unordered_map>
+
+using namespace xop;
+
+const char* LatencyStats::getStageName(int stage)
+{
+	static const char *s_names[kStages] = { "parse", "dispatch", "queue", "socket", "total" };
+	return (stage >= 0 && stage < kStages) ? s_names[stage] : "";
+}
+
+std::string LatencyStats::getSummary(int stage) const
+{
+	Histogram::Snapshot snapshot = _stages[stage].snapshot();
+	if (snapshot.count == 0)
+	{
+		return "";
+	}
+
+	char buf[160] = { 0 };
+	snprintf(buf, sizeof(buf), "p50 <= %llu us, p99 <= %llu us, p999 <= %llu us, max %llu us, %llu frames",
+	         (unsigned long long)snapshot.getPercentile(0.5), (unsigned long long)snapshot.getPercentile(0.99),
+	         (unsigned long long)snapshot.getPercentile(0.999), (unsigned long long)snapshot.max,
+	         (unsigned long long)snapshot.count);
+	return buf;
+}
+
+void LatencyStats::recordDequeue(const FrameTiming& timing, int64_t now, LatencyStats *stream)
+{
+	_stages[kParse].record(timing.dispatchTime > timing.arrivalTime ? timing.dispatchTime - timing.arrivalTime : 0);
+	record(kDispatch, timing.enqueueTime - timing.dispatchTime, stream);
+	record(kQueue, now - timing.enqueueTime, stream);
+}
+
+void LatencyStats::recordSent(int64_t arrivalTime, int64_t appendTime, int64_t now, LatencyStats *stream)
+{
+	record(kSocket, now - appendTime, stream);
+	record(kTotal, now - arrivalTime, stream);
+}
+
+static std::mutex s_mutex;
+static std::unordered_map<std::string, std::weak_ptr<StreamMetrics>> s_streams;
+
+StreamMetrics::Ptr StreamMetrics::get(const std::string& streamPath)
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+	auto iter = s_streams.find(streamPath);
+	if (iter != s_streams.end())
+	{
+		Ptr metrics = iter->second.lock();
+		if (metrics != nullptr)
+		{
+			return metrics;
+		}
+	}
+
+	// "/app/stream"
+	std::string app, stream = streamPath;
+	size_t pos = streamPath.find('/', 1);
+	if (pos != std::string::npos)
+	{
+		app = streamPath.substr(1, pos - 1);
+		stream = streamPath.substr(pos + 1);
+	}
+
+	Ptr metrics = std::make_shared<StreamMetrics>();
+	metrics->streamPath = streamPath;
+	metrics->labels = { { "app", app }, { "stream", stream } };
+
+	Metrics& registry = Metrics::instance();
+	metrics->ingestBytes = registry.counter("xop_stream_ingest_bytes_total", "Media bytes received for the stream.", metrics->labels);
+	metrics->ingestVideoFrames = registry.counter("xop_stream_ingest_frames_total", "Media frames received for the stream.",
+	                                              { metrics->labels[0], metrics->labels[1], { "type", "video" } });
+	metrics->ingestAudioFrames = registry.counter("xop_stream_ingest_frames_total", "Media frames received for the stream.",
+	                                              { metrics->labels[0], metrics->labels[1], { "type", "audio" } });
+	metrics->egressBytes = registry.counter("xop_stream_egress_bytes_total", "Media bytes handed to the players of the stream.", metrics->labels);
+	metrics->egressFrames = registry.counter("xop_stream_egress_frames_total", "Media frames handed to the players of the stream.", metrics->labels);
+	metrics->droppedFrames = registry.counter("xop_stream_dropped_frames_total", "Frames dropped because a player could not keep up.", metrics->labels);
+
+	s_streams[streamPath] = metrics;
+	return metrics;
+}
+
+StreamMetrics::~StreamMetrics()
+{
+	std::lock_guard<std::mutex> lock(s_mutex);
+
+	// get() may have replaced this one meanwhile, sharing the same ids
+	auto iter = s_streams.find(streamPath);
+	if (iter == s_streams.end() || !iter->second.expired())
+	{
+		return;
+	}
+	s_streams.erase(iter);
+
+	Metrics& registry = Metrics::instance();
+	for (uint32_t id : { ingestBytes, ingestVideoFrames, ingestAudioFrames, egressBytes, egressFrames, droppedFrames })
+	{
+		registry.release(id);
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef XOP_STREAM_METRICS_H
+#define XOP_STREAM_METRICS_H
+
+#include <string>
+#include <memory>
+#include "net/Metrics.h"
+
+namespace xop
+{
+
+// Monotonic times (TaskScheduler::getMicroseconds) of one frame on its way
+// from the publisher's socket to a player's socket, 0 if not known.
+struct FrameTiming
+{
+	int64_t arrivalTime = 0;  // read of the publisher socket started
+	int64_t dispatchTime = 0; // RtmpSession fan-out started
+	int64_t enqueueTime = 0;  // handed to the player's trigger queue
+};
+
+// Server internal latency of frames in microseconds, by stage:
+// parse      arrival -> fan-out
+// dispatch   fan-out -> player's trigger queue (players before it in the loop)
+// queue      trigger queue -> trigger event run on the player's thread
+// socket     write queue -> last byte accepted by ::send
+// total      arrival -> last byte accepted by ::send
+class LatencyStats
+{
+public:
+	enum Stage { kParse, kDispatch, kQueue, kSocket, kTotal, kStages };
+
+	static const char* getStageName(int stage);
+
+	/* the trigger event of the frame runs on the player's thread */
+	void recordDequeue(const FrameTiming& timing, int64_t now, LatencyStats *stream);
+	/* the last byte of the frame was sent */
+	void recordSent(int64_t arrivalTime, int64_t appendTime, int64_t now, LatencyStats *stream);
+	/* once per frame by the publisher, may run on any thread */
+	void addParse(int64_t usec)
+	{ _stages[kParse].add(usec > 0 ? usec : 0); }
+
+	Histogram::Snapshot snapshot(int stage) const
+	{ return _stages[stage].snapshot(); }
+
+	/* "p50 <= 2048 us, p99 <= 8192 us, p999 <= 16384 us, max 9000 us, 1500 frames", empty if none */
+	std::string getSummary(int stage) const;
+
+private:
+	// the player's stats have one writer, the stream's are added to by all its players
+	void record(int stage, int64_t usec, LatencyStats *stream)
+	{
+		uint64_t value = (usec > 0) ? usec : 0;
+		_stages[stage].record(value);
+		if (stream != nullptr)
+		{
+			stream->_stages[stage].add(value);
+		}
+	}
+
+	Histogram _stages[kStages];
+};
+
+// Counter ids of one stream path, labelled with its app and stream name.
+struct StreamMetrics
+{
+	using Ptr = std::shared_ptr<StreamMetrics>;
+
+	// one per stream path while it is in use, by the RtmpSession and its
+	// players: the series go away with the last of them
+	static Ptr get(const std::string& streamPath);
+	~StreamMetrics();
+
+	std::string streamPath;
+	MetricLabels labels;
+	uint32_t ingestBytes = 0;
+	uint32_t ingestVideoFrames = 0;
+	uint32_t ingestAudioFrames = 0;
+	uint32_t egressBytes = 0;    // media payload handed to the players
+	uint32_t egressFrames = 0;
+	uint32_t droppedFrames = 0;  // trigger queue or write queue full
+	LatencyStats latency;        // of all players, parse once per frame
+};
+
+}
+
+#endif
@@ -119,6 +119,13 @@ public:
 		m_peerBandwidth = size;
 	}
 
+	/* outbound connections send connect, createStream and publish/play right
+	   after the handshake instead of waiting for each _result */
+	void setFastStart(bool fastStart = true)
+	{
+		m_isFastStart = fastStart;
+	}
+
 protected:
 
 	uint32_t getChunkSize() const 
@@ -141,6 +148,11 @@ protected:
 		return m_peerBandwidth;
 	}
 
+	bool isFastStart() const
+	{
+		return m_isFastStart;
+	}
+
 	virtual int parseRtmpUrl(std::string url)
 	{
 		char ip[100] = { 0 };
@@ -238,6 +250,7 @@ protected:
 	uint32_t m_acknowledgementSize = 5000000;
 	uint32_t m_maxChunkSize = 128;
 	uint32_t m_maxGopCacheLen = 0;
+	bool m_isFastStart = false;
 };
 
 }